@@ -0,0 +1,350 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+#pragma once
+
+#include <rawtoaces/image_converter.h>
+
+#include <atomic>
+#include <ostream>
+
+namespace rta
+{
+namespace util
+{
+
+/// Converts a list of image files using a pool of worker threads. Each worker
+/// owns a private copy of the `ImageConverter` passed in, and pulls the files
+/// to process from a shared queue, so the files get converted independently
+/// of each other. In the pipelined mode the decoding, transforming and
+/// encoding of the images run as separate stages connected by bounded queues,
+/// so reading the next file overlaps with processing the previous ones.
+class BatchConverter
+{
+public:
+    struct Settings
+    {
+        /// The number of files to convert concurrently. The value of 0 uses
+        /// one worker per available hardware thread.
+        size_t jobs = 1;
+
+        /// Read the metadata of all files passed to `process_files()` before
+        /// converting them, and solve every distinct colour transform only
+        /// once. The other methods convert the files as soon as they are
+        /// found, and always solve the transform of every file separately.
+        bool plan = false;
+
+        /// The maximum total memory in bytes the concurrently converted files
+        /// may use, or 0 for no limit. The peak memory of every file is
+        /// estimated from its header, and a file waits until its estimate
+        /// fits into the budget left by the files already being converted.
+        size_t max_memory = 0;
+
+        /// Run the decoding, transforming and encoding as separate pipeline
+        /// stages, each having `jobs` threads.
+        bool pipeline = false;
+
+        /// Continue converting the remaining files after a failure instead of
+        /// stopping at the first failed file.
+        bool keep_going = false;
+
+        /// Skip the files which have not changed since they were last
+        /// converted with the same settings. A manifest of the converted
+        /// files is kept in each output directory. The outputs recorded in
+        /// the manifest get replaced when their inputs or the settings
+        /// change, even if overwriting is not enabled.
+        bool incremental = false;
+
+        /// Search the directories passed to `process_paths()` and
+        /// `watch_directory()` recursively.
+        bool recursive = false;
+
+        /// The directory to watch for the new files, see `watch_directory()`.
+        std::string watch;
+
+        /// The job file to convert, see `process_job_file()`.
+        std::string job_file;
+
+        /// The socket to serve the conversion requests on, see `serve()`.
+        std::string serve;
+
+        /// The socket of the server to send the files to, see
+        /// `submit_files()`.
+        std::string connect;
+
+        /// Convert only one of `shard_count` disjoint parts of the input
+        /// files, the part with the given 0-based index, so independent
+        /// processes given the same inputs cover every file exactly once.
+        /// A file is assigned to a shard by a hash of its path, see
+        /// `is_in_shard()`.
+        size_t shard_index = 0;
+
+        /// The number of shards the input files are split into.
+        size_t shard_count = 1;
+
+        /// Split the files passed to `process_files()` into the shards of
+        /// about the same total file size instead, so the shards finish at
+        /// about the same time. Not supported by the other methods, which
+        /// convert the files as soon as they are found.
+        bool shard_by_size = false;
+
+        /// The order to convert the files passed to `process_files()` and
+        /// the jobs of `process_job_file()` in, see `schedule_files()`. Not
+        /// supported by the other methods, which convert the files as soon
+        /// as they are found.
+        enum class Order
+        {
+            /// The order the files have been given in.
+            Input,
+
+            /// The largest files first, so the batch doesn't end with a
+            /// single worker converting a large file while the others idle.
+            LargestFirst,
+
+            /// The order of the files on the storage, approximated by their
+            /// inode numbers, so hard drives and tape-staged storage read the
+            /// files sequentially instead of seeking. Same as `Input` on
+            /// Windows.
+            Physical
+        } order = Order::Input;
+
+        /// How to report the throughput and the estimated time left while
+        /// converting. The reports are written to `std::cerr` every second,
+        /// and once more with the averages of the whole batch at the end.
+        enum class Progress
+        {
+            /// No reports, only a message for every file taken.
+            None,
+
+            /// A single line refreshed in place, replacing the messages for
+            /// every file taken.
+            TTY,
+
+            /// A JSON object per line, for the monitoring tools.
+            JSON
+        } progress = Progress::None;
+    } settings;
+
+    /// A record of a file which has failed to convert.
+    struct Failure
+    {
+        /// The index of the file in the list passed to `process_files()` or
+        /// `submit_files()`, of the job in the job file, or in the order the
+        /// files have been found by `process_paths()` and `watch_directory()`
+        /// or received by `serve()`.
+        size_t index = 0;
+
+        /// The path of the file.
+        std::string file;
+
+        /// The processing stage which has failed, one of "prepare" (making
+        /// the output path), "decode", "transform" or "encode".
+        std::string stage;
+
+        /// The reason of the failure.
+        std::string reason;
+
+        /// The time in seconds spent on the file until the failure.
+        double elapsed = 0.0;
+    };
+
+    /// Add the command line parameters used by the batch converter to the
+    /// parser object. Call this after `ImageConverter::init_parser()` to
+    /// add the parameters to the same parser.
+    /// @param arg_parser The command line parser object to be updated.
+    void init_parser( OIIO::ArgParse &arg_parser );
+
+    /// Initialise the batch converter settings from the command line parser
+    /// object. Prior to calling this, first initialise the object via
+    /// `BatchConverter::init_parser()`, and call
+    /// `OIIO::ArgParse::parse_args()`.
+    /// @param arg_parser the command line parser object
+    /// @result `true` if parsed successfully
+    bool parse_parameters( const OIIO::ArgParse &arg_parser );
+
+    /// Convert all `files` using the settings of the given `converter`.
+    /// A progress message is printed for every file in the order the files
+    /// appear in the list. The processing stops at the first failed file, the
+    /// files which are already being converted by other workers are finished.
+    /// If `Settings::keep_going` is set, all files are processed regardless of
+    /// failures, and a summary of the failed files is printed at the end.
+    /// If `Settings::incremental` is set, the unchanged files are skipped,
+    /// and the converted files get recorded in the manifests.
+    /// @param converter
+    ///     The converter to process the files with. Every worker makes its own
+    ///     copy of the object.
+    /// @param files
+    ///     The paths of the files to convert.
+    /// @result
+    ///     `true` if all files have been converted or skipped successfully.
+    bool process_files(
+        const ImageConverter &converter, const std::vector<std::string> &files );
+
+    /// Find the image files in the given `paths` and convert them as soon as
+    /// they are found, instead of building the full list first. The
+    /// directories are scanned in parallel using `Settings::jobs` threads,
+    /// recursively if `Settings::recursive` is set, and only the files of the
+    /// raw formats supported by OpenImageIO are picked up from them. The
+    /// progress messages and failures are numbered in the order the files
+    /// have been found. Otherwise, this behaves the same as `process_files()`.
+    /// @param converter
+    ///     The converter to process the files with. Every worker makes its own
+    ///     copy of the object.
+    /// @param paths
+    ///     The paths of the files and directories to convert.
+    /// @result
+    ///     `true` if all found files have been converted or skipped
+    ///     successfully.
+    bool process_paths(
+        const ImageConverter &converter, const std::vector<std::string> &paths );
+
+    /// Convert the jobs listed in a job file, each with its own settings and
+    /// optionally its own output path. The file is in the JSON Lines format,
+    /// every line being an object like
+    /// `{"input": "a.dng", "output": "a.exr", "settings": {"headroom": 4}}`.
+    /// The keys of "settings" are the names of the `ImageConverter::Settings`
+    /// fields, and override the settings of `converter` for the job. All jobs
+    /// are converted by the same pool of workers, and the progress messages
+    /// and failures are numbered in the order of the jobs. Nothing gets
+    /// converted if any line of the file is malformed. The incremental mode
+    /// is not supported. Otherwise, this behaves the same as
+    /// `process_files()`.
+    /// @param converter
+    ///     The converter holding the default settings of the jobs. Every
+    ///     worker makes its own copy of the object.
+    /// @param path
+    ///     The path of the job file.
+    /// @result
+    ///     `true` if all jobs have been converted successfully.
+    bool process_job_file(
+        const ImageConverter &converter, const std::string &path );
+
+    /// Watch the given `directory`, converting every raw file as soon as it
+    /// has been completely written into the directory, until `stop()` gets
+    /// called. The workers and their converters are
+    /// kept alive between the arrivals of the files. The failed files are
+    /// reported but never stop the watching, as if `Settings::keep_going`
+    /// was set. The subdirectories are watched too if `Settings::recursive`
+    /// is set. If `Settings::incremental` is set, the files already present
+    /// in the directory get converted first, skipping the unchanged ones, and
+    /// the converted files get recorded in the manifests as they are done,
+    /// the manifests being saved every time the watcher wakes up.
+    /// Only supported on Linux.
+    /// @param converter
+    ///     The converter to process the files with. Every worker makes its own
+    ///     copy of the object.
+    /// @param directory
+    ///     The path of the directory to watch.
+    /// @result
+    ///     `true` if all arrived files have been converted successfully before
+    ///     the watching has been stopped.
+    bool watch_directory(
+        const ImageConverter &converter, const std::string &directory );
+
+    /// Serve the conversion requests sent by the clients over a Unix domain
+    /// socket, until `stop()` gets called. Every request is a line of JSON,
+    /// the same as a line of a job file, see `process_job_file()`, with an
+    /// optional "id" of any JSON type. The requests of all clients are
+    /// converted by the same pool of workers, which stays alive between the
+    /// requests along with the loaded spectral data. Every request gets a
+    /// response line with the same "id", the "status" of "ok" or "error",
+    /// the "input" and "output" paths, the "time" spent converting the file
+    /// and the "queued" time spent waiting for a worker, in seconds. The
+    /// failed requests have the "stage" and the "reason" of the failure as
+    /// well, the stage being "request" for the malformed requests. The
+    /// responses are sent as soon as the files are done, so they may come in
+    /// a different order than the requests. The failures are only reported
+    /// to the clients, not kept for `get_failures()`, and the state of every
+    /// request is freed once it has been answered, so a long-running server
+    /// doesn't grow with the requests. Only supported on Linux and macOS.
+    /// @param converter
+    ///     The converter holding the default settings of the requests. Every
+    ///     worker makes its own copy of the object.
+    /// @param socket_path
+    ///     The path of the socket to create.
+    /// @result
+    ///     `true` if all requests have been converted successfully before the
+    ///     serving has been stopped.
+    bool serve(
+        const ImageConverter &converter, const std::string &socket_path );
+
+    /// Send the files to a server started by `serve()` for conversion, and
+    /// wait for all of them to finish. A message is printed for every
+    /// finished file, and the failures get recorded the same way as by
+    /// `process_files()`. The files get converted with the settings of the
+    /// server.
+    /// @param socket_path
+    ///     The path of the socket the server is listening on.
+    /// @param files
+    ///     The paths of the files to convert.
+    /// @result
+    ///     `true` if all files have been converted successfully.
+    bool submit_files(
+        const std::string &socket_path, const std::vector<std::string> &files );
+
+    /// Send the jobs of a job file to a server started by `serve()`, the same
+    /// as `submit_files()`. The job file is in the format described in
+    /// `process_job_file()`.
+    /// @param socket_path
+    ///     The path of the socket the server is listening on.
+    /// @param path
+    ///     The path of the job file.
+    /// @result
+    ///     `true` if all jobs have been converted successfully.
+    bool
+    submit_job_file( const std::string &socket_path, const std::string &path );
+
+    /// Make the running or the next call to `watch_directory()` or `serve()`
+    /// return once the files which have already arrived get converted. This
+    /// only sets a flag, so it is safe to call from a signal handler.
+    void stop();
+
+    /// Select the files of the shard set by `Settings::shard_index` out of
+    /// the given list. The selection only depends on the paths, and the file
+    /// sizes if `Settings::shard_by_size` is set, not on the order of the
+    /// list.
+    /// @param files the paths of the files to select from.
+    /// @result the indices of the selected files in `files`, in the same order.
+    std::vector<size_t>
+    select_shard( const std::vector<std::string> &files ) const;
+
+    /// Reorder the files to convert according to `Settings::order`. The
+    /// files which can't be accessed go last.
+    /// @param files the paths of the files.
+    /// @param indices the indices of the files in `files` to convert,
+    /// reordered in place. The files of the same size or position keep their
+    /// relative order.
+    void schedule_files(
+        const std::vector<std::string> &files,
+        std::vector<size_t>            &indices ) const;
+
+    /// Check whether the given file belongs to the shard set by
+    /// `Settings::shard_index`, using a hash of the path.
+    /// @param file the path of the file.
+    /// @result `true` if the file belongs to the shard.
+    bool is_in_shard( const std::string &file ) const;
+
+    /// Get the failures recorded by the last call to any of the methods
+    /// converting the files, ordered the same way as the files.
+    /// @result a reference to the list of failures.
+    const std::vector<Failure> &get_failures() const;
+
+    /// Get the number of files the last call to any of the methods
+    /// converting the files has queued for conversion, excluding the
+    /// unchanged files skipped in the incremental mode.
+    /// @result the number of files.
+    size_t get_total_files() const;
+
+    /// Print a table of the failures recorded by the last call to any of the
+    /// methods converting the files.
+    /// @param stream the stream to print the table to.
+    void print_failure_summary( std::ostream &stream ) const;
+
+private:
+    std::vector<Failure> _failures;
+    size_t               _total_files = 0;
+    std::atomic<bool>    _stop        = false;
+};
+
+} //namespace util
+} //namespace rta
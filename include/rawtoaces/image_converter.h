@@ -6,6 +6,9 @@
 #include <OpenImageIO/imagebuf.h>
 #include <OpenImageIO/argparse.h>
 
+#include <functional>
+#include <memory>
+
 namespace rta
 {
 namespace util
@@ -22,9 +25,49 @@ namespace util
 std::vector<std::vector<std::string>>
 collect_image_files( const std::vector<std::string> &paths );
 
+/// Options of `scan_image_files`.
+struct ScanOptions
+{
+    /// Descend into the subdirectories. Symbolic links to directories are not
+    /// followed, to avoid cycles.
+    bool recursive = false;
+
+    /// Only pick up the files found in directories whose extensions belong to
+    /// the raw formats supported by OpenImageIO. The paths of files given
+    /// directly are always accepted.
+    bool raw_only = false;
+
+    /// The number of threads scanning directories in parallel. The value of 0
+    /// uses all available hardware threads.
+    size_t threads = 1;
+};
+
+/// Find the image files in the given `paths`, calling `callback` for every
+/// file as soon as it is found, without building the full list first. The
+/// same files get filtered out as in `collect_image_files`. The calls to
+/// `callback` never overlap, but with more than one thread the order of the
+/// files is not defined. Invalid paths are skipped with an error message.
+///
+/// @param paths vector of paths to files or directories to scan.
+/// @param options the options of the scan.
+/// @param callback the function to call for every found file. Return `false`
+/// from it to stop the scan.
+/// @return `false` if the scan has been stopped by `callback`.
+bool scan_image_files(
+    const std::vector<std::string>                   &paths,
+    const ScanOptions                                &options,
+    const std::function<bool( const std::string & )> &callback );
+
+class TransformCache;
+
 class ImageConverter
 {
 public:
+    /// Construct a converter with the default settings. The copies of the
+    /// converter share the cache of the transforms solved from the spectral
+    /// data, so the workers of a batch solve every distinct transform once.
+    ImageConverter();
+
     struct Settings
     {
         /// The  white balancing method to use for conversion can be specified
@@ -121,6 +164,7 @@ public:
         bool                     overwrite   = false;
         bool                     create_dirs = false;
         std::string              output_dir;
+        std::string              transform_cache;
 
         // Diagnostic:
         bool use_timing = false;
@@ -184,6 +228,51 @@ public:
     bool configure(
         const OIIO::ImageSpec &imageSpec, OIIO::ParamValueList &options );
 
+    /// The colour transform solved by `configure` for a particular file: the
+    /// hints for the OIIO raw image reader, and the matrices to apply to the
+    /// decoded pixels. The files sharing the same transform key, see
+    /// `get_transform_key`, can reuse the transform solved for one of them.
+    struct Transform
+    {
+        OIIO::ParamValueList             hints;
+        std::vector<double>              WB_multipliers;
+        std::vector<std::vector<double>> IDT_matrix;
+        std::vector<std::vector<double>> CAT_matrix;
+    };
+
+    /// Read the metadata needed to solve the colour transform of a file,
+    /// without decoding the pixels.
+    /// @param input_filename
+    ///    A file name of the raw image file to read the metadata from.
+    /// @param image_spec
+    ///    The image spec to read the metadata into.
+    /// @result
+    ///    `true` if read successfully.
+    bool read_metadata(
+        const std::string &input_filename, OIIO::ImageSpec &image_spec ) const;
+
+    /// Make a key identifying the colour transform `configure` would solve
+    /// for the given metadata with the current settings. The key only
+    /// contains the metadata the transform depends on, like the camera
+    /// model, the white balance multipliers and the DNG calibration, so the
+    /// files getting equal keys also get the same transform.
+    /// @param image_spec
+    ///    The image spec obtained by `read_metadata`.
+    /// @result
+    ///    The key, an opaque binary string.
+    std::string get_transform_key( const OIIO::ImageSpec &image_spec ) const;
+
+    /// Solve the colour transform for the given metadata. This is equivalent
+    /// to `configure`, storing the results into the `transform`.
+    /// @param image_spec
+    ///    The image spec obtained by `read_metadata`.
+    /// @param transform
+    ///    The transform to store the hints and the matrices into.
+    /// @result
+    ///    `true` if solved successfully.
+    bool solve_transform(
+        const OIIO::ImageSpec &image_spec, Transform &transform );
+
     /// Load an image from a given `path` into a `buffer` using the `hints`
     /// calculated by the `configure` method. The hints can be manually
     /// modified prior to invoking this method.
@@ -238,6 +327,29 @@ public:
     bool
     make_output_path( std::string &path, const std::string &suffix = "_aces" );
 
+    /// Check that the converted image can be written to the given output
+    /// path, for the outputs named explicitly instead of being made by
+    /// `make_output_path`.
+    /// @param path
+    ///     The output file path.
+    /// @result
+    ///    `true` if the file can be written, e.g. the directory of the file
+    ///     exists, or creating directories is allowed; the file does not
+    ///     exist or overwriting is allowed.
+    bool check_output_path( const std::string &path );
+
+    /// Get the output file path `make_output_path` would generate for the
+    /// given input file path, without checking or modifying the file system.
+    /// @param path
+    ///     The input file path.
+    /// @param suffix
+    ///     A suffix to add to the file name.
+    /// @result
+    ///     The output file path, or an empty string if the input path is
+    ///     malformed.
+    std::string get_output_path(
+        const std::string &path, const std::string &suffix = "_aces" ) const;
+
     /// Saves the image into ACES Container.
     /// @param output_filename
     ///     Full path to the file to be saved.
@@ -249,14 +361,77 @@ public:
     save_image( const std::string &output_filename, const OIIO::ImageBuf &buf );
 
     /// A convenience single-call method to process an image. This is equivalent to calling the following
-    /// methods sequentially: `make_output_path`->`configure`->`apply_matrix`->
-    /// `apply_scale`->`apply_crop`->`save`.
+    /// methods sequentially: `make_output_path`->`decode_image`->`transform_image`->`encode_image`.
     /// @param input_filename
     ///     Full path to the file to be converted.
     /// @result
     ///    `true` if processed successfully.
     bool process_image( const std::string &input_filename );
 
+    /// The first stage of `process_image`: configures the converter for the
+    /// given file and loads it. Equivalent to `configure`->`load_image`.
+    /// @param input_filename
+    ///     Full path to the file to be decoded.
+    /// @param buffer
+    ///     The image buffer to load the image into.
+    /// @result
+    ///    `true` if decoded successfully.
+    bool
+    decode_image( const std::string &input_filename, OIIO::ImageBuf &buffer );
+
+    /// A variant of the first stage of `process_image` using a transform
+    /// solved in advance by `solve_transform`, possibly for another file
+    /// with the same transform key. The file metadata is not read again,
+    /// and no solving takes place. Equivalent to `load_image`.
+    /// @param input_filename
+    ///     Full path to the file to be decoded.
+    /// @param transform
+    ///     The transform to decode the file with.
+    /// @param buffer
+    ///     The image buffer to load the image into.
+    /// @result
+    ///    `true` if decoded successfully.
+    bool decode_image(
+        const std::string &input_filename,
+        const Transform   &transform,
+        OIIO::ImageBuf    &buffer );
+
+    /// The second stage of `process_image`: applies the transform configured
+    /// by `decode_image` to the image in-place. Equivalent to
+    /// `apply_matrix`->`apply_scale`->`apply_crop`.
+    /// @param input_filename
+    ///     Full path to the file the image was decoded from, used in messages.
+    /// @param buffer
+    ///     The image buffer to transform.
+    /// @result
+    ///    `true` if transformed successfully.
+    bool transform_image(
+        const std::string &input_filename, OIIO::ImageBuf &buffer );
+
+    /// The last stage of `process_image`: saves the transformed image.
+    /// Equivalent to `save_image`, with the progress and timing messages.
+    /// @param output_filename
+    ///     Full path to the file to be saved.
+    /// @param buffer
+    ///     The image buffer to save.
+    /// @result
+    ///    `true` if encoded successfully.
+    bool encode_image(
+        const std::string &output_filename, const OIIO::ImageBuf &buffer );
+
+    /// Estimate the peak memory needed to convert the given file, reading
+    /// only the header of the file. The estimate covers the buffers of the
+    /// raw decoder, the floating point image, and the extra copy made by the
+    /// hard crop, using the current settings.
+    /// @param input_filename
+    ///     Full path to the file to be converted.
+    /// @param bytes
+    ///     The variable to store the estimate into, in bytes.
+    /// @result
+    ///    `true` if the header of the file has been read successfully.
+    bool estimate_memory_usage(
+        const std::string &input_filename, size_t &bytes ) const;
+
     /// Get the solved white balance multipliers of the currently processed
     /// image. The multipliers become available after calling either of the
     /// two `configure` methods.
@@ -275,11 +450,28 @@ public:
     /// @result a reference to the matrix.
     const std::vector<std::vector<double>> &get_CAT_matrix() const;
 
+    /// Get the reason of the most recent failure of `process_image`, or one
+    /// of the `decode_image`, `transform_image` and `encode_image` stages.
+    /// The message is also printed to `std::cerr` when the failure happens.
+    /// @result a reference to the message, empty if the last call succeeded.
+    const std::string &get_last_error() const;
+
 private:
+    /// Load the image in `decode_image`, recording the failure.
+    bool load_image_stage(
+        const std::string          &input_filename,
+        const OIIO::ParamValueList &hints,
+        OIIO::ImageBuf             &buffer );
+
     // Solved transform of the current image.
     std::vector<std::vector<double>> _idt_matrix;
     std::vector<std::vector<double>> _cat_matrix;
     std::vector<double>              _wb_multipliers;
+
+    // The spectral transforms solved so far, shared by the copies.
+    std::shared_ptr<TransformCache> _transform_cache;
+
+    std::string _last_error;
 };
 
 } //namespace util
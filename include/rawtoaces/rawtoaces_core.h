@@ -5,6 +5,8 @@
 
 #include <rawtoaces/spectral_data.h>
 
+#include <memory>
+
 namespace rta
 {
 namespace core
@@ -27,6 +29,10 @@ static const std::vector<std::vector<double> > CAT_D65_to_ACES = {
 
 // clang-format on
 
+/// The R, G and B channels of a camera, or the X, Y and Z channels of an
+/// observer, found once in the spectral data for the calculations to use.
+typedef std::array<const Spectrum *, 3> ChannelTriplet;
+
 /// Calculate spectral power distribution (SPD) of CIE standard daylight illuminant.
 /// The function generates the spectral power distribution for a daylight illuminant
 /// based on the requested correlated color temperature using CIE standard formulas.
@@ -45,6 +51,8 @@ void calculate_daylight_SPD( const int &cct, Spectrum &spectrum );
 /// @pre cct is in valid range for blackbody calculations (1500-3999)
 void calculate_blackbody_SPD( const int &cct, Spectrum &spectrum );
 
+class SpectralDatabase;
+
 /// Solve an input transform using spectral sensitivity curves of a camera.
 class SpectralSolver
 {
@@ -75,6 +83,15 @@ public:
     /// @param search_directories optional database search path for spectral data files
     SpectralSolver( const std::vector<std::string> &search_directories = {} );
 
+    /// Initialize SpectralSolver with a database loaded in advance.
+    /// The cameras, illuminants and data files get looked up in the database
+    /// instead of being searched for and loaded from the files on every call,
+    /// which makes the solvers cheap to create.
+    ///
+    /// @param database the database to look the spectral data up in, shared
+    /// with other solvers
+    explicit SpectralSolver( std::shared_ptr<const SpectralDatabase> database );
+
     /// A helper method collecting spectral data files of a given type from the database.
     /// This function searches through the configured search directories to find all
     /// spectral data files matching the specified type (e.g., "camera", "illuminant").
@@ -120,6 +137,11 @@ public:
     /// This function analyzes all available illuminants and selects the one that best matches
     /// the white balance coefficients. It uses Sum of Squared Errors (SSE) to find the
     /// optimal match and automatically scales the white balance multipliers.
+    /// The candidates are the daylight illuminants from 4000K to 25000K, the
+    /// blackbody illuminants from 1500K to 4000K, both every
+    /// `illuminant_cct_step` kelvin, and the illuminants in the database. The
+    /// multipliers of the camera under every candidate are calculated once
+    /// per camera, and only the best match gets generated or copied.
     ///
     /// @param wb_multipliers white-balancing multipliers to match
     /// @return `true` if loaded successfully, `false` otherwise
@@ -165,9 +187,66 @@ public:
 
     int verbosity = 0;
 
+    /// The step in kelvin between the daylight and blackbody illuminants
+    /// tried by `find_illuminant( wb_multipliers )`.
+    int illuminant_cct_step = 500;
+
 private:
-    std::vector<std::string>  _search_directories;
-    std::vector<SpectralData> _all_illuminants;
+    /// A candidate illuminant of the white balance search, along with the
+    /// white balance multipliers of the camera under it.
+    struct LocusEntry
+    {
+        enum class Kind
+        {
+            Daylight,
+            Blackbody,
+            Stored
+        } kind;
+
+        /// The colour temperature of a daylight or blackbody illuminant, or
+        /// the index of an illuminant in `_stored_illuminants`.
+        int value;
+
+        /// The white balance multipliers, normalised to green.
+        double WB[3];
+    };
+
+    /// Calculate `_wb_locus` for the current camera, unless already
+    /// calculated. The stored illuminants of other shapes are skipped.
+    /// @result `false` if the camera is not sampled at 380-780nm with 5nm
+    /// step.
+    bool update_wb_locus();
+
+    /// Find the channels of `camera`, `observer` and `illuminant` used by the
+    /// calculations. Called once by every public calculation, as the data
+    /// sets may have changed since the previous one. The missing channels
+    /// are set to `nullptr`.
+    void find_channels();
+
+    /// Check that the channels found by `find_channels()` are still the ones
+    /// of the data sets, for the debug assertions.
+    bool are_channels_current() const;
+
+    std::vector<std::string>                _search_directories;
+    std::shared_ptr<const SpectralDatabase> _database;
+
+    // The channels found by `find_channels()`.
+    ChannelTriplet _camera_channels   = {};
+    ChannelTriplet _observer_channels = {};
+    Spectrum      *_illuminant_power  = nullptr;
+
+    // The illuminants found in the database, loaded on the first use, and
+    // their power channels, `nullptr` for the ones missing it or sampled
+    // differently than `ReferenceSpectrum`.
+    std::vector<std::shared_ptr<const SpectralData>> _stored_illuminants;
+    std::vector<const Spectrum *>                    _stored_powers;
+    bool                                             _stored_loaded = false;
+
+    // The white balance search candidates, calculated for a copy of the
+    // camera data and the step they are calculated for.
+    std::vector<LocusEntry> _wb_locus;
+    ReferenceSpectrum       _wb_locus_camera[3];
+    int                     _wb_locus_step = 0;
 
     std::vector<double>              _wb_multipliers;
     std::vector<std::vector<double>> _idt_matrix;
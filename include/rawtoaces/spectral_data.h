@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include <array>
 #include <string>
 #include <vector>
 #include <map>
@@ -93,6 +94,100 @@ struct Spectrum
     double max() const;
 };
 
+/// A spectral curve sampled at 380-780nm with 5nm step, the default
+/// `Spectrum::ReferenceShape` all data gets reshaped to, with the samples
+/// stored inline. Unlike `Spectrum`, creating, copying and combining these
+/// never allocates, which makes them suited for the temporaries of the
+/// spectral calculations. Convert from and to `Spectrum` to exchange the
+/// curves with `SpectralData`.
+struct ReferenceSpectrum
+{
+    /// The number of spectral samples.
+    static constexpr size_t Size = 81;
+
+    /// The shape of the spectral samples.
+    inline static const Spectrum::Shape shape = { 380, 780, 5 };
+
+    /// The spectral samples storage.
+    std::array<double, Size> values;
+
+    /// The `ReferenceSpectrum` object constructor. Initialises all spectral
+    /// samples with `value`.
+    /// @param value the value to initialise the spectral samples with.
+    explicit ReferenceSpectrum( double value = 0 );
+
+    /// Copy the samples of a `Spectrum` object.
+    /// @param spectrum the spectrum to copy the samples of.
+    /// - throws: if `spectrum` has a different shape than `shape`, see
+    /// `Spectrum::reshape()`.
+    explicit ReferenceSpectrum( const Spectrum &spectrum );
+
+    /// Copy the samples into a `Spectrum` object.
+    /// @result the `Spectrum` object of the same shape.
+    Spectrum to_spectrum() const;
+
+    /// Per-element addition operator.
+    friend ReferenceSpectrum
+    operator+( const ReferenceSpectrum &lhs, const ReferenceSpectrum &rhs );
+
+    /// Per-element subtraction operator.
+    friend ReferenceSpectrum
+    operator-( const ReferenceSpectrum &lhs, const ReferenceSpectrum &rhs );
+
+    /// Per-element multiplication operator.
+    friend ReferenceSpectrum
+    operator*( const ReferenceSpectrum &lhs, const ReferenceSpectrum &rhs );
+
+    /// Per-element division operator.
+    friend ReferenceSpectrum
+    operator/( const ReferenceSpectrum &lhs, const ReferenceSpectrum &rhs );
+
+    /// Per-element addition operator.
+    ReferenceSpectrum &operator+=( const ReferenceSpectrum &rhs );
+
+    /// Per-element subtraction operator.
+    ReferenceSpectrum &operator-=( const ReferenceSpectrum &rhs );
+
+    /// Per-element multiplication operator.
+    ReferenceSpectrum &operator*=( const ReferenceSpectrum &rhs );
+
+    /// Per-element division operator.
+    ReferenceSpectrum &operator/=( const ReferenceSpectrum &rhs );
+
+    /// Multiply all elements by a value.
+    ReferenceSpectrum &operator*=( double value );
+
+    /// Integrate the spectral curve.
+    /// @result the sum of all elements in `values`.
+    double integrate() const;
+
+    /// Find the maximum element in `values`
+    /// @result the maximum element in `values`.
+    double max() const;
+};
+
+/// Integrate the product of two spectral curves in a single pass. The same
+/// as `( a * b ).integrate()`, without creating the intermediate spectrum.
+/// @param a the first spectral curve.
+/// @param b the second spectral curve, of the same shape as `a`.
+/// @result the sum of the products of the corresponding samples.
+double dot( const Spectrum &a, const Spectrum &b );
+double dot( const ReferenceSpectrum &a, const ReferenceSpectrum &b );
+
+/// Integrate the product of three spectral curves in a single pass. The same
+/// as `( a * b * c ).integrate()`, without creating the intermediate
+/// spectra, like the response of a camera channel to a patch lit by an
+/// illuminant.
+/// @param a the first spectral curve.
+/// @param b the second spectral curve, of the same shape as `a`.
+/// @param c the third spectral curve, of the same shape as `a`.
+/// @result the sum of the products of the corresponding samples.
+double dot3( const Spectrum &a, const Spectrum &b, const Spectrum &c );
+double dot3(
+    const ReferenceSpectrum &a,
+    const ReferenceSpectrum &b,
+    const ReferenceSpectrum &c );
+
 /// A data-class for storing spectral data, based on the file format used in
 /// [rawtoaces-data](https://github.com/AcademySoftwareFoundation/rawtoaces-data).
 struct SpectralData
@@ -125,11 +220,34 @@ struct SpectralData
     /// RGB or XYZ triplet.
     typedef std::vector<SpectralChannel> SpectralSet;
 
+    /// The channels of the "main" data set used by the solver, which can be
+    /// accessed without looking their names up, see `operator[]( Channel )`.
+    enum Channel
+    {
+        R,
+        G,
+        B,
+        X,
+        Y,
+        Z,
+        Power,
+        ChannelCount
+    };
+
     /// The spectral data storage.
     std::map<std::string, SpectralSet> data;
 
     bool load( const std::string &path, bool reshape = true );
 
+    /// Load only the header fields of a data file, like the manufacturer,
+    /// model and type, which is enough to list or look the data sets up.
+    /// The parsing stops at the end of the `header` object, so the spectral
+    /// samples following it are never read. The spectral data fields and
+    /// `data` are left empty.
+    /// @param path the path of the file to load.
+    /// @result `true` if the header has been loaded successfully.
+    bool load_header( const std::string &path );
+
     /// A convenience operator returning the `Spectrum` of a given channel name
     /// in the "main" data set.
     /// @param name the channel name in the "main" data set to return.
@@ -148,6 +266,32 @@ struct SpectralData
     /// @throw if the requested channel is not found.
     Spectrum       &get( std::string set_name, std::string channel_name );
     const Spectrum &get( std::string set_name, std::string channel_name ) const;
+
+    /// Get the name of a channel, like "R" or "power".
+    /// @param channel the channel.
+    /// @result the channel name in the "main" data set.
+    static const char *channel_name( Channel channel );
+
+    /// Find a channel in the "main" data set by name. The calculations
+    /// using the same channels repeatedly should keep the pointer instead of
+    /// finding it every time.
+    /// @param channel the channel to find.
+    /// @result the channel, `nullptr` if not found.
+    Spectrum       *find_channel( Channel channel );
+    const Spectrum *find_channel( Channel channel ) const;
+
+    /// Check whether the "main" data set has the given channel.
+    /// @param channel the channel to check.
+    /// @result `true` if the channel is found.
+    bool has_channel( Channel channel ) const;
+
+    /// A convenience operator returning the `Spectrum` of a given channel in
+    /// the "main" data set.
+    /// @param channel the channel to return.
+    /// @result the `Spectrum` object corresponding to the given channel.
+    /// - throws: if the requested channel is not found.
+    Spectrum       &operator[]( Channel channel );
+    const Spectrum &operator[]( Channel channel ) const;
 };
 
 } // namespace core
@@ -0,0 +1,201 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+#pragma once
+
+#include <rawtoaces/spectral_data.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace rta
+{
+namespace core
+{
+
+/// An immutable in-memory copy of the spectral data found in the database
+/// directories: the camera sensitivities, the illuminants, the training data
+/// and the observers. Building the database only reads the file headers, and
+/// indexes them by the camera make and model, and by the illuminant type,
+/// ignoring the case. The spectral samples of a file are loaded once, on the
+/// first lookup returning it. A database can be used from multiple threads, and
+/// shared by all `SpectralSolver` objects of a process, see `get()`.
+///
+/// The data can also be compiled into a single binary file, see `compile()`,
+/// which loads without parsing any JSON. The file stays mapped into memory,
+/// and the spectral data of an entry is decoded on its first lookup, the
+/// same as with the JSON files. The JSON files stay the source of truth: a
+/// compiled file remembers the files it has been compiled from, and is only
+/// used while none of them have changed.
+class SpectralDatabase
+{
+public:
+    /// A shared reference to a loaded data set.
+    typedef std::shared_ptr<const SpectralData> DataPtr;
+
+    /// Build a database from the given directories. Every directory is
+    /// expected to contain the `camera`, `illuminant`, `training` and `cmf`
+    /// subdirectories. If the same camera, illuminant or file is found in
+    /// multiple directories, the first one wins, the same as when searching
+    /// the directories with `SpectralSolver`. The files which fail to load
+    /// are reported and skipped. The headers of the files of a directory are
+    /// read in parallel.
+    ///
+    /// An entry of the search path can also be a compiled database file,
+    /// standing in for the directories it has been compiled from. If any of
+    /// the source files have changed since, a warning is printed and the
+    /// source directories are loaded instead.
+    ///
+    /// @param directories the database search path
+    /// @param verbosity the verbosity level of the warnings about the missing
+    /// directories
+    SpectralDatabase(
+        const std::vector<std::string> &directories, int verbosity = 0 );
+
+    ~SpectralDatabase();
+
+    SpectralDatabase( const SpectralDatabase & )            = delete;
+    SpectralDatabase &operator=( const SpectralDatabase & ) = delete;
+
+    /// Get the database shared by the whole process for the given search
+    /// path, building it on the first call. The database is never rebuilt,
+    /// so the changes made to the files afterwards are not picked up.
+    /// Thread-safe.
+    ///
+    /// @param directories the database search path
+    /// @param verbosity the verbosity level used if the database gets built
+    /// @return the shared database
+    static std::shared_ptr<const SpectralDatabase>
+    get( const std::vector<std::string> &directories, int verbosity = 0 );
+
+    /// Compile the spectral data found in the given directories into a
+    /// single binary file, to be used in the search path in place of the
+    /// directories. The file holds the spectra already reshaped to
+    /// `Spectrum::ReferenceShape`, along with the sizes and modification
+    /// times of the source files to detect them changing. The file is
+    /// written under a temporary name and renamed, so the running processes
+    /// never see it partially written.
+    ///
+    /// @param directories the database directories to compile, compiled
+    /// database files are not accepted
+    /// @param path the path of the file to write
+    /// @param verbosity the verbosity level of the warnings about the missing
+    /// directories
+    /// @return `true` if the file has been written successfully
+    static bool compile(
+        const std::vector<std::string> &directories,
+        const std::string              &path,
+        int                             verbosity = 0 );
+
+    /// Check whether a compiled database file can be used, that is, it is
+    /// valid and none of its source files have changed since compiling.
+    /// @param path the path of the compiled file
+    /// @param directories the variable to store the directories the file
+    /// has been compiled from into, which get loaded in place of an out of
+    /// date file. Empty if the file is not a valid compiled database.
+    /// @return `true` if the file can be used
+    static bool check_compiled(
+        const std::string &path, std::vector<std::string> &directories );
+
+    /// Get the search path the database has been built from.
+    /// @return the database directories
+    const std::vector<std::string> &directories() const;
+
+    /// Find the spectral sensitivity data of a camera.
+    /// @param make the camera make, case-insensitive
+    /// @param model the camera model, case-insensitive
+    /// @return the camera data, or `nullptr` if not found
+    DataPtr
+    find_camera( const std::string &make, const std::string &model ) const;
+
+    /// Check whether the database has the spectral sensitivity data of a
+    /// camera, without loading the spectral data.
+    /// @param make the camera make, case-insensitive
+    /// @param model the camera model, case-insensitive
+    /// @return `true` if a file for the camera has been found. Its spectral
+    /// data may still fail to load, see `find_camera()`.
+    bool has_camera( const std::string &make, const std::string &model ) const;
+
+    /// Find the spectral power distribution of an illuminant stored in the
+    /// database. The built-in daylight and blackbody illuminants are not
+    /// stored, see `SpectralSolver::find_illuminant()`.
+    /// @param type the illuminant type, case-insensitive
+    /// @return the illuminant data, or `nullptr` if not found
+    DataPtr find_illuminant( const std::string &type ) const;
+
+    /// Find a data file by its path relative to the database directories,
+    /// like `training/training_spectral.json` or `cmf/cmf_1931.json`.
+    /// @param relative_path the path of the file inside a database directory
+    /// @return the data, or `nullptr` if not found or failed to load
+    DataPtr find_file( const std::string &relative_path ) const;
+
+    /// Get the headers of all cameras, in the order they have been found.
+    /// The returned data sets may only have the header fields loaded, use
+    /// `find_camera()` to get the spectral data.
+    /// @return the camera headers
+    const std::vector<DataPtr> &cameras() const;
+
+    /// Get the headers of all illuminants stored in the database, in the
+    /// order they have been found. The returned data sets may only have the
+    /// header fields loaded, see `load_illuminants()`.
+    /// @return the illuminant headers
+    const std::vector<DataPtr> &illuminants() const;
+
+    /// Get the full data of all illuminants stored in the database, in the
+    /// order they have been found, loading the ones not loaded yet. The
+    /// files which fail to load are skipped.
+    /// @return the illuminant data sets
+    std::vector<DataPtr> load_illuminants() const;
+
+private:
+    /// A data file found in the database, loaded on the first use.
+    struct Entry;
+
+    /// Get the full data of a file, loading it on the first call.
+    /// Thread-safe.
+    /// @return the data, or `nullptr` if the file has failed to load
+    DataPtr load( Entry &entry ) const;
+
+    /// Load all files of a database directory.
+    /// @param directory the database directory
+    /// @param verbosity the verbosity level of the warnings about the missing
+    /// directories
+    void load_directory( const std::string &directory, int verbosity );
+
+    /// Load the headers of a compiled database file, keeping the file mapped
+    /// to decode the spectral data on the first lookup, or load its source
+    /// directories if any of the source files have changed.
+    void load_compiled( const std::string &path, int verbosity );
+
+    /// Add a file to the indices. The relative paths resolve to the first
+    /// file added, even if it has failed to load.
+    /// @param type the data type, the name of the subdirectory it comes from
+    /// @param key the path of the file relative to the database directory
+    /// @param path the path to load the full data from
+    /// @param header the header of the file, or `nullptr` if failed to load
+    /// @return the entry of the file, or `nullptr` if failed to load
+    Entry *add(
+        const std::string &type,
+        const std::string &key,
+        const std::string &path,
+        DataPtr            header );
+
+    std::vector<std::string> _directories;
+
+    std::vector<std::unique_ptr<Entry>> _entries;
+
+    std::vector<DataPtr> _cameras;
+    std::vector<DataPtr> _illuminants;
+    std::vector<Entry *> _illuminant_entries;
+
+    // The files sharing the same camera or illuminant name, in the order
+    // they have been found.
+    std::unordered_map<std::string, std::vector<Entry *>> _cameras_by_name;
+    std::unordered_map<std::string, std::vector<Entry *>> _illuminants_by_type;
+    std::unordered_map<std::string, Entry *>              _files;
+};
+
+} // namespace core
+} // namespace rta
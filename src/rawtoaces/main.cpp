@@ -2,9 +2,20 @@
 // Copyright Contributors to the rawtoaces Project.
 
 #include <rawtoaces/image_converter.h>
+#include <rawtoaces/batch_converter.h>
 
+#include <csignal>
 #include <set>
 
+// The batch converter to stop on an interrupt in the watch and serve modes.
+static rta::util::BatchConverter *running_converter = nullptr;
+
+extern "C" void stop_running( int )
+{
+    if ( running_converter )
+        running_converter->stop();
+}
+
 int main( int argc, const char *argv[] )
 {
 #ifndef WIN32
@@ -14,10 +25,12 @@ int main( int argc, const char *argv[] )
 #endif
 
     rta::util::ImageConverter converter;
+    rta::util::BatchConverter batch_converter;
 
     OIIO::ArgParse arg_parser;
     arg_parser.arg( "filename" ).action( OIIO::ArgParse::append() ).hidden();
     converter.init_parser( arg_parser );
+    batch_converter.init_parser( arg_parser );
 
     if ( arg_parser.parse_args( argc, argv ) < 0 )
     {
@@ -29,51 +42,160 @@ int main( int argc, const char *argv[] )
         return 1;
     }
 
-    auto files = arg_parser["filename"].as_vec<std::string>();
-    if ( files.empty() || ( files.size() == 1 && files[0] == "" ) )
+    if ( !batch_converter.parse_parameters( arg_parser ) )
     {
-        arg_parser.print_help();
         return 1;
     }
 
-    // Gather all the raw images from arg list
-    std::vector<std::vector<std::string>> batches =
-        rta::util::collect_image_files( files );
+    auto files = arg_parser["filename"].as_vec<std::string>();
+    bool has_files =
+        !files.empty() && !( files.size() == 1 && files[0] == "" );
 
-    // Process raw files
-    bool empty  = true;
-    bool result = true;
+    bool   result;
+    size_t total_files;
 
-    size_t file_index  = 0;
-    size_t total_files = 0;
+    if ( !batch_converter.settings.watch.empty() )
+    {
+        if ( has_files )
+        {
+            std::cerr << "The input files can't be combined with --watch."
+                      << std::endl;
+            return 1;
+        }
 
-    for ( auto const &batch: batches )
-        total_files += batch.size();
+        // Finish the files which have already arrived on an interrupt.
+        running_converter = &batch_converter;
+        std::signal( SIGINT, stop_running );
+        std::signal( SIGTERM, stop_running );
+
+        result      = batch_converter.watch_directory(
+            converter, batch_converter.settings.watch );
+        total_files = batch_converter.get_total_files();
+
+        // Failed files never stop the watching, same as --keep-going.
+        if ( result )
+            return 0;
+        return batch_converter.get_failures().size() < total_files ? 2 : 1;
+    }
 
-    for ( auto const &batch: batches )
+    if ( !batch_converter.settings.serve.empty() )
     {
-        for ( auto const &input_filename: batch )
+        if ( has_files )
         {
-            ++file_index;
-            std::cout << "[" << file_index << "/" << total_files
-                      << "] Processing file: " << input_filename << std::endl;
+            std::cerr << "The input files can't be combined with --serve."
+                      << std::endl;
+            return 1;
+        }
+
+        // Finish the requests which have already arrived on an interrupt.
+        running_converter = &batch_converter;
+        std::signal( SIGINT, stop_running );
+        std::signal( SIGTERM, stop_running );
+
+        // Failed requests never stop the serving.
+        result = batch_converter.serve(
+            converter, batch_converter.settings.serve );
+        return result ? 0 : 1;
+    }
 
-            empty  = false;
-            result = converter.process_image( input_filename );
-            if ( !result )
+    if ( !batch_converter.settings.connect.empty() )
+    {
+        const std::string &socket_path = batch_converter.settings.connect;
+
+        if ( !batch_converter.settings.job_file.empty() )
+        {
+            if ( has_files )
             {
-                std::cerr << "Failed on file [" << file_index << "/"
-                          << total_files << "]: " << input_filename
-                          << std::endl;
-                break;
+                std::cerr << "The input files can't be combined with "
+                          << "--job-file." << std::endl;
+                return 1;
             }
+
+            result = batch_converter.submit_job_file(
+                socket_path, batch_converter.settings.job_file );
+        }
+        else if ( has_files )
+        {
+            std::vector<std::vector<std::string>> batches =
+                rta::util::collect_image_files( files );
+
+            std::vector<std::string> input_files;
+            for ( auto const &batch: batches )
+                input_files.insert(
+                    input_files.end(), batch.begin(), batch.end() );
+
+            result = batch_converter.submit_files( socket_path, input_files );
         }
-        if ( !result )
-            break;
+        else
+        {
+            arg_parser.print_help();
+            return 1;
+        }
+
+        total_files = batch_converter.get_total_files();
+        if ( result )
+            return 0;
+        return batch_converter.get_failures().size() < total_files ? 2 : 1;
     }
 
-    if ( empty )
+    if ( !batch_converter.settings.job_file.empty() )
+    {
+        if ( has_files )
+        {
+            std::cerr << "The input files can't be combined with --job-file."
+                      << std::endl;
+            return 1;
+        }
+
+        // Convert the files listed in the job file with their own settings
+        result      = batch_converter.process_job_file(
+            converter, batch_converter.settings.job_file );
+        total_files = batch_converter.get_total_files();
+    }
+    else if ( !has_files )
+    {
         arg_parser.print_help();
+        return 1;
+    }
+    else if ( batch_converter.settings.recursive )
+    {
+        // Convert the raw images as soon as they are found
+        result      = batch_converter.process_paths( converter, files );
+        total_files = batch_converter.get_total_files();
+    }
+    else
+    {
+        // Gather all the raw images from arg list
+        std::vector<std::vector<std::string>> batches =
+            rta::util::collect_image_files( files );
+
+        std::vector<std::string> input_files;
+        for ( auto const &batch: batches )
+            input_files.insert( input_files.end(), batch.begin(), batch.end() );
+
+        if ( input_files.empty() )
+        {
+            arg_parser.print_help();
+            return 0;
+        }
+
+        // Process raw files
+        result      = batch_converter.process_files( converter, input_files );
+        total_files = batch_converter.get_total_files();
+    }
+
+    if ( result )
+    {
+        return 0;
+    }
+
+    // A distinct exit code for a batch which has been processed to the end
+    // with some of the files converted successfully.
+    if ( batch_converter.settings.keep_going &&
+         batch_converter.get_failures().size() < total_files )
+    {
+        return 2;
+    }
 
-    return result ? 0 : 1;
+    return 1;
 }
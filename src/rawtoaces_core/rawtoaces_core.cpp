@@ -2,10 +2,13 @@
 // Copyright Contributors to the rawtoaces Project.
 
 #include <rawtoaces/rawtoaces_core.h>
+#include <rawtoaces/spectral_database.h>
 #include "rawtoaces_core_priv.h"
 #include "mathOps.h"
 #include "define.h"
 
+#include <cmath>
+
 using namespace ceres;
 
 namespace rta
@@ -42,12 +45,15 @@ vector<double> CCT_to_xy( const double &cct )
     return { x, y };
 }
 
-void calculate_daylight_SPD( const int &cct_input, Spectrum &spectrum )
+/// Calculate the weights of the second and third components of the CIE
+/// daylight model for a colour temperature, see `daylight_components()`.
+///
+/// @param cct_input The correlated color temperature in Kelvin, or in
+/// hundreds of Kelvin using the pre-1968 constant (40 to 250)
+/// @param m1 The weight of the second component
+/// @param m2 The weight of the third component
+void daylight_weights( const int &cct_input, double &m1, double &m2 )
 {
-    int step             = static_cast<int>( spectrum.shape.step );
-    int wavelength_range = s_series[53].wl - s_series[0].wl;
-    assert( wavelength_range % step == 0 );
-
     double cct;
     if ( cct_input >= 40 && cct_input <= 250 )
         cct = cct_input * 100 * 1.4387752 / 1.438;
@@ -60,15 +66,26 @@ void calculate_daylight_SPD( const int &cct_input, Spectrum &spectrum )
         exit( 1 );
     }
 
-    spectrum.values.clear();
-
-    vector<int>    wavelengths, wavelengths_interpolated;
-    vector<double> s00, s10, s20, s01, s11, s21;
     vector<double> xy = CCT_to_xy( cct );
 
     double m0 = 0.0241 + 0.2562 * xy[0] - 0.7341 * xy[1];
-    double m1 = ( -1.3515 - 1.7703 * xy[0] + 5.9114 * xy[1] ) / m0;
-    double m2 = ( 0.03000 - 31.4424 * xy[0] + 30.0717 * xy[1] ) / m0;
+    m1        = ( -1.3515 - 1.7703 * xy[0] + 5.9114 * xy[1] ) / m0;
+    m2        = ( 0.03000 - 31.4424 * xy[0] + 30.0717 * xy[1] ) / m0;
+}
+
+/// Calculate the three components of the CIE daylight model, resampled to
+/// the given step within 380-780nm. A daylight SPD is the first component
+/// plus the other two weighted by `daylight_weights()`.
+///
+/// @param step The sampling step in nanometers
+/// @param components The vectors to store the components into
+void daylight_components( int step, vector<double> components[3] )
+{
+    int wavelength_range = s_series[53].wl - s_series[0].wl;
+    assert( wavelength_range % step == 0 );
+
+    vector<int>    wavelengths, wavelengths_interpolated;
+    vector<double> s00, s10, s20;
 
     for ( int i = 0; i < countSize( s_series ); i++ )
     {
@@ -84,20 +101,44 @@ void calculate_daylight_SPD( const int &cct_input, Spectrum &spectrum )
         wavelengths_interpolated.push_back( s_series[0].wl + step * i );
     }
 
-    s01 = interp1DLinear( wavelengths, wavelengths_interpolated, s00 );
-    s11 = interp1DLinear( wavelengths, wavelengths_interpolated, s10 );
-    s21 = interp1DLinear( wavelengths, wavelengths_interpolated, s20 );
+    vector<double> s01 =
+        interp1DLinear( wavelengths, wavelengths_interpolated, s00 );
+    vector<double> s11 =
+        interp1DLinear( wavelengths, wavelengths_interpolated, s10 );
+    vector<double> s21 =
+        interp1DLinear( wavelengths, wavelengths_interpolated, s20 );
+
+    for ( int k = 0; k < 3; k++ )
+        components[k].clear();
 
     for ( int i = 0; i < num_wavelengths; i++ )
     {
         int wavelength = s_series[0].wl + step * i;
         if ( wavelength >= 380 && wavelength <= 780 )
         {
-            spectrum.values.push_back( s01[i] + m1 * s11[i] + m2 * s21[i] );
+            components[0].push_back( s01[i] );
+            components[1].push_back( s11[i] );
+            components[2].push_back( s21[i] );
         }
     }
 }
 
+void calculate_daylight_SPD( const int &cct_input, Spectrum &spectrum )
+{
+    double m1, m2;
+    daylight_weights( cct_input, m1, m2 );
+
+    vector<double> components[3];
+    daylight_components( static_cast<int>( spectrum.shape.step ), components );
+
+    spectrum.values.clear();
+    for ( size_t i = 0; i < components[0].size(); i++ )
+    {
+        spectrum.values.push_back(
+            components[0][i] + m1 * components[1][i] + m2 * components[2][i] );
+    }
+}
+
 void calculate_blackbody_SPD( const int &cct, Spectrum &spectrum )
 {
     if ( cct < 1500 || cct >= 4000 )
@@ -176,6 +217,13 @@ SpectralSolver::SpectralSolver(
     }
 }
 
+SpectralSolver::SpectralSolver(
+    std::shared_ptr<const SpectralDatabase> database )
+    : SpectralSolver( database->directories() )
+{
+    _database = database;
+}
+
 /// Scale the illuminant (Light Source) to camera sensitivity data using the maximum RGB channel.
 /// This function normalizes the illuminant spectral data by scaling it based on the camera's
 /// most sensitive RGB channel. The scaling ensures proper integration between camera sensitivity
@@ -186,24 +234,43 @@ SpectralSolver::SpectralSolver(
 /// @pre camera contains valid RGB channel data and illuminant contains power spectrum data
 void scale_illuminant( const SpectralData &camera, SpectralData &illuminant )
 {
-    double max_R = camera["R"].max();
-    double max_G = camera["G"].max();
-    double max_B = camera["B"].max();
+    scale_illuminant(
+        channel_triplet( camera, SpectralData::R ),
+        illuminant[SpectralData::Power] );
+}
+
+ChannelTriplet
+channel_triplet( const SpectralData &data, SpectralData::Channel first )
+{
+    ChannelTriplet result;
+    for ( int i = 0; i < 3; i++ )
+        result[i] = &data[static_cast<SpectralData::Channel>( first + i )];
+    return result;
+}
+
+/// Scale the power of an illuminant to the most sensitive channel of a
+/// camera, the same as above, using the channels found in advance.
+///
+/// @param camera the R, G and B channels of the camera
+/// @param power the power of the illuminant to scale
+void scale_illuminant( const ChannelTriplet &camera, Spectrum &power )
+{
+    double max_R = camera[0]->max();
+    double max_G = camera[1]->max();
+    double max_B = camera[2]->max();
 
-    std::string max_channel;
+    size_t max_channel;
 
     if ( max_R >= max_G && max_R >= max_B )
-        max_channel = "R";
+        max_channel = 0;
     else if ( max_G >= max_R && max_G >= max_B )
-        max_channel = "G";
+        max_channel = 1;
     else
-        max_channel = "B";
+        max_channel = 2;
 
-    const Spectrum &camera_spectrum     = camera[max_channel];
-    Spectrum       &illuminant_spectrum = illuminant["power"];
-
-    double scale = 1.0 / ( camera_spectrum * illuminant_spectrum ).integrate();
-    illuminant_spectrum *= scale;
+    double scale = 1.0 / dot( *camera[max_channel], power );
+    for ( auto &value: power.values )
+        value *= scale;
 }
 
 /// Check if two strings are not equal, ignoring case differences.
@@ -263,6 +330,15 @@ bool SpectralSolver::load_spectral_data(
     {
         return out_data.load( file_path );
     }
+    else if ( _database )
+    {
+        auto data = _database->find_file( file_path );
+        if ( !data )
+            return false;
+
+        out_data = *data;
+        return true;
+    }
     else
     {
         for ( const auto &directory: _search_directories )
@@ -286,17 +362,29 @@ bool SpectralSolver::find_camera(
     assert( !make.empty() );
     assert( !model.empty() );
 
+    if ( _database )
+    {
+        auto data = _database->find_camera( make, model );
+        if ( !data )
+            return false;
+
+        camera = *data;
+        return true;
+    }
+
     auto camera_files = collect_data_files( "camera" );
 
+    // Only the headers get read until the camera is found.
     for ( const auto &camera_file: camera_files )
     {
-        camera.load( camera_file );
-
+        if ( !camera.load_header( camera_file ) )
+            continue;
         if ( is_not_equal_insensitive( camera.manufacturer, make ) )
             continue;
         if ( is_not_equal_insensitive( camera.model, model ) )
             continue;
-        return true;
+        if ( camera.load( camera_file ) )
+            return true;
     }
     return false;
 }
@@ -327,80 +415,322 @@ bool SpectralSolver::find_illuminant( const std::string &type )
         generate_illuminant( cct, illuminant_type, false, illuminant );
         return true;
     }
+    else if ( _database )
+    {
+        auto data = _database->find_illuminant( type );
+        if ( data )
+        {
+            illuminant = *data;
+            return true;
+        }
+    }
     else
     {
         auto illuminant_files = collect_data_files( "illuminant" );
 
         for ( const auto &illuminant_file: illuminant_files )
         {
-            if ( !illuminant.load( illuminant_file ) )
+            if ( !illuminant.load_header( illuminant_file ) )
                 continue;
             if ( is_not_equal_insensitive( illuminant.type, type ) )
                 continue;
-            return true;
+            if ( illuminant.load( illuminant_file ) )
+                return true;
         }
     }
 
     return false;
 }
 
-bool SpectralSolver::find_illuminant( const vector<double> &wb )
+/// Get the name of a daylight illuminant of a white balance search. The
+/// temperatures not divisible by 100K keep all digits, like "d5525", which
+/// `SpectralSolver::find_illuminant()` reads back as the same temperature.
+std::string daylight_type( int cct )
 {
-    if ( camera.data.count( "main" ) == 0 ||
-         camera.data.at( "main" ).size() != 3 )
+    if ( cct % 100 == 0 )
+        return "d" + std::to_string( cct / 100 );
+    return "d" + std::to_string( cct );
+}
+
+/// Check if a spectrum can be copied into a `ReferenceSpectrum`, which
+/// throws for any other shape.
+bool is_reference_spectrum( const Spectrum *spectrum )
+{
+    return spectrum != nullptr && spectrum->shape == ReferenceSpectrum::shape &&
+           spectrum->values.size() == ReferenceSpectrum::Size;
+}
+
+/// Check if all channels have been found.
+bool is_complete( const ChannelTriplet &channels )
+{
+    return std::find( channels.begin(), channels.end(), nullptr ) ==
+           channels.end();
+}
+
+void SpectralSolver::find_channels()
+{
+    for ( int i = 0; i < 3; i++ )
     {
-        std::cerr << "ERROR: camera needs to be initialised prior to calling "
-                  << "SpectralSolver::find_illuminant()" << std::endl;
-        return false;
+        _camera_channels[i] = camera.find_channel(
+            static_cast<SpectralData::Channel>( SpectralData::R + i ) );
+        _observer_channels[i] = observer.find_channel(
+            static_cast<SpectralData::Channel>( SpectralData::X + i ) );
     }
+    _illuminant_power = illuminant.find_channel( SpectralData::Power );
+}
 
-    if ( _all_illuminants.empty() )
+bool SpectralSolver::are_channels_current() const
+{
+    for ( int i = 0; i < 3; i++ )
+    {
+        if ( _camera_channels[i] !=
+                 camera.find_channel( static_cast<SpectralData::Channel>(
+                     SpectralData::R + i ) ) ||
+             _observer_channels[i] !=
+                 observer.find_channel( static_cast<SpectralData::Channel>(
+                     SpectralData::X + i ) ) )
+            return false;
+    }
+    return _illuminant_power == illuminant.find_channel( SpectralData::Power );
+}
+
+bool SpectralSolver::update_wb_locus()
+{
+    assert( are_channels_current() );
+
+    for ( auto *channel: _camera_channels )
     {
-        // Daylight - pre-calculate
-        for ( int cct = 4000; cct <= 25000; cct += 500 )
+        if ( !is_reference_spectrum( channel ) )
         {
-            SpectralData     &illuminant_data = _all_illuminants.emplace_back();
-            const std::string type = "d" + std::to_string( cct / 100 );
-            generate_illuminant( cct, type, true, illuminant_data );
+            std::cerr << "ERROR: The camera data of " << camera.manufacturer
+                      << " " << camera.model << " needs to be sampled at "
+                      << "380-780nm with 5nm step." << std::endl;
+            return false;
         }
+    }
 
-        // Blackbody - pre-calculate
-        for ( int cct = 1500; cct < 4000; cct += 500 )
+    const ReferenceSpectrum channels[3] = {
+        ReferenceSpectrum( *_camera_channels[0] ),
+        ReferenceSpectrum( *_camera_channels[1] ),
+        ReferenceSpectrum( *_camera_channels[2] )
+    };
+
+    bool is_same_camera = _wb_locus_step == illuminant_cct_step;
+    for ( int c = 0; c < 3 && is_same_camera; c++ )
+        is_same_camera = _wb_locus_camera[c].values == channels[c].values;
+    if ( is_same_camera )
+        return true;
+
+    if ( !_stored_loaded )
+    {
+        if ( _database )
         {
-            SpectralData     &illuminant_data = _all_illuminants.emplace_back();
-            const std::string type            = std::to_string( cct ) + "k";
-            generate_illuminant( cct, type, false, illuminant_data );
+            _stored_illuminants = _database->load_illuminants();
         }
+        else
+        {
+            auto illuminant_files = collect_data_files( "illuminant" );
 
-        auto illuminant_files = collect_data_files( "illuminant" );
+            for ( const auto &illuminant_file: illuminant_files )
+            {
+                auto illuminant_data = std::make_shared<SpectralData>();
+                if ( illuminant_data->load( illuminant_file ) )
+                    _stored_illuminants.push_back( illuminant_data );
+            }
+        }
 
-        for ( const auto &illuminant_file: illuminant_files )
+        // The illuminants sampled differently get skipped.
+        for ( auto &stored: _stored_illuminants )
         {
-            SpectralData &illuminant_data = _all_illuminants.emplace_back();
-            if ( !illuminant_data.load( illuminant_file ) )
+            const Spectrum *power = stored->find_channel( SpectralData::Power );
+            if ( !is_reference_spectrum( power ) )
             {
-                _all_illuminants.pop_back();
-                continue;
+                power = nullptr;
+                if ( verbosity > 0 )
+                    std::cerr << "Warning: Skipping the illuminant '"
+                              << stored->type << "', which is not sampled "
+                              << "at 380-780nm with 5nm step." << std::endl;
             }
+            _stored_powers.push_back( power );
+        }
+        _stored_loaded = true;
+    }
+
+    _wb_locus.clear();
+
+    // The white balance multipliers only depend on the ratios of the channel
+    // responses, so the illuminants don't need scaling here.
+    auto add_entry = [this]( LocusEntry::Kind kind,
+                             int              value,
+                             const double     response[3] ) {
+        LocusEntry &entry = _wb_locus.emplace_back();
+        entry.kind        = kind;
+        entry.value       = value;
+        entry.WB[0]       = response[1] / response[0];
+        entry.WB[1]       = 1.0;
+        entry.WB[2]       = response[1] / response[2];
+    };
+
+    // Daylight - a daylight SPD is a weighted sum of three components, so
+    // the responses to the components are all needed per camera.
+    vector<double> component_samples[3];
+    daylight_components(
+        static_cast<int>( ReferenceSpectrum::shape.step ), component_samples );
+
+    ReferenceSpectrum components[3];
+    for ( int k = 0; k < 3; k++ )
+    {
+        assert( component_samples[k].size() == ReferenceSpectrum::Size );
+        std::copy(
+            component_samples[k].begin(),
+            component_samples[k].end(),
+            components[k].values.begin() );
+    }
+
+    double component_responses[3][3];
+    for ( int c = 0; c < 3; c++ )
+        for ( int k = 0; k < 3; k++ )
+            component_responses[c][k] = dot( channels[c], components[k] );
+
+    for ( int cct = 4000; cct <= 25000; cct += illuminant_cct_step )
+    {
+        double m1, m2;
+        daylight_weights( cct, m1, m2 );
+
+        double response[3];
+        for ( int c = 0; c < 3; c++ )
+            response[c] = component_responses[c][0] +
+                          m1 * component_responses[c][1] +
+                          m2 * component_responses[c][2];
+        add_entry( LocusEntry::Kind::Daylight, cct, response );
+    }
+
+    // Blackbody
+    Spectrum blackbody( 0, ReferenceSpectrum::shape );
+    for ( int cct = 1500; cct < 4000; cct += illuminant_cct_step )
+    {
+        calculate_blackbody_SPD( cct, blackbody );
+        const ReferenceSpectrum power( blackbody );
+
+        double response[3];
+        for ( int c = 0; c < 3; c++ )
+            response[c] = dot( channels[c], power );
+        add_entry( LocusEntry::Kind::Blackbody, cct, response );
+    }
+
+    // Stored in the database
+    for ( size_t i = 0; i < _stored_powers.size(); i++ )
+    {
+        if ( _stored_powers[i] == nullptr )
+            continue;
+
+        const ReferenceSpectrum power( *_stored_powers[i] );
+
+        double response[3];
+        for ( int c = 0; c < 3; c++ )
+            response[c] = dot( channels[c], power );
+        add_entry( LocusEntry::Kind::Stored, static_cast<int>( i ), response );
+    }
+
+    for ( int c = 0; c < 3; c++ )
+        _wb_locus_camera[c] = channels[c];
+    _wb_locus_step = illuminant_cct_step;
+    return true;
+}
+
+bool SpectralSolver::find_illuminant( const vector<double> &wb )
+{
+    find_channels();
+
+    if ( camera.data.count( "main" ) == 0 ||
+         camera.data.at( "main" ).size() != 3 ||
+         !is_complete( _camera_channels ) )
+    {
+        std::cerr << "ERROR: camera needs to be initialised prior to calling "
+                  << "SpectralSolver::find_illuminant()" << std::endl;
+        return false;
+    }
+
+    if ( illuminant_cct_step <= 0 )
+    {
+        std::cerr << "ERROR: The illuminant colour temperature step has to "
+                  << "be positive, got " << illuminant_cct_step << "."
+                  << std::endl;
+        return false;
+    }
+
+    assert( wb.size() == 3 );
+
+    // The search divides by the multipliers, which would make every
+    // candidate match equally badly.
+    for ( size_t i = 0; i < 3; i++ )
+    {
+        if ( !std::isfinite( wb[i] ) || wb[i] <= 0 )
+        {
+            std::cerr << "ERROR: The white balance multipliers have to be "
+                      << "positive and finite, got " << wb[0] << ", "
+                      << wb[1] << ", " << wb[2] << "." << std::endl;
+            return false;
         }
     }
 
+    if ( !update_wb_locus() )
+        return false;
+
     // SSE: Sum of Squared Errors
-    double sse = max_double_value;
+    double            sse  = max_double_value;
+    const LocusEntry *best = nullptr;
 
-    for ( auto &current_illuminant: _all_illuminants )
+    for ( const auto &entry: _wb_locus )
     {
-        vector<double> wb_tmp  = _calculate_WB( camera, current_illuminant );
-        double         sse_tmp = calculate_SSE( wb_tmp, wb );
+        double sse_tmp = 0;
+        for ( size_t i = 0; i < 3; i++ )
+        {
+            double error = entry.WB[i] / wb[i] - 1.0;
+            sse_tmp += error * error;
+        }
 
         if ( sse_tmp < sse )
         {
-            sse             = sse_tmp;
-            illuminant      = current_illuminant;
-            _wb_multipliers = wb_tmp;
+            sse  = sse_tmp;
+            best = &entry;
         }
     }
 
+    if ( best == nullptr )
+    {
+        std::cerr << "ERROR: No illuminant matches the white balance "
+                  << "multipliers " << wb[0] << ", " << wb[1] << ", " << wb[2]
+                  << "." << std::endl;
+        return false;
+    }
+
+    // Only the best match gets generated, or copied from the database.
+    illuminant = SpectralData();
+    switch ( best->kind )
+    {
+        case LocusEntry::Kind::Daylight:
+            generate_illuminant(
+                best->value, daylight_type( best->value ), true, illuminant );
+            break;
+        case LocusEntry::Kind::Blackbody:
+            generate_illuminant(
+                best->value,
+                std::to_string( best->value ) + "k",
+                false,
+                illuminant );
+            break;
+        case LocusEntry::Kind::Stored:
+            illuminant = *_stored_illuminants[best->value];
+            break;
+    }
+    _illuminant_power = illuminant.find_channel( SpectralData::Power );
+    assert( _illuminant_power != nullptr );
+    assert( are_channels_current() );
+
+    scale_illuminant( _camera_channels, *_illuminant_power );
+    _wb_multipliers.assign( best->WB, best->WB + 3 );
+
     if ( verbosity > 1 )
         std::cerr << "The illuminant calculated to be the best match to the "
                   << "camera metadata is '" << illuminant.type << "'."
@@ -411,8 +741,11 @@ bool SpectralSolver::find_illuminant( const vector<double> &wb )
 
 bool SpectralSolver::calculate_WB()
 {
+    find_channels();
+
     if ( camera.data.count( "main" ) == 0 ||
-         camera.data.at( "main" ).size() != 3 )
+         camera.data.at( "main" ).size() != 3 ||
+         !is_complete( _camera_channels ) )
     {
         std::cerr << "ERROR: camera needs to be initialised prior to calling "
                   << "SpectralSolver::calculate_WB()" << std::endl;
@@ -420,14 +753,14 @@ bool SpectralSolver::calculate_WB()
     }
 
     if ( illuminant.data.count( "main" ) == 0 ||
-         illuminant.data.at( "main" ).size() != 1 )
+         illuminant.data.at( "main" ).size() != 1 || !_illuminant_power )
     {
         std::cerr << "ERROR: illuminant needs to be initialised prior to "
                   << "calling SpectralSolver::calculate_WB()" << std::endl;
         return false;
     }
 
-    _wb_multipliers = _calculate_WB( camera, illuminant );
+    _wb_multipliers = _calculate_WB( _camera_channels, *_illuminant_power );
     return true;
 }
 
@@ -442,14 +775,11 @@ bool SpectralSolver::calculate_WB()
 std::vector<double>
 calculate_CM( const SpectralData &camera, const SpectralData &illuminant )
 {
-    const Spectrum &camera_r            = camera["R"];
-    const Spectrum &camera_g            = camera["G"];
-    const Spectrum &camera_b            = camera["B"];
-    const Spectrum &illuminant_spectrum = illuminant["power"];
+    const Spectrum &illuminant_spectrum = illuminant[SpectralData::Power];
 
-    double r = ( camera_r * illuminant_spectrum ).integrate();
-    double g = ( camera_g * illuminant_spectrum ).integrate();
-    double b = ( camera_b * illuminant_spectrum ).integrate();
+    double r = dot( camera[SpectralData::R], illuminant_spectrum );
+    double g = dot( camera[SpectralData::G], illuminant_spectrum );
+    double b = dot( camera[SpectralData::B], illuminant_spectrum );
 
     double max = std::max( { r, g, b } );
 
@@ -473,7 +803,7 @@ std::vector<Spectrum> calculate_TI(
 {
     std::vector<Spectrum> result;
 
-    const Spectrum &illuminant_spectrum = illuminant["power"];
+    const Spectrum &illuminant_spectrum = illuminant[SpectralData::Power];
     for ( auto &[name, training_spectrum]: training_data.data.at( "main" ) )
     {
         result.push_back( training_spectrum * illuminant_spectrum );
@@ -495,22 +825,149 @@ std::vector<Spectrum> calculate_TI(
 std::vector<double>
 _calculate_WB( const SpectralData &camera, SpectralData &illuminant )
 {
-    scale_illuminant( camera, illuminant );
+    return _calculate_WB(
+        channel_triplet( camera, SpectralData::R ),
+        illuminant[SpectralData::Power] );
+}
 
-    const Spectrum &camera_r            = camera["R"];
-    const Spectrum &camera_g            = camera["G"];
-    const Spectrum &camera_b            = camera["B"];
-    const Spectrum &illuminant_spectrum = illuminant["power"];
+/// Calculate white balance multipliers, the same as above, using the
+/// channels found in advance.
+///
+/// @param camera the R, G and B channels of the camera
+/// @param power the power of the illuminant, scaled in-place
+/// @return the white balance multipliers [R, G, B], normalized to green
+std::vector<double>
+_calculate_WB( const ChannelTriplet &camera, Spectrum &power )
+{
+    scale_illuminant( camera, power );
 
-    double r = ( camera_r * illuminant_spectrum ).integrate();
-    double g = ( camera_g * illuminant_spectrum ).integrate();
-    double b = ( camera_b * illuminant_spectrum ).integrate();
+    double r = dot( *camera[0], power );
+    double g = dot( *camera[1], power );
+    double b = dot( *camera[2], power );
 
     // Normalise to the green channel.
     std::vector<double> wb = { g / r, 1.0, g / b };
     return wb;
 }
 
+/// Wrap the samples of a spectral curve into a row vector, without copying.
+Eigen::Map<const Eigen::RowVectorXd> as_row( const vector<double> &values )
+{
+    return Eigen::Map<const Eigen::RowVectorXd>( values.data(), values.size() );
+}
+
+SpectralMatrix spectral_matrix( const ChannelTriplet &channels )
+{
+    SpectralMatrix result( channels.size(), channels[0]->values.size() );
+    for ( size_t i = 0; i < channels.size(); i++ )
+    {
+        const vector<double> &values = channels[i]->values;
+        assert( values.size() == static_cast<size_t>( result.cols() ) );
+        result.row( i ) = as_row( values );
+    }
+    return result;
+}
+
+SpectralMatrix spectral_matrix( const std::vector<Spectrum> &spectra )
+{
+    assert( !spectra.empty() );
+
+    SpectralMatrix result( spectra.size(), spectra[0].values.size() );
+    for ( size_t i = 0; i < spectra.size(); i++ )
+    {
+        const vector<double> &values = spectra[i].values;
+        assert( values.size() == static_cast<size_t>( result.cols() ) );
+        result.row( i ) = as_row( values );
+    }
+    return result;
+}
+
+SpectralMatrix spectral_matrix( const SpectralData::SpectralSet &set )
+{
+    assert( !set.empty() );
+
+    SpectralMatrix result( set.size(), set[0].second.values.size() );
+    for ( size_t i = 0; i < set.size(); i++ )
+    {
+        const vector<double> &values = set[i].second.values;
+        assert( values.size() == static_cast<size_t>( result.cols() ) );
+        result.row( i ) = as_row( values );
+    }
+    return result;
+}
+
+/// Multiply the spectral curves by the power of an illuminant, per sample.
+/// @param spectra the spectral curves, one per row
+/// @param power the power of the illuminant
+/// @return the weighted spectral curves
+SpectralMatrix
+weight_by_illuminant( SpectralMatrix spectra, const Spectrum &power )
+{
+    assert( power.values.size() == static_cast<size_t>( spectra.cols() ) );
+
+    spectra.array().rowwise() *= as_row( power.values ).array();
+    return spectra;
+}
+
+/// Multiply the spectral curves of the patches by the projection matrix in
+/// a single matrix product, integrating all patches under all channels.
+/// @param patches the spectral curves of the patches, one per row
+/// @param projection the projection matrix, one row per sample and one
+/// column per output channel
+/// @return the integrated values, one row per patch
+std::vector<std::vector<double>> project_patches(
+    const SpectralMatrix &patches, const Eigen::MatrixXd &projection )
+{
+    Eigen::MatrixXd product = patches * projection;
+
+    std::vector<std::vector<double>> result(
+        product.rows(), std::vector<double>( product.cols() ) );
+    for ( Eigen::Index i = 0; i < product.rows(); i++ )
+        for ( Eigen::Index j = 0; j < product.cols(); j++ )
+            result[i][j] = product( i, j );
+    return result;
+}
+
+/// Build the matrix projecting the spectral curves of the patches onto the
+/// CIE XYZ values, normalised to the luminance of the illuminant and adapted
+/// to the ACES white point.
+/// @param observer the colour matching functions, one per row
+/// @param white the XYZ values of the illuminant, not normalised
+/// @return the projection matrix, one row per sample
+Eigen::MatrixXd
+XYZ_projection( const SpectralMatrix &observer, const Eigen::Vector3d &white )
+{
+    std::vector<double> reference_white_point(
+        ACES_white_point_XYZ, ACES_white_point_XYZ + 3 );
+    std::vector<double> source_white_point = { white[0] / white[1],
+                                               1.0,
+                                               white[2] / white[1] };
+
+    auto CAT = calculate_CAT( source_white_point, reference_white_point );
+
+    Eigen::Matrix3d transform;
+    for ( int i = 0; i < 3; i++ )
+        for ( int j = 0; j < 3; j++ )
+            transform( i, j ) = CAT[j][i] / white[1];
+
+    return observer.transpose() * transform;
+}
+
+/// Build the matrix projecting the spectral curves of the patches onto the
+/// white-balanced camera RGB values.
+/// @param camera the camera sensitivities, one per row
+/// @param WB_multipliers the white balance multipliers
+/// @return the projection matrix, one row per sample
+Eigen::MatrixXd RGB_projection(
+    const SpectralMatrix &camera, const std::vector<double> &WB_multipliers )
+{
+    assert( WB_multipliers.size() == 3 );
+
+    Eigen::Vector3d multipliers(
+        WB_multipliers[0], WB_multipliers[1], WB_multipliers[2] );
+    return camera.transpose() * multipliers.asDiagonal();
+}
+
 /// Calculate CIE XYZ tristimulus values from training illuminant data.
 /// This function computes XYZ tristimulus values for each training patch based on
 /// the training illuminant data (TI) and applies color adaptation transformation.
@@ -529,37 +986,59 @@ std::vector<std::vector<double>> calculate_XYZ(
     assert( training_illuminants.size() > 0 );
     assert( training_illuminants[0].values.size() == 81 );
 
-    std::vector<double> reference_white_point(
-        ACES_white_point_XYZ, ACES_white_point_XYZ + 3 );
-    std::vector<std::vector<double>> XYZ;
-
-    const Spectrum &observer_x          = observer["X"];
-    const Spectrum &observer_y          = observer["Y"];
-    const Spectrum &observer_z          = observer["Z"];
-    const Spectrum &illuminant_spectrum = illuminant["power"];
-
-    double scale = 1.0 / ( observer_y * illuminant_spectrum ).integrate();
+    SpectralMatrix observer_matrix =
+        spectral_matrix( channel_triplet( observer, SpectralData::X ) );
+    Eigen::Vector3d white =
+        weight_by_illuminant(
+            observer_matrix, illuminant[SpectralData::Power] )
+            .rowwise()
+            .sum();
+
+    return project_patches(
+        spectral_matrix( training_illuminants ),
+        XYZ_projection( observer_matrix, white ) );
+}
 
-    for ( auto &training_illuminant: training_illuminants )
-    {
-        auto &xyz = XYZ.emplace_back( 3 );
-        xyz[0]    = ( training_illuminant * observer_x ).integrate() * scale;
-        xyz[1]    = ( training_illuminant * observer_y ).integrate() * scale;
-        xyz[2]    = ( training_illuminant * observer_z ).integrate() * scale;
-    }
+/// Calculate CIE XYZ tristimulus values of the training patches lit by an
+/// illuminant. The same as the overload above, but without computing the
+/// intermediate spectra of the lit patches: the illuminant is folded into
+/// the colour matching functions instead, and all patches get projected in
+/// a single matrix product.
+///
+/// @param observer CIE 1931 color matching functions (X, Y, Z)
+/// @param illuminant Illuminant data containing power spectrum information
+/// @param training Training patch reflectances, one per row
+/// @return 2D vector containing XYZ values for each training patch
+std::vector<std::vector<double>> calculate_XYZ(
+    const SpectralData   &observer,
+    const SpectralData   &illuminant,
+    const SpectralMatrix &training )
+{
+    return calculate_XYZ(
+        channel_triplet( observer, SpectralData::X ),
+        illuminant[SpectralData::Power],
+        training );
+}
 
-    std::vector<double> source_white_point( 3 );
-    double              y = ( observer_y * illuminant_spectrum ).integrate();
-    source_white_point[0] =
-        ( observer_x * illuminant_spectrum ).integrate() / y;
-    source_white_point[1] = 1.0;
-    source_white_point[2] =
-        ( observer_z * illuminant_spectrum ).integrate() / y;
+/// Calculate CIE XYZ tristimulus values of the training patches lit by an
+/// illuminant, the same as above, using the channels found in advance.
+///
+/// @param observer the X, Y and Z colour matching functions
+/// @param power the power of the illuminant
+/// @param training Training patch reflectances, one per row
+/// @return 2D vector containing XYZ values for each training patch
+std::vector<std::vector<double>> calculate_XYZ(
+    const ChannelTriplet &observer,
+    const Spectrum       &power,
+    const SpectralMatrix &training )
+{
+    assert( training.rows() > 0 );
 
-    XYZ = mulVector(
-        XYZ, calculate_CAT( source_white_point, reference_white_point ) );
+    SpectralMatrix lit_observer =
+        weight_by_illuminant( spectral_matrix( observer ), power );
+    Eigen::Vector3d white = lit_observer.rowwise().sum();
 
-    return XYZ;
+    return project_patches( training, XYZ_projection( lit_observer, white ) );
 }
 
 /// Calculate white-balanced linearized camera RGB responses from training illuminant data.
@@ -580,23 +1059,58 @@ std::vector<std::vector<double>> calculate_RGB(
     assert( training_illuminants.size() > 0 );
     assert( training_illuminants[0].values.size() == 81 );
 
-    const Spectrum &camera_r = camera["R"];
-    const Spectrum &camera_g = camera["G"];
-    const Spectrum &camera_b = camera["B"];
+    return project_patches(
+        spectral_matrix( training_illuminants ),
+        RGB_projection(
+            spectral_matrix( channel_triplet( camera, SpectralData::R ) ),
+            WB_multipliers ) );
+}
 
-    std::vector<std::vector<double>> RGB;
-    for ( auto &training_illuminant: training_illuminants )
-    {
-        auto &rgb = RGB.emplace_back( 3 );
-        rgb[0] =
-            ( training_illuminant * camera_r ).integrate() * WB_multipliers[0];
-        rgb[1] =
-            ( training_illuminant * camera_g ).integrate() * WB_multipliers[1];
-        rgb[2] =
-            ( training_illuminant * camera_b ).integrate() * WB_multipliers[2];
-    }
+/// Calculate white-balanced linearized camera RGB responses of the training
+/// patches lit by an illuminant. The same as the overload above, but with
+/// the illuminant folded into the camera sensitivities, and all patches
+/// projected in a single matrix product.
+///
+/// @param camera Camera sensitivity data containing RGB spectral information
+/// @param illuminant Illuminant data containing power spectrum information
+/// @param WB_multipliers White balance multipliers from calculate_WB function
+/// @param training Training patch reflectances, one per row
+/// @return 2D vector containing RGB values for each training patch
+std::vector<std::vector<double>> calculate_RGB(
+    const SpectralData        &camera,
+    const SpectralData        &illuminant,
+    const std::vector<double> &WB_multipliers,
+    const SpectralMatrix      &training )
+{
+    return calculate_RGB(
+        channel_triplet( camera, SpectralData::R ),
+        illuminant[SpectralData::Power],
+        WB_multipliers,
+        training );
+}
 
-    return RGB;
+/// Calculate white-balanced linearized camera RGB responses of the training
+/// patches lit by an illuminant, the same as above, using the channels found
+/// in advance.
+///
+/// @param camera the R, G and B channels of the camera
+/// @param power the power of the illuminant
+/// @param WB_multipliers White balance multipliers from calculate_WB function
+/// @param training Training patch reflectances, one per row
+/// @return 2D vector containing RGB values for each training patch
+std::vector<std::vector<double>> calculate_RGB(
+    const ChannelTriplet      &camera,
+    const Spectrum            &power,
+    const std::vector<double> &WB_multipliers,
+    const SpectralMatrix      &training )
+{
+    assert( training.rows() > 0 );
+
+    SpectralMatrix lit_camera =
+        weight_by_illuminant( spectral_matrix( camera ), power );
+
+    return project_patches(
+        training, RGB_projection( lit_camera, WB_multipliers ) );
 }
 
 /// Cost function object for IDT matrix optimization using Ceres solver.
@@ -705,8 +1219,11 @@ bool curveFit(
 
 bool SpectralSolver::calculate_IDT_matrix()
 {
+    find_channels();
+
     if ( camera.data.count( "main" ) == 0 ||
-         camera.data.at( "main" ).size() != 3 )
+         camera.data.at( "main" ).size() != 3 ||
+         !is_complete( _camera_channels ) )
     {
         std::cerr << "ERROR: camera needs to be initialised prior to calling "
                   << "SpectralSolver::calculate_IDT_matrix()" << std::endl;
@@ -714,7 +1231,7 @@ bool SpectralSolver::calculate_IDT_matrix()
     }
 
     if ( illuminant.data.count( "main" ) == 0 ||
-         illuminant.data.at( "main" ).size() != 1 )
+         illuminant.data.at( "main" ).size() != 1 || !_illuminant_power )
     {
         std::cerr << "ERROR: illuminant needs to be initialised prior to "
                   << "calling SpectralSolver::calculate_IDT_matrix()"
@@ -723,7 +1240,8 @@ bool SpectralSolver::calculate_IDT_matrix()
     }
 
     if ( observer.data.count( "main" ) == 0 ||
-         observer.data.at( "main" ).size() != 3 )
+         observer.data.at( "main" ).size() != 3 ||
+         !is_complete( _observer_channels ) )
     {
         std::cerr << "ERROR: observer needs to be initialised prior to calling "
                   << "SpectralSolver::calculate_IDT_matrix()" << std::endl;
@@ -741,9 +1259,13 @@ bool SpectralSolver::calculate_IDT_matrix()
 
     double beta_params_start[6] = { 1.0, 0.0, 0.0, 1.0, 0.0, 0.0 };
 
-    auto TI  = calculate_TI( illuminant, training_data );
-    auto RGB = calculate_RGB( camera, _wb_multipliers, TI );
-    auto XYZ = calculate_XYZ( observer, illuminant, TI );
+    SpectralMatrix training =
+        spectral_matrix( training_data.data.at( "main" ) );
+
+    auto RGB = calculate_RGB(
+        _camera_channels, *_illuminant_power, _wb_multipliers, training );
+    auto XYZ =
+        calculate_XYZ( _observer_channels, *_illuminant_power, training );
 
     return curveFit( RGB, XYZ, beta_params_start, verbosity, _idt_matrix );
 }
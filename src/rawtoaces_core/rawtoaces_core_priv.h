@@ -6,6 +6,8 @@
 // Contains the declarations of the private functions,
 // exposed here for unit-testing.
 
+#include <Eigen/Core>
+
 namespace rta
 {
 namespace core
@@ -15,6 +17,14 @@ std::vector<double> CCT_to_xy( const double &cctd );
 
 void scale_illuminant( const SpectralData &camera, SpectralData &illuminant );
 
+/// Find the three consecutive channels of a data set, starting from `first`,
+/// like R, G and B.
+/// - throws: if any of them is missing, see `SpectralData::operator[]`.
+ChannelTriplet
+channel_triplet( const SpectralData &data, SpectralData::Channel first );
+
+void scale_illuminant( const ChannelTriplet &camera, Spectrum &power );
+
 std::vector<double>
 calculate_CM( const SpectralData &camera, const SpectralData &illuminant );
 
@@ -24,6 +34,24 @@ std::vector<Spectrum> calculate_TI(
 std::vector<double>
 _calculate_WB( const SpectralData &camera, SpectralData &illuminant );
 
+std::vector<double>
+_calculate_WB( const ChannelTriplet &camera, Spectrum &power );
+
+/// Spectral curves stored one per row, one column per sample, so a set of
+/// curves can be integrated against another in a single matrix product.
+typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+    SpectralMatrix;
+
+/// Copy the channels into the rows of a matrix, in the given order.
+SpectralMatrix spectral_matrix( const ChannelTriplet &channels );
+
+/// Copy the spectral curves into the rows of a matrix.
+SpectralMatrix spectral_matrix( const std::vector<Spectrum> &spectra );
+
+/// Copy the channels of a spectral set into the rows of a matrix, in the
+/// order they are stored in.
+SpectralMatrix spectral_matrix( const SpectralData::SpectralSet &set );
+
 std::vector<std::vector<double>> calculate_XYZ(
     const SpectralData          &observer,
     const SpectralData          &illuminant,
@@ -34,6 +62,28 @@ std::vector<std::vector<double>> calculate_RGB(
     const std::vector<double>   &WB_multipliers,
     const std::vector<Spectrum> &TI );
 
+std::vector<std::vector<double>> calculate_XYZ(
+    const SpectralData   &observer,
+    const SpectralData   &illuminant,
+    const SpectralMatrix &training );
+
+std::vector<std::vector<double>> calculate_RGB(
+    const SpectralData        &camera,
+    const SpectralData        &illuminant,
+    const std::vector<double> &WB_multipliers,
+    const SpectralMatrix      &training );
+
+std::vector<std::vector<double>> calculate_XYZ(
+    const ChannelTriplet &observer,
+    const Spectrum       &power,
+    const SpectralMatrix &training );
+
+std::vector<std::vector<double>> calculate_RGB(
+    const ChannelTriplet      &camera,
+    const Spectrum            &power,
+    const std::vector<double> &WB_multipliers,
+    const SpectralMatrix      &training );
+
 bool curveFit(
     const std::vector<std::vector<double>> &RGB,
     const std::vector<std::vector<double>> &XYZ,
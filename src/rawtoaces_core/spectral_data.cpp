@@ -3,9 +3,13 @@
 
 #include <rawtoaces/spectral_data.h>
 
+#include "spectral_kernels.h"
+
 #include <assert.h>
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
 #include <nlohmann/json.hpp>
 
 namespace rta
@@ -81,89 +85,260 @@ Spectrum &Spectrum::operator/=( const Spectrum &rhs )
     return op<Spectrum &>( *this, rhs, std::divides<double>() );
 }
 
-void Spectrum::reshape()
+/// The source samples every sample of the reference shape gets interpolated
+/// from when reshaping a spectrum of the given shape and size.
+struct ReshapePlan
 {
-    if ( shape == ReferenceShape )
-        return;
+    Spectrum::Shape      shape;
+    size_t               size = 0;
+    std::vector<int32_t> lower;
+    std::vector<int32_t> upper;
+    std::vector<double>  ratios;
+};
+
+/// Fill in a plan for reshaping the spectra of `plan.shape` and `plan.size`
+/// into `Spectrum::ReferenceShape`. The samples before the source range copy
+/// the first source sample, the ones after the range copy the last one.
+static void build_plan( ReshapePlan &plan )
+{
+    double wl_src_first = static_cast<double>( plan.shape.first );
+    double wl_src_step  = static_cast<double>( plan.shape.step );
 
-    std::vector<double> temp;
-    size_t              src = 0;
+    double wl_dst_first = static_cast<double>( Spectrum::ReferenceShape.first );
+    double wl_dst_last  = static_cast<double>( Spectrum::ReferenceShape.last );
+    double wl_dst_step  = static_cast<double>( Spectrum::ReferenceShape.step );
 
-    double wl_src_first = static_cast<double>( shape.first );
-    double wl_src_step  = static_cast<double>( shape.step );
+    plan.lower.clear();
+    plan.upper.clear();
+    plan.ratios.clear();
 
-    double wl_dst_first = static_cast<double>( ReferenceShape.first );
-    double wl_dst_last  = static_cast<double>( ReferenceShape.last );
-    double wl_dst_step  = static_cast<double>( ReferenceShape.step );
+    size_t last = plan.size - 1;
+    size_t src  = 0;
 
-    double wl_src = wl_src_first;
     double wl_dst = wl_dst_first;
-
     while ( wl_dst <= wl_dst_last )
     {
-        if ( wl_src < wl_dst )
+        int32_t lower = 0;
+        int32_t upper = 0;
+        double  ratio = 0;
+
+        if ( wl_src_first < wl_dst )
         {
-            if ( src < values.size() - 1 )
+            // Find the last source sample not past the target wavelength,
+            // starting from the one found for the previous target.
+            while ( src < last &&
+                    wl_src_first + wl_src_step * ( src + 1 ) <= wl_dst )
+                src++;
+
+            double wl_src = wl_src_first + wl_src_step * src;
+            lower         = static_cast<int32_t>( src );
+            upper         = lower;
+
+            if ( src < last && wl_src < wl_dst )
             {
+                // The target wavelength is between two source samples,
+                // linearly interpolating.
                 double next_wl_src = wl_src_first + wl_src_step * ( src + 1 );
-                if ( next_wl_src <= wl_dst )
-                {
-                    // The next source wavelength is still not big enough,
-                    // advancing.
-                    src++;
-                    wl_src = next_wl_src;
-                }
-                else
-                {
-                    // The target wavelength is between two source samples,
-                    // linearly interpolating.
-                    double ratio =
-                        ( wl_dst - wl_src ) / ( next_wl_src - wl_src );
-                    double vv =
-                        values[src] * ( 1.0 - ratio ) + values[src + 1] * ratio;
-                    temp.push_back( vv );
-                    wl_dst = wl_dst_first + wl_dst_step * temp.size();
-                }
-            }
-            else
-            {
-                // We have passed all available source samples,
-                // copying the last sample.
-                temp.push_back( values[src] );
-                wl_dst = wl_dst_first + wl_dst_step * temp.size();
+                upper              = lower + 1;
+                ratio = ( wl_dst - wl_src ) / ( next_wl_src - wl_src );
             }
         }
-        else if ( wl_src == wl_dst )
-        {
-            // Found an exact match, just copy it over.
-            temp.push_back( values[src] );
-            wl_dst = wl_dst_first + wl_dst_step * temp.size();
-        }
-        else
-        {
-            // Haven't reached the available source range yet, advancing.
-            temp.push_back( values[src] );
-            wl_dst = wl_dst_first + wl_dst_step * temp.size();
-        }
+
+        plan.lower.push_back( lower );
+        plan.upper.push_back( upper );
+        plan.ratios.push_back( ratio );
+        wl_dst = wl_dst_first + wl_dst_step * plan.lower.size();
+    }
+}
+
+void Spectrum::reshape()
+{
+    if ( shape == ReferenceShape )
+        return;
+
+    if ( values.empty() )
+    {
+        *this = Spectrum( 0, ReferenceShape );
+        return;
     }
 
-    values = temp;
+    // The spectra loaded together usually share the same shape, so the last
+    // plan gets reused.
+    thread_local ReshapePlan plan;
+    if ( !( plan.shape == shape ) || plan.size != values.size() )
+    {
+        plan.shape = shape;
+        plan.size  = values.size();
+        build_plan( plan );
+    }
+
+    std::vector<double> temp( plan.lower.size() );
+    kernels::get_kernels().interpolate(
+        values.data(),
+        plan.lower.data(),
+        plan.upper.data(),
+        plan.ratios.data(),
+        temp.data(),
+        temp.size() );
+
+    values = std::move( temp );
     shape  = ReferenceShape;
 }
 
 double Spectrum::integrate() const
 {
-    double result = 0;
-    for ( auto &v: values )
-        result += v;
-    return result;
+    return kernels::get_kernels().sum( values.data(), values.size() );
 }
 
 double Spectrum::max() const
 {
     if ( values.empty() )
         return 0;
-    return *std::max_element( values.begin(), values.end() );
+    return kernels::get_kernels().max( values.data(), values.size() );
+}
+
+ReferenceSpectrum::ReferenceSpectrum( double value )
+{
+    values.fill( value );
+}
+
+ReferenceSpectrum::ReferenceSpectrum( const Spectrum &spectrum )
+{
+    if ( !( spectrum.shape == shape ) || spectrum.values.size() != Size )
+        throw std::invalid_argument(
+            "The spectrum needs to be sampled at 380-780nm with 5nm step." );
+
+    std::copy( spectrum.values.begin(), spectrum.values.end(), values.begin() );
+}
+
+Spectrum ReferenceSpectrum::to_spectrum() const
+{
+    Spectrum result( 0, shape );
+    std::copy( values.begin(), values.end(), result.values.begin() );
+    return result;
+}
+
+template <typename F>
+static ReferenceSpectrum &
+op( ReferenceSpectrum &lhs, const ReferenceSpectrum &rhs, F func )
+{
+    for ( size_t i = 0; i < ReferenceSpectrum::Size; i++ )
+        lhs.values[i] = func( lhs.values[i], rhs.values[i] );
+    return lhs;
+}
+
+ReferenceSpectrum
+operator+( const ReferenceSpectrum &lhs, const ReferenceSpectrum &rhs )
+{
+    ReferenceSpectrum result = lhs;
+    return op( result, rhs, std::plus<double>() );
+}
+
+ReferenceSpectrum
+operator-( const ReferenceSpectrum &lhs, const ReferenceSpectrum &rhs )
+{
+    ReferenceSpectrum result = lhs;
+    return op( result, rhs, std::minus<double>() );
+}
+
+ReferenceSpectrum
+operator*( const ReferenceSpectrum &lhs, const ReferenceSpectrum &rhs )
+{
+    ReferenceSpectrum result = lhs;
+    return op( result, rhs, std::multiplies<double>() );
+}
+
+ReferenceSpectrum
+operator/( const ReferenceSpectrum &lhs, const ReferenceSpectrum &rhs )
+{
+    ReferenceSpectrum result = lhs;
+    return op( result, rhs, std::divides<double>() );
+}
+
+ReferenceSpectrum &ReferenceSpectrum::operator+=( const ReferenceSpectrum &rhs )
+{
+    return op( *this, rhs, std::plus<double>() );
+}
+
+ReferenceSpectrum &ReferenceSpectrum::operator-=( const ReferenceSpectrum &rhs )
+{
+    return op( *this, rhs, std::minus<double>() );
+}
+
+ReferenceSpectrum &ReferenceSpectrum::operator*=( const ReferenceSpectrum &rhs )
+{
+    return op( *this, rhs, std::multiplies<double>() );
+}
+
+ReferenceSpectrum &ReferenceSpectrum::operator/=( const ReferenceSpectrum &rhs )
+{
+    return op( *this, rhs, std::divides<double>() );
+}
+
+ReferenceSpectrum &ReferenceSpectrum::operator*=( double value )
+{
+    for ( auto &v: values )
+        v *= value;
+    return *this;
+}
+
+double ReferenceSpectrum::integrate() const
+{
+    return kernels::get_kernels().sum( values.data(), Size );
+}
+
+double ReferenceSpectrum::max() const
+{
+    return kernels::get_kernels().max( values.data(), Size );
+}
+
+/// Sum the products of the corresponding samples of two curves.
+static double dot_samples( const double *a, const double *b, size_t size )
+{
+    return kernels::get_kernels().dot( a, b, size );
+}
+
+/// Sum the products of the corresponding samples of three curves.
+static double dot_samples(
+    const double *a, const double *b, const double *c, size_t size )
+{
+    return kernels::get_kernels().dot3( a, b, c, size );
+}
+
+double dot( const Spectrum &a, const Spectrum &b )
+{
+    assert( a.shape == b.shape );
+    assert( a.values.size() == b.values.size() );
+
+    return dot_samples( a.values.data(), b.values.data(), a.values.size() );
+}
+
+double dot( const ReferenceSpectrum &a, const ReferenceSpectrum &b )
+{
+    return dot_samples(
+        a.values.data(), b.values.data(), ReferenceSpectrum::Size );
+}
+
+double dot3( const Spectrum &a, const Spectrum &b, const Spectrum &c )
+{
+    assert( a.shape == b.shape && a.shape == c.shape );
+    assert( a.values.size() == b.values.size() );
+    assert( a.values.size() == c.values.size() );
+
+    return dot_samples(
+        a.values.data(), b.values.data(), c.values.data(), a.values.size() );
+}
+
+double dot3(
+    const ReferenceSpectrum &a,
+    const ReferenceSpectrum &b,
+    const ReferenceSpectrum &c )
+{
+    return dot_samples(
+        a.values.data(),
+        b.values.data(),
+        c.values.data(),
+        ReferenceSpectrum::Size );
 }
 
 inline void
@@ -178,26 +353,187 @@ parse_string( nlohmann::json &j, std::string &dst, const std::string &key )
         dst = v;
 }
 
+namespace
+{
+
+/// Reset all fields of a data set, in case it has been loaded before.
+void reset( SpectralData &data )
+{
+    data.manufacturer.erase();
+    data.model.erase();
+    data.type.erase();
+    data.description.erase();
+    data.document_creator.erase();
+    data.unique_identifier.erase();
+    data.measurement_equipment.erase();
+    data.laboratory.erase();
+    data.creation_date.erase();
+    data.comments.erase();
+    data.license.erase();
+    data.units.erase();
+    data.reflection_geometry.erase();
+    data.transmission_geometry.erase();
+    data.bandwidth_FWHM.erase();
+    data.bandwidth_corrected.erase();
+    data.data.clear();
+}
+
+/// Parse the fields of the `header` object of a data file.
+void parse_header( nlohmann::json &h, SpectralData &data )
+{
+    parse_string( h, data.manufacturer, "manufacturer" );
+    parse_string( h, data.model, "model" );
+    parse_string( h, data.type, "type" );
+    parse_string( h, data.description, "description" );
+    parse_string( h, data.document_creator, "document_creator" );
+    parse_string( h, data.unique_identifier, "unique_identifier" );
+    parse_string( h, data.measurement_equipment, "measurement_equipment" );
+    parse_string( h, data.laboratory, "laboratory" );
+    parse_string( h, data.creation_date, "document_creation_date" );
+    parse_string( h, data.comments, "comments" );
+    parse_string( h, data.license, "license" );
+
+    // The schema version 1.0.0 replaces 'header/illuminant' with
+    // 'header/type' in the illuminant files. If both are present, the type
+    // takes precedence.
+    if ( data.type.empty() )
+    {
+        std::string schema_version;
+        parse_string( h, schema_version, "schema_version" );
+        if ( schema_version == "0.1.0" )
+        {
+            parse_string( h, data.type, "illuminant" );
+        }
+    }
+}
+
+/// A SAX handler collecting the values of the top-level `header` object of a
+/// data file, which stops the parsing at the end of that object.
+class HeaderReader : public nlohmann::json_sax<nlohmann::json>
+{
+public:
+    /// The values found in the header, only the strings, numbers, booleans
+    /// and nulls are collected.
+    nlohmann::json header = nlohmann::json::object();
+
+    /// The parsing error, if any.
+    std::string error;
+
+    bool null() override { return store( nullptr ); }
+    bool boolean( bool value ) override { return store( value ); }
+    bool number_integer( number_integer_t value ) override
+    {
+        return store( value );
+    }
+    bool number_unsigned( number_unsigned_t value ) override
+    {
+        return store( value );
+    }
+    bool number_float( number_float_t value, const string_t & ) override
+    {
+        return store( value );
+    }
+    bool string( string_t &value ) override { return store( value ); }
+    bool binary( binary_t & ) override { return true; }
+
+    bool start_object( std::size_t ) override
+    {
+        _depth++;
+        return true;
+    }
+
+    bool end_object() override
+    {
+        // Returning `false` stops the parser.
+        if ( _depth == 2 && _in_header )
+            return false;
+        _depth--;
+        return true;
+    }
+
+    bool start_array( std::size_t ) override
+    {
+        _depth++;
+        return true;
+    }
+
+    bool end_array() override
+    {
+        _depth--;
+        return true;
+    }
+
+    bool key( string_t &value ) override
+    {
+        if ( _depth == 1 )
+            _in_header = value == "header";
+        else if ( _depth == 2 )
+            _key = value;
+        return true;
+    }
+
+    bool parse_error(
+        std::size_t,
+        const std::string &,
+        const nlohmann::detail::exception &exception ) override
+    {
+        error = exception.what();
+        return false;
+    }
+
+private:
+    template <typename T> bool store( T &&value )
+    {
+        if ( _depth == 2 && _in_header )
+            header[_key] = std::forward<T>( value );
+        return true;
+    }
+
+    int         _depth     = 0;
+    bool        _in_header = false;
+    std::string _key;
+};
+
+} // namespace
+
+bool SpectralData::load_header( const std::string &path )
+{
+    reset( *this );
+
+    std::ifstream i( path );
+    if ( !i.is_open() )
+    {
+        std::cerr << "Error: Failed to open file " << path << "." << std::endl;
+        return false;
+    }
+
+    HeaderReader reader;
+    nlohmann::json::sax_parse( i, &reader );
+    if ( !reader.error.empty() )
+    {
+        std::cerr << "Error: JSON parsing of " << path
+                  << " failed with error: " << reader.error << std::endl;
+        return false;
+    }
+
+    try
+    {
+        parse_header( reader.header, *this );
+    }
+    catch ( const std::exception &error )
+    {
+        std::cerr << "Error: JSON parsing of " << path
+                  << " failed with error: " << error.what() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
 bool SpectralData::load( const std::string &path, bool reshape )
 {
     // Reset all in case the object has been initialised before.
-    manufacturer.erase();
-    model.erase();
-    type.erase();
-    description.erase();
-    document_creator.erase();
-    unique_identifier.erase();
-    measurement_equipment.erase();
-    laboratory.erase();
-    creation_date.erase();
-    comments.erase();
-    license.erase();
-    units.erase();
-    reflection_geometry.erase();
-    transmission_geometry.erase();
-    bandwidth_FWHM.erase();
-    bandwidth_corrected.erase();
-    data.clear();
+    reset( *this );
 
     core::Spectrum::Shape shape;
 
@@ -213,30 +549,7 @@ bool SpectralData::load( const std::string &path, bool reshape )
         nlohmann::json file_data = nlohmann::json::parse( i );
 
         nlohmann::json &h = file_data["header"];
-        parse_string( h, manufacturer, "manufacturer" );
-        parse_string( h, model, "model" );
-        parse_string( h, type, "type" );
-        parse_string( h, description, "description" );
-        parse_string( h, document_creator, "document_creator" );
-        parse_string( h, unique_identifier, "unique_identifier" );
-        parse_string( h, measurement_equipment, "measurement_equipment" );
-        parse_string( h, laboratory, "laboratory" );
-        parse_string( h, creation_date, "document_creation_date" );
-        parse_string( h, comments, "comments" );
-        parse_string( h, license, "license" );
-
-        // The schema version 1.0.0 replaces 'header/illuminant' with
-        // 'header/type' in the illuminant files. If both are present, the type
-        // takes precedence.
-        if ( type.empty() )
-        {
-            std::string schema_version;
-            parse_string( h, schema_version, "schema_version" );
-            if ( schema_version == "0.1.0" )
-            {
-                parse_string( h, type, "illuminant" );
-            }
-        }
+        parse_header( h, *this );
 
         nlohmann::json &d = file_data["spectral_data"];
         parse_string( d, units, "units" );
@@ -386,5 +699,62 @@ const Spectrum &SpectralData::operator[]( std::string name ) const
     return get( "main", name );
 }
 
+const char *SpectralData::channel_name( Channel channel )
+{
+    switch ( channel )
+    {
+        case R: return "R";
+        case G: return "G";
+        case B: return "B";
+        case X: return "X";
+        case Y: return "Y";
+        case Z: return "Z";
+        case Power: return "power";
+        default: return "";
+    }
+}
+
+const Spectrum *SpectralData::find_channel( Channel channel ) const
+{
+    assert( channel < ChannelCount );
+
+    auto set = data.find( "main" );
+    if ( set == data.end() )
+        return nullptr;
+
+    const char *name = channel_name( channel );
+    for ( auto &item: set->second )
+    {
+        if ( item.first == name )
+            return &item.second;
+    }
+    return nullptr;
+}
+
+Spectrum *SpectralData::find_channel( Channel channel )
+{
+    const SpectralData &self = *this;
+    return const_cast<Spectrum *>( self.find_channel( channel ) );
+}
+
+bool SpectralData::has_channel( Channel channel ) const
+{
+    return find_channel( channel ) != nullptr;
+}
+
+Spectrum &SpectralData::operator[]( Channel channel )
+{
+    if ( Spectrum *spectrum = find_channel( channel ) )
+        return *spectrum;
+    return get( "main", channel_name( channel ) );
+}
+
+const Spectrum &SpectralData::operator[]( Channel channel ) const
+{
+    if ( const Spectrum *spectrum = find_channel( channel ) )
+        return *spectrum;
+    return get( "main", channel_name( channel ) );
+}
+
 } // namespace core
 } // namespace rta
@@ -0,0 +1,1022 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+#include <rawtoaces/spectral_database.h>
+#include <rawtoaces/rawtoaces_core.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <tuple>
+
+#ifndef WIN32
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+namespace rta
+{
+namespace core
+{
+
+namespace
+{
+
+/// Convert a string to lower case, for the case-insensitive lookups.
+std::string to_lower( std::string value )
+{
+    std::transform(
+        value.begin(), value.end(), value.begin(), []( unsigned char c ) {
+            return static_cast<char>( std::tolower( c ) );
+        } );
+    return value;
+}
+
+/// Make the index key of a camera.
+std::string camera_key( const std::string &make, const std::string &model )
+{
+    return to_lower( make ) + '\n' + to_lower( model );
+}
+
+/// Make the index key of a file path relative to a database directory.
+std::string file_key( const std::string &relative_path )
+{
+    return std::filesystem::path( relative_path )
+        .lexically_normal()
+        .generic_string();
+}
+
+// The layout of the compiled database files. A file starts with the header,
+// followed by the arrays of the records, the spectral values and the
+// strings. All records are plain data with the natural alignment of their
+// members, written in the byte order of the machine compiling the file, so
+// they can be copied out of a mapped file without any parsing. The strings
+// and the values are referenced by their offsets into their pools.
+
+// Increment when the layout of the compiled files changes.
+const uint32_t compiled_version = 1;
+
+const char compiled_magic[8] = { 'R', 'T', 'A', 'S', 'P', 'E', 'C', '\0' };
+const uint32_t compiled_byte_order = 0x01020304;
+
+/// A reference to a string in the string pool.
+struct StringRecord
+{
+    uint64_t offset;
+    uint64_t size;
+};
+
+/// The header at the start of a compiled file.
+struct HeaderRecord
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t file_size;
+    uint64_t directory_count;
+    uint64_t directory_offset;
+    uint64_t source_count;
+    uint64_t source_offset;
+    uint64_t entry_count;
+    uint64_t entry_offset;
+    uint64_t set_count;
+    uint64_t set_offset;
+    uint64_t channel_count;
+    uint64_t channel_offset;
+    uint64_t value_count;
+    uint64_t value_offset;
+    uint64_t string_size;
+    uint64_t string_offset;
+};
+
+/// The state of a source file or directory at the time of compiling.
+struct SourceRecord
+{
+    enum Kind : uint32_t
+    {
+        Missing   = 0,
+        File      = 1,
+        Directory = 2
+    };
+
+    StringRecord path;
+    uint32_t     kind;
+    uint32_t     reserved;
+    uint64_t     size;
+    int64_t      time;
+};
+
+/// The number of the header strings of a `SpectralData`.
+const size_t header_field_count = 16;
+
+/// A data file, indexed by its path relative to the database directory.
+struct EntryRecord
+{
+    StringRecord key;
+    StringRecord type;
+    uint32_t     loaded;
+    uint32_t     reserved;
+    uint64_t     first_set;
+    uint64_t     set_count;
+    StringRecord header[header_field_count];
+};
+
+/// A spectral set of a data file.
+struct SetRecord
+{
+    StringRecord name;
+    uint64_t     first_channel;
+    uint64_t     channel_count;
+};
+
+/// A spectral channel of a set.
+struct ChannelRecord
+{
+    StringRecord name;
+    float        first;
+    float        last;
+    float        step;
+    uint32_t     reserved;
+    uint64_t     first_value;
+    uint64_t     value_count;
+};
+
+static_assert( sizeof( HeaderRecord ) % 8 == 0, "unaligned record" );
+static_assert( sizeof( SourceRecord ) % 8 == 0, "unaligned record" );
+static_assert( sizeof( EntryRecord ) % 8 == 0, "unaligned record" );
+static_assert( sizeof( SetRecord ) % 8 == 0, "unaligned record" );
+static_assert( sizeof( ChannelRecord ) % 8 == 0, "unaligned record" );
+
+/// The header strings of a `SpectralData`, in the order they are stored in.
+const std::array<std::string SpectralData::*, header_field_count>
+    header_fields = { &SpectralData::manufacturer,
+                      &SpectralData::model,
+                      &SpectralData::type,
+                      &SpectralData::description,
+                      &SpectralData::document_creator,
+                      &SpectralData::unique_identifier,
+                      &SpectralData::measurement_equipment,
+                      &SpectralData::laboratory,
+                      &SpectralData::creation_date,
+                      &SpectralData::comments,
+                      &SpectralData::license,
+                      &SpectralData::units,
+                      &SpectralData::reflection_geometry,
+                      &SpectralData::transmission_geometry,
+                      &SpectralData::bandwidth_FWHM,
+                      &SpectralData::bandwidth_corrected };
+
+/// The data types stored in a database directory, in the order they get
+/// loaded in.
+const char *data_types[] = { "camera", "illuminant", "training", "cmf" };
+
+/// Get the current state of a source file or directory.
+SourceRecord get_source_state( const std::string &path )
+{
+    SourceRecord result = {};
+
+    std::error_code error;
+    auto            status = std::filesystem::status( path, error );
+    if ( error || !std::filesystem::exists( status ) )
+    {
+        result.kind = SourceRecord::Missing;
+        return result;
+    }
+
+    if ( std::filesystem::is_directory( status ) )
+    {
+        // The directory times change when the files get added or removed.
+        result.kind = SourceRecord::Directory;
+    }
+    else
+    {
+        result.kind = SourceRecord::File;
+        result.size = std::filesystem::file_size( path, error );
+    }
+
+    result.time = static_cast<int64_t>( std::filesystem::last_write_time(
+                                            path, error )
+                                            .time_since_epoch()
+                                            .count() );
+    return result;
+}
+
+/// The contents of a compiled database file, either mapped into memory, or
+/// read into a buffer where mapping is not available.
+class CompiledFile
+{
+public:
+    CompiledFile()                                 = default;
+    CompiledFile( const CompiledFile & )            = delete;
+    CompiledFile &operator=( const CompiledFile & ) = delete;
+
+    ~CompiledFile()
+    {
+#ifndef WIN32
+        if ( _mapped )
+            munmap( _mapped, _size );
+#endif
+    }
+
+    /// Open the file and map or read its contents.
+    /// @result `false` if the file can not be read.
+    bool open( const std::string &path )
+    {
+#ifndef WIN32
+        int fd = ::open( path.c_str(), O_RDONLY );
+        if ( fd < 0 )
+            return false;
+
+        struct stat info;
+        if ( fstat( fd, &info ) == 0 && info.st_size > 0 )
+        {
+            void *mapped = mmap(
+                nullptr,
+                static_cast<size_t>( info.st_size ),
+                PROT_READ,
+                MAP_PRIVATE,
+                fd,
+                0 );
+            if ( mapped != MAP_FAILED )
+            {
+                _mapped = mapped;
+                _data   = static_cast<const char *>( mapped );
+                _size   = static_cast<size_t>( info.st_size );
+            }
+        }
+        close( fd );
+
+        if ( _mapped )
+            return true;
+#endif
+        std::ifstream stream( path, std::ios::binary );
+        if ( !stream.is_open() )
+            return false;
+        _buffer.assign(
+            std::istreambuf_iterator<char>( stream ),
+            std::istreambuf_iterator<char>() );
+        _data = _buffer.data();
+        _size = _buffer.size();
+        return true;
+    }
+
+    /// Copy a record out of the file.
+    /// @param offset the offset of the first record of the array
+    /// @param index the index of the record in the array
+    /// @param record the variable to copy the record into
+    /// @result `false` if the record is out of the file bounds.
+    template <typename T>
+    bool read( uint64_t offset, uint64_t index, T &record ) const
+    {
+        if ( offset > _size || index >= ( _size - offset ) / sizeof( T ) )
+            return false;
+        std::memcpy(
+            &record, _data + offset + index * sizeof( T ), sizeof( T ) );
+        return true;
+    }
+
+    /// Get a pointer into the file.
+    /// @result `nullptr` if the range is out of the file bounds.
+    const char *at( uint64_t offset, uint64_t size ) const
+    {
+        if ( offset > _size || size > _size - offset )
+            return nullptr;
+        return _data + offset;
+    }
+
+    size_t size() const { return _size; }
+
+private:
+    void             *_mapped = nullptr;
+    const char       *_data   = nullptr;
+    size_t            _size   = 0;
+    std::vector<char> _buffer;
+};
+
+/// Reads the records of a compiled database file, checking them against the
+/// file bounds.
+class CompiledReader
+{
+public:
+    CompiledReader( const CompiledFile &file, const HeaderRecord &header )
+        : _file( file ), _header( header )
+    {}
+
+    bool string( const StringRecord &record, std::string &value ) const
+    {
+        if ( record.offset > _header.string_size ||
+             record.size > _header.string_size - record.offset )
+            return false;
+        const char *data =
+            _file.at( _header.string_offset + record.offset, record.size );
+        if ( !data )
+            return false;
+        value.assign( data, record.size );
+        return true;
+    }
+
+    bool
+    values( const ChannelRecord &record, std::vector<double> &values ) const
+    {
+        if ( record.first_value > _header.value_count ||
+             record.value_count > _header.value_count - record.first_value )
+            return false;
+        const char *data = _file.at(
+            _header.value_offset + record.first_value * sizeof( double ),
+            record.value_count * sizeof( double ) );
+        if ( !data )
+            return false;
+        values.resize( record.value_count );
+        std::memcpy(
+            values.data(), data, record.value_count * sizeof( double ) );
+        return true;
+    }
+
+    /// Read the header strings of a data set.
+    bool header( const EntryRecord &entry, SpectralData &data ) const
+    {
+        for ( size_t i = 0; i < header_field_count; i++ )
+        {
+            if ( !string( entry.header[i], data.*header_fields[i] ) )
+                return false;
+        }
+        return true;
+    }
+
+    /// Read a data set with all its spectral sets and channels.
+    bool data( const EntryRecord &entry, SpectralData &data ) const
+    {
+        if ( !header( entry, data ) )
+            return false;
+
+        for ( uint64_t i = 0; i < entry.set_count; i++ )
+        {
+            SetRecord   set;
+            std::string set_name;
+            if ( !_file.read( _header.set_offset, entry.first_set + i, set ) ||
+                 !string( set.name, set_name ) )
+                return false;
+
+            auto &channels = data.data[set_name];
+            for ( uint64_t j = 0; j < set.channel_count; j++ )
+            {
+                ChannelRecord channel;
+                std::string   channel_name;
+                if ( !_file.read(
+                         _header.channel_offset,
+                         set.first_channel + j,
+                         channel ) ||
+                     !string( channel.name, channel_name ) )
+                    return false;
+
+                Spectrum spectrum( 0, Spectrum::EmptyShape );
+                spectrum.shape = { channel.first, channel.last, channel.step };
+                if ( !values( channel, spectrum.values ) )
+                    return false;
+                channels.emplace_back( channel_name, std::move( spectrum ) );
+            }
+        }
+        return true;
+    }
+
+private:
+    const CompiledFile &_file;
+    const HeaderRecord &_header;
+};
+
+/// Collects the contents of a compiled database file while compiling.
+class CompiledWriter
+{
+public:
+    StringRecord string( const std::string &value )
+    {
+        StringRecord result = { _strings.size(), value.size() };
+        _strings += value;
+        return result;
+    }
+
+    void directory( const std::string &path )
+    {
+        _directories.push_back( string( path ) );
+    }
+
+    void source( const std::string &path )
+    {
+        SourceRecord record = get_source_state( path );
+        record.path         = string( path );
+        _sources.push_back( record );
+    }
+
+    void entry(
+        const std::string  &type,
+        const std::string  &key,
+        const SpectralData *data )
+    {
+        EntryRecord record = {};
+        record.key         = string( key );
+        record.type        = string( type );
+        record.loaded      = data != nullptr;
+        record.first_set   = _sets.size();
+
+        if ( data )
+        {
+            for ( size_t i = 0; i < header_field_count; i++ )
+                record.header[i] = string( data->*header_fields[i] );
+
+            for ( const auto &[set_name, channels]: data->data )
+            {
+                SetRecord set     = {};
+                set.name          = string( set_name );
+                set.first_channel = _channels.size();
+                set.channel_count = channels.size();
+                _sets.push_back( set );
+
+                for ( const auto &[channel_name, spectrum]: channels )
+                {
+                    ChannelRecord channel = {};
+                    channel.name          = string( channel_name );
+                    channel.first         = spectrum.shape.first;
+                    channel.last          = spectrum.shape.last;
+                    channel.step          = spectrum.shape.step;
+                    channel.first_value   = _values.size();
+                    channel.value_count   = spectrum.values.size();
+                    _channels.push_back( channel );
+
+                    _values.insert(
+                        _values.end(),
+                        spectrum.values.begin(),
+                        spectrum.values.end() );
+                }
+            }
+        }
+
+        record.set_count = _sets.size() - record.first_set;
+        _entries.push_back( record );
+    }
+
+    /// Write the collected contents into a stream.
+    /// @result `false` if writing has failed.
+    bool write( std::ostream &stream ) const
+    {
+        HeaderRecord header = {};
+        std::memcpy( header.magic, compiled_magic, sizeof( compiled_magic ) );
+        header.version    = compiled_version;
+        header.byte_order = compiled_byte_order;
+
+        uint64_t offset = sizeof( HeaderRecord );
+        layout(
+            offset,
+            _directories,
+            header.directory_count,
+            header.directory_offset );
+        layout( offset, _sources, header.source_count, header.source_offset );
+        layout( offset, _entries, header.entry_count, header.entry_offset );
+        layout( offset, _sets, header.set_count, header.set_offset );
+        layout(
+            offset, _channels, header.channel_count, header.channel_offset );
+        layout( offset, _values, header.value_count, header.value_offset );
+        header.string_size   = _strings.size();
+        header.string_offset = offset;
+        header.file_size     = offset + _strings.size();
+
+        stream.write(
+            reinterpret_cast<const char *>( &header ), sizeof( header ) );
+        write( stream, _directories );
+        write( stream, _sources );
+        write( stream, _entries );
+        write( stream, _sets );
+        write( stream, _channels );
+        write( stream, _values );
+        stream.write( _strings.data(), _strings.size() );
+        return stream.good();
+    }
+
+private:
+    template <typename T>
+    static void layout(
+        uint64_t             &offset,
+        const std::vector<T> &records,
+        uint64_t             &count,
+        uint64_t             &records_offset )
+    {
+        count          = records.size();
+        records_offset = offset;
+        offset += records.size() * sizeof( T );
+    }
+
+    template <typename T>
+    static void write( std::ostream &stream, const std::vector<T> &records )
+    {
+        stream.write(
+            reinterpret_cast<const char *>( records.data() ),
+            records.size() * sizeof( T ) );
+    }
+
+    std::vector<StringRecord>  _directories;
+    std::vector<SourceRecord>  _sources;
+    std::vector<EntryRecord>   _entries;
+    std::vector<SetRecord>     _sets;
+    std::vector<ChannelRecord> _channels;
+    std::vector<double>        _values;
+    std::string                _strings;
+};
+
+/// Open a compiled database file, read the list of its source directories,
+/// and check whether any of the source files have changed since compiling.
+/// @param path the path of the compiled file
+/// @param file the file to open
+/// @param header the variable to read the header into
+/// @param directories the variable to read the source directories into
+/// @param up_to_date set to `true` if none of the sources have changed
+/// @result an error message if the file is not a valid compiled database,
+/// or an empty string on success.
+std::string open_compiled(
+    const std::string        &path,
+    CompiledFile             &file,
+    HeaderRecord             &header,
+    std::vector<std::string> &directories,
+    bool                     &up_to_date )
+{
+    const std::string prefix = "The compiled spectral database " + path;
+
+    if ( !file.open( path ) || !file.read( 0, 0, header ) ||
+         std::memcmp( header.magic, compiled_magic, sizeof( compiled_magic ) ) )
+        return "Failed to read the compiled spectral database " + path + ".";
+
+    if ( header.version != compiled_version ||
+         header.byte_order != compiled_byte_order )
+        return prefix + " has been compiled by a different version of " +
+               "rawtoaces or on a different platform. Please recompile it " +
+               "with --compile-database.";
+
+    if ( header.file_size != file.size() )
+        return prefix + " is truncated.";
+
+    CompiledReader reader( file, header );
+
+    directories.resize( header.directory_count );
+    for ( uint64_t i = 0; i < header.directory_count; i++ )
+    {
+        StringRecord record;
+        if ( !file.read( header.directory_offset, i, record ) ||
+             !reader.string( record, directories[i] ) )
+            return prefix + " is corrupted.";
+    }
+
+    // Checking the sizes and times of the sources is much cheaper than
+    // hashing their contents, and catches any edits made to the data.
+    up_to_date = true;
+    for ( uint64_t i = 0; i < header.source_count && up_to_date; i++ )
+    {
+        SourceRecord record;
+        std::string  source_path;
+        if ( !file.read( header.source_offset, i, record ) ||
+             !reader.string( record.path, source_path ) )
+            return prefix + " is corrupted.";
+
+        SourceRecord current = get_source_state( source_path );
+        up_to_date = current.kind == record.kind &&
+                     current.time == record.time && current.size == record.size;
+    }
+
+    return "";
+}
+
+/// A compiled database file kept open for the lifetime of the database, so
+/// its entries can be decoded on the first use.
+struct CompiledSource
+{
+    CompiledFile file;
+    HeaderRecord header;
+};
+
+} // namespace
+
+struct SpectralDatabase::Entry
+{
+    /// The path of the file to load the full data from.
+    std::string path;
+
+    /// The compiled file to decode the data from instead, and the record of
+    /// the data in it.
+    std::shared_ptr<const CompiledSource> compiled;
+    EntryRecord                           record = {};
+
+    /// The data loaded on the first use, or `nullptr` if not loaded yet or
+    /// failed to load.
+    DataPtr data;
+
+    /// Guards loading the data.
+    std::once_flag loaded;
+};
+
+SpectralDatabase::SpectralDatabase(
+    const std::vector<std::string> &directories, int verbosity )
+    : _directories( directories )
+{
+    for ( const auto &directory: directories )
+    {
+        std::error_code error;
+        if ( std::filesystem::is_regular_file( directory, error ) )
+            load_compiled( directory, verbosity );
+        else
+            load_directory( directory, verbosity );
+    }
+}
+
+SpectralDatabase::~SpectralDatabase() = default;
+
+void SpectralDatabase::load_directory(
+    const std::string &directory, int verbosity )
+{
+    // The solver provides the same directory scan as used for the lookups
+    // without a database.
+    SpectralSolver scanner( { directory } );
+    scanner.verbosity = verbosity;
+
+    struct File
+    {
+        std::string type;
+        std::string key;
+        std::string path;
+        DataPtr     header;
+    };
+
+    std::vector<File> files;
+    for ( const char *type: data_types )
+    {
+        for ( const auto &path: scanner.collect_data_files( type ) )
+        {
+            std::string key =
+                file_key( std::string( type ) + "/" +
+                          std::filesystem::path( path ).filename().string() );
+            files.push_back( { type, key, path, nullptr } );
+        }
+    }
+
+    // Reading a header is mostly waiting for the file, so the large
+    // databases get read by several threads. The files are still added in
+    // the order they have been found.
+    std::atomic<size_t> next( 0 );
+    auto                read_headers = [&files, &next]() {
+        for ( size_t i = next++; i < files.size(); i = next++ )
+        {
+            auto header = std::make_shared<SpectralData>();
+            if ( header->load_header( files[i].path ) )
+                files[i].header = header;
+        }
+    };
+
+    const size_t files_per_thread = 16;
+    size_t       thread_count     = std::min<size_t>(
+        std::max( 1u, std::thread::hardware_concurrency() ),
+        ( files.size() + files_per_thread - 1 ) / files_per_thread );
+
+    std::vector<std::thread> threads;
+    for ( size_t i = 1; i < thread_count; i++ )
+        threads.emplace_back( read_headers );
+    read_headers();
+    for ( auto &thread: threads )
+        thread.join();
+
+    for ( const auto &file: files )
+        add( file.type, file.key, file.path, file.header );
+}
+
+void SpectralDatabase::load_compiled( const std::string &path, int verbosity )
+{
+    auto                     source = std::make_shared<CompiledSource>();
+    std::vector<std::string> directories;
+    bool                     up_to_date = false;
+
+    std::string error = open_compiled(
+        path, source->file, source->header, directories, up_to_date );
+    if ( !error.empty() )
+    {
+        std::cerr << "Error: " << error << std::endl;
+        return;
+    }
+
+    if ( !up_to_date )
+    {
+        std::cerr << "Warning: The compiled spectral database " << path
+                  << " is out of date, loading the source files instead. "
+                  << "Please recompile it with --compile-database."
+                  << std::endl;
+
+        for ( const auto &directory: directories )
+            load_directory( directory, verbosity );
+        return;
+    }
+
+    // Only the headers get read here, the spectral data stays in the mapped
+    // file until the first lookup of an entry, see `load()`. The entries
+    // only get added once all headers have been read successfully.
+    CompiledReader reader( source->file, source->header );
+
+    struct File
+    {
+        std::string type;
+        std::string key;
+        EntryRecord record;
+        DataPtr     header;
+    };
+
+    std::vector<File> files;
+    for ( uint64_t i = 0; i < source->header.entry_count; i++ )
+    {
+        File file;
+        if ( !source->file.read(
+                 source->header.entry_offset, i, file.record ) ||
+             !reader.string( file.record.key, file.key ) ||
+             !reader.string( file.record.type, file.type ) )
+        {
+            std::cerr << "Error: The compiled spectral database " << path
+                      << " is corrupted." << std::endl;
+            return;
+        }
+
+        if ( file.record.loaded )
+        {
+            auto header = std::make_shared<SpectralData>();
+            if ( !reader.header( file.record, *header ) )
+            {
+                std::cerr << "Error: The compiled spectral database " << path
+                          << " is corrupted." << std::endl;
+                return;
+            }
+            file.header = header;
+        }
+        files.push_back( std::move( file ) );
+    }
+
+    for ( const auto &file: files )
+    {
+        if ( Entry *entry = add( file.type, file.key, path, file.header ) )
+        {
+            entry->compiled = source;
+            entry->record   = file.record;
+        }
+    }
+}
+
+bool SpectralDatabase::check_compiled(
+    const std::string &path, std::vector<std::string> &directories )
+{
+    CompiledFile file;
+    HeaderRecord header;
+    bool         up_to_date = false;
+
+    directories.clear();
+    if ( !open_compiled( path, file, header, directories, up_to_date ).empty() )
+        directories.clear();
+    return up_to_date;
+}
+
+SpectralDatabase::Entry *SpectralDatabase::add(
+    const std::string &type,
+    const std::string &key,
+    const std::string &path,
+    DataPtr            header )
+{
+    if ( !header )
+    {
+        _files.emplace( key, nullptr );
+        return nullptr;
+    }
+
+    auto &entry = _entries.emplace_back( std::make_unique<Entry>() );
+    entry->path = path;
+    _files.emplace( key, entry.get() );
+
+    if ( type == "camera" )
+    {
+        _cameras.push_back( header );
+        _cameras_by_name[camera_key( header->manufacturer, header->model )]
+            .push_back( entry.get() );
+    }
+    else if ( type == "illuminant" )
+    {
+        _illuminants.push_back( header );
+        _illuminant_entries.push_back( entry.get() );
+        _illuminants_by_type[to_lower( header->type )].push_back(
+            entry.get() );
+    }
+    return entry.get();
+}
+
+SpectralDatabase::DataPtr SpectralDatabase::load( Entry &entry ) const
+{
+    std::call_once( entry.loaded, [&entry]() {
+        auto data = std::make_shared<SpectralData>();
+        if ( entry.compiled )
+        {
+            CompiledReader reader(
+                entry.compiled->file, entry.compiled->header );
+            if ( !reader.data( entry.record, *data ) )
+            {
+                std::cerr << "Error: The compiled spectral database "
+                          << entry.path << " is corrupted." << std::endl;
+                return;
+            }
+        }
+        else if ( !data->load( entry.path ) )
+            return;
+
+        entry.data = data;
+    } );
+    return entry.data;
+}
+
+bool SpectralDatabase::compile(
+    const std::vector<std::string> &directories,
+    const std::string              &path,
+    int                             verbosity )
+{
+    CompiledWriter writer;
+
+    for ( const auto &directory: directories )
+    {
+        std::error_code error;
+        if ( std::filesystem::is_regular_file( directory, error ) )
+        {
+            std::cerr << "Error: Can not compile the spectral database from "
+                      << "the compiled database " << directory
+                      << ", please use its source directories instead."
+                      << std::endl;
+            return false;
+        }
+
+        // The absolute paths keep the file usable from any directory.
+        std::string absolute =
+            std::filesystem::absolute( directory, error ).string();
+        if ( error )
+            absolute = directory;
+        writer.directory( absolute );
+
+        SpectralSolver scanner( { absolute } );
+        scanner.verbosity = verbosity;
+
+        for ( const char *type: data_types )
+        {
+            writer.source(
+                ( std::filesystem::path( absolute ) / type ).string() );
+
+            for ( const auto &file_path: scanner.collect_data_files( type ) )
+            {
+                std::string key = file_key(
+                    std::string( type ) + "/" +
+                    std::filesystem::path( file_path ).filename().string() );
+
+                writer.source( file_path );
+
+                SpectralData data;
+                bool         loaded = data.load( file_path );
+                writer.entry( type, key, loaded ? &data : nullptr );
+            }
+        }
+    }
+
+    // Same as the transform cache files, written under a unique temporary
+    // name first, so the other processes never read a partial file.
+    std::ostringstream suffix;
+    suffix << ".tmp"
+           << std::hash<std::thread::id>()( std::this_thread::get_id() )
+           << "_"
+           << std::chrono::steady_clock::now().time_since_epoch().count();
+    std::filesystem::path temp_path = path;
+    temp_path += suffix.str();
+
+    std::error_code error;
+    {
+        std::ofstream stream( temp_path, std::ios::binary );
+        if ( !stream.is_open() || !writer.write( stream ) )
+        {
+            std::cerr << "Error: Failed to write the compiled spectral "
+                      << "database " << temp_path.string() << "." << std::endl;
+            stream.close();
+            std::filesystem::remove( temp_path, error );
+            return false;
+        }
+    }
+
+    std::filesystem::rename( temp_path, path, error );
+    if ( error )
+    {
+        std::cerr << "Error: Failed to write the compiled spectral database "
+                  << path << ": " << error.message() << std::endl;
+        std::filesystem::remove( temp_path, error );
+        return false;
+    }
+
+    return true;
+}
+
+std::shared_ptr<const SpectralDatabase> SpectralDatabase::get(
+    const std::vector<std::string> &directories, int verbosity )
+{
+    static std::mutex mutex;
+    static std::map<
+        std::vector<std::string>,
+        std::shared_ptr<const SpectralDatabase>>
+        databases;
+
+    // Building under the lock makes the concurrent callers wait for the
+    // database instead of building their own copies.
+    std::lock_guard<std::mutex> lock( mutex );
+
+    auto &database = databases[directories];
+    if ( !database )
+        database = std::make_shared<SpectralDatabase>( directories, verbosity );
+    return database;
+}
+
+const std::vector<std::string> &SpectralDatabase::directories() const
+{
+    return _directories;
+}
+
+SpectralDatabase::DataPtr SpectralDatabase::find_camera(
+    const std::string &make, const std::string &model ) const
+{
+    auto iter = _cameras_by_name.find( camera_key( make, model ) );
+    if ( iter == _cameras_by_name.end() )
+        return nullptr;
+
+    // Same as without the database, the files which fail to load are
+    // skipped.
+    for ( auto *entry: iter->second )
+    {
+        if ( auto data = load( *entry ) )
+            return data;
+    }
+    return nullptr;
+}
+
+bool SpectralDatabase::has_camera(
+    const std::string &make, const std::string &model ) const
+{
+    return _cameras_by_name.count( camera_key( make, model ) ) > 0;
+}
+
+SpectralDatabase::DataPtr
+SpectralDatabase::find_illuminant( const std::string &type ) const
+{
+    auto iter = _illuminants_by_type.find( to_lower( type ) );
+    if ( iter == _illuminants_by_type.end() )
+        return nullptr;
+
+    for ( auto *entry: iter->second )
+    {
+        if ( auto data = load( *entry ) )
+            return data;
+    }
+    return nullptr;
+}
+
+SpectralDatabase::DataPtr
+SpectralDatabase::find_file( const std::string &relative_path ) const
+{
+    auto iter = _files.find( file_key( relative_path ) );
+    if ( iter == _files.end() || !iter->second )
+        return nullptr;
+    return load( *iter->second );
+}
+
+const std::vector<SpectralDatabase::DataPtr> &SpectralDatabase::cameras() const
+{
+    return _cameras;
+}
+
+const std::vector<SpectralDatabase::DataPtr> &
+SpectralDatabase::illuminants() const
+{
+    return _illuminants;
+}
+
+std::vector<SpectralDatabase::DataPtr>
+SpectralDatabase::load_illuminants() const
+{
+    std::vector<DataPtr> result;
+    for ( auto *entry: _illuminant_entries )
+    {
+        if ( auto data = load( *entry ) )
+            result.push_back( data );
+    }
+    return result;
+}
+
+} // namespace core
+} // namespace rta
@@ -0,0 +1,635 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+#include "spectral_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined( __x86_64__ ) || defined( _M_X64 )
+#    define RTA_KERNELS_X86
+#    include <immintrin.h>
+#    if defined( _MSC_VER )
+#        include <intrin.h>
+#    endif
+#elif defined( __aarch64__ ) || defined( _M_ARM64 )
+#    define RTA_KERNELS_NEON
+#    include <arm_neon.h>
+#endif
+
+// MSVC allows the intrinsics of any instruction set in any function, while
+// GCC and Clang need the functions using them to be marked.
+#if defined( _MSC_VER ) && !defined( __clang__ )
+#    define RTA_TARGET( isa )
+#else
+#    define RTA_TARGET( isa ) __attribute__( ( target( isa ) ) )
+#endif
+
+// Note: this file is built with floating point contraction disabled, see
+// CMakeLists.txt, as fusing the multiplications and additions into FMA
+// instructions on some paths only would make the results differ.
+
+namespace rta
+{
+namespace core
+{
+namespace kernels
+{
+
+namespace
+{
+
+/// The number of the partial sums all kernels accumulate.
+const size_t Lanes = 8;
+
+/// Copy the last samples, fewer than `Lanes`, into a full block, padding it
+/// with the given value.
+void load_tail(
+    double block[Lanes], const double *values, size_t size, double padding )
+{
+    for ( size_t i = 0; i < Lanes; i++ )
+        block[i] = i < size ? values[i] : padding;
+}
+
+/// Finish a maximum the same way in all kernels. The vector instructions
+/// skip or keep a NaN depending on the order of the operands, so a NaN sample
+/// always makes the maximum NaN, and they pick either zero when comparing
+/// +0 and -0, so a zero maximum is always +0.
+double finish_max( double result, bool has_nan )
+{
+    if ( has_nan )
+        return std::numeric_limits<double>::quiet_NaN();
+    return result == 0 ? 0.0 : result;
+}
+
+// Scalar
+
+/// Combine the partial sums of the lanes, in the order all kernels use:
+/// the lanes 4 apart first, then 2 apart, then the last two.
+double combine( const double lanes[Lanes] )
+{
+    return ( ( lanes[0] + lanes[4] ) + ( lanes[2] + lanes[6] ) ) +
+           ( ( lanes[1] + lanes[5] ) + ( lanes[3] + lanes[7] ) );
+}
+
+double sum_scalar( const double *values, size_t size )
+{
+    double lanes[Lanes] = {};
+    for ( size_t i = 0; i < size; i++ )
+        lanes[i % Lanes] += values[i];
+    return combine( lanes );
+}
+
+double dot_scalar( const double *a, const double *b, size_t size )
+{
+    double lanes[Lanes] = {};
+    for ( size_t i = 0; i < size; i++ )
+        lanes[i % Lanes] += a[i] * b[i];
+    return combine( lanes );
+}
+
+double
+dot3_scalar( const double *a, const double *b, const double *c, size_t size )
+{
+    double lanes[Lanes] = {};
+    for ( size_t i = 0; i < size; i++ )
+        lanes[i % Lanes] += a[i] * b[i] * c[i];
+    return combine( lanes );
+}
+
+double max_scalar( const double *values, size_t size )
+{
+    double result  = values[0];
+    bool   has_nan = false;
+    for ( size_t i = 0; i < size; i++ )
+    {
+        has_nan |= std::isnan( values[i] );
+        result = values[i] > result ? values[i] : result;
+    }
+    return finish_max( result, has_nan );
+}
+
+/// The interpolation is shared by all instruction sets: the gather loads it
+/// would need are slower than the scalar loads on the CPUs measured, and NEON
+/// has none.
+void interpolate_scalar(
+    const double  *values,
+    const int32_t *lower,
+    const int32_t *upper,
+    const double  *ratios,
+    double        *result,
+    size_t         size )
+{
+    for ( size_t i = 0; i < size; i++ )
+        result[i] = values[lower[i]] * ( 1.0 - ratios[i] ) +
+                    values[upper[i]] * ratios[i];
+}
+
+const Kernels scalar_kernels = { InstructionSet::Scalar, "scalar",
+                                 sum_scalar,             dot_scalar,
+                                 dot3_scalar,            max_scalar,
+                                 interpolate_scalar };
+
+#if defined( RTA_KERNELS_X86 )
+
+// GCC reports the undefined registers the intrinsics start from as used
+// uninitialised when inlining them into the functions with a target attribute.
+#    if defined( __GNUC__ ) && !defined( __clang__ )
+#        pragma GCC diagnostic push
+#        pragma GCC diagnostic ignored "-Wuninitialized"
+#        pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#    endif
+
+#    if defined( _MSC_VER )
+
+/// Check whether the OS saves the given register states on context switches.
+bool os_saves( unsigned long long mask )
+{
+    int info[4];
+    __cpuid( info, 1 );
+    bool has_xgetbv = ( info[2] & ( 1 << 27 ) ) != 0;
+    return has_xgetbv && ( _xgetbv( 0 ) & mask ) == mask;
+}
+
+bool cpu_supports_avx2()
+{
+    int info[4];
+    __cpuidex( info, 7, 0 );
+    return ( info[1] & ( 1 << 5 ) ) != 0 && os_saves( 0x6 );
+}
+
+bool cpu_supports_avx512()
+{
+    int info[4];
+    __cpuidex( info, 7, 0 );
+    return ( info[1] & ( 1 << 16 ) ) != 0 && os_saves( 0xe6 );
+}
+
+#    else
+
+bool cpu_supports_avx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports( "avx2" );
+}
+
+bool cpu_supports_avx512()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports( "avx512f" );
+}
+
+#    endif
+
+// AVX2, two registers of 4 lanes
+
+/// Combine the partial sums of the lanes 4 apart, already added together.
+RTA_TARGET( "avx2" ) double combine_quad( __m256d quad )
+{
+    __m128d pair = _mm_add_pd(
+        _mm256_castpd256_pd128( quad ), _mm256_extractf128_pd( quad, 1 ) );
+    __m128d high = _mm_unpackhi_pd( pair, pair );
+    return _mm_cvtsd_f64( pair ) + _mm_cvtsd_f64( high );
+}
+
+RTA_TARGET( "avx2" ) double combine_avx2( __m256d low, __m256d high )
+{
+    return combine_quad( _mm256_add_pd( low, high ) );
+}
+
+RTA_TARGET( "avx2" ) double sum_avx2( const double *values, size_t size )
+{
+    __m256d low  = _mm256_setzero_pd();
+    __m256d high = _mm256_setzero_pd();
+
+    size_t i = 0;
+    for ( ; i + Lanes <= size; i += Lanes )
+    {
+        low  = _mm256_add_pd( low, _mm256_loadu_pd( values + i ) );
+        high = _mm256_add_pd( high, _mm256_loadu_pd( values + i + 4 ) );
+    }
+
+    if ( i < size )
+    {
+        double tail[Lanes];
+        load_tail( tail, values + i, size - i, 0.0 );
+        low  = _mm256_add_pd( low, _mm256_loadu_pd( tail ) );
+        high = _mm256_add_pd( high, _mm256_loadu_pd( tail + 4 ) );
+    }
+
+    return combine_avx2( low, high );
+}
+
+/// Multiply 4 samples of two curves.
+RTA_TARGET( "avx2" ) __m256d product_avx2( const double *a, const double *b )
+{
+    return _mm256_mul_pd( _mm256_loadu_pd( a ), _mm256_loadu_pd( b ) );
+}
+
+/// Multiply 4 samples of three curves.
+RTA_TARGET( "avx2" )
+__m256d product3_avx2( const double *a, const double *b, const double *c )
+{
+    return _mm256_mul_pd( product_avx2( a, b ), _mm256_loadu_pd( c ) );
+}
+
+RTA_TARGET( "avx2" )
+double dot_avx2( const double *a, const double *b, size_t size )
+{
+    __m256d low  = _mm256_setzero_pd();
+    __m256d high = _mm256_setzero_pd();
+
+    size_t i = 0;
+    for ( ; i + Lanes <= size; i += Lanes )
+    {
+        low  = _mm256_add_pd( low, product_avx2( a + i, b + i ) );
+        high = _mm256_add_pd( high, product_avx2( a + i + 4, b + i + 4 ) );
+    }
+
+    if ( i < size )
+    {
+        double tail_a[Lanes], tail_b[Lanes];
+        load_tail( tail_a, a + i, size - i, 0.0 );
+        load_tail( tail_b, b + i, size - i, 0.0 );
+        low  = _mm256_add_pd( low, product_avx2( tail_a, tail_b ) );
+        high = _mm256_add_pd( high, product_avx2( tail_a + 4, tail_b + 4 ) );
+    }
+
+    return combine_avx2( low, high );
+}
+
+RTA_TARGET( "avx2" )
+double
+dot3_avx2( const double *a, const double *b, const double *c, size_t size )
+{
+    __m256d low  = _mm256_setzero_pd();
+    __m256d high = _mm256_setzero_pd();
+
+    size_t i = 0;
+    for ( ; i + Lanes <= size; i += Lanes )
+    {
+        low  = _mm256_add_pd( low, product3_avx2( a + i, b + i, c + i ) );
+        high = _mm256_add_pd(
+            high, product3_avx2( a + i + 4, b + i + 4, c + i + 4 ) );
+    }
+
+    if ( i < size )
+    {
+        double tail_a[Lanes], tail_b[Lanes], tail_c[Lanes];
+        load_tail( tail_a, a + i, size - i, 0.0 );
+        load_tail( tail_b, b + i, size - i, 0.0 );
+        load_tail( tail_c, c + i, size - i, 0.0 );
+        low = _mm256_add_pd( low, product3_avx2( tail_a, tail_b, tail_c ) );
+        high = _mm256_add_pd(
+            high, product3_avx2( tail_a + 4, tail_b + 4, tail_c + 4 ) );
+    }
+
+    return combine_avx2( low, high );
+}
+
+/// Update the maximums of the two halves of a block, and flag the lanes of
+/// the NaN samples.
+RTA_TARGET( "avx2" )
+void max_block_avx2(
+    const double *block, __m256d &low, __m256d &high, __m256d &nan )
+{
+    __m256d block_low  = _mm256_loadu_pd( block );
+    __m256d block_high = _mm256_loadu_pd( block + 4 );
+    low                = _mm256_max_pd( low, block_low );
+    high               = _mm256_max_pd( high, block_high );
+    nan                = _mm256_or_pd(
+        nan, _mm256_cmp_pd( block_low, block_high, _CMP_UNORD_Q ) );
+}
+
+RTA_TARGET( "avx2" ) double max_avx2( const double *values, size_t size )
+{
+    // The padding of the last block is a sample, which never changes the
+    // maximum.
+    __m256d low  = _mm256_set1_pd( values[0] );
+    __m256d high = low;
+    __m256d nan  = _mm256_setzero_pd();
+
+    size_t i = 0;
+    for ( ; i + Lanes <= size; i += Lanes )
+        max_block_avx2( values + i, low, high, nan );
+
+    if ( i < size )
+    {
+        double tail[Lanes];
+        load_tail( tail, values + i, size - i, values[0] );
+        max_block_avx2( tail, low, high, nan );
+    }
+
+    __m256d quad = _mm256_max_pd( low, high );
+    __m128d pair = _mm_max_pd(
+        _mm256_castpd256_pd128( quad ), _mm256_extractf128_pd( quad, 1 ) );
+    __m128d last = _mm_max_pd( pair, _mm_unpackhi_pd( pair, pair ) );
+    return finish_max( _mm_cvtsd_f64( last ), _mm256_movemask_pd( nan ) != 0 );
+}
+
+const Kernels avx2_kernels = { InstructionSet::AVX2, "avx2", sum_avx2,
+                               dot_avx2,             dot3_avx2, max_avx2,
+                               interpolate_scalar };
+
+// AVX-512, a single register of 8 lanes
+
+RTA_TARGET( "avx512f" ) double combine_avx512( __m512d lanes )
+{
+    return combine_quad( _mm256_add_pd(
+        _mm512_castpd512_pd256( lanes ), _mm512_extractf64x4_pd( lanes, 1 ) ) );
+}
+
+/// Get the mask of the samples of the last block, fewer than `Lanes`.
+__mmask8 tail_mask( size_t size )
+{
+    return static_cast<__mmask8>( ( 1u << size ) - 1 );
+}
+
+RTA_TARGET( "avx512f" ) double sum_avx512( const double *values, size_t size )
+{
+    __m512d lanes = _mm512_setzero_pd();
+
+    size_t i = 0;
+    for ( ; i + Lanes <= size; i += Lanes )
+        lanes = _mm512_add_pd( lanes, _mm512_loadu_pd( values + i ) );
+
+    if ( i < size )
+    {
+        lanes = _mm512_add_pd(
+            lanes, _mm512_maskz_loadu_pd( tail_mask( size - i ), values + i ) );
+    }
+
+    return combine_avx512( lanes );
+}
+
+/// Multiply 8 samples of two curves, or fewer with the given mask, zeroing
+/// the rest.
+RTA_TARGET( "avx512f" )
+__m512d product_avx512( const double *a, const double *b, __mmask8 mask )
+{
+    return _mm512_mul_pd(
+        _mm512_maskz_loadu_pd( mask, a ), _mm512_maskz_loadu_pd( mask, b ) );
+}
+
+RTA_TARGET( "avx512f" )
+double dot_avx512( const double *a, const double *b, size_t size )
+{
+    __m512d lanes = _mm512_setzero_pd();
+
+    size_t   i    = 0;
+    __mmask8 full = tail_mask( Lanes );
+    for ( ; i + Lanes <= size; i += Lanes )
+        lanes = _mm512_add_pd( lanes, product_avx512( a + i, b + i, full ) );
+
+    if ( i < size )
+    {
+        lanes = _mm512_add_pd(
+            lanes, product_avx512( a + i, b + i, tail_mask( size - i ) ) );
+    }
+
+    return combine_avx512( lanes );
+}
+
+/// Multiply 8 samples of three curves, or fewer with the given mask.
+RTA_TARGET( "avx512f" )
+__m512d product3_avx512(
+    const double *a, const double *b, const double *c, __mmask8 mask )
+{
+    return _mm512_mul_pd(
+        product_avx512( a, b, mask ), _mm512_maskz_loadu_pd( mask, c ) );
+}
+
+RTA_TARGET( "avx512f" )
+double
+dot3_avx512( const double *a, const double *b, const double *c, size_t size )
+{
+    __m512d lanes = _mm512_setzero_pd();
+
+    size_t   i    = 0;
+    __mmask8 full = tail_mask( Lanes );
+    for ( ; i + Lanes <= size; i += Lanes )
+    {
+        lanes = _mm512_add_pd(
+            lanes, product3_avx512( a + i, b + i, c + i, full ) );
+    }
+
+    if ( i < size )
+    {
+        __mmask8 mask = tail_mask( size - i );
+        lanes         = _mm512_add_pd(
+            lanes, product3_avx512( a + i, b + i, c + i, mask ) );
+    }
+
+    return combine_avx512( lanes );
+}
+
+RTA_TARGET( "avx512f" ) double max_avx512( const double *values, size_t size )
+{
+    __m512d   lanes = _mm512_set1_pd( values[0] );
+    __mmask8 nan   = 0;
+
+    size_t i = 0;
+    for ( ; i + Lanes <= size; i += Lanes )
+    {
+        __m512d block = _mm512_loadu_pd( values + i );
+        lanes         = _mm512_max_pd( lanes, block );
+        nan |= _mm512_cmp_pd_mask( block, block, _CMP_UNORD_Q );
+    }
+
+    if ( i < size )
+    {
+        __m512d block =
+            _mm512_mask_loadu_pd( lanes, tail_mask( size - i ), values + i );
+        lanes = _mm512_max_pd( lanes, block );
+        nan |= _mm512_cmp_pd_mask( block, block, _CMP_UNORD_Q );
+    }
+
+    return finish_max( _mm512_reduce_max_pd( lanes ), nan != 0 );
+}
+
+const Kernels avx512_kernels = { InstructionSet::AVX512, "avx512",
+                                 sum_avx512,             dot_avx512,
+                                 dot3_avx512,            max_avx512,
+                                 interpolate_scalar };
+
+#    if defined( __GNUC__ ) && !defined( __clang__ )
+#        pragma GCC diagnostic pop
+#    endif
+
+#endif // RTA_KERNELS_X86
+
+#if defined( RTA_KERNELS_NEON )
+
+// NEON, four registers of 2 lanes. NEON is always available on AArch64, so
+// there is nothing to detect.
+
+double combine_neon( const float64x2_t lanes[4] )
+{
+    float64x2_t pair = vaddq_f64(
+        vaddq_f64( lanes[0], lanes[2] ), vaddq_f64( lanes[1], lanes[3] ) );
+    return vgetq_lane_f64( pair, 0 ) + vgetq_lane_f64( pair, 1 );
+}
+
+double sum_neon( const double *values, size_t size )
+{
+    float64x2_t lanes[4];
+    for ( int j = 0; j < 4; j++ )
+        lanes[j] = vdupq_n_f64( 0.0 );
+
+    double tail[Lanes];
+    for ( size_t i = 0; i < size; i += Lanes )
+    {
+        const double *block = values + i;
+        if ( i + Lanes > size )
+        {
+            load_tail( tail, values + i, size - i, 0.0 );
+            block = tail;
+        }
+
+        for ( int j = 0; j < 4; j++ )
+            lanes[j] = vaddq_f64( lanes[j], vld1q_f64( block + 2 * j ) );
+    }
+
+    return combine_neon( lanes );
+}
+
+double dot_neon( const double *a, const double *b, size_t size )
+{
+    float64x2_t lanes[4];
+    for ( int j = 0; j < 4; j++ )
+        lanes[j] = vdupq_n_f64( 0.0 );
+
+    double tail_a[Lanes], tail_b[Lanes];
+    for ( size_t i = 0; i < size; i += Lanes )
+    {
+        const double *block_a = a + i;
+        const double *block_b = b + i;
+        if ( i + Lanes > size )
+        {
+            load_tail( tail_a, a + i, size - i, 0.0 );
+            load_tail( tail_b, b + i, size - i, 0.0 );
+            block_a = tail_a;
+            block_b = tail_b;
+        }
+
+        for ( int j = 0; j < 4; j++ )
+        {
+            float64x2_t a_j = vld1q_f64( block_a + 2 * j );
+            float64x2_t b_j = vld1q_f64( block_b + 2 * j );
+            lanes[j]        = vaddq_f64( lanes[j], vmulq_f64( a_j, b_j ) );
+        }
+    }
+
+    return combine_neon( lanes );
+}
+
+double
+dot3_neon( const double *a, const double *b, const double *c, size_t size )
+{
+    float64x2_t lanes[4];
+    for ( int j = 0; j < 4; j++ )
+        lanes[j] = vdupq_n_f64( 0.0 );
+
+    double tail_a[Lanes], tail_b[Lanes], tail_c[Lanes];
+    for ( size_t i = 0; i < size; i += Lanes )
+    {
+        const double *block_a = a + i;
+        const double *block_b = b + i;
+        const double *block_c = c + i;
+        if ( i + Lanes > size )
+        {
+            load_tail( tail_a, a + i, size - i, 0.0 );
+            load_tail( tail_b, b + i, size - i, 0.0 );
+            load_tail( tail_c, c + i, size - i, 0.0 );
+            block_a = tail_a;
+            block_b = tail_b;
+            block_c = tail_c;
+        }
+
+        for ( int j = 0; j < 4; j++ )
+        {
+            lanes[j] = vaddq_f64(
+                lanes[j],
+                vmulq_f64(
+                    vmulq_f64(
+                        vld1q_f64( block_a + 2 * j ),
+                        vld1q_f64( block_b + 2 * j ) ),
+                    vld1q_f64( block_c + 2 * j ) ) );
+        }
+    }
+
+    return combine_neon( lanes );
+}
+
+double max_neon( const double *values, size_t size )
+{
+    float64x2_t lanes[4];
+    for ( int j = 0; j < 4; j++ )
+        lanes[j] = vdupq_n_f64( values[0] );
+
+    double tail[Lanes];
+    for ( size_t i = 0; i < size; i += Lanes )
+    {
+        const double *block = values + i;
+        if ( i + Lanes > size )
+        {
+            load_tail( tail, values + i, size - i, values[0] );
+            block = tail;
+        }
+
+        for ( int j = 0; j < 4; j++ )
+            lanes[j] = vmaxq_f64( lanes[j], vld1q_f64( block + 2 * j ) );
+    }
+
+    // Unlike the x86 instructions, these keep any NaN.
+    double result = vmaxvq_f64( vmaxq_f64(
+        vmaxq_f64( lanes[0], lanes[1] ), vmaxq_f64( lanes[2], lanes[3] ) ) );
+    return finish_max( result, std::isnan( result ) );
+}
+
+const Kernels neon_kernels = { InstructionSet::NEON, "neon", sum_neon,
+                               dot_neon,             dot3_neon, max_neon,
+                               interpolate_scalar };
+
+#endif // RTA_KERNELS_NEON
+
+} // namespace
+
+const Kernels *find_kernels( InstructionSet instruction_set )
+{
+    switch ( instruction_set )
+    {
+        case InstructionSet::Scalar: return &scalar_kernels;
+#if defined( RTA_KERNELS_X86 )
+        case InstructionSet::AVX2:
+            return cpu_supports_avx2() ? &avx2_kernels : nullptr;
+        case InstructionSet::AVX512:
+            return cpu_supports_avx512() ? &avx512_kernels : nullptr;
+#endif
+#if defined( RTA_KERNELS_NEON )
+        case InstructionSet::NEON: return &neon_kernels;
+#endif
+        default: return nullptr;
+    }
+}
+
+const Kernels &get_kernels()
+{
+    static const Kernels *kernels = []() {
+        for ( auto instruction_set: { InstructionSet::AVX512,
+                                      InstructionSet::AVX2,
+                                      InstructionSet::NEON } )
+        {
+            const Kernels *result = find_kernels( instruction_set );
+            if ( result )
+                return result;
+        }
+        return &scalar_kernels;
+    }();
+    return *kernels;
+}
+
+} // namespace kernels
+} // namespace core
+} // namespace rta
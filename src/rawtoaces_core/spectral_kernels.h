@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace rta
+{
+namespace core
+{
+namespace kernels
+{
+
+/// The instruction sets the spectral kernels are implemented with.
+enum class InstructionSet
+{
+    Scalar,
+    AVX2,
+    AVX512,
+    NEON
+};
+
+/// The spectral kernels implemented with a single instruction set.
+///
+/// The sums are accumulated in 8 lanes, every sample going into the lane of
+/// its index modulo 8, and the lanes are combined in the same order by all
+/// implementations. The vector widths only change how many lanes are
+/// processed at once, so all implementations give the same results, which
+/// do not depend on the CPU running them. They differ in the last bits from
+/// summing the samples one after another.
+struct Kernels
+{
+    /// The instruction set of the implementations.
+    InstructionSet instruction_set;
+
+    /// The name of the instruction set, like "avx2".
+    const char *name;
+
+    /// Sum the samples.
+    double ( *sum )( const double *values, size_t size );
+
+    /// Sum the products of the samples of two curves.
+    double ( *dot )( const double *a, const double *b, size_t size );
+
+    /// Sum the products of the samples of three curves.
+    double ( *dot3 )(
+        const double *a, const double *b, const double *c, size_t size );
+
+    /// Find the maximum sample, `size` needs to be positive. The result is
+    /// NaN if any sample is NaN, and +0 if the maximum is zero.
+    double ( *max )( const double *values, size_t size );
+
+    /// Linearly interpolate the samples, calculating
+    /// `result[i] = values[lower[i]] * ( 1 - ratios[i] ) +
+    /// values[upper[i]] * ratios[i]`.
+    void ( *interpolate )(
+        const double  *values,
+        const int32_t *lower,
+        const int32_t *upper,
+        const double  *ratios,
+        double        *result,
+        size_t         size );
+};
+
+/// Get the kernels implemented with an instruction set.
+/// @param instruction_set the instruction set.
+/// @result the kernels, or `nullptr` if the instruction set is not
+/// supported by the build or by the CPU.
+const Kernels *find_kernels( InstructionSet instruction_set );
+
+/// Get the kernels implemented with the widest instruction set supported by
+/// the CPU, detected on the first call. Thread-safe.
+/// @result the kernels.
+const Kernels &get_kernels();
+
+} // namespace kernels
+} // namespace core
+} // namespace rta
@@ -0,0 +1,2146 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+#include <rawtoaces/batch_converter.h>
+
+#include "conversion_manifest.h"
+#include "directory_watcher.h"
+#include "job_file.h"
+#include "local_socket.h"
+#include "memory_budget.h"
+#include "progress_reporter.h"
+#include "rawtoaces_util_priv.h"
+#include "work_queue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#ifndef WIN32
+#    include <sys/stat.h>
+#endif
+
+namespace rta
+{
+namespace util
+{
+
+namespace
+{
+
+/// Sort the failures by the index of the file.
+void sort_failures( std::vector<BatchConverter::Failure> &failures )
+{
+    std::sort(
+        failures.begin(),
+        failures.end(),
+        []( const BatchConverter::Failure &a,
+            const BatchConverter::Failure &b ) { return a.index < b.index; } );
+}
+
+/// The state shared by all workers of a single batch. The files get added by
+/// a producer while the workers are already converting the files added
+/// earlier.
+class Batch
+{
+public:
+    /// @param total the number of files which are going to be added, used in
+    /// the progress messages, or 0 if not known in advance.
+    /// @param keep_going continue taking files after a failure.
+    /// @param max_memory the memory budget of the conversions running
+    /// concurrently in bytes, or 0 for no limit.
+    Batch( size_t total, bool keep_going, size_t max_memory )
+        : _total( total )
+        , _keep_going( keep_going )
+        , _max_memory( max_memory )
+        , _memory( max_memory )
+    {}
+
+    /// Add a file to the end of the batch.
+    /// @param path the path of the file.
+    /// @param replace_output allow replacing the existing output of the file,
+    /// see `make_output_path()`.
+    /// @param transform the transform planned for the file, or `nullptr` to
+    /// solve the transform when decoding the file. The transform must stay
+    /// alive until the batch is done.
+    /// @result `false` if the processing has failed and is not allowed to
+    /// continue, in which case the file is not added.
+    bool add(
+        const std::string               &path,
+        bool                             replace_output,
+        const ImageConverter::Transform *transform = nullptr )
+    {
+        if ( failed && !_keep_going )
+            return false;
+
+        size_t index;
+        {
+            std::lock_guard<std::mutex> lock( _files_mutex );
+            index               = _size++;
+            FileState &file     = _files[index];
+            file.path           = path;
+            file.replace_output = replace_output;
+            file.transform      = transform;
+        }
+        _queue.push( index );
+        return true;
+    }
+
+    /// Add a job of a job file to the end of the batch. The file gets
+    /// converted with the settings of the job, and written to the output of
+    /// the job if it has one.
+    /// @param job the job, which must stay alive until the batch is done, or
+    /// until the file is done if `release_done` is set.
+    /// @result `false` if the processing has failed and is not allowed to
+    /// continue, in which case the job is not added.
+    bool add( const ConversionJob &job )
+    {
+        if ( failed && !_keep_going )
+            return false;
+
+        size_t index;
+        {
+            std::lock_guard<std::mutex> lock( _files_mutex );
+            index           = _size++;
+            FileState &file = _files[index];
+            file.path       = job.input;
+            file.output     = job.output;
+            file.settings   = &job.settings;
+        }
+        _queue.push( index );
+        return true;
+    }
+
+    /// Signal that no more files are going to be added.
+    void close() { _queue.close(); }
+
+    /// Get the number of files added to the batch.
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock( _files_mutex );
+        return _size;
+    }
+
+    /// Get the total number of files passed to the constructor.
+    size_t total() const { return _total; }
+
+    /// Get the path of the file with the given index.
+    /// @param index the index of the file.
+    const std::string &file( size_t index ) { return state( index ).path; }
+
+    /// Take the next file to process from the queue and print its progress
+    /// message, waiting for the producer if needed. Taking a file and
+    /// printing its message happen under the same lock, so the messages
+    /// appear in the order the files have been added.
+    /// @param index the variable to store the index of the file into.
+    /// @result `false` if no files are left, or the processing has failed
+    /// and is not allowed to continue.
+    bool next( size_t &index )
+    {
+        std::lock_guard<std::mutex> lock( _dispatch_mutex );
+        if ( ( failed && !_keep_going ) || !_queue.pop( index ) )
+            return false;
+
+        FileState &file = state( index );
+        file.start_time = std::chrono::steady_clock::now();
+        if ( !quiet )
+        {
+            std::cout << progress( index ) << " Processing file: " << file.path
+                      << std::endl;
+        }
+        return true;
+    }
+
+    /// Apply the settings of the job the file with the given index comes
+    /// from to the converter. The converter is left untouched for the files
+    /// not coming from jobs.
+    /// @param index the index of the file.
+    /// @param converter the converter to process the file with.
+    void configure( size_t index, ImageConverter &converter )
+    {
+        const FileState &file = state( index );
+        if ( file.settings )
+            converter.settings = *file.settings;
+    }
+
+    /// Get the output path of the file with the given index, once it has
+    /// been made by `make_output_path()`.
+    /// @param index the index of the file.
+    const std::string &output( size_t index ) { return state( index ).output; }
+
+    /// Get the time the processing of the file with the given index has
+    /// started at.
+    /// @param index the index of the file.
+    std::chrono::steady_clock::time_point start_time( size_t index )
+    {
+        return state( index ).start_time;
+    }
+
+    /// Make the output path of the file with the given index. The outputs
+    /// recorded in the manifest of an incremental batch get replaced even if
+    /// overwriting is not enabled, as they have been made by a previous run.
+    /// The output named by a job is only checked for being writable.
+    /// @param index the index of the file.
+    /// @param converter the converter to make the path with.
+    /// @param path the variable to store the output path into.
+    /// @result `true` if the output file can be written.
+    bool make_output_path(
+        size_t index, ImageConverter &converter, std::string &path )
+    {
+        const FileState &file = state( index );
+
+        bool overwrite               = converter.settings.overwrite;
+        converter.settings.overwrite = overwrite || file.replace_output;
+
+        bool result;
+        if ( file.output.empty() )
+        {
+            path   = file.path;
+            result = converter.make_output_path( path );
+        }
+        else
+        {
+            path   = file.output;
+            result = converter.check_output_path( path );
+        }
+
+        if ( result )
+            state( index ).output = path;
+
+        converter.settings.overwrite = overwrite;
+        return result;
+    }
+
+    /// Decode the file with the given index, using the transform planned for
+    /// the file if there is one.
+    /// @param index the index of the file.
+    /// @param converter the converter to decode the file with.
+    /// @param buffer the image buffer to load the image into.
+    /// @result `true` if decoded successfully.
+    bool
+    decode( size_t index, ImageConverter &converter, OIIO::ImageBuf &buffer )
+    {
+        const FileState &file = state( index );
+
+        bool result =
+            file.transform
+                ? converter.decode_image( file.path, *file.transform, buffer )
+                : converter.decode_image( file.path, buffer );
+
+        if ( result )
+        {
+            std::error_code error;
+            auto            size = std::filesystem::file_size( file.path, error );
+            if ( !error )
+                counters.bytes_read += static_cast<uint64_t>( size );
+
+            const OIIO::ImageSpec &spec = buffer.spec();
+            counters.pixels_decoded +=
+                static_cast<uint64_t>( spec.width ) * spec.height;
+        }
+        return result;
+    }
+
+    /// Reserve the estimated peak memory of converting the file with the
+    /// given index, waiting until it fits into the memory budget. Nothing
+    /// gets reserved if the batch has no budget, or the header of the file
+    /// can't be read, in which case the decoding is going to fail anyway.
+    /// @param index the index of the file.
+    /// @param converter the converter to estimate the memory usage with.
+    /// @result the reservation, to be kept until the file is done.
+    MemoryReservation
+    reserve_memory( size_t index, const ImageConverter &converter )
+    {
+        if ( !_max_memory )
+            return MemoryReservation();
+
+        size_t bytes;
+        if ( !converter.estimate_memory_usage( file( index ), bytes ) )
+            return MemoryReservation();
+
+        return MemoryReservation( _memory, bytes );
+    }
+
+    /// Run a processing stage for the file with the given index, recording
+    /// a failure if the stage returns `false` or throws.
+    /// @param index the index of the file being processed.
+    /// @param stage the name of the stage, used in the failure record.
+    /// @param converter the converter running the stage, used to get the
+    /// reason of the failure.
+    /// @param step the function running the stage.
+    /// @result `true` if the stage has succeeded.
+    bool run(
+        size_t                       index,
+        const char                  *stage,
+        const ImageConverter        &converter,
+        const std::function<bool()> &step )
+    {
+        const FileState &file = state( index );
+
+        bool        result;
+        std::string reason;
+        try
+        {
+            result = step();
+            if ( !result )
+                reason = converter.get_last_error();
+        }
+        catch ( const std::exception &e )
+        {
+            std::cerr << "ERROR: Exception while processing file "
+                      << file.path << ": " << e.what() << std::endl;
+            result = false;
+            reason = e.what();
+        }
+
+        if ( !result )
+        {
+            std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - file.start_time;
+
+            BatchConverter::Failure failure;
+            failure.index   = index;
+            failure.file    = file.path;
+            failure.stage   = stage;
+            failure.reason  = reason.empty() ? "Unknown error." : reason;
+            failure.elapsed = elapsed.count();
+
+            failed = true;
+            counters.files_failed++;
+            std::cerr << "Failed on file " << progress( index ) << ": "
+                      << file.path << std::endl;
+
+            if ( on_done )
+                on_done( index, &failure );
+
+            if ( keep_failures )
+            {
+                std::lock_guard<std::mutex> lock( _failures_mutex );
+                _failures.push_back( std::move( failure ) );
+            }
+
+            if ( release_done )
+                release( index );
+        }
+        return result;
+    }
+
+    /// Mark the file with the given index as converted successfully.
+    /// @param index the index of the file.
+    void complete( size_t index )
+    {
+        state( index ).completed = true;
+        counters.files_done++;
+        if ( on_done )
+            on_done( index, nullptr );
+
+        if ( release_done )
+            release( index );
+    }
+
+    /// Check whether the file with the given index has been converted
+    /// successfully. Call this after all workers have finished.
+    /// @param index the index of the file.
+    bool completed( size_t index ) { return state( index ).completed; }
+
+    /// Move the recorded failures out of the batch, ordered by file index.
+    /// Call this after all workers have finished.
+    std::vector<BatchConverter::Failure> take_failures()
+    {
+        sort_failures( _failures );
+        return std::move( _failures );
+    }
+
+    std::atomic<bool> failed = false;
+
+    /// The throughput counters of the batch.
+    ProgressCounters counters;
+
+    /// Don't print a message for every file taken for processing, as the
+    /// progress gets reported otherwise.
+    bool quiet = false;
+
+    /// Called by the worker finishing a file, with the index of the file,
+    /// and the failure record if the file has failed. Set this before
+    /// adding any files.
+    std::function<void( size_t index, const BatchConverter::Failure *failure )>
+        on_done;
+
+    /// Free the state of every file once it is done and `on_done` has been
+    /// called, so a batch running indefinitely doesn't grow with every file.
+    /// The methods taking the index of a file can't be used for the files
+    /// done then, except from `on_done`. Set this before adding any files.
+    bool release_done = false;
+
+    /// Keep the failure records for `take_failures()`. Unset this if
+    /// `on_done` reports the failures elsewhere, and `counters` are enough
+    /// to tell whether any file has failed.
+    bool keep_failures = true;
+
+private:
+    struct FileState
+    {
+        std::string path;
+        std::string output;
+        bool        replace_output = false;
+        bool        completed      = false;
+
+        const ImageConverter::Transform *transform = nullptr;
+        const ImageConverter::Settings  *settings  = nullptr;
+
+        std::chrono::steady_clock::time_point start_time;
+    };
+
+    /// Get the state of the file with the given index. The reference stays
+    /// valid while more files are added and the other files get released,
+    /// as `std::map` never relocates its elements.
+    FileState &state( size_t index )
+    {
+        std::lock_guard<std::mutex> lock( _files_mutex );
+        return _files.at( index );
+    }
+
+    /// Free the state of the file with the given index.
+    void release( size_t index )
+    {
+        std::lock_guard<std::mutex> lock( _files_mutex );
+        _files.erase( index );
+    }
+
+    /// Format the progress of the file with the given index, like "[3/10]".
+    std::string progress( size_t index ) const
+    {
+        std::string result = "[" + std::to_string( index + 1 );
+        if ( _total > 0 )
+            result += "/" + std::to_string( _total );
+        return result + "]";
+    }
+
+    const size_t      _total;
+    const bool        _keep_going;
+    const size_t      _max_memory;
+    MemoryBudget      _memory;
+    WorkQueue<size_t> _queue;
+    std::mutex        _dispatch_mutex;
+
+    mutable std::mutex          _files_mutex;
+    std::map<size_t, FileState> _files;
+    size_t                      _size = 0;
+
+    std::mutex                           _failures_mutex;
+    std::vector<BatchConverter::Failure> _failures;
+};
+
+/// The manifests of the output directories of an incremental batch. The
+/// methods can be called from multiple threads.
+class IncrementalState
+{
+public:
+    IncrementalState( const ImageConverter &converter )
+        : _converter( converter )
+        , _settings_hash(
+              ConversionManifest::hash_settings( converter.settings ) )
+    {}
+
+    /// Check whether the input file has been converted with the current
+    /// settings since it last changed, and its output still exists.
+    /// Otherwise, remember the current state of the file to record it once
+    /// the file gets converted.
+    /// @param input the path of the input file.
+    /// @param replace_output set to `true` if the output of the file has been
+    /// made by a previous run, and can be replaced.
+    /// @result `true` if the file can be skipped.
+    bool is_unchanged( const std::string &input, bool &replace_output )
+    {
+        replace_output = false;
+
+        std::lock_guard<std::mutex> lock( _mutex );
+
+        std::string output = _converter.get_output_path( input );
+        if ( output.empty() )
+            return false;
+
+        std::error_code error;
+        std::string     key =
+            std::filesystem::absolute( input, error ).lexically_normal().string();
+        if ( error )
+            return false;
+
+        ConversionManifest::Entry entry;
+        if ( !ConversionManifest::stat_input( input, entry ) )
+            return false;
+        entry.settings_hash = _settings_hash;
+        entry.output        = std::filesystem::absolute( output, error ).string();
+
+        std::string directory =
+            std::filesystem::path( entry.output ).parent_path().string();
+        ConversionManifest &manifest = get_manifest( directory );
+
+        const ConversionManifest::Entry *recorded = manifest.find( key );
+        if ( recorded && recorded->output == entry.output )
+        {
+            bool output_exists = std::filesystem::exists( entry.output, error );
+
+            if ( output_exists && recorded->size == entry.size &&
+                 recorded->mtime == entry.mtime &&
+                 recorded->settings_hash == entry.settings_hash )
+            {
+                return true;
+            }
+
+            replace_output = output_exists;
+        }
+
+        _pending[input] = { directory, key, entry };
+        return false;
+    }
+
+    /// Record a converted input file in the manifest of its output
+    /// directory.
+    /// @param input the path of the input file.
+    void record( const std::string &input )
+    {
+        std::lock_guard<std::mutex> lock( _mutex );
+
+        auto iter = _pending.find( input );
+        if ( iter == _pending.end() )
+            return;
+
+        const Pending &pending = iter->second;
+        _manifests.at( pending.directory ).update( pending.key, pending.entry );
+        _modified.insert( pending.directory );
+        _pending.erase( iter );
+    }
+
+    /// Forget the state of an input file which has failed to convert.
+    /// @param input the path of the input file.
+    void forget( const std::string &input )
+    {
+        std::lock_guard<std::mutex> lock( _mutex );
+        _pending.erase( input );
+    }
+
+    /// Save the manifests which have got new records since the last call.
+    /// The failed manifests are not retried until they get new records, so
+    /// the periodic saves don't repeat the same error.
+    /// @result `true` if all manifests have been saved successfully by this
+    /// and all earlier calls.
+    bool save()
+    {
+        std::lock_guard<std::mutex> lock( _mutex );
+
+        for ( const auto &directory: _modified )
+            _save_failed |= !_manifests.at( directory ).save();
+        _modified.clear();
+        return !_save_failed;
+    }
+
+private:
+    ConversionManifest &get_manifest( const std::string &directory )
+    {
+        auto iter = _manifests.find( directory );
+        if ( iter == _manifests.end() )
+        {
+            iter = _manifests.emplace( directory, directory ).first;
+            iter->second.load();
+        }
+        return iter->second;
+    }
+
+    struct Pending
+    {
+        std::string               directory;
+        std::string               key;
+        ConversionManifest::Entry entry;
+    };
+
+    const ImageConverter                     &_converter;
+    const std::string                         _settings_hash;
+    std::mutex                                _mutex;
+    std::map<std::string, ConversionManifest> _manifests;
+    std::map<std::string, Pending>            _pending;
+    std::set<std::string>                     _modified;
+    bool                                      _save_failed = false;
+};
+
+/// Run `worker` on `num_threads` threads, the calling thread being one of
+/// them, and wait for all of them to finish.
+void run_parallel( size_t num_threads, const std::function<void()> &worker )
+{
+    std::vector<std::thread> threads;
+    for ( size_t i = 1; i < num_threads; i++ )
+        threads.emplace_back( worker );
+    worker();
+
+    for ( auto &thread: threads )
+        thread.join();
+}
+
+/// The colour transforms of a batch, solved before converting the pixels.
+/// A shoot usually has only a handful of distinct transforms, so solving
+/// each one once saves rebuilding the solvers and refitting the matrices
+/// for every file.
+class TransformPlan
+{
+public:
+    /// Read the metadata of all files, and solve every distinct transform
+    /// once. Both phases run in parallel.
+    /// @param converter the converter to solve the transforms with.
+    /// @param files the paths of the files.
+    /// @param num_threads the number of threads to use.
+    void build(
+        const ImageConverter           &converter,
+        const std::vector<std::string> &files,
+        size_t                          num_threads )
+    {
+        _file_transforms.assign( files.size(), no_transform );
+
+        // The metadata of the first file found for every transform key.
+        std::vector<OIIO::ImageSpec>  specs;
+        std::map<std::string, size_t> keys;
+        std::mutex                    mutex;
+
+        std::atomic<size_t> next_file( 0 );
+        run_parallel( num_threads, [&]() {
+            size_t i;
+            while ( ( i = next_file++ ) < files.size() )
+            {
+                // The files failing here get decoded the usual way, which
+                // reports the failure.
+                OIIO::ImageSpec spec;
+                if ( !converter.read_metadata( files[i], spec ) )
+                    continue;
+
+                std::string key = converter.get_transform_key( spec );
+
+                std::lock_guard<std::mutex> lock( mutex );
+                auto [iter, inserted] = keys.emplace( key, specs.size() );
+                if ( inserted )
+                    specs.push_back( std::move( spec ) );
+                _file_transforms[i] = iter->second;
+            }
+        } );
+
+        _transforms.resize( specs.size() );
+        _solved.assign( specs.size(), false );
+
+        std::atomic<size_t> next_transform( 0 );
+        run_parallel( std::min( num_threads, specs.size() ), [&]() {
+            ImageConverter worker_converter = converter;
+
+            size_t i;
+            while ( ( i = next_transform++ ) < specs.size() )
+            {
+                _solved[i] =
+                    worker_converter.solve_transform( specs[i], _transforms[i] );
+            }
+        } );
+    }
+
+    /// Get the transform planned for the file with the given index.
+    /// @param index the index of the file in the list passed to `build()`.
+    /// @result the transform, or `nullptr` if it couldn't be planned.
+    const ImageConverter::Transform *get( size_t index ) const
+    {
+        size_t transform = _file_transforms[index];
+        if ( transform == no_transform || !_solved[transform] )
+            return nullptr;
+        return &_transforms[transform];
+    }
+
+    /// Get the number of distinct transforms found.
+    size_t size() const { return _transforms.size(); }
+
+private:
+    static constexpr size_t no_transform = static_cast<size_t>( -1 );
+
+    std::vector<ImageConverter::Transform> _transforms;
+    std::deque<bool>                       _solved; // written concurrently
+    std::vector<size_t>                    _file_transforms;
+};
+
+/// A file travelling through the stages of the pipeline. The converter
+/// configured by the decoding stage travels along with the image, so the
+/// later stages apply the transform solved for this particular file.
+struct PipelineItem
+{
+    size_t            index = 0;
+    std::string       output_path;
+    ImageConverter    converter;
+    OIIO::ImageBuf    buffer;
+    MemoryReservation memory;
+};
+
+using PipelineQueue = WorkQueue<std::unique_ptr<PipelineItem>>;
+
+/// Start `count` threads running `worker`. The last thread to finish calls
+/// `on_finished`.
+void start_workers(
+    std::vector<std::thread>    &threads,
+    size_t                       count,
+    const std::function<void()> &worker,
+    const std::function<void()> &on_finished )
+{
+    auto remaining = std::make_shared<std::atomic<size_t>>( count );
+    for ( size_t i = 0; i < count; i++ )
+    {
+        threads.emplace_back( [=]() {
+            worker();
+            if ( --*remaining == 0 )
+                on_finished();
+        } );
+    }
+}
+
+/// Convert a single file from start to end. This is equivalent to
+/// `ImageConverter::process_image()`, running every stage via `Batch::run()`
+/// to record the stage which fails.
+void convert_file( Batch &batch, size_t index, ImageConverter &converter )
+{
+    const std::string &input_path = batch.file( index );
+    std::string        output_path;
+    OIIO::ImageBuf     buffer;
+
+    batch.configure( index, converter );
+
+    if ( !batch.run( index, "prepare", converter, [&]() {
+             return batch.make_output_path( index, converter, output_path );
+         } ) )
+        return;
+
+    MemoryReservation memory = batch.reserve_memory( index, converter );
+
+    if ( !batch.run( index, "decode", converter, [&]() {
+             return batch.decode( index, converter, buffer );
+         } ) )
+        return;
+
+    if ( !batch.run( index, "transform", converter, [&]() {
+             return converter.transform_image( input_path, buffer );
+         } ) )
+        return;
+
+    if ( batch.run( index, "encode", converter, [&]() {
+             return converter.encode_image( output_path, buffer );
+         } ) )
+        batch.complete( index );
+}
+
+/// Every worker converts its files from start to end, one at a time.
+/// `produce` runs on the calling thread, adding the files to the batch while
+/// the workers convert the files added so far.
+void process_independent(
+    Batch                       &batch,
+    const ImageConverter        &converter,
+    size_t                       num_workers,
+    const std::function<void()> &produce )
+{
+    auto worker = [&]() {
+        ImageConverter worker_converter = converter;
+
+        size_t index;
+        while ( batch.next( index ) )
+            convert_file( batch, index, worker_converter );
+    };
+
+    std::vector<std::thread> threads;
+    for ( size_t i = 0; i < num_workers; i++ )
+        threads.emplace_back( worker );
+
+    produce();
+    batch.close();
+
+    for ( auto &thread: threads )
+        thread.join();
+}
+
+/// The decoding, transforming and encoding of the files run as separate
+/// stages connected by bounded queues, each stage having `num_workers`
+/// threads. A full queue blocks the stage feeding it, which limits the number
+/// of decoded images held in memory when a later stage falls behind.
+/// `produce` runs on the calling thread, adding the files to the batch while
+/// the stages process the files added so far.
+void process_pipelined(
+    Batch                       &batch,
+    const ImageConverter        &converter,
+    size_t                       num_workers,
+    const std::function<void()> &produce )
+{
+    PipelineQueue decoded( num_workers );
+    PipelineQueue transformed( num_workers );
+
+    auto decode = [&]() {
+        ImageConverter worker_converter = converter;
+
+        size_t index;
+        while ( batch.next( index ) )
+        {
+            auto item   = std::make_unique<PipelineItem>();
+            item->index = index;
+
+            batch.configure( index, worker_converter );
+
+            bool result =
+                batch.run( index, "prepare", worker_converter, [&]() {
+                    return batch.make_output_path(
+                        index, worker_converter, item->output_path );
+                } );
+
+            // The reservation travels along with the image, and gets
+            // released once the item is done with or dropped on a failure.
+            if ( result )
+            {
+                item->memory = batch.reserve_memory( index, worker_converter );
+                result = batch.run( index, "decode", worker_converter, [&]() {
+                    return batch.decode(
+                        index, worker_converter, item->buffer );
+                } );
+            }
+
+            if ( result )
+            {
+                item->converter = worker_converter;
+                decoded.push( std::move( item ) );
+            }
+        }
+    };
+
+    // The items already in flight are finished even after a failure, the
+    // same as in the non-pipelined mode.
+    auto transform = [&]() {
+        std::unique_ptr<PipelineItem> item;
+        while ( decoded.pop( item ) )
+        {
+            bool result =
+                batch.run( item->index, "transform", item->converter, [&]() {
+                    return item->converter.transform_image(
+                        batch.file( item->index ), item->buffer );
+                } );
+
+            if ( result )
+                transformed.push( std::move( item ) );
+        }
+    };
+
+    auto encode = [&]() {
+        std::unique_ptr<PipelineItem> item;
+        while ( transformed.pop( item ) )
+        {
+            bool result =
+                batch.run( item->index, "encode", item->converter, [&]() {
+                    return item->converter.encode_image(
+                        item->output_path, item->buffer );
+                } );
+
+            if ( result )
+                batch.complete( item->index );
+        }
+    };
+
+    std::vector<std::thread> threads;
+    start_workers( threads, num_workers, decode, [&]() { decoded.close(); } );
+    start_workers(
+        threads, num_workers, transform, [&]() { transformed.close(); } );
+    start_workers( threads, num_workers, encode, []() {} );
+
+    produce();
+    batch.close();
+
+    for ( auto &thread: threads )
+        thread.join();
+}
+
+/// Get the number of workers to use for the given number of files.
+/// @param total the number of files, or 0 if not known in advance.
+size_t worker_count( const BatchConverter::Settings &settings, size_t total )
+{
+    size_t num_workers = settings.jobs;
+    if ( num_workers == 0 )
+        num_workers = std::max( std::thread::hardware_concurrency(), 1u );
+    if ( total > 0 )
+        num_workers = std::min( num_workers, total );
+    return num_workers;
+}
+
+/// Convert the files added to the batch by `produce`.
+/// @param total the number of files `produce` is going to add, or 0 if not
+/// known in advance.
+void run_batch(
+    Batch                          &batch,
+    const BatchConverter::Settings &settings,
+    const ImageConverter           &converter,
+    size_t                          total,
+    const std::function<void()>    &produce )
+{
+    size_t num_workers = worker_count( settings, total );
+
+    std::unique_ptr<ProgressReporter> reporter;
+    if ( settings.progress != BatchConverter::Settings::Progress::None )
+    {
+        bool tty    = settings.progress == BatchConverter::Settings::Progress::TTY;
+        batch.quiet = tty;
+        reporter    = std::make_unique<ProgressReporter>(
+            batch.counters,
+            total,
+            tty ? ProgressReporter::Format::TTY
+                   : ProgressReporter::Format::JSON,
+            std::cerr );
+        reporter->start( std::chrono::seconds( 1 ) );
+    }
+
+    if ( settings.pipeline )
+        process_pipelined( batch, converter, num_workers, produce );
+    else
+        process_independent( batch, converter, num_workers, produce );
+
+    if ( reporter )
+        reporter->stop();
+}
+
+/// Record the files converted by the batch in the manifests.
+/// @result `true` if the manifests have been saved successfully.
+bool record_converted( Batch &batch, IncrementalState &incremental )
+{
+    for ( size_t i = 0; i < batch.size(); i++ )
+    {
+        if ( batch.completed( i ) )
+            incremental.record( batch.file( i ) );
+    }
+
+    return incremental.save();
+}
+
+/// Parse a shard specification like "2/8".
+/// @param text the string to parse.
+/// @param index the variable to store the 0-based shard index into.
+/// @param count the variable to store the number of shards into.
+/// @result `true` if parsed successfully.
+bool parse_shard( const std::string &text, size_t &index, size_t &count )
+{
+    std::istringstream stream( text );
+    long long          parsed_index, parsed_count;
+    char               separator;
+    if ( !( stream >> parsed_index >> separator >> parsed_count ) ||
+         separator != '/' || !stream.eof() )
+        return false;
+
+    if ( parsed_count < 1 || parsed_index < 0 || parsed_index >= parsed_count )
+        return false;
+
+    index = static_cast<size_t>( parsed_index );
+    count = static_cast<size_t>( parsed_count );
+    return true;
+}
+
+/// A 64-bit FNV-1a hash of a path, the same on every platform, so all
+/// processes of a sharded batch agree on the shard of every file.
+uint64_t hash_path( const std::string &path )
+{
+    uint64_t hash = 14695981039346656037ull;
+    for ( unsigned char c: path )
+    {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+/// Parse a memory size like "512M" or "1.5G". The suffixes K, M, G and T
+/// are binary multiples, a number without a suffix is in bytes.
+/// @param text the string to parse.
+/// @param bytes the variable to store the size into.
+/// @result `true` if parsed successfully.
+bool parse_memory_size( const std::string &text, size_t &bytes )
+{
+    std::istringstream stream( text );
+    double             value;
+    if ( !( stream >> value ) || value < 0 )
+        return false;
+
+    std::string suffix;
+    stream >> suffix;
+    suffix = OIIO::Strutil::lower( suffix );
+    if ( !suffix.empty() && suffix.back() == 'b' )
+        suffix.pop_back();
+
+    static const std::map<std::string, double> multipliers = {
+        { "", 1.0 },
+        { "k", 1024.0 },
+        { "m", 1024.0 * 1024.0 },
+        { "g", 1024.0 * 1024.0 * 1024.0 },
+        { "t", 1024.0 * 1024.0 * 1024.0 * 1024.0 }
+    };
+
+    auto iter = multipliers.find( suffix );
+    if ( iter == multipliers.end() || !stream.eof() )
+        return false;
+
+    bytes = static_cast<size_t>( value * iter->second );
+    return true;
+}
+
+/// Get the number of seconds between two points in time.
+double seconds_between(
+    std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end )
+{
+    return std::chrono::duration<double>( end - start ).count();
+}
+
+/// Send the conversion requests to a server started by
+/// `BatchConverter::serve()`, and wait for all of them to finish. The
+/// requests get numbered by their "id", and a message is printed for every
+/// finished request.
+/// @param socket_path the path of the socket the server is listening on.
+/// @param requests the requests to send.
+/// @param failures the list to store the failed requests into.
+/// @result `false` if the requests couldn't be sent.
+bool send_requests(
+    const std::string                    &socket_path,
+    std::vector<nlohmann::json>           requests,
+    std::vector<BatchConverter::Failure> &failures )
+{
+    auto connection = LocalSocket::connect( socket_path );
+    if ( !connection )
+        return false;
+
+    // The server reads the requests regardless of the responses waiting to
+    // be read, so sending all requests first can't block forever.
+    for ( size_t i = 0; i < requests.size(); i++ )
+    {
+        requests[i]["id"] = i;
+        if ( !connection->write_line( requests[i].dump() ) )
+        {
+            std::cerr << "ERROR: Failed to send the requests to "
+                      << socket_path << "." << std::endl;
+            return false;
+        }
+    }
+
+    auto input_of = [&]( size_t index ) {
+        const auto &input = requests[index]["input"];
+        return input.is_string() ? input.get<std::string>() : input.dump();
+    };
+
+    std::vector<bool> finished( requests.size(), false );
+    size_t            num_finished = 0;
+    std::string       line;
+    while ( num_finished < requests.size() )
+    {
+        if ( connection->read_line( line, -1 ) != LocalSocket::ReadResult::Line )
+        {
+            std::cerr << "ERROR: The server has closed the connection before "
+                      << "finishing all requests." << std::endl;
+            break;
+        }
+
+        nlohmann::json response = nlohmann::json::parse( line, nullptr, false );
+        if ( !response.is_object() || !response["id"].is_number_unsigned() ||
+             response["id"].get<size_t>() >= requests.size() ||
+             finished[response["id"].get<size_t>()] )
+        {
+            std::cerr << "Warning: Ignoring an unexpected response: " << line
+                      << std::endl;
+            continue;
+        }
+
+        size_t index    = response["id"].get<size_t>();
+        finished[index] = true;
+        num_finished++;
+
+        std::string progress = "[" + std::to_string( num_finished ) + "/" +
+                               std::to_string( requests.size() ) + "]";
+        double      time     = response.value( "time", 0.0 );
+
+        if ( response.value( "status", "" ) == "ok" )
+        {
+            std::cout << progress << " Converted file: " << input_of( index )
+                      << " -> " << response.value( "output", "" ) << " ("
+                      << time << " s)" << std::endl;
+            continue;
+        }
+
+        BatchConverter::Failure failure;
+        failure.index   = index;
+        failure.file    = input_of( index );
+        failure.stage   = response.value( "stage", "request" );
+        failure.reason  = response.value( "reason", "Unknown error." );
+        failure.elapsed = time;
+
+        std::cerr << "Failed on file " << progress << ": " << failure.file
+                  << ": " << failure.reason << std::endl;
+        failures.push_back( std::move( failure ) );
+    }
+
+    // The requests left without a response have failed as well.
+    for ( size_t i = 0; i < requests.size(); i++ )
+    {
+        if ( finished[i] )
+            continue;
+
+        BatchConverter::Failure failure;
+        failure.index  = i;
+        failure.file   = input_of( i );
+        failure.stage  = "request";
+        failure.reason = "No response from the server.";
+        failures.push_back( std::move( failure ) );
+    }
+
+    sort_failures( failures );
+    return true;
+}
+
+} // namespace
+
+void BatchConverter::init_parser( OIIO::ArgParse &arg_parser )
+{
+    arg_parser.separator( "Batch processing options:" );
+
+    arg_parser.arg( "--jobs" )
+        .help(
+            "The number of files to convert in parallel. The value of 0 uses "
+            "all available hardware threads." )
+        .metavar( "N" )
+        .defaultval( 1 )
+        .action( OIIO::ArgParse::store<int>() );
+
+    arg_parser.arg( "--pipeline" )
+        .help(
+            "Run reading, transforming and writing of the images as separate "
+            "stages, so the next file gets read while the previous ones are "
+            "being transformed and written. Each stage uses the number of "
+            "threads set by --jobs." )
+        .action( OIIO::ArgParse::store_true() );
+
+    arg_parser.arg( "--shard" )
+        .help(
+            "Convert only one part of the input files, for splitting a batch "
+            "across multiple machines. I is the 0-based index of the part, "
+            "and N is the number of parts, like 0/4. Every file belongs to "
+            "exactly one part, chosen by a hash of its path." )
+        .metavar( "I/N" )
+        .action( OIIO::ArgParse::store() );
+
+    arg_parser.arg( "--shard-by-size" )
+        .help(
+            "Split the files into the parts set by --shard by their sizes "
+            "instead, so all parts take about the same time to convert. "
+            "Can't be combined with --recursive and --watch." )
+        .action( OIIO::ArgParse::store_true() );
+
+    arg_parser.arg( "--plan" )
+        .help(
+            "Read the metadata of all files in parallel before converting "
+            "them, and solve every distinct colour transform only once. This "
+            "saves the per-file setup when many files share the same camera "
+            "and white balance. Can't be combined with --recursive, --watch, "
+            "--job-file, --serve and --connect, which convert the files as "
+            "they arrive." )
+        .action( OIIO::ArgParse::store_true() );
+
+    arg_parser.arg( "--order" )
+        .help(
+            "The order to convert the files in: 'input' keeps the order the "
+            "files have been given in, 'largest-first' converts the largest "
+            "files first, so the batch doesn't end waiting for a single large "
+            "file, and 'physical' follows the placement of the files on the "
+            "storage, avoiding seeks on hard drives and tape-staged storage. "
+            "Not used with --recursive and --watch, which convert the files "
+            "as they are found." )
+        .metavar( "POLICY" )
+        .defaultval( "input" )
+        .action( OIIO::ArgParse::store() );
+
+    arg_parser.arg( "--max-memory" )
+        .help(
+            "The maximum total memory the files being converted in parallel "
+            "may use, like 48G or 512M. The memory needed by each file is "
+            "estimated from its header, and a file waits until it fits into "
+            "the budget. A file larger than the whole budget gets converted "
+            "alone. The value of 0 sets no limit." )
+        .metavar( "SIZE" )
+        .defaultval( "0" )
+        .action( OIIO::ArgParse::store() );
+
+    arg_parser.arg( "--recursive" )
+        .help(
+            "Search the input directories recursively. The subdirectories are "
+            "scanned in parallel using the number of threads set by --jobs, "
+            "and the files get converted as soon as they are found. Only the "
+            "files of the raw formats supported by OpenImageIO are picked up "
+            "from the directories." )
+        .action( OIIO::ArgParse::store_true() );
+
+    arg_parser.arg( "--watch" )
+        .help(
+            "Keep running, and convert every raw file as soon as it has been "
+            "completely written into the given directory, until interrupted. "
+            "Failed files never stop the watching. With --incremental, the "
+            "files already in the directory get converted first. Only "
+            "supported on Linux." )
+        .metavar( "DIR" )
+        .action( OIIO::ArgParse::store() );
+
+    arg_parser.arg( "--job-file" )
+        .help(
+            "Convert the jobs listed in the given JSON Lines file instead of "
+            "the input files. Every line is a JSON object naming an \"input\" "
+            "file, an optional \"output\" file, and optional \"settings\" "
+            "overriding the command line parameters for this file, like "
+            "{\"input\": \"a.dng\", \"settings\": {\"headroom\": 4}}. "
+            "All jobs run in a single process, sharing the worker threads." )
+        .metavar( "PATH" )
+        .action( OIIO::ArgParse::store() );
+
+    arg_parser.arg( "--serve" )
+        .help(
+            "Keep running, and convert the files sent by the clients over a "
+            "Unix domain socket created at the given path, until interrupted. "
+            "The worker threads and the loaded data stay alive between the "
+            "requests. Every request is a line of JSON in the format of "
+            "--job-file, and gets a line of JSON with the status and the "
+            "timings in response. Only supported on Linux and macOS." )
+        .metavar( "SOCKET" )
+        .action( OIIO::ArgParse::store() );
+
+    arg_parser.arg( "--connect" )
+        .help(
+            "Send the input files, or the jobs of --job-file, to the server "
+            "started with --serve listening on the given socket, and wait for "
+            "them to be converted. The files are converted with the settings "
+            "of the server." )
+        .metavar( "SOCKET" )
+        .action( OIIO::ArgParse::store() );
+
+    arg_parser.arg( "--incremental" )
+        .help(
+            "Skip the files which have not changed since they were last "
+            "converted with the same settings. A manifest of the converted "
+            "files is kept in each output directory." )
+        .action( OIIO::ArgParse::store_true() );
+
+    arg_parser.arg( "--keep-going" )
+        .help(
+            "Continue converting the remaining files after a file fails to "
+            "convert, and print a summary of the failed files at the end. "
+            "The exit code is 2 if only some of the files have failed." )
+        .action( OIIO::ArgParse::store_true() );
+
+    arg_parser.arg( "--progress" )
+        .help(
+            "Report the throughput in files/s, input MB/s and megapixels/s "
+            "and the estimated time left every second on stderr: 'tty' "
+            "refreshes a single status line, 'json' writes a JSON object per "
+            "line for the monitoring tools, and 'none' only prints a message "
+            "for every file." )
+        .metavar( "FORMAT" )
+        .defaultval( "none" )
+        .action( OIIO::ArgParse::store() );
+}
+
+bool BatchConverter::parse_parameters( const OIIO::ArgParse &arg_parser )
+{
+    int jobs = arg_parser["jobs"].get<int>();
+    if ( jobs < 0 )
+    {
+        std::cerr << std::endl
+                  << "Invalid number of jobs: " << jobs << ". "
+                  << "The value must be 0 or greater." << std::endl;
+        return false;
+    }
+    settings.jobs = static_cast<size_t>( jobs );
+
+    std::string max_memory = arg_parser["max-memory"].get();
+    if ( !parse_memory_size( max_memory, settings.max_memory ) )
+    {
+        std::cerr << std::endl
+                  << "Invalid memory size: " << max_memory << ". "
+                  << "Expected a number of bytes with an optional suffix of "
+                  << "K, M, G or T, like 48G." << std::endl;
+        return false;
+    }
+
+    settings.pipeline    = arg_parser["pipeline"].get<int>();
+    settings.plan        = arg_parser["plan"].get<int>();
+    settings.keep_going  = arg_parser["keep-going"].get<int>();
+    settings.incremental = arg_parser["incremental"].get<int>();
+    settings.recursive   = arg_parser["recursive"].get<int>();
+    settings.watch       = arg_parser["watch"].get();
+    settings.job_file    = arg_parser["job-file"].get();
+    settings.serve       = arg_parser["serve"].get();
+    settings.connect     = arg_parser["connect"].get();
+
+    std::string shard = arg_parser["shard"].get();
+    if ( !shard.empty() &&
+         !parse_shard( shard, settings.shard_index, settings.shard_count ) )
+    {
+        std::cerr << std::endl
+                  << "Invalid shard: " << shard << ". "
+                  << "Expected I/N, where N is the number of shards, and I is "
+                  << "the index of the shard from 0 to N-1." << std::endl;
+        return false;
+    }
+
+    std::string order = arg_parser["order"].get();
+    if ( order == "input" )
+    {
+        settings.order = Settings::Order::Input;
+    }
+    else if ( order == "largest-first" )
+    {
+        settings.order = Settings::Order::LargestFirst;
+    }
+    else if ( order == "physical" )
+    {
+        settings.order = Settings::Order::Physical;
+    }
+    else
+    {
+        std::cerr << std::endl
+                  << "Unsupported scheduling order: '" << order << "'. "
+                  << "The following orders are supported: input, "
+                  << "largest-first, physical." << std::endl;
+        return false;
+    }
+
+    std::string progress = arg_parser["progress"].get();
+    if ( progress == "none" )
+    {
+        settings.progress = Settings::Progress::None;
+    }
+    else if ( progress == "tty" )
+    {
+        settings.progress = Settings::Progress::TTY;
+    }
+    else if ( progress == "json" )
+    {
+        settings.progress = Settings::Progress::JSON;
+    }
+    else
+    {
+        std::cerr << std::endl
+                  << "Unsupported progress format: '" << progress << "'. "
+                  << "The following formats are supported: none, tty, json."
+                  << std::endl;
+        return false;
+    }
+
+    settings.shard_by_size = arg_parser["shard-by-size"].get<int>();
+    if ( settings.shard_by_size &&
+         ( settings.recursive || !settings.watch.empty() ) )
+    {
+        std::cerr << std::endl
+                  << "The --shard-by-size option needs the full list of "
+                  << "files, and can't be combined with --recursive or "
+                  << "--watch." << std::endl;
+        return false;
+    }
+
+    if ( !settings.job_file.empty() &&
+         ( settings.incremental || !settings.watch.empty() ) )
+    {
+        std::cerr << std::endl
+                  << "The --job-file option can't be combined with "
+                  << "--incremental or --watch." << std::endl;
+        return false;
+    }
+
+    if ( !settings.serve.empty() &&
+         ( settings.incremental || !settings.watch.empty() ||
+           !settings.job_file.empty() || !settings.connect.empty() ) )
+    {
+        std::cerr << std::endl
+                  << "The --serve option can't be combined with --incremental, "
+                  << "--watch, --job-file or --connect." << std::endl;
+        return false;
+    }
+
+    if ( !settings.connect.empty() &&
+         ( settings.incremental || !settings.watch.empty() ) )
+    {
+        std::cerr << std::endl
+                  << "The --connect option can't be combined with "
+                  << "--incremental or --watch." << std::endl;
+        return false;
+    }
+
+    if ( settings.plan &&
+         ( settings.recursive || !settings.watch.empty() ||
+           !settings.job_file.empty() || !settings.serve.empty() ||
+           !settings.connect.empty() ) )
+    {
+        std::cerr << std::endl
+                  << "The --plan option needs the full list of files, and "
+                  << "can't be combined with --recursive, --watch, "
+                  << "--job-file, --serve or --connect." << std::endl;
+        return false;
+    }
+
+    if ( ( !settings.serve.empty() || !settings.connect.empty() ) &&
+         !LocalSocket::is_supported() )
+    {
+        std::cerr << std::endl
+                  << "Unix domain sockets are not supported on this platform."
+                  << std::endl;
+        return false;
+    }
+
+    if ( !settings.watch.empty() && !DirectoryWatcher::is_supported() )
+    {
+        std::cerr << std::endl
+                  << "Watching directories is not supported on this platform."
+                  << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool BatchConverter::process_files(
+    const ImageConverter &converter, const std::vector<std::string> &files )
+{
+    _failures.clear();
+    _total_files = 0;
+
+    std::unique_ptr<IncrementalState> incremental;
+    if ( settings.incremental )
+        incremental = std::make_unique<IncrementalState>( converter );
+
+    // The files to convert, their indices in `files`, and whether their
+    // outputs can be replaced regardless of the overwrite setting.
+    std::vector<std::string> pending_files;
+    std::vector<size_t>      pending_indices;
+    std::vector<bool>        replace_outputs;
+
+    std::vector<size_t> shard = select_shard( files );
+    if ( settings.shard_count > 1 )
+    {
+        std::cout << "Shard " << settings.shard_index << "/"
+                  << settings.shard_count << ": " << shard.size() << " of "
+                  << files.size() << " files." << std::endl;
+    }
+
+    schedule_files( files, shard );
+
+    for ( size_t i: shard )
+    {
+        bool replace_output = false;
+        if ( incremental && incremental->is_unchanged( files[i], replace_output ) )
+        {
+            std::cout << "Skipping unchanged file: " << files[i] << std::endl;
+            continue;
+        }
+
+        pending_files.push_back( files[i] );
+        pending_indices.push_back( i );
+        replace_outputs.push_back( replace_output );
+    }
+
+    if ( pending_files.empty() )
+        return true;
+
+    TransformPlan plan;
+    if ( settings.plan )
+    {
+        plan.build(
+            converter,
+            pending_files,
+            worker_count( settings, pending_files.size() ) );
+        std::cout << "Planned " << plan.size()
+                  << " distinct colour transforms for " << pending_files.size()
+                  << " files." << std::endl;
+    }
+
+    Batch batch(
+        pending_files.size(), settings.keep_going, settings.max_memory );
+    run_batch( batch, settings, converter, pending_files.size(), [&]() {
+        for ( size_t i = 0; i < pending_files.size(); i++ )
+        {
+            const ImageConverter::Transform *transform =
+                settings.plan ? plan.get( i ) : nullptr;
+            if ( !batch.add( pending_files[i], replace_outputs[i], transform ) )
+                break;
+        }
+    } );
+
+    bool result = !incremental || record_converted( batch, *incremental );
+
+    _failures    = batch.take_failures();
+    _total_files = batch.size();
+    for ( auto &failure: _failures )
+        failure.index = pending_indices[failure.index];
+    sort_failures( _failures );
+
+    if ( settings.keep_going && !_failures.empty() )
+        print_failure_summary( std::cerr );
+
+    return result && _failures.empty();
+}
+
+bool BatchConverter::process_paths(
+    const ImageConverter &converter, const std::vector<std::string> &paths )
+{
+    _failures.clear();
+    _total_files = 0;
+
+    std::unique_ptr<IncrementalState> incremental;
+    if ( settings.incremental )
+        incremental = std::make_unique<IncrementalState>( converter );
+
+    ScanOptions options;
+    options.recursive = settings.recursive;
+    options.raw_only  = true;
+    options.threads   = settings.jobs;
+
+    // The files get converted as soon as they are found, so the total number
+    // of files is not known in advance.
+    Batch batch( 0, settings.keep_going, settings.max_memory );
+    run_batch( batch, settings, converter, 0, [&]() {
+        scan_image_files( paths, options, [&]( const std::string &file ) {
+            if ( !is_in_shard( file ) )
+                return true;
+
+            bool replace_output = false;
+            if ( incremental &&
+                 incremental->is_unchanged( file, replace_output ) )
+            {
+                std::cout << "Skipping unchanged file: " << file << std::endl;
+                return true;
+            }
+
+            return batch.add( file, replace_output );
+        } );
+    } );
+
+    bool result = !incremental || record_converted( batch, *incremental );
+
+    _failures    = batch.take_failures();
+    _total_files = batch.size();
+
+    if ( settings.keep_going && !_failures.empty() )
+        print_failure_summary( std::cerr );
+
+    return result && _failures.empty();
+}
+
+bool BatchConverter::process_job_file(
+    const ImageConverter &converter, const std::string &path )
+{
+    _failures.clear();
+    _total_files = 0;
+
+    std::vector<ConversionJob> jobs;
+    if ( !read_job_file( path, converter.settings, jobs ) )
+        return false;
+
+    std::vector<std::string> inputs;
+    for ( const auto &job: jobs )
+        inputs.push_back( job.input );
+
+    std::vector<size_t> shard = select_shard( inputs );
+    if ( settings.shard_count > 1 )
+    {
+        std::cout << "Shard " << settings.shard_index << "/"
+                  << settings.shard_count << ": " << shard.size() << " of "
+                  << jobs.size() << " jobs." << std::endl;
+    }
+
+    if ( shard.empty() )
+        return true;
+
+    schedule_files( inputs, shard );
+
+    Batch batch( shard.size(), settings.keep_going, settings.max_memory );
+    run_batch( batch, settings, converter, shard.size(), [&]() {
+        for ( size_t i: shard )
+        {
+            if ( !batch.add( jobs[i] ) )
+                break;
+        }
+    } );
+
+    _failures    = batch.take_failures();
+    _total_files = batch.size();
+    for ( auto &failure: _failures )
+        failure.index = shard[failure.index];
+    sort_failures( _failures );
+
+    if ( settings.keep_going && !_failures.empty() )
+        print_failure_summary( std::cerr );
+
+    return _failures.empty();
+}
+
+bool BatchConverter::watch_directory(
+    const ImageConverter &converter, const std::string &directory )
+{
+    _failures.clear();
+    _total_files = 0;
+
+    // Start watching before looking for the existing files, so the files
+    // arriving in between don't get missed.
+    DirectoryWatcher watcher( settings.recursive );
+    if ( !watcher.add_directory( directory ) )
+        return false;
+
+    std::unique_ptr<IncrementalState> incremental;
+    if ( settings.incremental )
+        incremental = std::make_unique<IncrementalState>( converter );
+
+    std::set<std::string> raw_extensions = raw_file_extensions();
+
+    // A watching batch is never stopped by failures. The state of every file
+    // is dropped once it is done, and the converted files get recorded in
+    // the manifests right away, so a crash only loses the files converted
+    // since the last save.
+    Batch batch( 0, true, settings.max_memory );
+    batch.release_done = true;
+    if ( incremental )
+    {
+        batch.on_done = [&]( size_t index, const Failure *failure ) {
+            if ( failure )
+                incremental->forget( batch.file( index ) );
+            else
+                incremental->record( batch.file( index ) );
+        };
+    }
+
+    auto add_file = [&]( const std::string &file ) {
+        if ( !is_in_shard( file ) )
+            return;
+
+        bool replace_output = false;
+        if ( incremental && incremental->is_unchanged( file, replace_output ) )
+        {
+            std::cout << "Skipping unchanged file: " << file << std::endl;
+            return;
+        }
+
+        batch.add( file, replace_output );
+    };
+
+    bool watching = true;
+    run_batch( batch, settings, converter, 0, [&]() {
+        if ( incremental )
+        {
+            ScanOptions options;
+            options.recursive = settings.recursive;
+            options.raw_only  = true;
+            options.threads   = settings.jobs;
+
+            scan_image_files(
+                { directory }, options, [&]( const std::string &file ) {
+                    add_file( file );
+                    return !_stop;
+                } );
+        }
+
+        std::cout << "Watching directory " << directory
+                  << " for new files." << std::endl;
+
+        // Wake up periodically to check whether the watching has to stop.
+        const int timeout_ms = 250;
+
+        std::vector<std::string> files;
+        while ( !_stop )
+        {
+            // Saves the records made since the last wakeup, if any.
+            if ( incremental )
+                incremental->save();
+
+            files.clear();
+            if ( !watcher.wait( timeout_ms, files ) )
+            {
+                watching = false;
+                break;
+            }
+
+            for ( const auto &file: files )
+            {
+                std::filesystem::path path( file );
+                std::string           extension =
+                    OIIO::Strutil::lower( path.extension().string() );
+
+                if ( is_ignored_file( path ) ||
+                     ( !raw_extensions.empty() &&
+                       raw_extensions.count( extension ) == 0 ) )
+                    continue;
+
+                add_file( file );
+            }
+        }
+    } );
+
+    std::cout << "Stopped watching directory " << directory << "."
+              << std::endl;
+
+    bool result = !incremental || incremental->save();
+
+    _failures    = batch.take_failures();
+    _total_files = batch.size();
+
+    if ( !_failures.empty() )
+        print_failure_summary( std::cerr );
+
+    return watching && result && _failures.empty();
+}
+
+bool BatchConverter::serve(
+    const ImageConverter &converter, const std::string &socket_path )
+{
+    _failures.clear();
+    _total_files = 0;
+
+    LocalSocketListener listener;
+    if ( !listener.listen( socket_path ) )
+        return false;
+
+    // A request waiting for its file to get converted.
+    struct Request
+    {
+        std::shared_ptr<LocalSocket>          connection;
+        nlohmann::json                        id;
+        std::unique_ptr<ConversionJob>        job;
+        std::chrono::steady_clock::time_point received;
+    };
+
+    std::mutex                requests_mutex;
+    std::map<size_t, Request> requests;
+
+    // A serving batch is never stopped by failures. The request, the state
+    // of its file and its failure are all dropped once the response is sent,
+    // so the memory used by a long-running server doesn't grow with every
+    // request.
+    Batch batch( 0, true, settings.max_memory );
+    batch.release_done  = true;
+    batch.keep_failures = false;
+
+    batch.on_done = [&]( size_t index, const Failure *failure ) {
+        Request request;
+        {
+            std::lock_guard<std::mutex> lock( requests_mutex );
+            auto                        iter = requests.find( index );
+            request                          = std::move( iter->second );
+            requests.erase( iter );
+        }
+
+        auto start_time = batch.start_time( index );
+
+        nlohmann::json response = {
+            { "status", failure ? "error" : "ok" },
+            { "input", request.job->input },
+            { "output", batch.output( index ) },
+            { "time",
+              seconds_between( start_time, std::chrono::steady_clock::now() ) },
+            { "queued", seconds_between( request.received, start_time ) }
+        };
+        if ( failure )
+        {
+            response["stage"]  = failure->stage;
+            response["reason"] = failure->reason;
+        }
+        if ( !request.id.is_null() )
+            response["id"] = request.id;
+
+        request.connection->write_line( response.dump() );
+    };
+
+    std::atomic<bool> serving = true;
+
+    // Wake up periodically to check whether the serving has to stop.
+    const int timeout_ms = 250;
+
+    // Read the requests of a client, and add them to the batch. The malformed
+    // requests get answered right away.
+    auto serve_client = [&]( const std::shared_ptr<LocalSocket> &connection ) {
+        std::string line;
+        while ( serving && !_stop )
+        {
+            auto status = connection->read_line( line, timeout_ms );
+            if ( status == LocalSocket::ReadResult::Timeout )
+                continue;
+            if ( status != LocalSocket::ReadResult::Line )
+                break;
+            if ( line.find_first_not_of( " \t" ) == std::string::npos )
+                continue;
+
+            Request request;
+            request.connection = connection;
+            request.job        = std::make_unique<ConversionJob>();
+            request.received   = std::chrono::steady_clock::now();
+
+            nlohmann::json data = nlohmann::json::parse( line, nullptr, false );
+            if ( data.is_object() && data.contains( "id" ) )
+            {
+                request.id = data["id"];
+                data.erase( "id" );
+            }
+
+            std::string error;
+            if ( data.is_discarded() )
+                error = "Not a valid JSON value.";
+            else
+                parse_job_value(
+                    data, converter.settings, *request.job, error );
+
+            if ( !error.empty() )
+            {
+                nlohmann::json response = { { "status", "error" },
+                                            { "stage", "request" },
+                                            { "reason", error } };
+                if ( !request.id.is_null() )
+                    response["id"] = request.id;
+
+                connection->write_line( response.dump() );
+                continue;
+            }
+
+            // Adding under the lock keeps the response from being sent
+            // before the request is registered.
+            std::lock_guard<std::mutex> lock( requests_mutex );
+            size_t                      index = batch.size();
+            const ConversionJob        &job   = *request.job;
+            requests[index]                   = std::move( request );
+            batch.add( job );
+        }
+    };
+
+    run_batch( batch, settings, converter, 0, [&]() {
+        std::cout << "Serving the conversion requests on " << socket_path
+                  << "." << std::endl;
+
+        struct Client
+        {
+            std::thread                        thread;
+            std::shared_ptr<std::atomic<bool>> finished;
+        };
+        std::list<Client> clients;
+
+        while ( !_stop )
+        {
+            std::unique_ptr<LocalSocket> connection;
+            if ( !listener.accept( timeout_ms, connection ) )
+            {
+                serving = false;
+                break;
+            }
+
+            // Join the threads of the clients which have disconnected.
+            for ( auto iter = clients.begin(); iter != clients.end(); )
+            {
+                if ( *iter->finished )
+                {
+                    iter->thread.join();
+                    iter = clients.erase( iter );
+                }
+                else
+                    ++iter;
+            }
+
+            if ( !connection )
+                continue;
+
+            std::shared_ptr<LocalSocket> client( std::move( connection ) );
+            auto finished = std::make_shared<std::atomic<bool>>( false );
+            clients.push_back(
+                { std::thread( [&serve_client, client, finished]() {
+                      serve_client( client );
+                      *finished = true;
+                  } ),
+                  finished } );
+        }
+
+        for ( auto &client: clients )
+            client.thread.join();
+    } );
+
+    std::cout << "Stopped serving on " << socket_path << "." << std::endl;
+
+    _total_files    = batch.size();
+    uint64_t failed = batch.counters.files_failed;
+    if ( failed > 0 )
+    {
+        std::cerr << "Conversion summary: " << _total_files - failed << " of "
+                  << _total_files << " files converted, " << failed
+                  << " failed, see the responses for the reasons."
+                  << std::endl;
+    }
+
+    return serving && failed == 0;
+}
+
+bool BatchConverter::submit_files(
+    const std::string &socket_path, const std::vector<std::string> &files )
+{
+    _failures.clear();
+    _total_files = 0;
+
+    // The server may be running in another directory.
+    std::vector<nlohmann::json> requests;
+    for ( const auto &file: files )
+    {
+        std::error_code error;
+        auto            path = std::filesystem::absolute( file, error );
+        requests.push_back(
+            { { "input", error ? file : path.lexically_normal().string() } } );
+    }
+
+    if ( !send_requests( socket_path, requests, _failures ) )
+        return false;
+
+    // The server converts all files regardless of the failures, the same as
+    // with `Settings::keep_going`.
+    _total_files = requests.size();
+    if ( !_failures.empty() )
+        print_failure_summary( std::cerr );
+
+    return _failures.empty();
+}
+
+bool BatchConverter::submit_job_file(
+    const std::string &socket_path, const std::string &path )
+{
+    _failures.clear();
+    _total_files = 0;
+
+    std::ifstream stream( path );
+    if ( !stream.is_open() )
+    {
+        std::cerr << "ERROR: Failed to open the job file " << path << "."
+                  << std::endl;
+        return false;
+    }
+
+    // The jobs are validated by the server, only the paths get resolved
+    // here, as the server may be running in another directory.
+    bool                        result      = true;
+    size_t                      line_number = 0;
+    std::string                 line;
+    std::vector<nlohmann::json> requests;
+    while ( std::getline( stream, line ) )
+    {
+        line_number++;
+        if ( line.find_first_not_of( " \t\r" ) == std::string::npos )
+            continue;
+
+        nlohmann::json data = nlohmann::json::parse( line, nullptr, false );
+        if ( !data.is_object() )
+        {
+            std::cerr << "ERROR: " << path << ":" << line_number << ": "
+                      << "Expected a JSON object." << std::endl;
+            result = false;
+            continue;
+        }
+
+        for ( const char *key: { "input", "output" } )
+        {
+            std::error_code error;
+            if ( data.contains( key ) && data[key].is_string() &&
+                 !data[key].get<std::string>().empty() )
+            {
+                auto absolute = std::filesystem::absolute(
+                    data[key].get<std::string>(), error );
+                if ( !error )
+                    data[key] = absolute.lexically_normal().string();
+            }
+        }
+
+        requests.push_back( std::move( data ) );
+    }
+
+    if ( !result || !send_requests( socket_path, requests, _failures ) )
+        return false;
+
+    _total_files = requests.size();
+    if ( !_failures.empty() )
+        print_failure_summary( std::cerr );
+
+    return _failures.empty();
+}
+
+void BatchConverter::stop()
+{
+    _stop = true;
+}
+
+std::vector<size_t>
+BatchConverter::select_shard( const std::vector<std::string> &files ) const
+{
+    std::vector<size_t> result;
+
+    if ( settings.shard_count <= 1 )
+    {
+        result.resize( files.size() );
+        for ( size_t i = 0; i < files.size(); i++ )
+            result[i] = i;
+        return result;
+    }
+
+    if ( !settings.shard_by_size )
+    {
+        for ( size_t i = 0; i < files.size(); i++ )
+        {
+            if ( is_in_shard( files[i] ) )
+                result.push_back( i );
+        }
+        return result;
+    }
+
+    // Assign the largest remaining file to the least loaded shard. The files
+    // are ordered by size and then by path, and the ties between the shards
+    // go to the one having fewer files, then to the lowest index, so every
+    // process makes the same assignment.
+    std::vector<uint64_t> sizes( files.size(), 0 );
+    for ( size_t i = 0; i < files.size(); i++ )
+    {
+        std::error_code error;
+        auto            size = std::filesystem::file_size( files[i], error );
+        if ( !error )
+            sizes[i] = static_cast<uint64_t>( size );
+    }
+
+    std::vector<size_t> order( files.size() );
+    for ( size_t i = 0; i < files.size(); i++ )
+        order[i] = i;
+    std::sort( order.begin(), order.end(), [&]( size_t a, size_t b ) {
+        if ( sizes[a] != sizes[b] )
+            return sizes[a] > sizes[b];
+        return files[a] < files[b];
+    } );
+
+    // The total size and the number of files of every shard.
+    std::vector<std::pair<uint64_t, size_t>> loads(
+        settings.shard_count, { 0, 0 } );
+    for ( size_t i: order )
+    {
+        size_t shard =
+            std::min_element( loads.begin(), loads.end() ) - loads.begin();
+        loads[shard].first += sizes[i];
+        loads[shard].second++;
+
+        if ( shard == settings.shard_index )
+            result.push_back( i );
+    }
+
+    std::sort( result.begin(), result.end() );
+    return result;
+}
+
+void BatchConverter::schedule_files(
+    const std::vector<std::string> &files, std::vector<size_t> &indices ) const
+{
+    if ( settings.order == Settings::Order::Input )
+        return;
+
+    // The sort keys of the files, the inaccessible files having no key.
+    std::map<size_t, std::pair<uint64_t, uint64_t>> keys;
+    for ( size_t i: indices )
+    {
+        if ( settings.order == Settings::Order::LargestFirst )
+        {
+            std::error_code error;
+            auto            size = std::filesystem::file_size( files[i], error );
+            if ( !error )
+                keys[i] = { 0, static_cast<uint64_t>( size ) };
+        }
+        else
+        {
+#ifndef WIN32
+            // Extent maps would be more precise, but need a privileged or
+            // filesystem-specific query, while the inode numbers mostly
+            // follow the allocation order on the common filesystems.
+            struct stat status;
+            if ( stat( files[i].c_str(), &status ) == 0 )
+            {
+                keys[i] = { static_cast<uint64_t>( status.st_dev ),
+                            static_cast<uint64_t>( status.st_ino ) };
+            }
+#else
+            return;
+#endif
+        }
+    }
+
+    std::stable_sort( indices.begin(), indices.end(), [&]( size_t a, size_t b ) {
+        auto key_a = keys.find( a );
+        auto key_b = keys.find( b );
+        if ( key_a == keys.end() || key_b == keys.end() )
+            return key_b == keys.end() && key_a != keys.end();
+
+        if ( settings.order == Settings::Order::LargestFirst )
+            return key_a->second.second > key_b->second.second;
+        return key_a->second < key_b->second;
+    } );
+}
+
+bool BatchConverter::is_in_shard( const std::string &file ) const
+{
+    if ( settings.shard_count <= 1 )
+        return true;
+
+    std::string path = std::filesystem::path( file ).lexically_normal().string();
+    return hash_path( path ) % settings.shard_count == settings.shard_index;
+}
+
+const std::vector<BatchConverter::Failure> &BatchConverter::get_failures() const
+{
+    return _failures;
+}
+
+size_t BatchConverter::get_total_files() const
+{
+    return _total_files;
+}
+
+void BatchConverter::print_failure_summary( std::ostream &stream ) const
+{
+    const std::string file_header = "File";
+    const int         stage_width = 9;
+    const int         time_width  = 10;
+
+    size_t file_width = file_header.size();
+    for ( const auto &failure: _failures )
+        file_width = std::max( file_width, failure.file.size() );
+
+    // Format into a local stream to leave the flags of `stream` untouched.
+    std::ostringstream table;
+    table << std::endl
+          << "Conversion summary: " << _total_files - _failures.size()
+          << " of " << _total_files << " files converted, "
+          << _failures.size() << " failed." << std::endl;
+
+    if ( !_failures.empty() )
+    {
+        table << std::left << std::setw( static_cast<int>( file_width ) )
+              << file_header << "  " << std::setw( stage_width ) << "Stage"
+              << "  " << std::right << std::setw( time_width ) << "Time (s)"
+              << "  " << "Reason" << std::endl;
+
+        table << std::fixed << std::setprecision( 3 );
+        for ( const auto &failure: _failures )
+        {
+            table << std::left << std::setw( static_cast<int>( file_width ) )
+                  << failure.file << "  " << std::setw( stage_width )
+                  << failure.stage << "  " << std::right
+                  << std::setw( time_width ) << failure.elapsed << "  "
+                  << failure.reason << std::endl;
+        }
+    }
+
+    stream << table.str();
+}
+
+} //namespace util
+} //namespace rta
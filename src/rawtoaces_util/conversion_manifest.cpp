@@ -0,0 +1,204 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+#include "conversion_manifest.h"
+
+#include <nlohmann/json.hpp>
+
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace rta
+{
+namespace util
+{
+
+// Increment when the layout of the manifest file changes.
+static const int manifest_version = 1;
+
+const char *const ConversionManifest::file_name = ".rawtoaces_manifest.json";
+
+ConversionManifest::ConversionManifest( const std::string &directory )
+    : _path( ( std::filesystem::path( directory ) / file_name ).string() )
+{}
+
+bool ConversionManifest::load()
+{
+    _entries.clear();
+
+    std::ifstream stream( _path );
+    if ( !stream.is_open() )
+        return true;
+
+    try
+    {
+        nlohmann::json data = nlohmann::json::parse( stream );
+        if ( data.at( "version" ).get<int>() != manifest_version )
+            return true;
+
+        for ( auto &[input, value]: data.at( "files" ).items() )
+        {
+            Entry entry;
+            entry.size          = value.at( "size" ).get<uint64_t>();
+            entry.mtime         = value.at( "mtime" ).get<int64_t>();
+            entry.settings_hash = value.at( "settings" ).get<std::string>();
+            entry.output        = value.at( "output" ).get<std::string>();
+            _entries[input]     = entry;
+        }
+    }
+    catch ( const nlohmann::json::exception &e )
+    {
+        std::cerr << "Warning: Ignoring the malformed manifest file " << _path
+                  << ": " << e.what() << std::endl;
+        _entries.clear();
+        return false;
+    }
+
+    return true;
+}
+
+bool ConversionManifest::save() const
+{
+    nlohmann::json files = nlohmann::json::object();
+    for ( const auto &[input, entry]: _entries )
+    {
+        files[input] = { { "size", entry.size },
+                         { "mtime", entry.mtime },
+                         { "settings", entry.settings_hash },
+                         { "output", entry.output } };
+    }
+
+    nlohmann::json data = { { "version", manifest_version },
+                            { "files", files } };
+
+    std::string temp_path = _path + ".tmp";
+    {
+        std::ofstream stream( temp_path );
+        if ( !stream.is_open() )
+        {
+            std::cerr << "ERROR: Failed to write the manifest file "
+                      << temp_path << "." << std::endl;
+            return false;
+        }
+        stream << data.dump( 4 ) << std::endl;
+        if ( !stream.good() )
+        {
+            std::cerr << "ERROR: Failed to write the manifest file "
+                      << temp_path << "." << std::endl;
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename( temp_path, _path, error );
+    if ( error )
+    {
+        std::cerr << "ERROR: Failed to replace the manifest file " << _path
+                  << ": " << error.message() << std::endl;
+        std::filesystem::remove( temp_path, error );
+        return false;
+    }
+
+    return true;
+}
+
+const ConversionManifest::Entry *
+ConversionManifest::find( const std::string &input ) const
+{
+    auto iter = _entries.find( input );
+    if ( iter == _entries.end() )
+        return nullptr;
+    return &iter->second;
+}
+
+void ConversionManifest::update( const std::string &input, const Entry &entry )
+{
+    _entries[input] = entry;
+}
+
+const std::string &ConversionManifest::path() const
+{
+    return _path;
+}
+
+bool ConversionManifest::stat_input( const std::string &input, Entry &entry )
+{
+    std::error_code error;
+
+    auto size = std::filesystem::file_size( input, error );
+    if ( error )
+        return false;
+
+    auto mtime = std::filesystem::last_write_time( input, error );
+    if ( error )
+        return false;
+
+    entry.size  = static_cast<uint64_t>( size );
+    entry.mtime = static_cast<int64_t>( mtime.time_since_epoch().count() );
+    return true;
+}
+
+std::string
+ConversionManifest::hash_settings( const ImageConverter::Settings &settings )
+{
+    // Serialise the relevant settings into a string. Strings are prefixed
+    // with their lengths, and floats are written in the exact hexadecimal
+    // notation, so different settings never produce the same string.
+    std::ostringstream stream;
+    stream << std::hexfloat;
+
+    auto add_string = [&stream]( const std::string &value ) {
+        stream << value.size() << ':' << value << ';';
+    };
+
+    add_string( RAWTOACES_VERSION );
+
+    stream << static_cast<int>( settings.WB_method ) << ';'
+           << static_cast<int>( settings.matrix_method ) << ';'
+           << static_cast<int>( settings.crop_mode ) << ';';
+    add_string( settings.illuminant );
+
+    stream << settings.headroom << ';';
+    for ( int value: settings.WB_box )
+        stream << value << ';';
+    for ( float value: settings.custom_WB )
+        stream << value << ';';
+    for ( const auto &row: settings.custom_matrix )
+        for ( float value: row )
+            stream << value << ';';
+
+    add_string( settings.custom_camera_make );
+    add_string( settings.custom_camera_model );
+
+    stream << settings.auto_bright << ';' << settings.adjust_maximum_threshold
+           << ';' << settings.black_level << ';' << settings.saturation_level
+           << ';' << settings.half_size << ';' << settings.highlight_mode << ';'
+           << settings.flip << ';';
+    for ( int value: settings.crop_box )
+        stream << value << ';';
+    for ( float value: settings.chromatic_aberration )
+        stream << value << ';';
+    stream << settings.denoise_threshold << ';' << settings.scale << ';';
+    add_string( settings.demosaic_algorithm );
+
+    for ( const auto &directory: settings.database_directories )
+        add_string( directory );
+
+    // 64-bit FNV-1a.
+    uint64_t hash = 14695981039346656037ull;
+    for ( unsigned char c: stream.str() )
+    {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+
+    std::ostringstream result;
+    result << std::hex << std::setw( 16 ) << std::setfill( '0' ) << hash;
+    return result.str();
+}
+
+} // namespace util
+} // namespace rta
@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+#pragma once
+
+#include <rawtoaces/image_converter.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace rta
+{
+namespace util
+{
+
+/// A record of the files converted into a single output directory. The
+/// manifest is stored as a JSON file in the output directory, and lets an
+/// incremental batch skip the input files which have not changed since they
+/// were last converted with the same settings.
+class ConversionManifest
+{
+public:
+    /// The state of an input file at the time of its conversion.
+    struct Entry
+    {
+        /// The size of the input file in bytes.
+        uint64_t size = 0;
+
+        /// The modification time of the input file, in the units of
+        /// `std::filesystem::file_time_type`.
+        int64_t mtime = 0;
+
+        /// The hash of the converter settings, see `hash_settings()`.
+        std::string settings_hash;
+
+        /// The path of the output file.
+        std::string output;
+    };
+
+    /// The name of the manifest file inside the output directory.
+    static const char *const file_name;
+
+    /// Construct an empty manifest for the given output directory.
+    /// @param directory the output directory the manifest belongs to.
+    explicit ConversionManifest( const std::string &directory );
+
+    /// Load the manifest file from the output directory. A missing file
+    /// results in an empty manifest.
+    /// @result `false` if the manifest file exists but can't be parsed, in
+    /// which case the manifest is left empty.
+    bool load();
+
+    /// Save the manifest file into the output directory. The file is written
+    /// under a temporary name first and then renamed, so an interrupted write
+    /// never leaves a truncated manifest behind.
+    /// @result `true` if saved successfully.
+    bool save() const;
+
+    /// Find the entry of an input file.
+    /// @param input the absolute path of the input file.
+    /// @result a pointer to the entry, or `nullptr` if the file is unknown.
+    const Entry *find( const std::string &input ) const;
+
+    /// Add or replace the entry of an input file.
+    /// @param input the absolute path of the input file.
+    /// @param entry the entry to store.
+    void update( const std::string &input, const Entry &entry );
+
+    /// Get the path of the manifest file.
+    const std::string &path() const;
+
+    /// Read the size and modification time of an input file.
+    /// @param input the path of the input file.
+    /// @param entry the entry to fill in, the other fields are left untouched.
+    /// @result `false` if the file can't be accessed.
+    static bool stat_input( const std::string &input, Entry &entry );
+
+    /// Calculate a hash of the converter settings which affect the converted
+    /// pixels. The settings controlling the output location, overwriting and
+    /// diagnostics are excluded. The version of rawtoaces is included, so
+    /// upgrading the tool invalidates the existing manifests.
+    /// @param settings the converter settings.
+    /// @result the hash as a hexadecimal string.
+    static std::string hash_settings( const ImageConverter::Settings &settings );
+
+private:
+    std::string                  _path;
+    std::map<std::string, Entry> _entries;
+};
+
+} // namespace util
+} // namespace rta
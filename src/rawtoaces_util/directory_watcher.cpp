@@ -0,0 +1,296 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+#include "directory_watcher.h"
+
+#include <iostream>
+
+#ifdef __linux__
+#    include <cerrno>
+#    include <cstring>
+#    include <poll.h>
+#    include <sys/inotify.h>
+#    include <unistd.h>
+#endif
+
+namespace rta
+{
+namespace util
+{
+
+#ifdef __linux__
+
+DirectoryWatcher::DirectoryWatcher( bool recursive )
+    : _recursive( recursive ), _fd( inotify_init1( IN_NONBLOCK | IN_CLOEXEC ) )
+{
+    if ( _fd < 0 )
+    {
+        std::cerr << "ERROR: Failed to initialise the directory watcher: "
+                  << std::strerror( errno ) << std::endl;
+    }
+}
+
+DirectoryWatcher::~DirectoryWatcher()
+{
+    if ( _fd >= 0 )
+        close( _fd );
+}
+
+bool DirectoryWatcher::is_supported()
+{
+    return true;
+}
+
+bool DirectoryWatcher::add_directory( const std::string &directory )
+{
+    if ( _fd < 0 )
+        return false;
+
+    if ( !std::filesystem::is_directory( directory ) )
+    {
+        std::cerr << "ERROR: Not a directory: " << directory << std::endl;
+        return false;
+    }
+
+    return add_watch( directory );
+}
+
+bool DirectoryWatcher::add_watch( const std::filesystem::path &directory )
+{
+    // The subdirectories only need to be watched for getting created or
+    // moved in, but a single watch per directory covers both cases.
+    uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR;
+    if ( _recursive )
+        mask |= IN_CREATE;
+
+    int wd = inotify_add_watch( _fd, directory.c_str(), mask );
+    if ( wd < 0 )
+    {
+        std::cerr << "ERROR: Failed to watch the directory " << directory
+                  << ": " << std::strerror( errno ) << std::endl;
+        return false;
+    }
+    _directories[wd] = directory;
+
+    if ( !_recursive )
+        return true;
+
+    bool            result = true;
+    std::error_code error;
+    for ( std::filesystem::directory_iterator iter( directory, error ), end;
+          !error && iter != end;
+          iter.increment( error ) )
+    {
+        std::error_code entry_error;
+        if ( iter->is_directory( entry_error ) &&
+             !iter->is_symlink( entry_error ) )
+        {
+            result = add_watch( iter->path() ) && result;
+        }
+    }
+
+    return result;
+}
+
+bool DirectoryWatcher::wait( int timeout_ms, std::vector<std::string> &files )
+{
+    if ( _fd < 0 )
+        return false;
+
+    pollfd poll_fd = { _fd, POLLIN, 0 };
+    int    ready   = poll( &poll_fd, 1, timeout_ms );
+    if ( ready < 0 )
+    {
+        // Interrupted by a signal, let the caller check whether to stop.
+        if ( errno == EINTR )
+            return true;
+
+        std::cerr << "ERROR: Failed to wait for the directory events: "
+                  << std::strerror( errno ) << std::endl;
+        return false;
+    }
+    if ( ready == 0 )
+    {
+        report_pending( files );
+        return true;
+    }
+
+    alignas( inotify_event ) char buffer[64 * 1024];
+    ssize_t length;
+    while ( ( length = read( _fd, buffer, sizeof( buffer ) ) ) > 0 )
+    {
+        for ( char *ptr = buffer; ptr < buffer + length;
+              ptr += sizeof( inotify_event ) +
+                     reinterpret_cast<inotify_event *>( ptr )->len )
+        {
+            const inotify_event *event =
+                reinterpret_cast<inotify_event *>( ptr );
+
+            if ( event->mask & IN_Q_OVERFLOW )
+            {
+                std::cerr << "Warning: Too many files have arrived at once, "
+                          << "some of them may have been missed." << std::endl;
+                continue;
+            }
+
+            // The watch has been removed along with its directory.
+            if ( event->mask & IN_IGNORED )
+            {
+                _directories.erase( event->wd );
+                continue;
+            }
+
+            auto iter = _directories.find( event->wd );
+            if ( iter == _directories.end() || event->len == 0 )
+                continue;
+
+            std::filesystem::path path = iter->second / event->name;
+
+            if ( event->mask & IN_ISDIR )
+            {
+                if ( !_recursive )
+                    continue;
+
+                add_watch( path );
+
+                if ( event->mask & IN_CREATE )
+                {
+                    // The files written into a new directory before it got
+                    // watched won't produce any events, like when copying a
+                    // directory tree.
+                    add_pending( path );
+                }
+                else if ( event->mask & IN_MOVED_TO )
+                {
+                    // The files of a directory moved in from elsewhere are
+                    // complete already, and won't produce any events.
+                    std::error_code error;
+                    for ( std::filesystem::recursive_directory_iterator
+                              file_iter( path, error ),
+                          end;
+                          !error && file_iter != end;
+                          file_iter.increment( error ) )
+                    {
+                        std::error_code entry_error;
+                        if ( file_iter->is_regular_file( entry_error ) )
+                            files.push_back( file_iter->path().string() );
+                    }
+                }
+                continue;
+            }
+
+            if ( event->mask & ( IN_CLOSE_WRITE | IN_MOVED_TO ) )
+            {
+                _pending.erase( path );
+                files.push_back( path.string() );
+            }
+        }
+    }
+
+    if ( length < 0 && errno != EAGAIN && errno != EINTR )
+    {
+        std::cerr << "ERROR: Failed to read the directory events: "
+                  << std::strerror( errno ) << std::endl;
+        return false;
+    }
+
+    if ( _directories.empty() )
+    {
+        std::cerr << "ERROR: All watched directories have been removed."
+                  << std::endl;
+        return false;
+    }
+
+    report_pending( files );
+    return true;
+}
+
+void DirectoryWatcher::add_pending( const std::filesystem::path &directory )
+{
+    std::error_code error;
+    for ( std::filesystem::recursive_directory_iterator
+              iter( directory, error ),
+          end;
+          !error && iter != end;
+          iter.increment( error ) )
+    {
+        std::error_code entry_error;
+        if ( !iter->is_regular_file( entry_error ) ||
+             _pending.count( iter->path() ) )
+            continue;
+
+        PendingFile file;
+        file.size = iter->file_size( entry_error );
+        file.time = iter->last_write_time( entry_error );
+        if ( !entry_error )
+            _pending[iter->path()] = file;
+    }
+}
+
+void DirectoryWatcher::report_pending( std::vector<std::string> &files )
+{
+    for ( auto iter = _pending.begin(); iter != _pending.end(); )
+    {
+        std::error_code size_error, time_error;
+
+        auto size = std::filesystem::file_size( iter->first, size_error );
+        auto time = std::filesystem::last_write_time( iter->first, time_error );
+
+        PendingFile &file = iter->second;
+        if ( size_error || time_error )
+        {
+            // Removed before getting reported.
+            iter = _pending.erase( iter );
+        }
+        else if ( file.checked && size == file.size && time == file.time )
+        {
+            files.push_back( iter->first.string() );
+            iter = _pending.erase( iter );
+        }
+        else
+        {
+            file.size    = size;
+            file.time    = time;
+            file.checked = true;
+            ++iter;
+        }
+    }
+}
+
+#else
+
+DirectoryWatcher::DirectoryWatcher( bool recursive ) : _recursive( recursive )
+{}
+
+DirectoryWatcher::~DirectoryWatcher() {}
+
+bool DirectoryWatcher::is_supported()
+{
+    return false;
+}
+
+bool DirectoryWatcher::add_directory( const std::string &directory )
+{
+    std::cerr << "ERROR: Watching directories is not supported on this "
+              << "platform, can't watch " << directory << std::endl;
+    return false;
+}
+
+bool DirectoryWatcher::add_watch( const std::filesystem::path & )
+{
+    return false;
+}
+
+bool DirectoryWatcher::wait( int, std::vector<std::string> & )
+{
+    return false;
+}
+
+void DirectoryWatcher::add_pending( const std::filesystem::path & ) {}
+
+void DirectoryWatcher::report_pending( std::vector<std::string> & ) {}
+
+#endif
+
+} // namespace util
+} // namespace rta
@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace rta
+{
+namespace util
+{
+
+/// Reports the files which have been completely written into the watched
+/// directories. A file is reported once the program writing it closes it, or
+/// once it gets moved into a watched directory, so the files still being
+/// copied are never picked up half-written. The watcher is implemented using
+/// inotify, and is only available on Linux.
+class DirectoryWatcher
+{
+public:
+    /// @param recursive also watch the subdirectories of the watched
+    /// directories, including the ones created later.
+    explicit DirectoryWatcher( bool recursive );
+    ~DirectoryWatcher();
+
+    DirectoryWatcher( const DirectoryWatcher & )            = delete;
+    DirectoryWatcher &operator=( const DirectoryWatcher & ) = delete;
+
+    /// Check whether watching directories is supported on this platform.
+    static bool is_supported();
+
+    /// Start watching a directory.
+    /// @param directory the path of the directory.
+    /// @result `true` if the directory is being watched.
+    bool add_directory( const std::string &directory );
+
+    /// Wait for the files to get written into the watched directories.
+    /// @param timeout_ms the maximum time to wait in milliseconds.
+    /// @param files the list to append the paths of the written files to.
+    /// Nothing gets appended if the time has run out.
+    /// @result `false` if the directories can't be watched any more, because
+    /// of an error or because all of them have been removed.
+    bool wait( int timeout_ms, std::vector<std::string> &files );
+
+private:
+    /// Watch a directory, and its subdirectories in the recursive mode.
+    bool add_watch( const std::filesystem::path &directory );
+
+    bool _recursive;
+    int  _fd = -1;
+
+    /// The watched directories by their watch descriptors.
+    std::map<int, std::filesystem::path> _directories;
+
+    /// A file found in a directory created while watching, which may still
+    /// be getting written, as the directory has not been watched yet when the
+    /// file got opened.
+    struct PendingFile
+    {
+        std::uintmax_t                  size = 0;
+        std::filesystem::file_time_type time;
+
+        /// Whether the file has been checked by a previous `wait()` call.
+        bool checked = false;
+    };
+
+    /// Collect the files of a directory created while watching, which have
+    /// been written before the directory got watched.
+    void add_pending( const std::filesystem::path &directory );
+
+    /// Report the pending files which have not changed since the previous
+    /// `wait()` call. The files still getting written get reported when
+    /// closed instead, like all other files.
+    void report_pending( std::vector<std::string> &files );
+
+    /// The files found in the created directories, not reported yet.
+    std::map<std::filesystem::path, PendingFile> _pending;
+};
+
+} // namespace util
+} // namespace rta
@@ -3,10 +3,20 @@
 
 #include <rawtoaces/image_converter.h>
 #include <rawtoaces/rawtoaces_core.h>
+#include <rawtoaces/spectral_database.h>
 #include <rawtoaces/usage_timer.h>
 
+#include "conversion_manifest.h"
+#include "transform_cache.h"
+#include "work_queue.h"
+
+#include <cmath>
 #include <set>
+#include <sstream>
 #include <filesystem>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 #include <OpenImageIO/imageio.h>
 #include <OpenImageIO/imagebuf.h>
@@ -38,6 +48,25 @@ struct CameraIdentifier
     }
 };
 
+/// Checks if a file should be skipped when collecting the image files, like
+/// system files (.DS_Store), the files in the formats rawtoaces produces (EXR)
+/// and the preview images (JPEG).
+bool is_ignored_file( const std::filesystem::path &path )
+{
+    static const std::set<std::string> ignore_filenames = {
+        ".DS_Store", ConversionManifest::file_name
+    };
+    std::string filename = path.filename().string();
+    if ( ignore_filenames.count( filename ) > 0 )
+        return true;
+
+    static const std::set<std::string> ignore_extensions = { ".exr",
+                                                             ".jpg",
+                                                             ".jpeg" };
+    std::string extension = OIIO::Strutil::lower( path.extension().string() );
+    return ignore_extensions.count( extension ) > 0;
+}
+
 /**
  * Checks if a file path is valid for processing and adds it to a batch list if appropriate.
  *
@@ -59,16 +88,7 @@ void check_and_add_file(
         return;
     }
 
-    static const std::set<std::string> ignore_filenames = { ".DS_Store" };
-    std::string                        filename = path.filename().string();
-    if ( ignore_filenames.count( filename ) > 0 )
-        return;
-
-    static const std::set<std::string> ignore_extensions = { ".exr",
-                                                             ".jpg",
-                                                             ".jpeg" };
-    std::string extension = OIIO::Strutil::lower( path.extension().string() );
-    if ( ignore_extensions.count( extension ) > 0 )
+    if ( is_ignored_file( path ) )
         return;
 
     batch.push_back( path.string() );
@@ -109,6 +129,150 @@ collect_image_files( const std::vector<std::string> &paths )
     return batches;
 }
 
+/// Gets the file extensions of the raw formats supported by OIIO, in lower
+/// case and with the leading dot.
+std::set<std::string> raw_file_extensions()
+{
+    std::set<std::string> result;
+
+    // The list has the form of "format1:ext1,ext2;format2:ext3".
+    std::string extension_list = OIIO::get_string_attribute( "extension_list" );
+    for ( const auto &format: OIIO::Strutil::splits( extension_list, ";" ) )
+    {
+        auto parts = OIIO::Strutil::splits( format, ":" );
+        if ( parts.size() != 2 || parts[0] != "raw" )
+            continue;
+
+        for ( const auto &extension: OIIO::Strutil::splits( parts[1], "," ) )
+            result.insert( "." + OIIO::Strutil::lower( extension ) );
+    }
+
+    return result;
+}
+
+bool scan_image_files(
+    const std::vector<std::string>                   &paths,
+    const ScanOptions                                &options,
+    const std::function<bool( const std::string & )> &callback )
+{
+    std::set<std::string> raw_extensions;
+    if ( options.raw_only )
+    {
+        raw_extensions = raw_file_extensions();
+        if ( raw_extensions.empty() )
+        {
+            std::cerr << "Warning: OpenImageIO reports no raw file formats, "
+                      << "the files will not be filtered by extension."
+                      << std::endl;
+        }
+    }
+
+    std::mutex        callback_mutex;
+    std::atomic<bool> stopped( false );
+
+    auto emit = [&]( const std::string &path ) {
+        std::lock_guard<std::mutex> lock( callback_mutex );
+        if ( !stopped && !callback( path ) )
+            stopped = true;
+    };
+
+    // The directories waiting to be scanned. The queue gets closed once the
+    // last directory has been scanned, which has not found new directories.
+    WorkQueue<std::filesystem::path> directories;
+    std::atomic<size_t>              pending_directories( 0 );
+
+    for ( const auto &path: paths )
+    {
+        if ( !std::filesystem::exists( path ) )
+        {
+            std::cerr << "File or directory not found: " << path << std::endl;
+            continue;
+        }
+
+        if ( std::filesystem::is_directory( path ) )
+        {
+            pending_directories++;
+            directories.push( path );
+        }
+        else
+        {
+            std::vector<std::string> batch;
+            check_and_add_file( path, batch );
+            for ( const auto &file: batch )
+                emit( file );
+        }
+    }
+
+    if ( pending_directories == 0 )
+        directories.close();
+
+    auto worker = [&]() {
+        std::filesystem::path directory;
+        while ( directories.pop( directory ) )
+        {
+            std::error_code error;
+            for ( std::filesystem::directory_iterator iter( directory, error ),
+                  end;
+                  !error && !stopped && iter != end;
+                  iter.increment( error ) )
+            {
+                // The entry types come from the directory listing where the
+                // file system provides them, saving a stat call per entry.
+                const auto     &entry = *iter;
+                std::error_code entry_error;
+
+                if ( entry.is_directory( entry_error ) )
+                {
+                    if ( options.recursive && !entry.is_symlink( entry_error ) )
+                    {
+                        pending_directories++;
+                        directories.push( entry.path() );
+                    }
+                    continue;
+                }
+
+                if ( !entry.is_regular_file( entry_error ) ||
+                     is_ignored_file( entry.path() ) )
+                    continue;
+
+                if ( !raw_extensions.empty() )
+                {
+                    std::string extension = OIIO::Strutil::lower(
+                        entry.path().extension().string() );
+                    if ( raw_extensions.count( extension ) == 0 )
+                        continue;
+                }
+
+                emit( entry.path().string() );
+            }
+
+            if ( error )
+            {
+                std::cerr << "Failed to read the directory " << directory
+                          << ": " << error.message() << std::endl;
+            }
+
+            if ( --pending_directories == 0 )
+                directories.close();
+        }
+    };
+
+    size_t num_threads = options.threads;
+    if ( num_threads == 0 )
+        num_threads = std::max( std::thread::hardware_concurrency(), 1u );
+
+    // The calling thread acts as one of the scanning threads.
+    std::vector<std::thread> threads;
+    for ( size_t i = 1; i < num_threads; i++ )
+        threads.emplace_back( worker );
+    worker();
+
+    for ( auto &thread: threads )
+        thread.join();
+
+    return !stopped;
+}
+
 /// Gets the list of database paths for rawtoaces data files.
 ///
 /// Precedence:
@@ -212,6 +376,39 @@ CameraIdentifier get_camera_identifier(
     return { camera_make, camera_model };
 }
 
+/// The spectral data located for an image, carried from
+/// `ImageConverter::configure` through to `prepare_transform_spectral`, so
+/// the metadata and the database only get searched once per image.
+struct SpectralContext
+{
+    /// The camera make and model of the image.
+    CameraIdentifier camera_identifier;
+
+    /// The database of the search path in the settings, or `nullptr` until
+    /// initialised by `init_spectral_context`.
+    std::shared_ptr<const core::SpectralDatabase> database;
+};
+
+/// Fills in a spectral context, unless already initialised.
+///
+/// @param context The context to initialise
+/// @param spec Image specification containing metadata
+/// @param settings Converter settings including the database paths
+/// @return true if the camera of the image has been identified
+bool init_spectral_context(
+    SpectralContext                &context,
+    const OIIO::ImageSpec          &spec,
+    const ImageConverter::Settings &settings )
+{
+    if ( !context.database )
+    {
+        context.database = core::SpectralDatabase::get(
+            settings.database_directories, settings.verbosity );
+        context.camera_identifier = get_camera_identifier( spec, settings );
+    }
+    return !context.camera_identifier.is_empty();
+}
+
 void print_data_error( const std::string &data_type )
 {
     std::cerr << "Failed to find " << data_type << "." << std::endl
@@ -219,39 +416,33 @@ void print_data_error( const std::string &data_type )
               << "in RAWTOACES_DATABASE_PATH" << std::endl;
 }
 
-/// Prepares spectral transformation matrices for RAW to ACES conversion
+/// Solves the spectral transform for the given camera and illuminant.
 ///
-/// This method initializes a spectral solver to find the appropriate camera data,
-/// loads training and observer spectral data, determines the illuminant (either from
-/// settings or by analyzing white balance multipliers), calculates white balance
-/// coefficients, and computes the IDT matrix. The CAT (Chromatic Adaptation Transform) matrix is not used in spectral
-/// mode as chromatic adaptation is embedded within the IDT (Input Device Transform) matrix.
+/// This function initializes a spectral solver to find the appropriate camera
+/// data, loads training and observer spectral data, finds the illuminant
+/// either by name or by matching the white balance multipliers, calculates
+/// the white balance coefficients for a named illuminant, and computes the
+/// IDT matrix.
 ///
-/// @param image_spec OpenImageIO image specification containing metadata
-/// @param settings ImageConverter settings including illuminant and verbosity
-/// @param WB_multipliers Output white balance multipliers (3-element vector)
-/// @param IDT_matrix Output Input Device Transform matrix (3x3 matrix)
-/// @param CAT_matrix Output Chromatic Adaptation Transform matrix (cleared in spectral mode)
-/// @return true if transformation matrices were successfully prepared, false otherwise
-bool prepare_transform_spectral(
-    const OIIO::ImageSpec            &image_spec,
-    const ImageConverter::Settings   &settings,
-    std::vector<double>              &WB_multipliers,
-    std::vector<std::vector<double>> &IDT_matrix,
-    std::vector<std::vector<double>> &CAT_matrix )
+/// @param context The camera make and model to find the data for, and the database to search
+/// @param settings ImageConverter settings including verbosity
+/// @param illuminant Lowercase name of the illuminant, or empty to find it from `WB_multipliers`
+/// @param WB_multipliers Normalised 3-element white balance multipliers, only used if `illuminant` is empty
+/// @param entry Output transform
+/// @return true if the transform was successfully solved, false otherwise
+bool solve_transform_spectral(
+    const SpectralContext          &context,
+    const ImageConverter::Settings &settings,
+    const std::string              &illuminant,
+    const std::vector<double>      &WB_multipliers,
+    TransformCache::Entry          &entry )
 {
-    // Step 1: Initialize and validate camera identification
-    std::string lower_illuminant = OIIO::Strutil::lower( settings.illuminant );
-
-    CameraIdentifier camera_identifier =
-        get_camera_identifier( image_spec, settings );
-    if ( camera_identifier.is_empty() )
-        return false;
-
     bool success = false;
 
-    // Step 2: Initialize spectral solver and find camera data
-    core::SpectralSolver solver( settings.database_directories );
+    // Step 1: Initialize spectral solver and find camera data
+    const CameraIdentifier &camera_identifier = context.camera_identifier;
+
+    core::SpectralSolver solver( context.database );
     solver.verbosity = settings.verbosity;
 
     success =
@@ -264,8 +455,8 @@ bool prepare_transform_spectral(
         return false;
     }
 
-    // Step 3: Load training spectral data
-    const std::string training_path = "training/training_spectral.json";
+    // Step 2: Load training spectral data
+    const std::string training_path = TransformCache::training_data_path;
     success = solver.load_spectral_data( training_path, solver.training_data );
     if ( !success )
     {
@@ -274,8 +465,8 @@ bool prepare_transform_spectral(
         return false;
     }
 
-    // Step 4: Load observer (CMF) spectral data
-    const std::string observer_path = "cmf/cmf_1931.json";
+    // Step 3: Load observer (CMF) spectral data
+    const std::string observer_path = TransformCache::observer_data_path;
     success = solver.load_spectral_data( observer_path, solver.observer );
     if ( !success )
     {
@@ -284,25 +475,146 @@ bool prepare_transform_spectral(
         return false;
     }
 
-    // Step 5: Determine illuminant and calculate white balance
-    if ( !lower_illuminant.empty() )
+    // Step 4: Determine illuminant and calculate white balance
+    if ( !illuminant.empty() )
     {
         // Use specified illuminant from settings
-        success = solver.find_illuminant( lower_illuminant );
+        success = solver.find_illuminant( illuminant );
 
         if ( !success )
         {
             const std::string data_type =
-                "illuminant type = '" + lower_illuminant + "'";
+                "illuminant type = '" + illuminant + "'";
             print_data_error( data_type );
             return false;
         }
+
+        success = solver.calculate_WB();
+
+        if ( !success )
+        {
+            std::cerr << "ERROR: Failed to calculate the white balancing "
+                      << "weights." << std::endl;
+            return false;
+        }
+
+        entry.WB_multipliers = solver.get_WB_multipliers();
+    }
+    else
+    {
+        // Auto-detect illuminant from white balance multipliers
+        success = solver.find_illuminant( WB_multipliers );
+
+        // Fails for the missing or invalid white balance metadata, and for
+        // the camera data of unsupported shapes.
+        if ( !success )
+        {
+            std::cerr << "ERROR: Failed to find the illuminant from the white "
+                      << "balance multipliers ";
+            for ( size_t i = 0; i < WB_multipliers.size(); i++ )
+                std::cerr << ( i > 0 ? ", " : "" ) << WB_multipliers[i];
+            std::cerr << ". Please check the \"raw:pre_mul\" metadata of "
+                      << "the image, or provide the illuminant with the "
+                      << "\"--illuminant\" parameter." << std::endl;
+            return false;
+        }
+    }
+    entry.illuminant = solver.illuminant.type;
+
+    // Step 5: Calculate Input Device Transform (IDT) matrix
+    success = solver.calculate_IDT_matrix();
+    if ( !success )
+    {
+        std::cerr << "Failed to calculate the input transform matrix."
+                  << std::endl;
+        return false;
     }
 
+    entry.IDT_matrix = solver.get_IDT_matrix();
+    return true;
+}
+
+/// Makes a key identifying the spectral transform in a `TransformCache`.
+///
+/// The white balance multipliers are quantised, so the multipliers differing
+/// only by the rounding errors of the metadata share a transform.
+///
+/// @param camera_identifier Camera make and model
+/// @param settings ImageConverter settings including database paths
+/// @param illuminant Lowercase name of the illuminant, or empty
+/// @param WB_multipliers Normalised white balance multipliers, only used if `illuminant` is empty
+/// @return the key
+std::string make_spectral_transform_key(
+    const CameraIdentifier         &camera_identifier,
+    const ImageConverter::Settings &settings,
+    const std::string              &illuminant,
+    const std::vector<double>      &WB_multipliers )
+{
+    std::ostringstream key;
+    key << "make=" << camera_identifier.make.size() << ":"
+        << camera_identifier.make << ";model="
+        << camera_identifier.model.size() << ":" << camera_identifier.model
+        << ";database=";
+    for ( const auto &directory: settings.database_directories )
+        key << directory.size() << ":" << directory;
+
+    if ( !illuminant.empty() )
+    {
+        key << ";illuminant=" << illuminant;
+    }
+    else
+    {
+        key << ";wb=";
+        for ( double multiplier: WB_multipliers )
+            key << std::llround( multiplier * 1e6 ) << ",";
+    }
+
+    return key.str();
+}
+
+/// Prepares spectral transformation matrices for RAW to ACES conversion
+///
+/// This method determines the illuminant (either from settings or by analyzing
+/// white balance multipliers), and solves the IDT matrix and the white balance
+/// coefficients for the camera from its spectral data, see
+/// `solve_transform_spectral`. The solved transforms are reused from `cache`
+/// if given, and from the files in `settings.transform_cache` if set. The CAT (Chromatic Adaptation Transform) matrix is not used in spectral
+/// mode as chromatic adaptation is embedded within the IDT (Input Device Transform) matrix.
+///
+/// @param image_spec OpenImageIO image specification containing metadata
+/// @param settings ImageConverter settings including illuminant and verbosity
+/// @param WB_multipliers Output white balance multipliers (3-element vector)
+/// @param IDT_matrix Output Input Device Transform matrix (3x3 matrix)
+/// @param CAT_matrix Output Chromatic Adaptation Transform matrix (cleared in spectral mode)
+/// @param cache Cache of the solved transforms, or nullptr to always solve
+/// @param context The camera and the database already located for the image, or nullptr to locate them here
+/// @return true if transformation matrices were successfully prepared, false otherwise
+bool prepare_transform_spectral(
+    const OIIO::ImageSpec            &image_spec,
+    const ImageConverter::Settings   &settings,
+    std::vector<double>              &WB_multipliers,
+    std::vector<std::vector<double>> &IDT_matrix,
+    std::vector<std::vector<double>> &CAT_matrix,
+    TransformCache                   *cache,
+    SpectralContext                  *context )
+{
+    // Step 1: Initialize and validate camera identification
+    std::string lower_illuminant = OIIO::Strutil::lower( settings.illuminant );
+
+    SpectralContext local_context;
+    if ( !context )
+        context = &local_context;
+    if ( !init_spectral_context( *context, image_spec, settings ) )
+        return false;
+
+    const CameraIdentifier &camera_identifier = context->camera_identifier;
+
+    // Step 2: Collect the white balance multipliers to find the illuminant
+    // from, unless the illuminant is given
+    std::vector<double> tmp_wb_multipliers;
     if ( lower_illuminant.empty() )
     {
-        // Auto-detect illuminant from white balance multipliers
-        std::vector<double> tmp_wb_multipliers( 4 );
+        tmp_wb_multipliers.resize( 4 );
 
         if ( WB_multipliers.size() == 4 )
         {
@@ -335,32 +647,54 @@ bool prepare_transform_spectral(
         if ( min_val > 0 && min_val != 1 )
             for ( int i = 0; i < 3; i++ )
                 tmp_wb_multipliers[i] /= min_val;
+    }
 
-        success = solver.find_illuminant( tmp_wb_multipliers );
+    // Step 3: Solve the transform, or reuse the cached one
+    auto solve = [&]( TransformCache::Entry &entry ) {
+        return solve_transform_spectral(
+            *context,
+            settings,
+            lower_illuminant,
+            tmp_wb_multipliers,
+            entry );
+    };
 
-        // Expected to be true due to camera lookup success in the previous step,
-        // since lack of camera is the only way for find_illuminant to return false;
-        assert( success );
+    TransformCache::Entry entry;
+    bool                  success = false;
+    if ( cache )
+    {
+        std::string key = make_spectral_transform_key(
+            camera_identifier, settings, lower_illuminant, tmp_wb_multipliers );
 
-        if ( settings.verbosity > 0 )
+        // The files of the persistent cache outlive the database, so the
+        // contents of the database become a part of the key.
+        if ( !settings.transform_cache.empty() )
         {
-            std::cerr << "Found illuminant: '" << solver.illuminant.type << "'."
-                      << std::endl;
+            key += ";data=" +
+                   cache->get_database_hash( settings.database_directories );
         }
+
+        success = cache->get( key, settings.transform_cache, solve, entry );
     }
     else
     {
-        // Calculate white balance for specified illuminant
-        success = solver.calculate_WB();
+        success = solve( entry );
+    }
 
-        if ( !success )
+    if ( !success )
+        return false;
+
+    if ( lower_illuminant.empty() )
+    {
+        if ( settings.verbosity > 0 )
         {
-            std::cerr << "ERROR: Failed to calculate the white balancing "
-                      << "weights." << std::endl;
-            return false;
+            std::cerr << "Found illuminant: '" << entry.illuminant << "'."
+                      << std::endl;
         }
-
-        WB_multipliers = solver.get_WB_multipliers();
+    }
+    else
+    {
+        WB_multipliers = entry.WB_multipliers;
 
         if ( settings.verbosity > 0 )
         {
@@ -373,16 +707,7 @@ bool prepare_transform_spectral(
         }
     }
 
-    // Step 6: Calculate Input Device Transform (IDT) matrix
-    success = solver.calculate_IDT_matrix();
-    if ( !success )
-    {
-        std::cerr << "Failed to calculate the input transform matrix."
-                  << std::endl;
-        return false;
-    }
-
-    IDT_matrix = solver.get_IDT_matrix();
+    IDT_matrix = entry.IDT_matrix;
 
     if ( settings.verbosity > 0 )
     {
@@ -398,7 +723,7 @@ bool prepare_transform_spectral(
         }
     }
 
-    // Step 7: Clear CAT matrix (not used in spectral mode)
+    // Step 4: Clear CAT matrix (not used in spectral mode)
     // CAT is embedded in IDT in spectral mode
     CAT_matrix.resize( 0 );
 
@@ -671,6 +996,10 @@ bool check_param(
     }
 }
 
+ImageConverter::ImageConverter()
+    : _transform_cache( std::make_shared<TransformCache>() )
+{}
+
 void ImageConverter::init_parser( OIIO::ArgParse &arg_parser )
 {
     arg_parser.intro( HelpString );
@@ -779,6 +1108,16 @@ void ImageConverter::init_parser( OIIO::ArgParse &arg_parser )
         .help( "Create output directories if they don't exist." )
         .action( OIIO::ArgParse::store_true() );
 
+    arg_parser.arg( "--transform-cache" )
+        .help(
+            "A directory to keep the colour transforms solved from the "
+            "spectral data in, to be reused by the following runs. The "
+            "directory gets created if needed. The transforms solved with a "
+            "different camera, training, observer or illuminant data are not "
+            "reused." )
+        .metavar( "DIR" )
+        .action( OIIO::ArgParse::store() );
+
     arg_parser.separator( "Raw conversion options:" );
 
     arg_parser.arg( "--auto-bright" )
@@ -877,6 +1216,15 @@ void ImageConverter::init_parser( OIIO::ArgParse &arg_parser )
         .help( "Shows the list of illuminants supported in spectral mode." )
         .action( OIIO::ArgParse::store_true() );
 
+    arg_parser.arg( "--compile-database" )
+        .help(
+            "Compile the spectral data found in the search path into a single "
+            "file, which loads faster than the JSON files, and exit. Use the "
+            "file in place of the data directories in --data-dir or "
+            "RAWTOACES_DATA_PATH." )
+        .metavar( "FILE" )
+        .action( OIIO::ArgParse::store() );
+
     arg_parser.arg( "--use-timing" )
         .help( "Log the execution time of each step of image processing." )
         .action( OIIO::ArgParse::store_true() );
@@ -925,6 +1273,20 @@ bool ImageConverter::parse_parameters( const OIIO::ArgParse &arg_parser )
         exit( 0 );
     }
 
+    std::string compiled_database = arg_parser["compile-database"].get();
+    if ( compiled_database.size() )
+    {
+        if ( !core::SpectralDatabase::compile(
+                 settings.database_directories,
+                 compiled_database,
+                 settings.verbosity ) )
+            exit( 1 );
+
+        std::cout << "Compiled the spectral database into "
+                  << compiled_database << "." << std::endl;
+        exit( 0 );
+    }
+
     std::string WB_method = arg_parser["wb-method"].get();
 
     if ( WB_method == "metadata" )
@@ -1143,16 +1505,18 @@ bool ImageConverter::parse_parameters( const OIIO::ArgParse &arg_parser )
     settings.scale             = arg_parser["scale"].get<float>();
     settings.denoise_threshold = arg_parser["denoise-threshold"].get<float>();
 
-    settings.overwrite   = arg_parser["overwrite"].get<int>();
-    settings.create_dirs = arg_parser["create-dirs"].get<int>();
-    settings.output_dir  = arg_parser["output-dir"].get();
-    settings.use_timing  = arg_parser["use-timing"].get<int>();
+    settings.overwrite       = arg_parser["overwrite"].get<int>();
+    settings.create_dirs     = arg_parser["create-dirs"].get<int>();
+    settings.output_dir      = arg_parser["output-dir"].get();
+    settings.transform_cache = arg_parser["transform-cache"].get();
+    settings.use_timing      = arg_parser["use-timing"].get<int>();
 
     // If an illuminant was requested, confirm that we have it in the database
     // an error out early, before we start loading any images.
     if ( settings.WB_method == Settings::WBMethod::Illuminant )
     {
-        core::SpectralSolver solver( settings.database_directories );
+        core::SpectralSolver solver( core::SpectralDatabase::get(
+            settings.database_directories, settings.verbosity ) );
         if ( !solver.find_illuminant( settings.illuminant ) )
         {
             std::cerr << std::endl
@@ -1173,15 +1537,11 @@ std::vector<std::string> ImageConverter::get_supported_illuminants() const
     result.push_back( "Day-light (e.g., D60, D6025)" );
     result.push_back( "Blackbody (e.g., 3200K)" );
 
-    rta::core::SpectralSolver solver( settings.database_directories );
-    auto                      files = solver.collect_data_files( "illuminant" );
-    for ( auto &file: files )
+    auto database = core::SpectralDatabase::get(
+        settings.database_directories, settings.verbosity );
+    for ( const auto &data: database->illuminants() )
     {
-        core::SpectralData data;
-        if ( data.load( file, false ) )
-        {
-            result.push_back( data.type );
-        }
+        result.push_back( data->type );
     }
 
     return result;
@@ -1191,16 +1551,12 @@ std::vector<std::string> ImageConverter::get_supported_cameras() const
 {
     std::vector<std::string> result;
 
-    rta::core::SpectralSolver solver( settings.database_directories );
-    auto                      files = solver.collect_data_files( "camera" );
-    for ( auto &file: files )
+    auto database = core::SpectralDatabase::get(
+        settings.database_directories, settings.verbosity );
+    for ( const auto &data: database->cameras() )
     {
-        core::SpectralData data;
-        if ( data.load( file, false ) )
-        {
-            std::string name = data.manufacturer + " / " + data.model;
-            result.push_back( name );
-        }
+        std::string name = data->manufacturer + " / " + data->model;
+        result.push_back( name );
     }
 
     return result;
@@ -1238,17 +1594,15 @@ void fix_metadata( OIIO::ImageSpec &spec )
     }
 }
 
-bool ImageConverter::configure(
-    const std::string &input_filename, OIIO::ParamValueList &options )
+/// Read the metadata of a raw file, opening it with the given reader hints.
+bool read_raw_metadata(
+    const std::string          &input_filename,
+    const OIIO::ParamValueList &options,
+    OIIO::ImageSpec            &image_spec )
 {
-    options["raw:ColorSpace"]    = "XYZ";
-    options["raw:use_camera_wb"] = 0;
-    options["raw:use_auto_wb"]   = 0;
-
     OIIO::ImageSpec temp_spec;
     temp_spec.extra_attribs = options;
 
-    OIIO::ImageSpec image_spec;
     auto image_input = OIIO::ImageInput::create( "raw", false, &temp_spec );
     bool result = image_input->open( input_filename, image_spec, temp_spec );
     if ( !result )
@@ -1257,9 +1611,104 @@ bool ImageConverter::configure(
     }
 
     fix_metadata( image_spec );
+    return true;
+}
+
+bool ImageConverter::configure(
+    const std::string &input_filename, OIIO::ParamValueList &options )
+{
+    options["raw:ColorSpace"]    = "XYZ";
+    options["raw:use_camera_wb"] = 0;
+    options["raw:use_auto_wb"]   = 0;
+
+    OIIO::ImageSpec image_spec;
+    if ( !read_raw_metadata( input_filename, options, image_spec ) )
+    {
+        return false;
+    }
+
     return configure( image_spec, options );
 }
 
+bool ImageConverter::read_metadata(
+    const std::string &input_filename, OIIO::ImageSpec &image_spec ) const
+{
+    // The same hints `configure` opens the file with.
+    OIIO::ParamValueList options;
+    options["raw:ColorSpace"]    = "XYZ";
+    options["raw:use_camera_wb"] = 0;
+    options["raw:use_auto_wb"]   = 0;
+
+    return read_raw_metadata( input_filename, options, image_spec );
+}
+
+std::string
+ImageConverter::get_transform_key( const OIIO::ImageSpec &image_spec ) const
+{
+    // The attributes read by `configure` and the `prepare_transform_*`
+    // functions. Everything else `configure` depends on comes from the
+    // settings, which are the same for all files of a converter.
+    static const char *const attribute_names[] = {
+        "cameraMake",
+        "cameraModel",
+        "raw:dng:version",
+        "raw:cam_mul",
+        "raw:pre_mul",
+        "raw:dng:baseline_exposure",
+        "raw:dng:calibration_illuminant1",
+        "raw:dng:calibration_illuminant2",
+        "raw:dng:color_matrix1",
+        "raw:dng:color_matrix2",
+        "raw:dng:camera_calibration1",
+        "raw:dng:camera_calibration2"
+    };
+
+    // The values are stored as raw bytes preceded by their type, so the
+    // equal keys mean bit-exact equal metadata.
+    std::string key;
+    for ( const char *name: attribute_names )
+    {
+        key += name;
+        key += '=';
+
+        const OIIO::ParamValue *attribute = image_spec.find_attribute( name );
+        if ( attribute )
+        {
+            key += attribute->type().c_str();
+            key += ':';
+            if ( attribute->type().basetype == OIIO::TypeDesc::STRING )
+            {
+                std::string value = attribute->get_string();
+                key += std::to_string( value.size() ) + ':' + value;
+            }
+            else
+            {
+                key.append(
+                    static_cast<const char *>( attribute->data() ),
+                    attribute->datasize() );
+            }
+        }
+        key += ';';
+    }
+
+    return key;
+}
+
+bool ImageConverter::solve_transform(
+    const OIIO::ImageSpec &image_spec, Transform &transform )
+{
+    transform.hints.clear();
+    if ( !configure( image_spec, transform.hints ) )
+    {
+        return false;
+    }
+
+    transform.WB_multipliers = _wb_multipliers;
+    transform.IDT_matrix     = _idt_matrix;
+    transform.CAT_matrix     = _cat_matrix;
+    return true;
+}
+
 // TODO:
 // Removed options comparing to v1.1:
 // -P - bad pixels
@@ -1380,15 +1829,21 @@ bool ImageConverter::configure(
             return false;
     }
 
+    // Carries the camera and the database located here to the spectral
+    // transform preparation below.
+    SpectralContext spectral_context;
+
     Settings::MatrixMethod matrix_method = settings.matrix_method;
     if ( settings.matrix_method == Settings::MatrixMethod::Auto )
     {
-        core::SpectralSolver solver( settings.database_directories );
-        CameraIdentifier     camera_identifier =
-            get_camera_identifier( image_spec, settings );
+        // Only the database index gets checked here, the spectral data is
+        // loaded when solving the transform, which is skipped entirely if
+        // the transform is cached.
+        const CameraIdentifier &camera_identifier =
+            spectral_context.camera_identifier;
 
-        if ( !camera_identifier.is_empty() &&
-             solver.find_camera(
+        if ( init_spectral_context( spectral_context, image_spec, settings ) &&
+             spectral_context.database->has_camera(
                  camera_identifier.make, camera_identifier.model ) )
         {
             matrix_method = Settings::MatrixMethod::Spectral;
@@ -1453,11 +1908,37 @@ bool ImageConverter::configure(
                  settings,
                  _wb_multipliers,
                  _idt_matrix,
-                 _cat_matrix ) )
+                 _cat_matrix,
+                 _transform_cache.get(),
+                 &spectral_context ) )
         {
-            std::cerr << "ERROR: the colour space transform has not been "
-                      << "configured properly (spectral mode)." << std::endl;
-            return false;
+            // Auto mode only checks the database index for the camera, so
+            // its spectral data may still fail to load, in which case the
+            // metadata matrix gets used, same as for an unknown camera.
+            const CameraIdentifier &camera_identifier =
+                spectral_context.camera_identifier;
+
+            bool fall_back =
+                settings.matrix_method == Settings::MatrixMethod::Auto &&
+                !is_spectral_white_balance && spectral_context.database &&
+                !spectral_context.database->find_camera(
+                    camera_identifier.make, camera_identifier.model );
+            if ( !fall_back )
+            {
+                std::cerr << "ERROR: the colour space transform has not been "
+                          << "configured properly (spectral mode)."
+                          << std::endl;
+                return false;
+            }
+
+            std::cerr << "Warning: Falling back to metadata matrix method "
+                      << "because the spectral data for camera "
+                      << static_cast<std::string>( camera_identifier )
+                      << " failed to load." << std::endl;
+
+            matrix_method                    = Settings::MatrixMethod::Metadata;
+            options["raw:ColorSpace"]        = "XYZ";
+            options["raw:use_camera_matrix"] = is_DNG ? 1 : 3;
         }
 
         if ( is_spectral_white_balance )
@@ -1737,69 +2218,159 @@ bool ImageConverter::apply_crop(
     return true;
 }
 
-bool ImageConverter::make_output_path(
-    std::string &path, const std::string &suffix )
+/// Build the output file path for the given input file path. The path is
+/// absolute if `output_dir` is not empty. This function doesn't access the
+/// file system, but may throw if the input path is malformed.
+std::filesystem::path output_file_path(
+    const std::string &path,
+    const std::string &suffix,
+    const std::string &output_dir )
 {
-    // Validate input path
-    if ( path.empty() )
-    {
-        std::cerr << "ERROR: Empty input path provided." << std::endl;
-        return false;
-    }
-    try
+    std::filesystem::path temp_path( path );
+
+    temp_path.replace_extension();
+    temp_path += suffix + ".exr";
+
+    if ( !output_dir.empty() )
     {
-        std::filesystem::path temp_path( path );
+        auto new_directory = std::filesystem::path( output_dir );
 
-        temp_path.replace_extension();
-        temp_path += suffix + ".exr";
+        auto filename      = temp_path.filename();
+        auto old_directory = temp_path.remove_filename();
 
-        if ( !settings.output_dir.empty() )
-        {
-            auto new_directory = std::filesystem::path( settings.output_dir );
+        new_directory = old_directory / new_directory;
+        temp_path     = std::filesystem::absolute( new_directory / filename );
+    }
 
-            auto filename      = temp_path.filename();
-            auto old_directory = temp_path.remove_filename();
+    return temp_path;
+}
 
-            new_directory = old_directory / new_directory;
+/// Check that an image can be written to the given output path.
+/// @param path the output file path.
+/// @param check_directory check that the directory of the file exists, and
+/// create it if `Settings::create_dirs` is set.
+/// @param settings the settings of the converter.
+/// @param error the stream to write the reason of a failure into.
+/// @result `true` if the file can be written.
+bool check_output_file(
+    const std::filesystem::path    &path,
+    bool                            check_directory,
+    const ImageConverter::Settings &settings,
+    std::ostringstream             &error )
+{
+    auto new_directory = path.parent_path();
 
-            if ( !std::filesystem::exists( new_directory ) )
+    if ( check_directory && !new_directory.empty() &&
+         !std::filesystem::exists( new_directory ) )
+    {
+        if ( settings.create_dirs )
+        {
+            if ( !std::filesystem::create_directory( new_directory ) )
             {
-                if ( settings.create_dirs )
-                {
-                    if ( !std::filesystem::create_directory( new_directory ) )
-                    {
-                        std::cerr << "ERROR: Failed to create directory "
-                                  << new_directory << "." << std::endl;
-                        return false;
-                    }
-                }
-                else
-                {
-                    std::cerr << "ERROR: The output directory " << new_directory
-                              << " does not exist." << std::endl;
-                    return false;
-                }
+                error << "Failed to create directory " << new_directory << ".";
+                return false;
             }
-            temp_path = std::filesystem::absolute( new_directory / filename );
         }
-
-        if ( !settings.overwrite && std::filesystem::exists( temp_path ) )
+        else
         {
-            std::cerr
-                << "ERROR: file " << temp_path << " already exists. Use "
-                << "--overwrite to allow overwriting existing files. Skipping "
-                << "this file." << std::endl;
+            error << "The output directory " << new_directory
+                  << " does not exist.";
             return false;
         }
+    }
+
+    if ( !settings.overwrite && std::filesystem::exists( path ) )
+    {
+        error << "file " << path << " already exists. Use "
+              << "--overwrite to allow overwriting existing files. "
+              << "Skipping this file.";
+        return false;
+    }
+
+    return true;
+}
+
+bool ImageConverter::make_output_path(
+    std::string &path, const std::string &suffix )
+{
+    _last_error.clear();
+
+    std::ostringstream error;
+    auto               fail = [&]() {
+        _last_error = error.str();
+        std::cerr << "ERROR: " << _last_error << std::endl;
+        return false;
+    };
+
+    // Validate input path
+    if ( path.empty() )
+    {
+        error << "Empty input path provided.";
+        return fail();
+    }
+    try
+    {
+        std::filesystem::path temp_path =
+            output_file_path( path, suffix, settings.output_dir );
+
+        // The output goes next to the input file unless an output directory
+        // is set, so only the latter may need creating.
+        if ( !check_output_file(
+                 temp_path, !settings.output_dir.empty(), settings, error ) )
+            return fail();
 
         path = temp_path.string();
         return true;
     }
     catch ( const std::exception &e )
     {
-        std::cerr << "ERROR: Invalid path format '" << path << "': " << e.what()
-                  << std::endl;
+        error << "Invalid path format '" << path << "': " << e.what();
+        return fail();
+    }
+}
+
+bool ImageConverter::check_output_path( const std::string &path )
+{
+    _last_error.clear();
+
+    std::ostringstream error;
+    auto               fail = [&]() {
+        _last_error = error.str();
+        std::cerr << "ERROR: " << _last_error << std::endl;
         return false;
+    };
+
+    if ( path.empty() )
+    {
+        error << "Empty output path provided.";
+        return fail();
+    }
+    try
+    {
+        if ( !check_output_file( path, true, settings, error ) )
+            return fail();
+        return true;
+    }
+    catch ( const std::exception &e )
+    {
+        error << "Invalid path format '" << path << "': " << e.what();
+        return fail();
+    }
+}
+
+std::string ImageConverter::get_output_path(
+    const std::string &path, const std::string &suffix ) const
+{
+    if ( path.empty() )
+        return "";
+
+    try
+    {
+        return output_file_path( path, suffix, settings.output_dir ).string();
+    }
+    catch ( const std::exception & )
+    {
+        return "";
     }
 }
 
@@ -1842,12 +2413,15 @@ bool ImageConverter::save_image(
 
 bool ImageConverter::process_image( const std::string &input_filename )
 {
+    _last_error.clear();
+
     // Early validation: check if input file exists and is valid
     if ( input_filename.empty() )
     {
+        _last_error = "Empty input filename provided.";
         if ( settings.verbosity > 0 )
         {
-            std::cerr << "ERROR: Empty input filename provided." << std::endl;
+            std::cerr << "ERROR: " << _last_error << std::endl;
         }
         return false;
     }
@@ -1858,20 +2432,21 @@ bool ImageConverter::process_image( const std::string &input_filename )
     {
         if ( !std::filesystem::exists( input_filename ) )
         {
+            _last_error = "Input file does not exist: " + input_filename;
             if ( settings.verbosity > 0 )
             {
-                std::cerr << "ERROR: Input file does not exist: "
-                          << input_filename << std::endl;
+                std::cerr << "ERROR: " << _last_error << std::endl;
             }
             return false;
         }
     }
     catch ( const std::filesystem::filesystem_error &e )
     {
+        _last_error = "Filesystem error while checking input file '" +
+                      input_filename + "': " + e.what();
         if ( settings.verbosity > 0 )
         {
-            std::cerr << "ERROR: Filesystem error while checking input file '"
-                      << input_filename << "': " << e.what() << std::endl;
+            std::cerr << "ERROR: " << _last_error << std::endl;
         }
         return false;
     }
@@ -1882,6 +2457,25 @@ bool ImageConverter::process_image( const std::string &input_filename )
         return ( false );
     }
 
+    OIIO::ImageBuf buffer;
+    if ( !decode_image( input_filename, buffer ) )
+    {
+        return ( false );
+    }
+
+    if ( !transform_image( input_filename, buffer ) )
+    {
+        return ( false );
+    }
+
+    return encode_image( output_filename, buffer );
+}
+
+bool ImageConverter::decode_image(
+    const std::string &input_filename, OIIO::ImageBuf &buffer )
+{
+    _last_error.clear();
+
     util::UsageTimer usage_timer;
     usage_timer.enabled = settings.use_timing;
 
@@ -1895,26 +2489,68 @@ bool ImageConverter::process_image( const std::string &input_filename )
     OIIO::ParamValueList hints;
     if ( !configure( input_filename, hints ) )
     {
-        std::cerr << "Failed to configure the reader for the file: "
-                  << input_filename << std::endl;
+        _last_error = "Failed to configure the reader for the file: " +
+                      input_filename;
+        std::cerr << _last_error << std::endl;
         return ( false );
     }
     usage_timer.print( input_filename, "configuring reader" );
 
+    return load_image_stage( input_filename, hints, buffer );
+}
+
+bool ImageConverter::decode_image(
+    const std::string &input_filename,
+    const Transform   &transform,
+    OIIO::ImageBuf    &buffer )
+{
+    _last_error.clear();
+
+    _wb_multipliers = transform.WB_multipliers;
+    _idt_matrix     = transform.IDT_matrix;
+    _cat_matrix     = transform.CAT_matrix;
+
+    return load_image_stage( input_filename, transform.hints, buffer );
+}
+
+bool ImageConverter::load_image_stage(
+    const std::string          &input_filename,
+    const OIIO::ParamValueList &hints,
+    OIIO::ImageBuf             &buffer )
+{
+    util::UsageTimer usage_timer;
+    usage_timer.enabled = settings.use_timing;
+
     // ___ Load image ___
     if ( settings.verbosity > 0 )
     {
         std::cerr << "Loading image: " << input_filename << std::endl;
     }
     usage_timer.reset();
-    OIIO::ImageBuf buffer;
     if ( !load_image( input_filename, hints, buffer ) )
     {
-        std::cerr << "Failed to read the file: " << input_filename << std::endl;
+        _last_error = "Failed to read the file: " + input_filename;
+        std::string oiio_error = buffer.geterror();
+        if ( !oiio_error.empty() )
+        {
+            _last_error += " (" + oiio_error + ")";
+        }
+        std::cerr << _last_error << std::endl;
         return ( false );
     }
     usage_timer.print( input_filename, "reading image" );
 
+    return ( true );
+}
+
+bool ImageConverter::transform_image(
+    const std::string &input_filename, OIIO::ImageBuf &buffer )
+{
+    _last_error.clear();
+
+    util::UsageTimer usage_timer;
+    usage_timer.enabled = settings.use_timing;
+
     // ___ Apply matrix/matrices ___
     if ( settings.verbosity > 0 )
     {
@@ -1923,8 +2559,9 @@ bool ImageConverter::process_image( const std::string &input_filename )
     usage_timer.reset();
     if ( !apply_matrix( buffer, buffer ) )
     {
-        std::cerr << "Failed to apply colour space conversion to the file: "
-                  << input_filename << std::endl;
+        _last_error = "Failed to apply colour space conversion to the file: " +
+                      input_filename;
+        std::cerr << _last_error << std::endl;
         return ( false );
     }
     usage_timer.print( input_filename, "applying transform matrix" );
@@ -1937,8 +2574,8 @@ bool ImageConverter::process_image( const std::string &input_filename )
     usage_timer.reset();
     if ( !apply_scale( buffer, buffer ) )
     {
-        std::cerr << "Failed to apply scale to the file: " << input_filename
-                  << std::endl;
+        _last_error = "Failed to apply scale to the file: " + input_filename;
+        std::cerr << _last_error << std::endl;
         return ( false );
     }
     usage_timer.print( input_filename, "applying scale" );
@@ -1951,12 +2588,23 @@ bool ImageConverter::process_image( const std::string &input_filename )
     usage_timer.reset();
     if ( !apply_crop( buffer, buffer ) )
     {
-        std::cerr << "Failed to apply crop to the file: " << input_filename
-                  << std::endl;
+        _last_error = "Failed to apply crop to the file: " + input_filename;
+        std::cerr << _last_error << std::endl;
         return ( false );
     }
     usage_timer.print( input_filename, "applying crop" );
 
+    return ( true );
+}
+
+bool ImageConverter::encode_image(
+    const std::string &output_filename, const OIIO::ImageBuf &buffer )
+{
+    _last_error.clear();
+
+    util::UsageTimer usage_timer;
+    usage_timer.enabled = settings.use_timing;
+
     // ___ Save image ___
     if ( settings.verbosity > 0 )
     {
@@ -1965,15 +2613,45 @@ bool ImageConverter::process_image( const std::string &input_filename )
     usage_timer.reset();
     if ( !save_image( output_filename, buffer ) )
     {
-        std::cerr << "Failed to save the file: " << output_filename
-                  << std::endl;
+        _last_error = "Failed to save the file: " + output_filename;
+        std::cerr << _last_error << std::endl;
         return ( false );
     }
-    usage_timer.print( input_filename, "writing image" );
+    usage_timer.print( output_filename, "writing image" );
 
     return ( true );
 }
 
+bool ImageConverter::estimate_memory_usage(
+    const std::string &input_filename, size_t &bytes ) const
+{
+    OIIO::ImageSpec image_spec;
+    auto            image_input = OIIO::ImageInput::create( "raw" );
+    if ( !image_input || !image_input->open( input_filename, image_spec ) )
+        return false;
+
+    // The header describes the full sensor, the half-size mode decodes a
+    // quarter of the pixels.
+    size_t sensor_pixels = static_cast<size_t>( image_spec.width ) *
+                           static_cast<size_t>( image_spec.height );
+    size_t image_pixels = settings.half_size ? sensor_pixels / 4 : sensor_pixels;
+
+    size_t image_size = image_pixels * image_spec.nchannels * sizeof( float );
+
+    // LibRaw holds the unpacked raw data and its 4-channel 16-bit working
+    // image while decoding, next to the floating point image being filled.
+    size_t decode_size =
+        ( sensor_pixels + image_pixels * 4 ) * sizeof( uint16_t ) + image_size;
+
+    // The hard crop can't be done in place, see `apply_crop`.
+    size_t transform_size = settings.crop_mode == Settings::CropMode::Hard
+                                ? image_size * 2
+                                : image_size;
+
+    bytes = std::max( decode_size, transform_size );
+    return true;
+}
+
 const std::vector<double> &ImageConverter::get_WB_multipliers() const
 {
     return _wb_multipliers;
@@ -1989,5 +2667,10 @@ const std::vector<std::vector<double>> &ImageConverter::get_CAT_matrix() const
     return _cat_matrix;
 }
 
+const std::string &ImageConverter::get_last_error() const
+{
+    return _last_error;
+}
+
 } //namespace util
 } //namespace rta
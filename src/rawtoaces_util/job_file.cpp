@@ -0,0 +1,316 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+#include "job_file.h"
+
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <type_traits>
+
+namespace rta
+{
+namespace util
+{
+
+namespace
+{
+
+using Settings = ImageConverter::Settings;
+
+/// Read a scalar setting, checking the JSON type of the value strictly, so
+/// a mistyped value gets reported instead of being converted.
+template <typename T> bool read_value( const nlohmann::json &value, T &result )
+{
+    if constexpr ( std::is_same_v<T, bool> )
+    {
+        if ( !value.is_boolean() )
+            return false;
+    }
+    else if constexpr ( std::is_same_v<T, std::string> )
+    {
+        if ( !value.is_string() )
+            return false;
+    }
+    else if constexpr ( std::is_integral_v<T> )
+    {
+        if ( !value.is_number_integer() )
+            return false;
+    }
+    else
+    {
+        if ( !value.is_number() )
+            return false;
+    }
+
+    result = value.get<T>();
+    return true;
+}
+
+/// Read a fixed-size array setting. The result is left untouched if the
+/// value is malformed.
+template <typename T, size_t N>
+bool read_value( const nlohmann::json &value, T ( &result )[N] )
+{
+    if ( !value.is_array() || value.size() != N )
+        return false;
+
+    T items[N];
+    for ( size_t i = 0; i < N; i++ )
+    {
+        if ( !read_value( value[i], items[i] ) )
+            return false;
+    }
+
+    for ( size_t i = 0; i < N; i++ )
+        result[i] = items[i];
+    return true;
+}
+
+/// Read an enumerated setting given by its name.
+template <typename T>
+bool read_enum(
+    const nlohmann::json           &value,
+    T                              &result,
+    const std::map<std::string, T> &names )
+{
+    if ( !value.is_string() )
+        return false;
+
+    auto iter = names.find( value.get<std::string>() );
+    if ( iter == names.end() )
+        return false;
+
+    result = iter->second;
+    return true;
+}
+
+using SettingReader =
+    std::function<bool( const nlohmann::json &value, Settings &settings )>;
+
+/// Make a reader of the given field of the settings.
+template <typename T> SettingReader field( T Settings::*member )
+{
+    return [member]( const nlohmann::json &value, Settings &settings ) {
+        return read_value( value, settings.*member );
+    };
+}
+
+/// The readers of the settings which can be overridden by a job, by the
+/// names of the fields. The values of the methods match the command line
+/// parameters.
+const std::map<std::string, SettingReader> &setting_readers()
+{
+    static const std::map<std::string, SettingReader> readers = {
+        { "WB_method",
+          []( const nlohmann::json &value, Settings &settings ) {
+              return read_enum(
+                  value,
+                  settings.WB_method,
+                  { { "metadata", Settings::WBMethod::Metadata },
+                    { "illuminant", Settings::WBMethod::Illuminant },
+                    { "box", Settings::WBMethod::Box },
+                    { "custom", Settings::WBMethod::Custom } } );
+          } },
+        { "matrix_method",
+          []( const nlohmann::json &value, Settings &settings ) {
+              return read_enum(
+                  value,
+                  settings.matrix_method,
+                  { { "auto", Settings::MatrixMethod::Auto },
+                    { "spectral", Settings::MatrixMethod::Spectral },
+                    { "metadata", Settings::MatrixMethod::Metadata },
+                    { "Adobe", Settings::MatrixMethod::Adobe },
+                    { "custom", Settings::MatrixMethod::Custom } } );
+          } },
+        { "crop_mode",
+          []( const nlohmann::json &value, Settings &settings ) {
+              return read_enum(
+                  value,
+                  settings.crop_mode,
+                  { { "off", Settings::CropMode::Off },
+                    { "soft", Settings::CropMode::Soft },
+                    { "hard", Settings::CropMode::Hard } } );
+          } },
+        { "custom_matrix",
+          []( const nlohmann::json &value, Settings &settings ) {
+              float matrix[9];
+              if ( !read_value( value, matrix ) )
+                  return false;
+
+              for ( int i = 0; i < 3; i++ )
+                  for ( int j = 0; j < 3; j++ )
+                      settings.custom_matrix[i][j] = matrix[i * 3 + j];
+              return true;
+          } },
+        { "illuminant", field( &Settings::illuminant ) },
+        { "headroom", field( &Settings::headroom ) },
+        { "WB_box", field( &Settings::WB_box ) },
+        { "custom_WB", field( &Settings::custom_WB ) },
+        { "custom_camera_make", field( &Settings::custom_camera_make ) },
+        { "custom_camera_model", field( &Settings::custom_camera_model ) },
+        { "auto_bright", field( &Settings::auto_bright ) },
+        { "adjust_maximum_threshold",
+          field( &Settings::adjust_maximum_threshold ) },
+        { "black_level", field( &Settings::black_level ) },
+        { "saturation_level", field( &Settings::saturation_level ) },
+        { "half_size", field( &Settings::half_size ) },
+        { "highlight_mode", field( &Settings::highlight_mode ) },
+        { "flip", field( &Settings::flip ) },
+        { "crop_box", field( &Settings::crop_box ) },
+        { "chromatic_aberration", field( &Settings::chromatic_aberration ) },
+        { "denoise_threshold", field( &Settings::denoise_threshold ) },
+        { "scale", field( &Settings::scale ) },
+        { "demosaic_algorithm", field( &Settings::demosaic_algorithm ) },
+        { "overwrite", field( &Settings::overwrite ) },
+        { "create_dirs", field( &Settings::create_dirs ) },
+        { "output_dir", field( &Settings::output_dir ) },
+        { "use_timing", field( &Settings::use_timing ) },
+        { "verbosity", field( &Settings::verbosity ) }
+    };
+    return readers;
+}
+
+} // namespace
+
+bool parse_job(
+    const std::string &line,
+    const Settings    &defaults,
+    ConversionJob     &job,
+    std::string       &error )
+{
+    nlohmann::json data = nlohmann::json::parse( line, nullptr, false );
+    if ( data.is_discarded() )
+    {
+        error = "Not a valid JSON value.";
+        return false;
+    }
+
+    return parse_job_value( data, defaults, job, error );
+}
+
+bool parse_job_value(
+    const nlohmann::json &data,
+    const Settings       &defaults,
+    ConversionJob        &job,
+    std::string          &error )
+{
+    if ( !data.is_object() )
+    {
+        error = "Expected a JSON object.";
+        return false;
+    }
+
+    job          = ConversionJob();
+    job.settings = defaults;
+
+    bool has_input = false;
+    for ( auto &[key, value]: data.items() )
+    {
+        if ( key == "input" )
+        {
+            if ( !read_value( value, job.input ) || job.input.empty() )
+            {
+                error = "The \"input\" must be a non-empty string.";
+                return false;
+            }
+            has_input = true;
+        }
+        else if ( key == "output" )
+        {
+            if ( !read_value( value, job.output ) )
+            {
+                error = "The \"output\" must be a string.";
+                return false;
+            }
+        }
+        else if ( key == "settings" )
+        {
+            if ( !value.is_object() )
+            {
+                error = "The \"settings\" must be a JSON object.";
+                return false;
+            }
+
+            const auto &readers = setting_readers();
+            for ( auto &[name, setting]: value.items() )
+            {
+                auto iter = readers.find( name );
+                if ( iter == readers.end() )
+                {
+                    error = "Unknown setting \"" + name + "\".";
+                    return false;
+                }
+                if ( !iter->second( setting, job.settings ) )
+                {
+                    error = "Invalid value of the setting \"" + name +
+                            "\": " + setting.dump() + ".";
+                    return false;
+                }
+            }
+        }
+        else
+        {
+            error = "Unknown key \"" + key + "\".";
+            return false;
+        }
+    }
+
+    if ( !has_input )
+    {
+        error = "Missing the \"input\" file.";
+        return false;
+    }
+
+    if ( job.settings.WB_method == Settings::WBMethod::Illuminant &&
+         job.settings.illuminant.empty() )
+    {
+        error = "The \"illuminant\" white balancing method needs the "
+                "\"illuminant\" setting.";
+        return false;
+    }
+
+    return true;
+}
+
+bool read_job_file(
+    const std::string          &path,
+    const Settings             &defaults,
+    std::vector<ConversionJob> &jobs )
+{
+    std::ifstream stream( path );
+    if ( !stream.is_open() )
+    {
+        std::cerr << "ERROR: Failed to open the job file " << path << "."
+                  << std::endl;
+        return false;
+    }
+
+    bool        result      = true;
+    size_t      line_number = 0;
+    std::string line;
+    while ( std::getline( stream, line ) )
+    {
+        line_number++;
+        if ( line.find_first_not_of( " \t\r" ) == std::string::npos )
+            continue;
+
+        ConversionJob job;
+        std::string   error;
+        if ( !parse_job( line, defaults, job, error ) )
+        {
+            std::cerr << "ERROR: " << path << ":" << line_number << ": "
+                      << error << std::endl;
+            result = false;
+            continue;
+        }
+
+        jobs.push_back( std::move( job ) );
+    }
+
+    return result;
+}
+
+} // namespace util
+} // namespace rta
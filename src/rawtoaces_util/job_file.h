@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+#pragma once
+
+#include <rawtoaces/image_converter.h>
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+#include <vector>
+
+namespace rta
+{
+namespace util
+{
+
+/// A single conversion listed in a job file.
+struct ConversionJob
+{
+    /// The path of the input file.
+    std::string input;
+
+    /// The path of the output file, or an empty string to make it from the
+    /// input path the same way as for the files given on the command line.
+    std::string output;
+
+    /// The settings to convert the file with, the default settings with the
+    /// overrides of the job applied.
+    ImageConverter::Settings settings;
+};
+
+/// Parse a single line of a job file. A line is a JSON object like
+/// `{"input": "a.dng", "output": "a.exr", "settings": {"headroom": 4}}`,
+/// where only "input" is required. The keys of "settings" are the names of
+/// the `ImageConverter::Settings` fields, except for `database_directories`
+/// and `transform_cache`, which are shared by the whole batch. The methods take the same values as
+/// the corresponding command line parameters, and `custom_matrix` is a flat
+/// list of 9 values.
+/// @param line the line to parse.
+/// @param defaults the settings to apply the overrides of the job to.
+/// @param job the job to store the result into.
+/// @param error the variable to store the reason of a failure into.
+/// @result `true` if parsed successfully.
+bool parse_job(
+    const std::string              &line,
+    const ImageConverter::Settings &defaults,
+    ConversionJob                  &job,
+    std::string                    &error );
+
+/// Parse a job which has already been parsed as a JSON value, the same as
+/// a line of a job file.
+/// @param data the JSON value of the job.
+/// @param defaults the settings to apply the overrides of the job to.
+/// @param job the job to store the result into.
+/// @param error the variable to store the reason of a failure into.
+/// @result `true` if parsed successfully.
+bool parse_job_value(
+    const nlohmann::json           &data,
+    const ImageConverter::Settings &defaults,
+    ConversionJob                  &job,
+    std::string                    &error );
+
+/// Read a job file in the JSON Lines format, one job per line as described
+/// in `parse_job()`. The empty lines are skipped. All malformed lines are
+/// reported with their line numbers.
+/// @param path the path of the job file.
+/// @param defaults the settings to apply the overrides of every job to.
+/// @param jobs the list to append the jobs to.
+/// @result `true` if the file has been read, and all lines parsed
+/// successfully.
+bool read_job_file(
+    const std::string              &path,
+    const ImageConverter::Settings &defaults,
+    std::vector<ConversionJob>     &jobs );
+
+} // namespace util
+} // namespace rta
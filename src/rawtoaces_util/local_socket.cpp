@@ -0,0 +1,336 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+#include "local_socket.h"
+
+#include <iostream>
+
+#ifndef WIN32
+#    include <cerrno>
+#    include <cstring>
+#    include <poll.h>
+#    include <sys/socket.h>
+#    include <sys/stat.h>
+#    include <sys/un.h>
+#    include <unistd.h>
+#endif
+
+namespace rta
+{
+namespace util
+{
+
+#ifndef WIN32
+
+namespace
+{
+
+/// Fill in the address of a socket.
+/// @result `false` if the path is too long for a socket address.
+bool make_address( const std::string &path, sockaddr_un &address )
+{
+    address            = {};
+    address.sun_family = AF_UNIX;
+    if ( path.empty() || path.size() >= sizeof( address.sun_path ) )
+    {
+        std::cerr << "ERROR: Invalid socket path \"" << path << "\", "
+                  << "the length must be between 1 and "
+                  << sizeof( address.sun_path ) - 1 << " characters."
+                  << std::endl;
+        return false;
+    }
+
+    std::memcpy( address.sun_path, path.c_str(), path.size() + 1 );
+    return true;
+}
+
+/// Create a socket which doesn't raise `SIGPIPE` when written to after the
+/// other side has closed it.
+int make_socket()
+{
+    int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+#    ifdef SO_NOSIGPIPE
+    if ( fd >= 0 )
+    {
+        int enable = 1;
+        setsockopt( fd, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof( enable ) );
+    }
+#    endif
+    return fd;
+}
+
+#    ifdef MSG_NOSIGNAL
+const int send_flags = MSG_NOSIGNAL;
+#    else
+const int send_flags = 0;
+#    endif
+
+} // namespace
+
+LocalSocket::LocalSocket( int fd ) : _fd( fd ) {}
+
+LocalSocket::~LocalSocket()
+{
+    if ( _fd >= 0 )
+        close( _fd );
+}
+
+bool LocalSocket::is_supported()
+{
+    return true;
+}
+
+std::unique_ptr<LocalSocket> LocalSocket::connect( const std::string &path )
+{
+    sockaddr_un address;
+    if ( !make_address( path, address ) )
+        return nullptr;
+
+    int fd = make_socket();
+    if ( fd < 0 )
+    {
+        std::cerr << "ERROR: Failed to create a socket: "
+                  << std::strerror( errno ) << std::endl;
+        return nullptr;
+    }
+
+    if ( ::connect(
+             fd, reinterpret_cast<sockaddr *>( &address ), sizeof( address ) ) <
+         0 )
+    {
+        std::cerr << "ERROR: Failed to connect to " << path << ": "
+                  << std::strerror( errno ) << std::endl;
+        close( fd );
+        return nullptr;
+    }
+
+    return std::make_unique<LocalSocket>( fd );
+}
+
+LocalSocket::ReadResult
+LocalSocket::read_line( std::string &line, int timeout_ms )
+{
+    while ( true )
+    {
+        size_t end = _buffer.find( '\n' );
+        if ( end != std::string::npos )
+        {
+            line = _buffer.substr( 0, end );
+            _buffer.erase( 0, end + 1 );
+            if ( !line.empty() && line.back() == '\r' )
+                line.pop_back();
+            return ReadResult::Line;
+        }
+
+        pollfd poll_fd = { _fd, POLLIN, 0 };
+        int    ready   = poll( &poll_fd, 1, timeout_ms );
+        if ( ready < 0 )
+        {
+            // Interrupted by a signal, let the caller check whether to stop.
+            if ( errno == EINTR )
+                return ReadResult::Timeout;
+
+            std::cerr << "ERROR: Failed to wait for the socket: "
+                      << std::strerror( errno ) << std::endl;
+            return ReadResult::Error;
+        }
+        if ( ready == 0 )
+            return ReadResult::Timeout;
+
+        char    buffer[4096];
+        ssize_t length = recv( _fd, buffer, sizeof( buffer ), 0 );
+        if ( length == 0 )
+            return ReadResult::Closed;
+        if ( length < 0 )
+        {
+            if ( errno == EINTR || errno == EAGAIN )
+                continue;
+            if ( errno == ECONNRESET )
+                return ReadResult::Closed;
+
+            std::cerr << "ERROR: Failed to read from the socket: "
+                      << std::strerror( errno ) << std::endl;
+            return ReadResult::Error;
+        }
+
+        _buffer.append( buffer, static_cast<size_t>( length ) );
+    }
+}
+
+bool LocalSocket::write_line( const std::string &line )
+{
+    std::string data = line + "\n";
+
+    std::lock_guard<std::mutex> lock( _write_mutex );
+    for ( size_t sent = 0; sent < data.size(); )
+    {
+        ssize_t length =
+            send( _fd, data.data() + sent, data.size() - sent, send_flags );
+        if ( length < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            return false;
+        }
+        sent += static_cast<size_t>( length );
+    }
+    return true;
+}
+
+LocalSocketListener::~LocalSocketListener()
+{
+    if ( _fd >= 0 )
+    {
+        close( _fd );
+        unlink( _path.c_str() );
+    }
+}
+
+bool LocalSocketListener::listen( const std::string &path )
+{
+    sockaddr_un address;
+    if ( !make_address( path, address ) )
+        return false;
+
+    struct stat status;
+    if ( lstat( path.c_str(), &status ) == 0 )
+    {
+        if ( !S_ISSOCK( status.st_mode ) )
+        {
+            std::cerr << "ERROR: The file " << path
+                      << " already exists and is not a socket." << std::endl;
+            return false;
+        }
+
+        // Only a socket nobody is listening on can be replaced.
+        int probe = make_socket();
+        if ( probe >= 0 &&
+             ::connect(
+                 probe,
+                 reinterpret_cast<sockaddr *>( &address ),
+                 sizeof( address ) ) == 0 )
+        {
+            close( probe );
+            std::cerr << "ERROR: Another server is already listening on "
+                      << path << "." << std::endl;
+            return false;
+        }
+        if ( probe >= 0 )
+            close( probe );
+
+        unlink( path.c_str() );
+    }
+
+    _fd = make_socket();
+    if ( _fd < 0 )
+    {
+        std::cerr << "ERROR: Failed to create a socket: "
+                  << std::strerror( errno ) << std::endl;
+        return false;
+    }
+
+    if ( bind( _fd,
+               reinterpret_cast<sockaddr *>( &address ),
+               sizeof( address ) ) < 0 ||
+         ::listen( _fd, SOMAXCONN ) < 0 )
+    {
+        std::cerr << "ERROR: Failed to listen on " << path << ": "
+                  << std::strerror( errno ) << std::endl;
+        close( _fd );
+        _fd = -1;
+        return false;
+    }
+
+    _path = path;
+    return true;
+}
+
+bool LocalSocketListener::accept(
+    int timeout_ms, std::unique_ptr<LocalSocket> &connection )
+{
+    connection.reset();
+    if ( _fd < 0 )
+        return false;
+
+    pollfd poll_fd = { _fd, POLLIN, 0 };
+    int    ready   = poll( &poll_fd, 1, timeout_ms );
+    if ( ready < 0 )
+    {
+        // Interrupted by a signal, let the caller check whether to stop.
+        if ( errno == EINTR )
+            return true;
+
+        std::cerr << "ERROR: Failed to wait for the connections: "
+                  << std::strerror( errno ) << std::endl;
+        return false;
+    }
+    if ( ready == 0 )
+        return true;
+
+    int fd = ::accept( _fd, nullptr, nullptr );
+    if ( fd < 0 )
+    {
+        // The client has given up before the connection got accepted.
+        if ( errno == EINTR || errno == EAGAIN || errno == ECONNABORTED )
+            return true;
+
+        std::cerr << "ERROR: Failed to accept a connection: "
+                  << std::strerror( errno ) << std::endl;
+        return false;
+    }
+
+#    ifdef SO_NOSIGPIPE
+    int enable = 1;
+    setsockopt( fd, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof( enable ) );
+#    endif
+
+    connection = std::make_unique<LocalSocket>( fd );
+    return true;
+}
+
+#else
+
+LocalSocket::LocalSocket( int fd ) : _fd( fd ) {}
+
+LocalSocket::~LocalSocket() {}
+
+bool LocalSocket::is_supported()
+{
+    return false;
+}
+
+std::unique_ptr<LocalSocket> LocalSocket::connect( const std::string &path )
+{
+    std::cerr << "ERROR: Unix domain sockets are not supported on this "
+              << "platform, can't connect to " << path << std::endl;
+    return nullptr;
+}
+
+LocalSocket::ReadResult LocalSocket::read_line( std::string &, int )
+{
+    return ReadResult::Error;
+}
+
+bool LocalSocket::write_line( const std::string & )
+{
+    return false;
+}
+
+LocalSocketListener::~LocalSocketListener() {}
+
+bool LocalSocketListener::listen( const std::string &path )
+{
+    std::cerr << "ERROR: Unix domain sockets are not supported on this "
+              << "platform, can't listen on " << path << std::endl;
+    return false;
+}
+
+bool LocalSocketListener::accept( int, std::unique_ptr<LocalSocket> & )
+{
+    return false;
+}
+
+#endif
+
+} // namespace util
+} // namespace rta
@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace rta
+{
+namespace util
+{
+
+/// A connection over a Unix domain socket exchanging lines of text. Writing
+/// is thread-safe, so the responses can be sent from multiple workers, while
+/// reading is meant to be done by a single thread. Unix domain sockets are
+/// only supported on Linux and macOS.
+class LocalSocket
+{
+public:
+    /// The outcome of reading a line.
+    enum class ReadResult
+    {
+        Line,
+        Timeout,
+        Closed,
+        Error
+    };
+
+    /// Take ownership of a connected socket.
+    /// @param fd the file descriptor of the socket.
+    explicit LocalSocket( int fd );
+    ~LocalSocket();
+
+    LocalSocket( const LocalSocket & )            = delete;
+    LocalSocket &operator=( const LocalSocket & ) = delete;
+
+    /// Check whether Unix domain sockets are supported on this platform.
+    static bool is_supported();
+
+    /// Connect to a server listening on the given socket.
+    /// @param path the path of the socket.
+    /// @result the connection, or `nullptr` if the connection has failed.
+    static std::unique_ptr<LocalSocket> connect( const std::string &path );
+
+    /// Read the next line, without the line break.
+    /// @param line the variable to store the line into.
+    /// @param timeout_ms the maximum time to wait in milliseconds, or -1 to
+    /// wait indefinitely.
+    /// @result `ReadResult::Line` if a line has been read, or the reason
+    /// why it hasn't. The text following the last line break is dropped once
+    /// the other side closes the connection.
+    ReadResult read_line( std::string &line, int timeout_ms );
+
+    /// Send a line, appending the line break.
+    /// @param line the line to send.
+    /// @result `true` if sent successfully, `false` if the connection has
+    /// been closed by the other side or has failed.
+    bool write_line( const std::string &line );
+
+private:
+    int         _fd;
+    std::string _buffer;
+    std::mutex  _write_mutex;
+};
+
+/// A Unix domain socket listening for the connections.
+class LocalSocketListener
+{
+public:
+    LocalSocketListener() = default;
+    ~LocalSocketListener();
+
+    LocalSocketListener( const LocalSocketListener & )            = delete;
+    LocalSocketListener &operator=( const LocalSocketListener & ) = delete;
+
+    /// Start listening on the given path. A stale socket left behind by a
+    /// server which hasn't exited cleanly gets replaced, but a socket with a
+    /// server still listening on it is not touched.
+    /// @param path the path of the socket to create.
+    /// @result `true` if listening.
+    bool listen( const std::string &path );
+
+    /// Wait for the next connection.
+    /// @param timeout_ms the maximum time to wait in milliseconds.
+    /// @param connection the variable to store the accepted connection into,
+    /// set to `nullptr` if the time has run out.
+    /// @result `false` if the socket has failed.
+    bool accept( int timeout_ms, std::unique_ptr<LocalSocket> &connection );
+
+private:
+    int         _fd = -1;
+    std::string _path;
+};
+
+} // namespace util
+} // namespace rta
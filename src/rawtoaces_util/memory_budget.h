@@ -0,0 +1,138 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+namespace rta
+{
+namespace util
+{
+
+/// A limit on the total memory used by the conversions running concurrently.
+/// Each conversion reserves its estimated peak memory before starting, and
+/// waits while the reservation doesn't fit into the budget. The reservations
+/// are granted in the order they have been requested, so a large file can't
+/// be held back indefinitely by the smaller files arriving after it.
+class MemoryBudget
+{
+public:
+    /// Construct a budget.
+    /// @param limit the maximum number of bytes reserved at any time, or 0
+    /// for an unlimited budget.
+    explicit MemoryBudget( size_t limit = 0 ) : _limit( limit ) {}
+
+    /// Reserve the given amount of memory, waiting until it fits into the
+    /// budget. A reservation larger than the whole budget gets reduced to
+    /// the budget, so such a file gets converted alone instead of blocking
+    /// forever.
+    /// @param bytes the amount of memory to reserve.
+    /// @result the amount actually reserved, to be passed to `release()`.
+    size_t acquire( size_t bytes )
+    {
+        if ( _limit == 0 )
+            return 0;
+
+        bytes = std::min( bytes, _limit );
+
+        std::unique_lock<std::mutex> lock( _mutex );
+        size_t                       ticket = _next_ticket++;
+        _changed.wait( lock, [&]() {
+            return ticket == _serving && _used + bytes <= _limit;
+        } );
+
+        _serving++;
+        _used += bytes;
+        lock.unlock();
+        _changed.notify_all();
+        return bytes;
+    }
+
+    /// Return a reservation made by `acquire()` to the budget.
+    /// @param bytes the amount returned by `acquire()`.
+    void release( size_t bytes )
+    {
+        if ( bytes == 0 )
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock( _mutex );
+            _used -= bytes;
+        }
+        _changed.notify_all();
+    }
+
+    /// Get the amount of memory currently reserved.
+    size_t used() const
+    {
+        std::lock_guard<std::mutex> lock( _mutex );
+        return _used;
+    }
+
+private:
+    const size_t            _limit;
+    mutable std::mutex      _mutex;
+    std::condition_variable _changed;
+    size_t                  _used        = 0;
+    size_t                  _next_ticket = 0;
+    size_t                  _serving     = 0;
+};
+
+/// A reservation of memory in a `MemoryBudget`, released on destruction.
+class MemoryReservation
+{
+public:
+    MemoryReservation() = default;
+
+    /// Reserve memory in the budget, waiting until it fits.
+    /// @param budget the budget to reserve the memory in.
+    /// @param bytes the amount of memory to reserve.
+    MemoryReservation( MemoryBudget &budget, size_t bytes )
+        : _budget( &budget ), _bytes( budget.acquire( bytes ) )
+    {}
+
+    ~MemoryReservation() { reset(); }
+
+    MemoryReservation( const MemoryReservation & )            = delete;
+    MemoryReservation &operator=( const MemoryReservation & ) = delete;
+
+    MemoryReservation( MemoryReservation &&other )
+        : _budget( other._budget ), _bytes( other._bytes )
+    {
+        other._budget = nullptr;
+        other._bytes  = 0;
+    }
+
+    MemoryReservation &operator=( MemoryReservation &&other )
+    {
+        if ( this != &other )
+        {
+            reset();
+            _budget       = other._budget;
+            _bytes        = other._bytes;
+            other._budget = nullptr;
+            other._bytes  = 0;
+        }
+        return *this;
+    }
+
+    /// Release the reservation early.
+    void reset()
+    {
+        if ( _budget )
+            _budget->release( _bytes );
+        _budget = nullptr;
+        _bytes  = 0;
+    }
+
+private:
+    MemoryBudget *_budget = nullptr;
+    size_t        _bytes  = 0;
+};
+
+} // namespace util
+} // namespace rta
@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+#include "progress_reporter.h"
+
+#include <nlohmann/json.hpp>
+
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+namespace rta
+{
+namespace util
+{
+
+namespace
+{
+
+/// Format a duration in seconds like "1:02:03" or "2:03".
+std::string format_duration( double seconds )
+{
+    uint64_t total   = static_cast<uint64_t>( std::llround( seconds ) );
+    uint64_t hours   = total / 3600;
+    uint64_t minutes = ( total / 60 ) % 60;
+
+    std::ostringstream stream;
+    if ( hours > 0 )
+        stream << hours << ":" << std::setw( 2 ) << std::setfill( '0' );
+    stream << minutes << ":" << std::setw( 2 ) << std::setfill( '0' )
+           << total % 60;
+    return stream.str();
+}
+
+} // namespace
+
+ProgressReporter::ProgressReporter(
+    const ProgressCounters &counters,
+    size_t                  total,
+    Format                  format,
+    std::ostream           &stream )
+    : _counters( counters ), _total( total ), _format( format ), _stream( stream )
+{
+    _start    = sample();
+    _previous = _start;
+}
+
+ProgressReporter::~ProgressReporter()
+{
+    stop_thread();
+}
+
+void ProgressReporter::start( std::chrono::milliseconds interval )
+{
+    _start    = sample();
+    _previous = _start;
+
+    _thread = std::thread( [this, interval]() {
+        std::unique_lock<std::mutex> lock( _mutex );
+        while ( !_stopped.wait_for( lock, interval, [this]() {
+            return _stopping;
+        } ) )
+        {
+            report( false );
+        }
+    } );
+}
+
+void ProgressReporter::stop()
+{
+    stop_thread();
+    report( true );
+}
+
+void ProgressReporter::stop_thread()
+{
+    if ( !_thread.joinable() )
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock( _mutex );
+        _stopping = true;
+    }
+    _stopped.notify_all();
+    _thread.join();
+}
+
+ProgressReporter::Sample ProgressReporter::sample() const
+{
+    Sample result;
+    result.time   = std::chrono::steady_clock::now();
+    result.failed = _counters.files_failed.load( std::memory_order_relaxed );
+    result.files  = _counters.files_done.load( std::memory_order_relaxed ) +
+                   result.failed;
+    result.bytes  = _counters.bytes_read.load( std::memory_order_relaxed );
+    result.pixels = _counters.pixels_decoded.load( std::memory_order_relaxed );
+    return result;
+}
+
+void ProgressReporter::report( bool final )
+{
+    Sample current = sample();
+    Sample from    = final ? _start : _previous;
+    _previous      = current;
+
+    double elapsed =
+        std::chrono::duration<double>( current.time - _start.time ).count();
+    double interval =
+        std::chrono::duration<double>( current.time - from.time ).count();
+    if ( interval <= 0.0 )
+        interval = 1.0;
+
+    double files_rate  = ( current.files - from.files ) / interval;
+    double bytes_rate  = ( current.bytes - from.bytes ) / interval / 1e6;
+    double pixels_rate = ( current.pixels - from.pixels ) / interval / 1e6;
+
+    uint64_t failed = current.failed;
+
+    // The time left is estimated from the average rate of the whole batch,
+    // which is less jumpy than the rate of the last interval.
+    bool   has_eta = false;
+    double eta     = 0.0;
+    if ( _total > 0 && current.files > _start.files && elapsed > 0.0 )
+    {
+        double   average   = ( current.files - _start.files ) / elapsed;
+        uint64_t remaining = _total > current.files ? _total - current.files
+                                                    : 0;
+        eta     = remaining / average;
+        has_eta = true;
+    }
+
+    if ( _format == Format::JSON )
+    {
+        nlohmann::json data = {
+            { "elapsed", elapsed },
+            { "files_done", current.files - failed },
+            { "files_failed", failed },
+            { "files_total", nullptr },
+            { "files_per_second", files_rate },
+            { "input_mb_per_second", bytes_rate },
+            { "megapixels_per_second", pixels_rate },
+            { "eta", nullptr },
+            { "final", final }
+        };
+        if ( _total > 0 )
+            data["files_total"] = _total;
+        if ( has_eta )
+            data["eta"] = eta;
+
+        _stream << data.dump() << std::endl;
+        return;
+    }
+
+    std::ostringstream line;
+    line << "\r[" << current.files;
+    if ( _total > 0 )
+        line << "/" << _total;
+    line << "] " << std::fixed << std::setprecision( 1 ) << files_rate
+         << " files/s, " << bytes_rate << " MB/s, " << pixels_rate
+         << " MP/s";
+    if ( failed > 0 )
+        line << ", " << failed << " failed";
+    if ( final )
+        line << ", " << format_duration( elapsed ) << " total";
+    else if ( has_eta )
+        line << ", ETA " << format_duration( eta );
+
+    // Clear the rest of the previous line, which may have been longer.
+    line << "\033[K";
+    if ( final )
+        line << "\n";
+
+    _stream << line.str() << std::flush;
+}
+
+} // namespace util
+} // namespace rta
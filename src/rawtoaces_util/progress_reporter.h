@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+namespace rta
+{
+namespace util
+{
+
+/// The counters of a batch, updated by the workers without locking.
+struct ProgressCounters
+{
+    std::atomic<uint64_t> files_done     = 0;
+    std::atomic<uint64_t> files_failed   = 0;
+    std::atomic<uint64_t> bytes_read     = 0;
+    std::atomic<uint64_t> pixels_decoded = 0;
+};
+
+/// Periodically reports the throughput of a batch and the estimated time
+/// left, from a background thread sampling the counters of the batch. The
+/// rates are measured over the last reporting interval, so the stalls of the
+/// storage show up right away, while the estimated time left uses the
+/// average rate of the whole batch.
+class ProgressReporter
+{
+public:
+    enum class Format
+    {
+        /// A single line refreshed in place, for a terminal.
+        TTY,
+
+        /// A line of JSON per report, for the monitoring tools.
+        JSON
+    };
+
+    /// @param counters the counters to report, must stay alive until the
+    /// reporter stops.
+    /// @param total the total number of files, or 0 if not known in advance.
+    /// @param format the format of the reports.
+    /// @param stream the stream to write the reports to.
+    ProgressReporter(
+        const ProgressCounters &counters,
+        size_t                  total,
+        Format                  format,
+        std::ostream           &stream );
+    ~ProgressReporter();
+
+    ProgressReporter( const ProgressReporter & )            = delete;
+    ProgressReporter &operator=( const ProgressReporter & ) = delete;
+
+    /// Start reporting periodically.
+    /// @param interval the time between the reports.
+    void start( std::chrono::milliseconds interval );
+
+    /// Stop reporting, and write the final report with the average rates of
+    /// the whole batch.
+    void stop();
+
+    /// Write a report of the current counters.
+    /// @param final report the average rates of the whole batch instead of
+    /// the rates since the previous report.
+    void report( bool final );
+
+private:
+    struct Sample
+    {
+        std::chrono::steady_clock::time_point time;
+
+        /// The number of the files done, including the failed ones.
+        uint64_t files  = 0;
+        uint64_t failed = 0;
+        uint64_t bytes  = 0;
+        uint64_t pixels = 0;
+    };
+
+    /// Take a sample of the counters.
+    Sample sample() const;
+
+    /// Stop the reporting thread, if running.
+    void stop_thread();
+
+    const ProgressCounters &_counters;
+    const size_t            _total;
+    const Format            _format;
+    std::ostream           &_stream;
+
+    Sample _start;
+    Sample _previous;
+
+    std::thread             _thread;
+    std::mutex              _mutex;
+    std::condition_variable _stopped;
+    bool                    _stopping = false;
+};
+
+} // namespace util
+} // namespace rta
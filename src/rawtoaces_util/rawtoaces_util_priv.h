@@ -4,10 +4,12 @@
 #pragma once
 
 #include <filesystem>
+#include <set>
 #include <string>
 #include <vector>
 #include <OpenImageIO/imageio.h>
 #include "../include/rawtoaces/image_converter.h"
+#include "transform_cache.h"
 
 // Contains the declarations of the private functions,
 // exposed here for unit-testing.
@@ -21,12 +23,19 @@ std::vector<std::string>
      database_paths( const std::string &override_path = "" );
 void fix_metadata( OIIO::ImageSpec &spec );
 
+bool                  is_ignored_file( const std::filesystem::path &path );
+std::set<std::string> raw_file_extensions();
+
+struct SpectralContext;
+
 bool prepare_transform_spectral(
     const OIIO::ImageSpec            &image_spec,
     const ImageConverter::Settings   &settings,
     std::vector<double>              &WB_multipliers,
     std::vector<std::vector<double>> &IDT_matrix,
-    std::vector<std::vector<double>> &CAT_matrix );
+    std::vector<std::vector<double>> &CAT_matrix,
+    TransformCache                   *cache   = nullptr,
+    SpectralContext                  *context = nullptr );
 
 } // namespace util
 } // namespace rta
@@ -0,0 +1,353 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+#include "transform_cache.h"
+
+#include <rawtoaces/spectral_database.h>
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+namespace rta
+{
+namespace util
+{
+
+namespace
+{
+
+// Increment when the layout of the transform files changes.
+const int transform_file_version = 1;
+
+/// Update a 64-bit FNV-1a hash with the given bytes.
+void hash_bytes( uint64_t &hash, const char *data, size_t size )
+{
+    for ( size_t i = 0; i < size; i++ )
+    {
+        hash ^= static_cast<unsigned char>( data[i] );
+        hash *= 1099511628211ull;
+    }
+}
+
+/// Update a hash with a string, prefixed with its length, so the
+/// concatenations of different strings never hash the same.
+void hash_string( uint64_t &hash, const std::string &value )
+{
+    std::string length = std::to_string( value.size() ) + ":";
+    hash_bytes( hash, length.data(), length.size() );
+    hash_bytes( hash, value.data(), value.size() );
+}
+
+/// Update a hash with the relative path, the size and the modification time
+/// of a file. Same as the compiled databases checking their sources, this
+/// catches the edits made to the data without reading it. The missing files
+/// are hashed as such, so adding a file changes the hash.
+void hash_file(
+    uint64_t                    &hash,
+    const std::filesystem::path &directory,
+    const std::string           &relative_path )
+{
+    hash_string( hash, relative_path );
+
+    std::error_code error;
+    auto            path = directory / relative_path;
+    auto            size = std::filesystem::file_size( path, error );
+    if ( error )
+    {
+        hash_string( hash, "<missing>" );
+        return;
+    }
+    auto time = std::filesystem::last_write_time( path, error );
+
+    hash_string( hash, std::to_string( size ) );
+    hash_string( hash, std::to_string( time.time_since_epoch().count() ) );
+}
+
+/// Update a hash with all JSON files of a directory, in the order of their
+/// names, as the database lookups go through all of them.
+void hash_files_of_type(
+    uint64_t &hash, const std::filesystem::path &directory, const char *type )
+{
+    std::vector<std::string> names;
+
+    std::error_code error;
+    for ( auto iter = std::filesystem::directory_iterator(
+              directory / type, error );
+          !error && iter != std::filesystem::directory_iterator();
+          iter.increment( error ) )
+    {
+        if ( iter->path().extension() == ".json" )
+            names.push_back( iter->path().filename().string() );
+    }
+    std::sort( names.begin(), names.end() );
+
+    for ( const auto &name: names )
+        hash_file( hash, directory, std::string( type ) + "/" + name );
+}
+
+/// Update a hash with the data files of a database directory.
+void hash_directory( uint64_t &hash, const std::filesystem::path &directory )
+{
+    hash_files_of_type( hash, directory, "camera" );
+    hash_files_of_type( hash, directory, "illuminant" );
+    hash_file( hash, directory, TransformCache::training_data_path );
+    hash_file( hash, directory, TransformCache::observer_data_path );
+}
+
+/// Format a hash as a hexadecimal string.
+std::string format_hash( uint64_t hash )
+{
+    std::ostringstream result;
+    result << std::hex << std::setw( 16 ) << std::setfill( '0' ) << hash;
+    return result.str();
+}
+
+/// Hash the data files of the database directories the transforms get
+/// solved from.
+std::string hash_database( const std::vector<std::string> &directories )
+{
+    uint64_t hash = 14695981039346656037ull;
+    for ( const auto &directory: directories )
+    {
+        hash_string( hash, directory );
+
+        // A compiled database stands in for its source directories, and
+        // holds all the data, unless it is out of date, in which case the
+        // database loads the source directories instead.
+        std::vector<std::string> sources;
+        std::error_code          error;
+        if ( !std::filesystem::is_regular_file( directory, error ) )
+        {
+            hash_directory( hash, directory );
+        }
+        else if ( core::SpectralDatabase::check_compiled( directory, sources ) )
+        {
+            std::filesystem::path path( directory );
+            hash_file( hash, path.parent_path(), path.filename().string() );
+        }
+        else
+        {
+            for ( const auto &source: sources )
+            {
+                hash_string( hash, source );
+                hash_directory( hash, source );
+            }
+        }
+    }
+
+    return format_hash( hash );
+}
+
+/// Get the path of the file storing the transform with the given key.
+std::filesystem::path
+transform_file_path( const std::string &directory, const std::string &key )
+{
+    uint64_t hash = 14695981039346656037ull;
+    hash_bytes( hash, key.data(), key.size() );
+    return std::filesystem::path( directory ) /
+           ( "transform_" + format_hash( hash ) + ".json" );
+}
+
+/// Load a transform from its file in the cache directory.
+/// @result `false` if there is no file for the transform, or the file is
+/// malformed, written by another version, or belongs to a different key.
+bool load_transform(
+    const std::string     &directory,
+    const std::string     &key,
+    TransformCache::Entry &entry )
+{
+    std::filesystem::path path = transform_file_path( directory, key );
+
+    std::ifstream stream( path );
+    if ( !stream.is_open() )
+        return false;
+
+    try
+    {
+        nlohmann::json data = nlohmann::json::parse( stream );
+        if ( data.at( "version" ).get<int>() != transform_file_version )
+            return false;
+
+        // Guards against the collisions of the file name hashes.
+        if ( data.at( "key" ).get<std::string>() != key )
+            return false;
+
+        TransformCache::Entry result;
+        result.illuminant = data.at( "illuminant" ).get<std::string>();
+        result.WB_multipliers =
+            data.at( "WB_multipliers" ).get<std::vector<double>>();
+        result.IDT_matrix =
+            data.at( "IDT_matrix" ).get<std::vector<std::vector<double>>>();
+
+        if ( result.IDT_matrix.size() != 3 )
+            return false;
+        for ( const auto &row: result.IDT_matrix )
+        {
+            if ( row.size() != 3 )
+                return false;
+        }
+
+        entry = result;
+    }
+    catch ( const nlohmann::json::exception &e )
+    {
+        std::cerr << "Warning: Ignoring the malformed transform cache file "
+                  << path.string() << ": " << e.what() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+/// Save a transform into its file in the cache directory. The file is
+/// written under a unique temporary name first and then renamed, so the
+/// processes sharing the directory never read a partially written file.
+/// Failing to save is not an error, as the transform is already solved.
+void save_transform(
+    const std::string           &directory,
+    const std::string           &key,
+    const TransformCache::Entry &entry )
+{
+    std::error_code error;
+    std::filesystem::create_directories( directory, error );
+
+    std::filesystem::path path = transform_file_path( directory, key );
+
+    std::ostringstream suffix;
+    suffix << ".tmp"
+           << std::hash<std::thread::id>()( std::this_thread::get_id() )
+           << "_"
+           << std::chrono::steady_clock::now().time_since_epoch().count();
+    std::filesystem::path temp_path = path;
+    temp_path += suffix.str();
+
+    nlohmann::json data = { { "version", transform_file_version },
+                            { "key", key },
+                            { "illuminant", entry.illuminant },
+                            { "WB_multipliers", entry.WB_multipliers },
+                            { "IDT_matrix", entry.IDT_matrix } };
+
+    {
+        std::ofstream stream( temp_path );
+        if ( stream.is_open() )
+        {
+            stream << data.dump(
+                          4, ' ', false, nlohmann::json::error_handler_t::replace )
+                   << std::endl;
+        }
+        if ( !stream.is_open() || !stream.good() )
+        {
+            std::cerr << "Warning: Failed to write the transform cache file "
+                      << temp_path.string() << "." << std::endl;
+            std::filesystem::remove( temp_path, error );
+            return;
+        }
+    }
+
+    std::filesystem::rename( temp_path, path, error );
+    if ( error )
+    {
+        std::cerr << "Warning: Failed to write the transform cache file "
+                  << path.string() << ": " << error.message() << std::endl;
+        std::filesystem::remove( temp_path, error );
+    }
+}
+
+} // namespace
+
+const char *const TransformCache::training_data_path =
+    "training/training_spectral.json";
+const char *const TransformCache::observer_data_path = "cmf/cmf_1931.json";
+
+bool TransformCache::get(
+    const std::string                    &key,
+    const std::string                    &directory,
+    const std::function<bool( Entry & )> &solve,
+    Entry                                &entry )
+{
+    std::unique_lock<std::mutex> lock( _mutex );
+    _solved.wait( lock, [&]() { return _solving.count( key ) == 0; } );
+
+    auto iter = _entries.find( key );
+    if ( iter != _entries.end() )
+    {
+        entry = iter->second;
+        return true;
+    }
+
+    _solving.insert( key );
+    lock.unlock();
+
+    Entry result;
+    bool  success = false;
+    try
+    {
+        success = !directory.empty() && load_transform( directory, key, result );
+        if ( !success )
+        {
+            success = solve( result );
+            if ( success && !directory.empty() )
+                save_transform( directory, key, result );
+        }
+    }
+    catch ( ... )
+    {
+        lock.lock();
+        _solving.erase( key );
+        lock.unlock();
+        _solved.notify_all();
+        throw;
+    }
+
+    lock.lock();
+    _solving.erase( key );
+    if ( success )
+        _entries[key] = result;
+    lock.unlock();
+    _solved.notify_all();
+
+    if ( success )
+        entry = result;
+    return success;
+}
+
+std::string
+TransformCache::get_database_hash( const std::vector<std::string> &directories )
+{
+    DatabaseHash *database_hash = nullptr;
+    {
+        std::lock_guard<std::mutex> lock( _mutex );
+        database_hash = &_database_hashes[directories];
+    }
+
+    // Hashing checks all database files, so it runs unlocked, not to block
+    // the lookups of the other threads, while the threads needing the same
+    // directories wait for a single hashing.
+    std::call_once( database_hash->computed, [&]() {
+        database_hash->value = hash_database( directories );
+    } );
+    return database_hash->value;
+}
+
+size_t TransformCache::size() const
+{
+    std::lock_guard<std::mutex> lock( _mutex );
+    return _entries.size();
+}
+
+void TransformCache::clear()
+{
+    std::lock_guard<std::mutex> lock( _mutex );
+    _entries.clear();
+}
+
+} // namespace util
+} // namespace rta
@@ -0,0 +1,105 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace rta
+{
+namespace util
+{
+
+/// A thread-safe cache of the colour transforms solved from the spectral
+/// data, shared by all copies of an `ImageConverter`. Solving a transform
+/// loads the camera, training and observer data and runs a non-linear fit,
+/// while the result only depends on the camera, the illuminant or the white
+/// balance multipliers, and the database, so the consecutive frames of a
+/// shoot can reuse it. The transforms can also be kept in a directory, one
+/// JSON file per transform, to be reused by the following runs.
+class TransformCache
+{
+public:
+    /// A transform solved from the spectral data.
+    struct Entry
+    {
+        /// The name of the illuminant, either given or found from the white
+        /// balance multipliers.
+        std::string illuminant;
+
+        /// The white balance multipliers solved for the given illuminant, or
+        /// empty if the illuminant has been found from the multipliers.
+        std::vector<double> WB_multipliers;
+
+        /// The input device transform matrix.
+        std::vector<std::vector<double>> IDT_matrix;
+    };
+
+    /// The paths of the training and observer data the spectral transforms
+    /// are solved with, relative to the database directories.
+    static const char *const training_data_path;
+    static const char *const observer_data_path;
+
+    /// Get the transform for the given key, solving it if not cached. If
+    /// another thread is already solving the same key, wait for its result
+    /// instead of solving again. The failures are not cached, so every
+    /// caller of a failing key reports its own errors.
+    /// @param key the key identifying the transform.
+    /// @param directory the directory to look the transforms missing from
+    /// memory up in, and to save the solved transforms into, or an empty
+    /// string to only cache in memory. The key needs to include
+    /// `get_database_hash()` in this case, as the files outlive the
+    /// database they have been solved from.
+    /// @param solve the function to solve the transform with, only called
+    /// on a miss.
+    /// @param entry the variable to store the transform into.
+    /// @result `true` if the transform has been found or solved.
+    bool get(
+        const std::string                    &key,
+        const std::string                    &directory,
+        const std::function<bool( Entry & )> &solve,
+        Entry                                &entry );
+
+    /// Get a hash of the database files the transforms get solved from: the
+    /// camera, illuminant, training and observer data in the given
+    /// directories, or the compiled database files standing in for them.
+    /// Only the names, sizes and modification times of the files are hashed,
+    /// without reading them. The hash is computed once for the same
+    /// directories, the concurrent callers waiting for it without blocking
+    /// the other calls of the cache, so the changes to the database made
+    /// while running are not picked up.
+    /// @param directories the database directories.
+    /// @result the hash as a hexadecimal string.
+    std::string
+    get_database_hash( const std::vector<std::string> &directories );
+
+    /// Get the number of the cached transforms.
+    size_t size() const;
+
+    /// Remove all cached transforms.
+    void clear();
+
+private:
+    mutable std::mutex           _mutex;
+    std::condition_variable      _solved;
+    std::map<std::string, Entry> _entries;
+    std::set<std::string>        _solving;
+
+    /// A database hash, computed on the first use.
+    struct DatabaseHash
+    {
+        std::once_flag computed;
+        std::string    value;
+    };
+
+    std::map<std::vector<std::string>, DatabaseHash> _database_hashes;
+};
+
+} // namespace util
+} // namespace rta
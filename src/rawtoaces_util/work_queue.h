@@ -0,0 +1,89 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+namespace rta
+{
+namespace util
+{
+
+/// A thread-safe FIFO queue shared between the producers and the consumers
+/// of work items. Consumers block in `pop()` until an item becomes available,
+/// or the queue gets closed. A queue constructed with a non-zero capacity is
+/// bounded: producers block in `push()` while the queue is full, which limits
+/// the number of items in flight when a consumer falls behind.
+template <typename T> class WorkQueue
+{
+public:
+    /// Construct a queue.
+    /// @param capacity the maximum number of items the queue can hold, or 0
+    /// for an unbounded queue.
+    explicit WorkQueue( size_t capacity = 0 ) : _capacity( capacity ) {}
+
+    /// Add an item to the back of the queue, waiting for a free slot if the
+    /// queue is bounded and full.
+    /// @param item the item to add.
+    /// @result `false` if the queue has been closed, in which case the item
+    /// is discarded.
+    bool push( T item )
+    {
+        std::unique_lock<std::mutex> lock( _mutex );
+        _not_full.wait( lock, [this]() {
+            return _closed || _capacity == 0 || _items.size() < _capacity;
+        } );
+        if ( _closed )
+            return false;
+
+        _items.push_back( std::move( item ) );
+        lock.unlock();
+        _not_empty.notify_one();
+        return true;
+    }
+
+    /// Remove an item from the front of the queue, waiting for one to become
+    /// available if the queue is empty.
+    /// @param item the variable to move the item into.
+    /// @result `false` if the queue has been closed and no items are left.
+    bool pop( T &item )
+    {
+        std::unique_lock<std::mutex> lock( _mutex );
+        _not_empty.wait( lock, [this]() { return _closed || !_items.empty(); } );
+        if ( _items.empty() )
+            return false;
+
+        item = std::move( _items.front() );
+        _items.pop_front();
+        lock.unlock();
+        _not_full.notify_one();
+        return true;
+    }
+
+    /// Close the queue. No new items can be added after this call, the
+    /// consumers will drain the remaining items and then stop.
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock( _mutex );
+            _closed = true;
+        }
+        _not_empty.notify_all();
+        _not_full.notify_all();
+    }
+
+private:
+    std::mutex              _mutex;
+    std::condition_variable _not_empty;
+    std::condition_variable _not_full;
+    std::deque<T>           _items;
+    const size_t            _capacity;
+    bool                    _closed = false;
+};
+
+} // namespace util
+} // namespace rta
@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+// Times the spectral kernels implemented with every instruction set supported
+// by the CPU, and the reshaping of a spectrum sampled every 1nm. Not run as a
+// test, as the timings depend on the machine.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+#include "../src/rawtoaces_core/spectral_kernels.h"
+#include <rawtoaces/spectral_data.h>
+
+using namespace rta::core;
+
+/// Prevents the compiler from dropping the calls whose results are unused.
+volatile double sink = 0;
+
+/// Time a function, calling it repeatedly for about 0.2 seconds.
+/// @param function the function to time.
+/// @result the average time of a call, in nanoseconds.
+double time_ns( const std::function<double()> &function )
+{
+    typedef std::chrono::steady_clock Clock;
+
+    size_t count = 1;
+    while ( true )
+    {
+        auto start = Clock::now();
+        for ( size_t i = 0; i < count; i++ )
+            sink = sink + function();
+        std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+
+        if ( elapsed.count() > 2e8 )
+            return elapsed.count() / static_cast<double>( count );
+        count *= 2;
+    }
+}
+
+void benchmark_kernels( const kernels::Kernels &k, size_t size )
+{
+    std::vector<double>  a( size ), b( size ), c( size ), result( size );
+    std::vector<int32_t> lower( size ), upper( size );
+    std::vector<double>  ratios( size );
+    for ( size_t i = 0; i < size; i++ )
+    {
+        a[i]      = 0.1 * i;
+        b[i]      = 1.0 / ( i + 1.0 );
+        c[i]      = 1.0 - 0.001 * i;
+        lower[i]  = static_cast<int32_t>( i / 2 );
+        upper[i]  = static_cast<int32_t>( std::min( i / 2 + 1, size - 1 ) );
+        ratios[i] = ( i % 2 ) * 0.5;
+    }
+
+    double sum = time_ns( [&]() { return k.sum( a.data(), size ); } );
+    double dot =
+        time_ns( [&]() { return k.dot( a.data(), b.data(), size ); } );
+    double dot3 = time_ns(
+        [&]() { return k.dot3( a.data(), b.data(), c.data(), size ); } );
+    double max = time_ns( [&]() { return k.max( b.data(), size ); } );
+    double interpolate = time_ns( [&]() {
+        k.interpolate(
+            a.data(),
+            lower.data(),
+            upper.data(),
+            ratios.data(),
+            result.data(),
+            size );
+        return result[0];
+    } );
+
+    printf(
+        "%-8s %6zu %10.1f %10.1f %10.1f %10.1f %12.1f\n",
+        k.name,
+        size,
+        sum,
+        dot,
+        dot3,
+        max,
+        interpolate );
+}
+
+int main( int, char ** )
+{
+    printf( "Using %s by default.\n\n", kernels::get_kernels().name );
+    printf(
+        "%-8s %6s %10s %10s %10s %10s %12s (ns per call)\n",
+        "isa",
+        "size",
+        "sum",
+        "dot",
+        "dot3",
+        "max",
+        "interpolate" );
+
+    for ( auto instruction_set: { kernels::InstructionSet::Scalar,
+                                  kernels::InstructionSet::AVX2,
+                                  kernels::InstructionSet::AVX512,
+                                  kernels::InstructionSet::NEON } )
+    {
+        const kernels::Kernels *k = kernels::find_kernels( instruction_set );
+        if ( k == nullptr )
+            continue;
+
+        benchmark_kernels( *k, 81 );
+        benchmark_kernels( *k, 401 );
+    }
+
+    Spectrum::Shape shape = { 360, 830, 1 };
+    Spectrum        source( 0, shape );
+    for ( size_t i = 0; i < source.values.size(); i++ )
+        source.values[i] = 0.01 * i;
+
+    double reshape = time_ns( [&]() {
+        Spectrum spectrum = source;
+        spectrum.reshape();
+        return spectrum.values[0];
+    } );
+    printf( "\nreshape 1nm to 5nm: %.1f ns per call\n", reshape );
+
+    return 0;
+}
@@ -6,11 +6,14 @@
 #    include <windows.h>
 #endif
 
+#include <cmath>
 #include <filesystem>
+#include <limits>
 #include <OpenImageIO/unittest.h>
 
 #include "../src/rawtoaces_core/mathOps.h"
 #include <rawtoaces/rawtoaces_core.h>
+#include <rawtoaces/spectral_database.h>
 #include "../src/rawtoaces_core/rawtoaces_core_priv.h"
 
 #define DATA_PATH "../_deps/rawtoaces_data-src/data/"
@@ -740,6 +743,28 @@ void load_file( const std::string &path, rta::core::SpectralData &data )
     OIIO_CHECK_ASSERT( data.load( full_path.string() ) );
 }
 
+void testIDT_LoadHeader()
+{
+    rta::core::SpectralData camera;
+    OIIO_CHECK_ASSERT(
+        camera.load_header( DATA_PATH "camera/Nikon_D200_380_780_5.json" ) );
+    OIIO_CHECK_EQUAL( camera.manufacturer, "Nikon" );
+    OIIO_CHECK_EQUAL( camera.model, "D200" );
+    OIIO_CHECK_ASSERT( camera.data.empty() );
+
+    // Loading the header of another file resets the previous data.
+    rta::core::SpectralData illuminant;
+    OIIO_CHECK_ASSERT( illuminant.load(
+        DATA_PATH "camera/Nikon_D200_380_780_5.json" ) );
+    OIIO_CHECK_ASSERT( illuminant.load_header(
+        DATA_PATH "illuminant/iso7589_stutung_380_780_5.json" ) );
+    OIIO_CHECK_EQUAL( illuminant.type, "ISO7589" );
+    OIIO_CHECK_ASSERT( illuminant.manufacturer.empty() );
+    OIIO_CHECK_ASSERT( illuminant.data.empty() );
+
+    OIIO_CHECK_ASSERT( !camera.load_header( DATA_PATH "camera/missing.json" ) );
+}
+
 void testIDT_scaleLSC()
 {
     rta::core::SpectralData illuminant;
@@ -854,6 +879,71 @@ void testIDT_ChooseIllumSrc()
         OIIO_CHECK_EQUAL_THRESH( illumData[i], illumData_Test[i], 1e-5 );
 }
 
+void testIDT_ChooseIllumSrc_FineStep()
+{
+    rta::core::SpectralSolver solver( { DATA_PATH } );
+    load_camera_helper( solver, "nikon", "d200", "", true, false );
+
+    vector<double> wb = { 1.2, 1.0, 1.7 };
+
+    auto calculate_sse = [&wb]( const vector<double> &found ) {
+        double result = 0;
+        for ( size_t i = 0; i < 3; i++ )
+            result += ( found[i] / wb[i] - 1.0 ) * ( found[i] / wb[i] - 1.0 );
+        return result;
+    };
+
+    OIIO_CHECK_ASSERT( solver.find_illuminant( wb ) );
+    double coarse_sse = calculate_sse( solver.get_WB_multipliers() );
+
+    // A finer grid matches at least as well.
+    solver.illuminant_cct_step = 10;
+    OIIO_CHECK_ASSERT( solver.find_illuminant( wb ) );
+    vector<double> found_wb = solver.get_WB_multipliers();
+    OIIO_CHECK_ASSERT( calculate_sse( found_wb ) <= coarse_sse );
+
+    // The multipliers match the ones of the generated illuminant.
+    OIIO_CHECK_ASSERT( solver.calculate_WB() );
+    for ( size_t i = 0; i < 3; i++ )
+        OIIO_CHECK_EQUAL_THRESH(
+            solver.get_WB_multipliers()[i], found_wb[i], 1e-9 );
+
+    solver.illuminant_cct_step = 0;
+    OIIO_CHECK_ASSERT( !solver.find_illuminant( wb ) );
+}
+
+void testIDT_ChooseIllumSrc_InvalidWB()
+{
+    rta::core::SpectralSolver solver( { DATA_PATH } );
+    load_camera_helper( solver, "nikon", "d200", "", true, false );
+
+    OIIO_CHECK_ASSERT( !solver.find_illuminant( vector<double>{ 0, 0, 0 } ) );
+    OIIO_CHECK_ASSERT( !solver.find_illuminant(
+        vector<double>{ 1.0, std::nan( "" ), 1.0 } ) );
+    OIIO_CHECK_ASSERT( !solver.find_illuminant(
+        vector<double>{ 1.0, 1.0, std::numeric_limits<double>::infinity() } ) );
+    OIIO_CHECK_ASSERT( !solver.find_illuminant( vector<double>{ -1, 1, 1 } ) );
+
+    // Still finds the same illuminant as a new solver after the failures.
+    rta::core::SpectralSolver reference( { DATA_PATH } );
+    load_camera_helper( reference, "nikon", "d200", "", true, false );
+    OIIO_CHECK_ASSERT( reference.find_illuminant( vector<double>{ 1, 1, 1 } ) );
+    OIIO_CHECK_ASSERT( solver.find_illuminant( vector<double>{ 1, 1, 1 } ) );
+    OIIO_CHECK_EQUAL( solver.illuminant.type, reference.illuminant.type );
+}
+
+void testIDT_ChooseIllumSrc_InvalidCamera()
+{
+    rta::core::SpectralSolver solver( { DATA_PATH } );
+    load_camera_helper( solver, "nikon", "d200", "", true, false );
+
+    // A camera sampled differently fails without throwing.
+    solver.camera[rta::core::SpectralData::G] =
+        rta::core::Spectrum( 1, { 380, 780, 10 } );
+    vector<double> wb = { 1, 1, 1 };
+    OIIO_CHECK_ASSERT( !solver.find_illuminant( wb ) );
+}
+
 void testIDT_ChooseIllumType()
 {
     rta::core::SpectralSolver solver( { DATA_PATH } );
@@ -5236,6 +5326,48 @@ void testIDT_CalRGB()
             OIIO_CHECK_EQUAL_THRESH( RGB[i][j], RGB_test[i][j], 1e-5 );
 }
 
+void testIDT_CalRGBXYZ_Matrix()
+{
+    rta::core::SpectralData camera;
+    load_file( "camera/Nikon_D200_380_780_5.json", camera );
+
+    rta::core::SpectralData illuminant;
+    load_file( "illuminant/iso7589_stutung_380_780_5.json", illuminant );
+
+    rta::core::SpectralData training_data;
+    load_file( "training/training_spectral.json", training_data );
+
+    rta::core::SpectralData observer;
+    load_file( "cmf/cmf_1931.json", observer );
+
+    scale_illuminant( camera, illuminant );
+    auto WB = _calculate_WB( camera, illuminant );
+    auto TI = calculate_TI( illuminant, training_data );
+
+    // The matrix form integrates the patches with the illuminant folded
+    // into the camera and observer curves, which only changes the order of
+    // the floating point operations.
+    auto training = spectral_matrix( training_data.data.at( "main" ) );
+    OIIO_CHECK_EQUAL( training.rows(), TI.size() );
+    OIIO_CHECK_EQUAL( training.cols(), 81 );
+
+    auto RGB      = calculate_RGB( camera, WB, TI );
+    auto RGB_test = calculate_RGB( camera, illuminant, WB, training );
+    auto XYZ      = calculate_XYZ( observer, illuminant, TI );
+    auto XYZ_test = calculate_XYZ( observer, illuminant, training );
+
+    OIIO_CHECK_EQUAL( RGB_test.size(), RGB.size() );
+    OIIO_CHECK_EQUAL( XYZ_test.size(), XYZ.size() );
+    for ( size_t i = 0; i < RGB.size(); i++ )
+    {
+        for ( size_t j = 0; j < 3; j++ )
+        {
+            OIIO_CHECK_EQUAL_THRESH( RGB_test[i][j], RGB[i][j], 1e-12 );
+            OIIO_CHECK_EQUAL_THRESH( XYZ_test[i][j], XYZ[i][j], 1e-12 );
+        }
+    }
+}
+
 void testIDT_CurveFit()
 {
     rta::core::SpectralData camera;
@@ -5289,22 +5421,174 @@ void testIDT_CalIDT()
             OIIO_CHECK_EQUAL_THRESH( IDT[i][j], IDT_test[i][j], 1e-4 );
 }
 
+void testIDT_SpectralDatabase()
+{
+    auto database = rta::core::SpectralDatabase::get( { DATA_PATH } );
+    OIIO_CHECK_ASSERT(
+        database == rta::core::SpectralDatabase::get( { DATA_PATH } ) );
+    OIIO_CHECK_ASSERT( !database->cameras().empty() );
+    OIIO_CHECK_ASSERT( !database->illuminants().empty() );
+    OIIO_CHECK_EQUAL(
+        database->load_illuminants().size(), database->illuminants().size() );
+
+    // The lookups ignore the case.
+    auto camera = database->find_camera( "nikon", "d200" );
+    OIIO_CHECK_ASSERT( camera != nullptr );
+    OIIO_CHECK_ASSERT( camera == database->find_camera( "NIKON", "D200" ) );
+    OIIO_CHECK_ASSERT( database->find_camera( "nikon", "d2000" ) == nullptr );
+    OIIO_CHECK_ASSERT( database->has_camera( "Nikon", "d200" ) );
+    OIIO_CHECK_ASSERT( !database->has_camera( "nikon", "d2000" ) );
+
+    rta::core::SpectralData reference;
+    load_file( "camera/Nikon_D200_380_780_5.json", reference );
+    OIIO_CHECK_EQUAL( camera->model, reference.model );
+    for ( const char *channel: { "R", "G", "B" } )
+    {
+        OIIO_CHECK_ASSERT(
+            ( *camera )[channel].values == reference[channel].values );
+    }
+
+    auto illuminant = database->find_illuminant( "Iso7589" );
+    OIIO_CHECK_ASSERT( illuminant != nullptr );
+    OIIO_CHECK_EQUAL( illuminant->type, "ISO7589" );
+    OIIO_CHECK_ASSERT( database->find_illuminant( "d55" ) == nullptr );
+
+    OIIO_CHECK_ASSERT(
+        database->find_file( "training/training_spectral.json" ) != nullptr );
+    OIIO_CHECK_ASSERT( database->find_file( "cmf/missing.json" ) == nullptr );
+
+    // A solver using the database finds the same data as one searching the
+    // files.
+    rta::core::SpectralSolver files_solver( { DATA_PATH } );
+    load_camera_helper( files_solver, "nikon", "d200", "", true, true );
+
+    rta::core::SpectralSolver database_solver( database );
+    load_camera_helper( database_solver, "nikon", "d200", "", true, true );
+
+    std::vector<double> wb = { 1.0, 1.0, 1.0 };
+    OIIO_CHECK_ASSERT( files_solver.find_illuminant( wb ) );
+    OIIO_CHECK_ASSERT( database_solver.find_illuminant( wb ) );
+    OIIO_CHECK_EQUAL(
+        database_solver.illuminant.type, files_solver.illuminant.type );
+    OIIO_CHECK_ASSERT(
+        database_solver.get_WB_multipliers() ==
+        files_solver.get_WB_multipliers() );
+
+    OIIO_CHECK_ASSERT( database_solver.find_illuminant( "iso7589" ) );
+    OIIO_CHECK_ASSERT( !database_solver.find_illuminant( "missing" ) );
+}
+
+void testIDT_SpectralDatabase_Compiled()
+{
+    std::filesystem::path temp_dir =
+        std::filesystem::temp_directory_path() / "rawtoaces_test_compiled";
+    std::filesystem::remove_all( temp_dir );
+    std::filesystem::create_directories( temp_dir );
+
+    // The compiled file holds the same data as the JSON files.
+    std::string compiled = ( temp_dir / "database.bin" ).string();
+    OIIO_CHECK_ASSERT(
+        rta::core::SpectralDatabase::compile( { DATA_PATH }, compiled ) );
+
+    std::vector<std::string> sources;
+    OIIO_CHECK_ASSERT(
+        rta::core::SpectralDatabase::check_compiled( compiled, sources ) );
+    OIIO_CHECK_EQUAL( sources.size(), 1 );
+
+    auto reference = rta::core::SpectralDatabase::get( { DATA_PATH } );
+    rta::core::SpectralDatabase database( { compiled } );
+    OIIO_CHECK_EQUAL( database.cameras().size(), reference->cameras().size() );
+    OIIO_CHECK_EQUAL(
+        database.illuminants().size(), reference->illuminants().size() );
+
+    // Only the headers get read when loading, the spectral data gets decoded
+    // from the mapped file on the first lookup.
+    OIIO_CHECK_ASSERT( database.cameras().front()->data.empty() );
+
+    auto camera = database.find_camera( "nikon", "d200" );
+    OIIO_CHECK_ASSERT( camera != nullptr );
+    auto reference_camera = reference->find_camera( "nikon", "d200" );
+    OIIO_CHECK_EQUAL( camera->description, reference_camera->description );
+    for ( const char *channel: { "R", "G", "B" } )
+    {
+        OIIO_CHECK_ASSERT( ( *camera )[channel].shape ==
+                           rta::core::Spectrum::ReferenceShape );
+        OIIO_CHECK_ASSERT(
+            ( *camera )[channel].values ==
+            ( *reference_camera )[channel].values );
+    }
+
+    auto training = database.find_file( "training/training_spectral.json" );
+    OIIO_CHECK_ASSERT( training != nullptr );
+    OIIO_CHECK_EQUAL(
+        training->data.size(),
+        reference->find_file( "training/training_spectral.json" )
+            ->data.size() );
+
+    // A compiled file can not be compiled again.
+    OIIO_CHECK_ASSERT( !rta::core::SpectralDatabase::compile(
+        { compiled }, ( temp_dir / "again.bin" ).string() ) );
+
+    // Changing a source file makes the database load the JSON files instead.
+    std::filesystem::path source_dir = temp_dir / "data";
+    std::filesystem::create_directories( source_dir / "camera" );
+    std::filesystem::path camera_file = source_dir / "camera" / "camera.json";
+    std::filesystem::copy_file(
+        DATA_PATH "camera/Nikon_D200_380_780_5.json", camera_file );
+
+    std::string small = ( temp_dir / "small.bin" ).string();
+    OIIO_CHECK_ASSERT( rta::core::SpectralDatabase::compile(
+        { source_dir.string() }, small ) );
+    OIIO_CHECK_ASSERT(
+        rta::core::SpectralDatabase( { small } )
+            .find_camera( "nikon", "d200" ) != nullptr );
+
+    std::filesystem::copy_file(
+        DATA_PATH "camera/ARRI_D21_380_780_5.json",
+        camera_file,
+        std::filesystem::copy_options::overwrite_existing );
+    OIIO_CHECK_ASSERT(
+        !rta::core::SpectralDatabase::check_compiled( small, sources ) );
+
+    rta::core::SpectralDatabase stale( { small } );
+    OIIO_CHECK_ASSERT( stale.find_camera( "nikon", "d200" ) == nullptr );
+    OIIO_CHECK_ASSERT( stale.find_camera( "arri", "d21" ) != nullptr );
+
+    // A file which is not a compiled database is skipped.
+    std::filesystem::path invalid = temp_dir / "invalid.bin";
+    std::filesystem::copy_file( camera_file, invalid );
+    OIIO_CHECK_ASSERT( !rta::core::SpectralDatabase::check_compiled(
+        invalid.string(), sources ) );
+    OIIO_CHECK_ASSERT( sources.empty() );
+    OIIO_CHECK_ASSERT(
+        rta::core::SpectralDatabase( { invalid.string() } ).cameras().empty() );
+
+    std::filesystem::remove_all( temp_dir );
+}
+
 int main( int, char ** )
 {
     testIDT_LoadCameraSpst();
     testIDT_LoadIlluminant();
     testIDT_LoadTrainingData();
     testIDT_LoadCMF();
+    testIDT_LoadHeader();
     testIDT_scaleLSC();
     testIDT_CalCM();
     testIDT_CalWB();
     testIDT_ChooseIllumSrc();
+    testIDT_ChooseIllumSrc_FineStep();
+    testIDT_ChooseIllumSrc_InvalidWB();
+    testIDT_ChooseIllumSrc_InvalidCamera();
     testIDT_ChooseIllumType();
     testIDT_CalTI();
     testIDT_CalXYZ();
     testIDT_CalRGB();
+    testIDT_CalRGBXYZ_Matrix();
     testIDT_CurveFit();
     testIDT_CalIDT();
+    testIDT_SpectralDatabase();
+    testIDT_SpectralDatabase_Compiled();
 
     return unit_test_failures;
 }
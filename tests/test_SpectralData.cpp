@@ -6,10 +6,12 @@
 #    include <windows.h>
 #endif
 
+#include <cmath>
 #include <filesystem>
 #include <OpenImageIO/unittest.h>
 
 #include "../src/rawtoaces_core/mathOps.h"
+#include "../src/rawtoaces_core/spectral_kernels.h"
 #include <rawtoaces/rawtoaces_core.h>
 
 #define DATA_PATH "../_deps/rawtoaces_data-src/data/"
@@ -51,6 +53,289 @@ void testSpectralData_Spectrum()
     check_Spectrum( spectrum3, shape );
 }
 
+void testSpectralData_ReferenceSpectrum()
+{
+    rta::core::Spectrum spectrum1;
+    init_Spectrum( spectrum1 );
+
+    rta::core::ReferenceSpectrum reference1( spectrum1 );
+    OIIO_CHECK_EQUAL( reference1.values.size(), 81 );
+    check_Spectrum( reference1.to_spectrum() );
+
+    rta::core::ReferenceSpectrum reference2( 2.0 );
+    auto product = reference1 * reference2;
+    auto sum     = reference1 + reference2;
+    for ( size_t i = 0; i < 81; i++ )
+    {
+        OIIO_CHECK_EQUAL( product.values[i], i * 2.0 );
+        OIIO_CHECK_EQUAL( sum.values[i], i + 2.0 );
+    }
+    OIIO_CHECK_EQUAL( product.integrate(), 6480.0 );
+    OIIO_CHECK_EQUAL( product.max(), 160.0 );
+
+    reference2 *= 0.5;
+    OIIO_CHECK_EQUAL( reference2.integrate(), 81.0 );
+
+    // Only the spectra sampled at the reference shape can be converted.
+    rta::core::Spectrum::Shape shape = { 20, 50, 10 };
+    rta::core::Spectrum        spectrum2( 0, shape );
+    bool thrown = false;
+    try
+    {
+        rta::core::ReferenceSpectrum reference3( spectrum2 );
+    }
+    catch ( const std::invalid_argument & )
+    {
+        thrown = true;
+    }
+    OIIO_CHECK_ASSERT( thrown );
+}
+
+void testSpectralData_Dot()
+{
+    rta::core::Spectrum a, b, c;
+    for ( size_t i = 0; i < a.values.size(); i++ )
+    {
+        a.values[i] = 0.1 * i;
+        b.values[i] = 1.0 / ( i + 1.0 );
+        c.values[i] = 81.0 - i;
+    }
+
+    // The fused forms sum in the same order as the temporary spectra.
+    OIIO_CHECK_EQUAL( rta::core::dot( a, b ), ( a * b ).integrate() );
+    OIIO_CHECK_EQUAL( rta::core::dot3( a, b, c ), ( a * b * c ).integrate() );
+
+    rta::core::ReferenceSpectrum ra( a ), rb( b ), rc( c );
+    OIIO_CHECK_EQUAL( rta::core::dot( ra, rb ), ( ra * rb ).integrate() );
+    OIIO_CHECK_EQUAL(
+        rta::core::dot3( ra, rb, rc ), ( ra * rb * rc ).integrate() );
+    OIIO_CHECK_EQUAL( rta::core::dot( ra, rb ), rta::core::dot( a, b ) );
+
+    rta::core::Spectrum::Shape shape = { 20, 50, 10 };
+    rta::core::Spectrum        d( 2, shape ), e( 3, shape );
+    OIIO_CHECK_EQUAL( rta::core::dot( d, e ), 24.0 );
+    OIIO_CHECK_EQUAL( rta::core::dot3( d, e, e ), 72.0 );
+}
+
+void testSpectralData_Kernels()
+{
+    using namespace rta::core::kernels;
+
+    const Kernels *scalar = find_kernels( InstructionSet::Scalar );
+    OIIO_CHECK_ASSERT( scalar != nullptr );
+    OIIO_CHECK_ASSERT( find_kernels( get_kernels().instruction_set ) );
+
+    std::vector<double>  a, b, c, result, expected;
+    std::vector<int32_t> lower, upper;
+    std::vector<double>  ratios;
+    for ( size_t i = 0; i < 401; i++ )
+    {
+        a.push_back( 0.1 * i - 7.3 );
+        b.push_back( 1.0 / ( i + 1.0 ) );
+        c.push_back( 81.0 - i * 0.7 );
+        lower.push_back( static_cast<int32_t>( ( i * 7 ) % 401 ) );
+        upper.push_back( static_cast<int32_t>( ( i * 13 + 1 ) % 401 ) );
+        ratios.push_back( ( i % 10 ) * 0.1 );
+    }
+
+    // All instruction sets accumulate in the same order, so the results
+    // are expected to match exactly, including the partial blocks.
+    std::vector<size_t> sizes;
+    for ( size_t size = 0; size <= 40; size++ )
+        sizes.push_back( size );
+    sizes.push_back( 81 );
+    sizes.push_back( 401 );
+
+    for ( auto instruction_set: { InstructionSet::AVX2,
+                                  InstructionSet::AVX512,
+                                  InstructionSet::NEON } )
+    {
+        const Kernels *kernels = find_kernels( instruction_set );
+        if ( kernels == nullptr )
+            continue;
+
+        OIIO_CHECK_ASSERT( kernels->instruction_set == instruction_set );
+
+        for ( size_t size: sizes )
+        {
+            OIIO_CHECK_EQUAL(
+                kernels->sum( a.data(), size ), scalar->sum( a.data(), size ) );
+            OIIO_CHECK_EQUAL(
+                kernels->dot( a.data(), b.data(), size ),
+                scalar->dot( a.data(), b.data(), size ) );
+            OIIO_CHECK_EQUAL(
+                kernels->dot3( a.data(), b.data(), c.data(), size ),
+                scalar->dot3( a.data(), b.data(), c.data(), size ) );
+
+            if ( size > 0 )
+            {
+                OIIO_CHECK_EQUAL(
+                    kernels->max( b.data(), size ),
+                    scalar->max( b.data(), size ) );
+                OIIO_CHECK_EQUAL(
+                    kernels->max( c.data(), size ),
+                    scalar->max( c.data(), size ) );
+            }
+
+            result.assign( size, 0 );
+            expected.assign( size, 0 );
+            kernels->interpolate(
+                a.data(),
+                lower.data(),
+                upper.data(),
+                ratios.data(),
+                result.data(),
+                size );
+            scalar->interpolate(
+                a.data(),
+                lower.data(),
+                upper.data(),
+                ratios.data(),
+                expected.data(),
+                size );
+            OIIO_CHECK_ASSERT( result == expected );
+        }
+    }
+
+    OIIO_CHECK_EQUAL( scalar->sum( a.data(), 0 ), 0.0 );
+    OIIO_CHECK_EQUAL( scalar->max( a.data(), 401 ), a[400] );
+    OIIO_CHECK_EQUAL( scalar->max( c.data(), 401 ), c[0] );
+
+    // A NaN anywhere makes the maximum NaN, and a zero maximum is +0, on all
+    // instruction sets.
+    for ( auto instruction_set: { InstructionSet::Scalar,
+                                  InstructionSet::AVX2,
+                                  InstructionSet::AVX512,
+                                  InstructionSet::NEON } )
+    {
+        const Kernels *kernels = find_kernels( instruction_set );
+        if ( kernels == nullptr )
+            continue;
+
+        for ( size_t position: { 0, 1, 3, 7, 8, 12, 20 } )
+        {
+            std::vector<double> values( b.begin(), b.begin() + 21 );
+            values[position] = std::nan( "" );
+            OIIO_CHECK_ASSERT(
+                std::isnan( kernels->max( values.data(), 21 ) ) );
+        }
+
+        std::vector<double> zeros = { -0.0, 0.0, -0.0, -1.0, -0.0 };
+        for ( size_t size = 1; size <= zeros.size(); size++ )
+        {
+            double zero = kernels->max( zeros.data(), size );
+            OIIO_CHECK_EQUAL( zero, 0.0 );
+            OIIO_CHECK_ASSERT( !std::signbit( zero ) );
+        }
+    }
+}
+
+void testSpectralData_Reshape()
+{
+    // A linear curve sampled every 10nm from 400 to 700, which interpolates
+    // exactly, and gets extended with the first and the last samples.
+    rta::core::Spectrum::Shape shape = { 400, 700, 10 };
+    rta::core::Spectrum        spectrum1( 0, shape );
+    init_Spectrum( spectrum1 );
+    spectrum1.reshape();
+    OIIO_CHECK_ASSERT(
+        spectrum1.shape == rta::core::Spectrum::ReferenceShape );
+    OIIO_CHECK_EQUAL( spectrum1.values.size(), 81 );
+    for ( size_t i = 0; i < spectrum1.values.size(); i++ )
+    {
+        double wavelength = 380.0 + 5.0 * i;
+        double expected   = ( wavelength - 400.0 ) / 10.0;
+        expected          = std::min( std::max( expected, 0.0 ), 30.0 );
+        OIIO_CHECK_EQUAL( spectrum1.values[i], expected );
+    }
+
+    // Reshaping another spectrum of the same shape reuses the plan.
+    rta::core::Spectrum spectrum2( 2, shape );
+    spectrum2.reshape();
+    OIIO_CHECK_EQUAL( spectrum2.values.size(), 81 );
+    OIIO_CHECK_EQUAL( spectrum2.integrate(), 162.0 );
+
+    // A 1nm grid only keeps the matching samples.
+    rta::core::Spectrum::Shape shape_1nm = { 360, 830, 1 };
+    rta::core::Spectrum        spectrum3( 0, shape_1nm );
+    init_Spectrum( spectrum3 );
+    spectrum3.reshape();
+    OIIO_CHECK_EQUAL( spectrum3.values.size(), 81 );
+    for ( size_t i = 0; i < spectrum3.values.size(); i++ )
+        OIIO_CHECK_EQUAL( spectrum3.values[i], 20.0 + 5.0 * i );
+
+    rta::core::Spectrum spectrum4( 0, rta::core::Spectrum::EmptyShape );
+    spectrum4.reshape();
+    OIIO_CHECK_ASSERT(
+        spectrum4.shape == rta::core::Spectrum::ReferenceShape );
+    OIIO_CHECK_EQUAL( spectrum4.values.size(), 81 );
+    OIIO_CHECK_EQUAL( spectrum4.max(), 0.0 );
+}
+
+void testSpectralData_Channels()
+{
+    using rta::core::SpectralData;
+
+    OIIO_CHECK_EQUAL(
+        std::string( SpectralData::channel_name( SpectralData::Power ) ),
+        "power" );
+
+    SpectralData data1;
+    auto        &set = data1.data["main"];
+    set.emplace_back( "R", rta::core::Spectrum( 1 ) );
+    set.emplace_back( "G", rta::core::Spectrum( 2 ) );
+    set.emplace_back( "B", rta::core::Spectrum( 3 ) );
+
+    OIIO_CHECK_EQUAL( &data1[SpectralData::R], &data1["R"] );
+    OIIO_CHECK_EQUAL( &data1[SpectralData::G], &data1["G"] );
+    OIIO_CHECK_EQUAL( &data1[SpectralData::B], &data1["B"] );
+    OIIO_CHECK_EQUAL( data1[SpectralData::B].values[0], 3 );
+    OIIO_CHECK_ASSERT( data1.has_channel( SpectralData::R ) );
+    OIIO_CHECK_ASSERT( !data1.has_channel( SpectralData::X ) );
+    OIIO_CHECK_ASSERT( !data1.has_channel( SpectralData::Power ) );
+    OIIO_CHECK_EQUAL( data1.find_channel( SpectralData::B ), &data1["B"] );
+    OIIO_CHECK_ASSERT( data1.find_channel( SpectralData::Power ) == nullptr );
+
+    bool thrown = false;
+    try
+    {
+        data1[SpectralData::Power];
+    }
+    catch ( const std::invalid_argument & )
+    {
+        thrown = true;
+    }
+    OIIO_CHECK_ASSERT( thrown );
+
+    // The copies return their own channels, not the ones of the source.
+    SpectralData data2 = data1;
+    OIIO_CHECK_EQUAL( &data2[SpectralData::R], &data2["R"] );
+    OIIO_CHECK_NE( &data2[SpectralData::R], &data1[SpectralData::R] );
+
+    // The channels are found by name after the data changes.
+    SpectralData data3 = data1;
+    auto &set3 = data3.data["main"];
+    set3.insert( set3.begin(), { "X", rta::core::Spectrum( 4 ) } );
+    OIIO_CHECK_EQUAL( data3[SpectralData::R].values[0], 1 );
+    OIIO_CHECK_EQUAL( data3[SpectralData::B].values[0], 3 );
+    OIIO_CHECK_EQUAL( data3[SpectralData::X].values[0], 4 );
+    set3.erase( set3.begin(), set3.begin() + 2 );
+    OIIO_CHECK_ASSERT( !data3.has_channel( SpectralData::R ) );
+    OIIO_CHECK_EQUAL( data3[SpectralData::G].values[0], 2 );
+    OIIO_CHECK_EQUAL( &data3[SpectralData::B], &data3["B"] );
+    set3.clear();
+    OIIO_CHECK_ASSERT( !data3.has_channel( SpectralData::G ) );
+    data3.data.clear();
+    OIIO_CHECK_ASSERT( !data3.has_channel( SpectralData::B ) );
+
+    data1.data.clear();
+    OIIO_CHECK_ASSERT( !data1.has_channel( SpectralData::R ) );
+
+    data1 = data2;
+    OIIO_CHECK_EQUAL( &data1[SpectralData::G], &data1["G"] );
+    OIIO_CHECK_EQUAL( data1[SpectralData::G].values[0], 2 );
+}
+
 void init_SpectralData( rta::core::SpectralData &data )
 {
     data.manufacturer          = "manufacturer";
@@ -242,6 +527,11 @@ void testSpectralData_LoadSpst()
 int main( int, char ** )
 {
     testSpectralData_Spectrum();
+    testSpectralData_ReferenceSpectrum();
+    testSpectralData_Dot();
+    testSpectralData_Kernels();
+    testSpectralData_Reshape();
+    testSpectralData_Channels();
     testSpectralData_Properties();
     testSpectralData_LoadSpst();
 
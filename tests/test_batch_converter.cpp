@@ -0,0 +1,1834 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright Contributors to the rawtoaces Project.
+
+#ifdef WIN32
+#    define WIN32_LEAN_AND_MEAN
+#    include <windows.h>
+#    undef RGB
+#else
+#    include <sys/stat.h>
+#endif
+
+#include "../src/rawtoaces_util/conversion_manifest.h"
+#include "../src/rawtoaces_util/directory_watcher.h"
+#include "../src/rawtoaces_util/job_file.h"
+#include "../src/rawtoaces_util/local_socket.h"
+#include "../src/rawtoaces_util/memory_budget.h"
+#include "../src/rawtoaces_util/progress_reporter.h"
+#include "../src/rawtoaces_util/work_queue.h"
+
+// must be before <OpenImageIO/unittest.h>
+#include <rawtoaces/batch_converter.h>
+
+#include <OpenImageIO/imagebuf.h>
+#include <OpenImageIO/unittest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "test_utils.h"
+
+using namespace rta::util;
+
+const std::string dng_test_file =
+    "../../tests/materials/blackmagic_cinema_camera_cinemadng.dng";
+
+/// RAII helper class creating a unique temporary directory.
+class TestDirectory
+{
+public:
+    TestDirectory()
+    {
+        static int counter = 0;
+        test_dir           = ( std::filesystem::temp_directory_path() /
+                     ( "rawtoaces_batch_test_" + std::to_string( ++counter ) +
+                       "_" + std::to_string( std::time( nullptr ) ) ) )
+                       .string();
+        std::filesystem::create_directories( test_dir );
+    }
+
+    ~TestDirectory() { std::filesystem::remove_all( test_dir ); }
+
+    TestDirectory( const TestDirectory & )            = delete;
+    TestDirectory &operator=( const TestDirectory & ) = delete;
+
+    const std::string &path() const { return test_dir; }
+
+    /// Copies the test DNG file into the directory under the given names.
+    std::vector<std::string>
+    copy_test_files( const std::vector<std::string> &filenames ) const
+    {
+        std::vector<std::string> result;
+        for ( const auto &filename: filenames )
+        {
+            auto path = std::filesystem::path( test_dir ) / filename;
+            std::filesystem::copy_file( dng_test_file, path );
+            result.push_back( path.string() );
+        }
+        return result;
+    }
+
+private:
+    std::string test_dir;
+};
+
+/// Verifies that all items pushed into a closed queue get consumed exactly
+/// once when multiple consumers compete for them.
+void test_work_queue_multiple_consumers()
+{
+    std::cout << std::endl
+              << "test_work_queue_multiple_consumers()" << std::endl;
+
+    const size_t      num_items = 1000;
+    WorkQueue<size_t> queue;
+    for ( size_t i = 0; i < num_items; i++ )
+        queue.push( i );
+    queue.close();
+
+    // No new items are accepted after the queue got closed.
+    OIIO_CHECK_ASSERT( !queue.push( num_items ) );
+
+    std::vector<std::atomic<int>> counts( num_items );
+    std::vector<std::thread>      threads;
+    for ( size_t i = 0; i < 4; i++ )
+    {
+        threads.emplace_back( [&]() {
+            size_t item;
+            while ( queue.pop( item ) )
+                counts[item]++;
+        } );
+    }
+    for ( auto &thread: threads )
+        thread.join();
+
+    for ( size_t i = 0; i < num_items; i++ )
+        OIIO_CHECK_EQUAL( counts[i].load(), 1 );
+}
+
+/// Verifies that a producer blocks on a full bounded queue until a consumer
+/// frees a slot.
+void test_work_queue_bounded()
+{
+    std::cout << std::endl << "test_work_queue_bounded()" << std::endl;
+
+    WorkQueue<int> queue( 2 );
+    OIIO_CHECK_ASSERT( queue.push( 1 ) );
+    OIIO_CHECK_ASSERT( queue.push( 2 ) );
+
+    std::atomic<bool> pushed( false );
+    std::thread       producer( [&]() {
+        queue.push( 3 );
+        pushed = true;
+    } );
+
+    std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+    OIIO_CHECK_ASSERT( !pushed );
+
+    int item = 0;
+    OIIO_CHECK_ASSERT( queue.pop( item ) );
+    OIIO_CHECK_EQUAL( item, 1 );
+    producer.join();
+    OIIO_CHECK_ASSERT( pushed );
+
+    queue.close();
+    OIIO_CHECK_ASSERT( queue.pop( item ) );
+    OIIO_CHECK_EQUAL( item, 2 );
+    OIIO_CHECK_ASSERT( queue.pop( item ) );
+    OIIO_CHECK_EQUAL( item, 3 );
+    OIIO_CHECK_ASSERT( !queue.pop( item ) );
+}
+
+/// Verifies that closing a full bounded queue releases a blocked producer.
+void test_work_queue_close_releases_producer()
+{
+    std::cout << std::endl
+              << "test_work_queue_close_releases_producer()" << std::endl;
+
+    WorkQueue<int> queue( 1 );
+    OIIO_CHECK_ASSERT( queue.push( 1 ) );
+
+    bool        result = true;
+    std::thread producer( [&]() { result = queue.push( 2 ); } );
+    std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+    queue.close();
+    producer.join();
+
+    OIIO_CHECK_ASSERT( !result );
+}
+
+/// Verifies that the number of jobs gets parsed from the command line.
+void test_parse_parameters_jobs()
+{
+    std::cout << std::endl << "test_parse_parameters_jobs()" << std::endl;
+
+    const char *argv[] = { "DUMMY PROGRAM PATH", "--jobs", "4" };
+    const int   argc   = sizeof( argv ) / sizeof( argv[0] );
+
+    BatchConverter batch_converter;
+    OIIO::ArgParse arg_parser;
+    batch_converter.init_parser( arg_parser );
+    OIIO_CHECK_EQUAL( arg_parser.parse_args( argc, argv ), 0 );
+    OIIO_CHECK_ASSERT( batch_converter.parse_parameters( arg_parser ) );
+    OIIO_CHECK_EQUAL( batch_converter.settings.jobs, 4 );
+}
+
+/// Verifies that the pipelined mode gets enabled from the command line.
+void test_parse_parameters_pipeline()
+{
+    std::cout << std::endl << "test_parse_parameters_pipeline()" << std::endl;
+
+    const char *argv[] = { "DUMMY PROGRAM PATH", "--pipeline" };
+    const int   argc   = sizeof( argv ) / sizeof( argv[0] );
+
+    BatchConverter batch_converter;
+    OIIO_CHECK_ASSERT( !batch_converter.settings.pipeline );
+
+    OIIO::ArgParse arg_parser;
+    batch_converter.init_parser( arg_parser );
+    OIIO_CHECK_EQUAL( arg_parser.parse_args( argc, argv ), 0 );
+    OIIO_CHECK_ASSERT( batch_converter.parse_parameters( arg_parser ) );
+    OIIO_CHECK_ASSERT( batch_converter.settings.pipeline );
+}
+
+/// Verifies that the keep-going mode gets enabled from the command line.
+void test_parse_parameters_keep_going()
+{
+    std::cout << std::endl
+              << "test_parse_parameters_keep_going()" << std::endl;
+
+    const char *argv[] = { "DUMMY PROGRAM PATH", "--keep-going" };
+    const int   argc   = sizeof( argv ) / sizeof( argv[0] );
+
+    BatchConverter batch_converter;
+    OIIO_CHECK_ASSERT( !batch_converter.settings.keep_going );
+
+    OIIO::ArgParse arg_parser;
+    batch_converter.init_parser( arg_parser );
+    OIIO_CHECK_EQUAL( arg_parser.parse_args( argc, argv ), 0 );
+    OIIO_CHECK_ASSERT( batch_converter.parse_parameters( arg_parser ) );
+    OIIO_CHECK_ASSERT( batch_converter.settings.keep_going );
+}
+
+/// Verifies that the recursive mode gets enabled from the command line.
+void test_parse_parameters_recursive()
+{
+    std::cout << std::endl
+              << "test_parse_parameters_recursive()" << std::endl;
+
+    const char *argv[] = { "DUMMY PROGRAM PATH", "--recursive" };
+    const int   argc   = sizeof( argv ) / sizeof( argv[0] );
+
+    BatchConverter batch_converter;
+    OIIO_CHECK_ASSERT( !batch_converter.settings.recursive );
+
+    OIIO::ArgParse arg_parser;
+    batch_converter.init_parser( arg_parser );
+    OIIO_CHECK_EQUAL( arg_parser.parse_args( argc, argv ), 0 );
+    OIIO_CHECK_ASSERT( batch_converter.parse_parameters( arg_parser ) );
+    OIIO_CHECK_ASSERT( batch_converter.settings.recursive );
+}
+
+/// Verifies that the watched directory gets set from the command line.
+void test_parse_parameters_watch()
+{
+    std::cout << std::endl << "test_parse_parameters_watch()" << std::endl;
+
+    const char *argv[] = { "DUMMY PROGRAM PATH", "--watch", "/tmp/ingest" };
+    const int   argc   = sizeof( argv ) / sizeof( argv[0] );
+
+    BatchConverter batch_converter;
+    OIIO::ArgParse arg_parser;
+    batch_converter.init_parser( arg_parser );
+    OIIO_CHECK_EQUAL( arg_parser.parse_args( argc, argv ), 0 );
+
+    bool result = batch_converter.parse_parameters( arg_parser );
+    OIIO_CHECK_EQUAL( result, DirectoryWatcher::is_supported() );
+    if ( result )
+        OIIO_CHECK_EQUAL( batch_converter.settings.watch, "/tmp/ingest" );
+}
+
+/// Verifies that the memory budget gets parsed with the size suffixes, and
+/// an invalid size gets rejected.
+void test_parse_parameters_max_memory()
+{
+    std::cout << std::endl
+              << "test_parse_parameters_max_memory()" << std::endl;
+
+    auto parse = []( const char *value, size_t &max_memory ) {
+        const char *argv[] = { "DUMMY PROGRAM PATH", "--max-memory", value };
+        const int   argc   = sizeof( argv ) / sizeof( argv[0] );
+
+        BatchConverter batch_converter;
+        OIIO::ArgParse arg_parser;
+        batch_converter.init_parser( arg_parser );
+        arg_parser.parse_args( argc, argv );
+
+        bool result;
+        capture_stderr( [&]() {
+            result = batch_converter.parse_parameters( arg_parser );
+        } );
+        max_memory = batch_converter.settings.max_memory;
+        return result;
+    };
+
+    size_t max_memory;
+    OIIO_CHECK_ASSERT( parse( "1000", max_memory ) );
+    OIIO_CHECK_EQUAL( max_memory, 1000 );
+    OIIO_CHECK_ASSERT( parse( "512M", max_memory ) );
+    OIIO_CHECK_EQUAL( max_memory, size_t( 512 ) << 20 );
+    OIIO_CHECK_ASSERT( parse( "48GB", max_memory ) );
+    OIIO_CHECK_EQUAL( max_memory, size_t( 48 ) << 30 );
+    OIIO_CHECK_ASSERT( parse( "1.5k", max_memory ) );
+    OIIO_CHECK_EQUAL( max_memory, 1536 );
+
+    OIIO_CHECK_ASSERT( !parse( "lots", max_memory ) );
+    OIIO_CHECK_ASSERT( !parse( "12X", max_memory ) );
+    OIIO_CHECK_ASSERT( !parse( "-1G", max_memory ) );
+}
+
+/// Verifies that the planning gets enabled from the command line, and gets
+/// rejected along with the options converting the files as they arrive.
+void test_parse_parameters_plan()
+{
+    std::cout << std::endl << "test_parse_parameters_plan()" << std::endl;
+
+    const char *argv[] = { "DUMMY PROGRAM PATH", "--plan" };
+    const int   argc   = sizeof( argv ) / sizeof( argv[0] );
+
+    BatchConverter batch_converter;
+    OIIO_CHECK_ASSERT( !batch_converter.settings.plan );
+
+    OIIO::ArgParse arg_parser;
+    batch_converter.init_parser( arg_parser );
+    OIIO_CHECK_EQUAL( arg_parser.parse_args( argc, argv ), 0 );
+    OIIO_CHECK_ASSERT( batch_converter.parse_parameters( arg_parser ) );
+    OIIO_CHECK_ASSERT( batch_converter.settings.plan );
+
+    const std::vector<std::vector<const char *>> combinations = {
+        { "--recursive" },
+        { "--watch", "/tmp/ingest" },
+        { "--job-file", "jobs.json" },
+        { "--serve", "/tmp/rawtoaces.sock" },
+        { "--connect", "/tmp/rawtoaces.sock" }
+    };
+    for ( auto args: combinations )
+    {
+        args.insert( args.begin(), { "DUMMY PROGRAM PATH", "--plan" } );
+
+        BatchConverter invalid;
+        OIIO::ArgParse invalid_parser;
+        invalid.init_parser( invalid_parser );
+        invalid_parser.parse_args(
+            static_cast<int>( args.size() ), args.data() );
+
+        bool        result;
+        std::string output = capture_stderr(
+            [&]() { result = invalid.parse_parameters( invalid_parser ); } );
+        OIIO_CHECK_ASSERT( !result );
+        OIIO_CHECK_ASSERT(
+            output.find( "The --plan option" ) != std::string::npos );
+    }
+}
+
+/// Verifies that the shard gets parsed from the command line, and the
+/// invalid shards get rejected.
+void test_parse_parameters_shard()
+{
+    std::cout << std::endl << "test_parse_parameters_shard()" << std::endl;
+
+    auto parse = []( std::vector<const char *> args,
+                     BatchConverter           &batch_converter ) {
+        args.insert( args.begin(), "DUMMY PROGRAM PATH" );
+
+        OIIO::ArgParse arg_parser;
+        batch_converter.init_parser( arg_parser );
+        arg_parser.parse_args( static_cast<int>( args.size() ), args.data() );
+
+        bool result;
+        capture_stderr( [&]() {
+            result = batch_converter.parse_parameters( arg_parser );
+        } );
+        return result;
+    };
+
+    BatchConverter batch_converter;
+    OIIO_CHECK_ASSERT( parse( { "--shard", "2/4" }, batch_converter ) );
+    OIIO_CHECK_EQUAL( batch_converter.settings.shard_index, 2 );
+    OIIO_CHECK_EQUAL( batch_converter.settings.shard_count, 4 );
+    OIIO_CHECK_ASSERT( !batch_converter.settings.shard_by_size );
+
+    for ( const char *shard: { "4/4", "1/-4", "1/0", "1", "1/4x", "a/b" } )
+    {
+        BatchConverter invalid;
+        OIIO_CHECK_ASSERT( !parse( { "--shard", shard }, invalid ) );
+    }
+
+    BatchConverter by_size;
+    OIIO_CHECK_ASSERT(
+        parse( { "--shard", "0/2", "--shard-by-size" }, by_size ) );
+    OIIO_CHECK_ASSERT( by_size.settings.shard_by_size );
+
+    BatchConverter recursive;
+    OIIO_CHECK_ASSERT( !parse(
+        { "--shard", "0/2", "--shard-by-size", "--recursive" }, recursive ) );
+}
+
+/// Verifies that the scheduling policies reorder the files as requested,
+/// Verifies the reports of the progress reporter in both formats.
+void test_progress_reporter()
+{
+    std::cout << std::endl << "test_progress_reporter()" << std::endl;
+
+    ProgressCounters counters;
+
+    std::ostringstream json_stream;
+    ProgressReporter   json_reporter(
+        counters, 10, ProgressReporter::Format::JSON, json_stream );
+
+    counters.files_done     = 3;
+    counters.files_failed   = 1;
+    counters.bytes_read     = 4000000;
+    counters.pixels_decoded = 8000000;
+    std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+
+    json_reporter.report( false );
+    auto data = nlohmann::json::parse( json_stream.str() );
+    OIIO_CHECK_EQUAL( data["files_done"].get<int>(), 3 );
+    OIIO_CHECK_EQUAL( data["files_failed"].get<int>(), 1 );
+    OIIO_CHECK_EQUAL( data["files_total"].get<int>(), 10 );
+    OIIO_CHECK_ASSERT( data["files_per_second"].get<double>() > 0.0 );
+    OIIO_CHECK_ASSERT( data["input_mb_per_second"].get<double>() > 0.0 );
+    OIIO_CHECK_ASSERT( data["megapixels_per_second"].get<double>() > 0.0 );
+    OIIO_CHECK_ASSERT( data["eta"].is_number() );
+    OIIO_CHECK_ASSERT( !data["final"].get<bool>() );
+
+    // Nothing has changed since the previous report, but the final report
+    // uses the averages of the whole batch.
+    json_stream.str( "" );
+    json_reporter.report( false );
+    data = nlohmann::json::parse( json_stream.str() );
+    OIIO_CHECK_EQUAL( data["files_per_second"].get<double>(), 0.0 );
+
+    json_stream.str( "" );
+    json_reporter.report( true );
+    data = nlohmann::json::parse( json_stream.str() );
+    OIIO_CHECK_ASSERT( data["files_per_second"].get<double>() > 0.0 );
+    OIIO_CHECK_ASSERT( data["final"].get<bool>() );
+
+    // Without the total number of files, the time left is not known.
+    ProgressCounters   tty_counters;
+    std::ostringstream tty_stream;
+    ProgressReporter   tty_reporter(
+        tty_counters, 0, ProgressReporter::Format::TTY, tty_stream );
+
+    tty_counters.files_done   = 2;
+    tty_counters.files_failed = 1;
+    tty_reporter.start( std::chrono::milliseconds( 1 ) );
+    std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+    tty_reporter.stop();
+
+    std::string output = tty_stream.str();
+    OIIO_CHECK_EQUAL( output.front(), '\r' );
+    OIIO_CHECK_EQUAL( output.back(), '\n' );
+    OIIO_CHECK_ASSERT( output.find( "[3] " ) != std::string::npos );
+    OIIO_CHECK_ASSERT( output.find( "1 failed" ) != std::string::npos );
+    OIIO_CHECK_ASSERT( output.find( "ETA" ) == std::string::npos );
+    OIIO_CHECK_ASSERT( output.find( " total\033[K\n" ) != std::string::npos );
+}
+
+/// putting the missing files last.
+void test_schedule_files()
+{
+    std::cout << std::endl << "test_schedule_files()" << std::endl;
+
+    TestDirectory            test_dir;
+    std::vector<std::string> files;
+    for ( size_t size: { 10, 30, 0, 20 } )
+    {
+        files.push_back(
+            test_dir.path() + "/file" + std::to_string( files.size() ) +
+            ".dng" );
+        std::ofstream( files.back() ) << std::string( size, 'x' );
+    }
+    files.insert( files.begin() + 1, test_dir.path() + "/missing.dng" );
+
+    BatchConverter      batch_converter;
+    std::vector<size_t> indices = { 0, 1, 2, 3, 4 };
+    batch_converter.schedule_files( files, indices );
+    OIIO_CHECK_ASSERT( indices == std::vector<size_t>( { 0, 1, 2, 3, 4 } ) );
+
+    batch_converter.settings.order =
+        BatchConverter::Settings::Order::LargestFirst;
+    batch_converter.schedule_files( files, indices );
+    OIIO_CHECK_ASSERT( indices == std::vector<size_t>( { 2, 4, 0, 3, 1 } ) );
+
+    // Only the given subset gets reordered.
+    indices = { 3, 4, 0 };
+    batch_converter.schedule_files( files, indices );
+    OIIO_CHECK_ASSERT( indices == std::vector<size_t>( { 4, 0, 3 } ) );
+
+#ifndef WIN32
+    // The files have been created in order, so they are expected to have
+    // increasing inode numbers, but that is not guaranteed, so compare with
+    // the inodes instead.
+    batch_converter.settings.order = BatchConverter::Settings::Order::Physical;
+    indices                        = { 4, 3, 2, 1, 0 };
+    batch_converter.schedule_files( files, indices );
+    OIIO_CHECK_EQUAL( indices.back(), 1 );
+
+    for ( size_t i = 1; i + 1 < indices.size(); i++ )
+    {
+        struct stat previous, current;
+        stat( files[indices[i - 1]].c_str(), &previous );
+        stat( files[indices[i]].c_str(), &current );
+        OIIO_CHECK_LT( previous.st_ino, current.st_ino );
+    }
+#endif
+}
+
+/// Verifies that the scheduling order gets parsed from the command line.
+void test_parse_parameters_order()
+{
+    std::cout << std::endl << "test_parse_parameters_order()" << std::endl;
+
+    const std::vector<std::pair<const char *, BatchConverter::Settings::Order>>
+        orders = { { "input", BatchConverter::Settings::Order::Input },
+                   { "largest-first",
+                     BatchConverter::Settings::Order::LargestFirst },
+                   { "physical", BatchConverter::Settings::Order::Physical } };
+
+    for ( const auto &[name, order]: orders )
+    {
+        const char *argv[] = { "DUMMY PROGRAM PATH", "--order", name };
+
+        BatchConverter batch_converter;
+        OIIO::ArgParse arg_parser;
+        batch_converter.init_parser( arg_parser );
+        OIIO_CHECK_EQUAL( arg_parser.parse_args( 3, argv ), 0 );
+        OIIO_CHECK_ASSERT( batch_converter.parse_parameters( arg_parser ) );
+        OIIO_CHECK_ASSERT( batch_converter.settings.order == order );
+    }
+
+    const char *argv[] = { "DUMMY PROGRAM PATH", "--order", "random" };
+
+    BatchConverter batch_converter;
+    OIIO::ArgParse arg_parser;
+    batch_converter.init_parser( arg_parser );
+    OIIO_CHECK_EQUAL( arg_parser.parse_args( 3, argv ), 0 );
+
+    bool        result;
+    std::string output = capture_stderr(
+        [&]() { result = batch_converter.parse_parameters( arg_parser ); } );
+    OIIO_CHECK_ASSERT( !result );
+    OIIO_CHECK_ASSERT(
+        output.find( "Unsupported scheduling order: 'random'" ) !=
+        std::string::npos );
+}
+
+/// Verifies that the progress format gets parsed, and the unsupported ones
+/// are rejected.
+void test_parse_parameters_progress()
+{
+    std::cout << std::endl << "test_parse_parameters_progress()" << std::endl;
+
+    const std::vector<
+        std::pair<const char *, BatchConverter::Settings::Progress>>
+        formats = { { "none", BatchConverter::Settings::Progress::None },
+                    { "tty", BatchConverter::Settings::Progress::TTY },
+                    { "json", BatchConverter::Settings::Progress::JSON } };
+
+    for ( const auto &[name, format]: formats )
+    {
+        const char *argv[] = { "DUMMY PROGRAM PATH", "--progress", name };
+
+        BatchConverter batch_converter;
+        OIIO::ArgParse arg_parser;
+        batch_converter.init_parser( arg_parser );
+        OIIO_CHECK_EQUAL( arg_parser.parse_args( 3, argv ), 0 );
+        OIIO_CHECK_ASSERT( batch_converter.parse_parameters( arg_parser ) );
+        OIIO_CHECK_ASSERT( batch_converter.settings.progress == format );
+    }
+
+    const char *argv[] = { "DUMMY PROGRAM PATH", "--progress", "xml" };
+
+    BatchConverter batch_converter;
+    OIIO::ArgParse arg_parser;
+    batch_converter.init_parser( arg_parser );
+    OIIO_CHECK_EQUAL( arg_parser.parse_args( 3, argv ), 0 );
+
+    bool        result;
+    std::string output = capture_stderr(
+        [&]() { result = batch_converter.parse_parameters( arg_parser ); } );
+    OIIO_CHECK_ASSERT( !result );
+    OIIO_CHECK_ASSERT(
+        output.find( "Unsupported progress format: 'xml'" ) !=
+        std::string::npos );
+}
+
+/// Verifies that a negative number of jobs gets rejected.
+void test_parse_parameters_negative_jobs()
+{
+    std::cout << std::endl
+              << "test_parse_parameters_negative_jobs()" << std::endl;
+
+    const char *argv[] = { "DUMMY PROGRAM PATH", "--jobs", "-2" };
+    const int   argc   = sizeof( argv ) / sizeof( argv[0] );
+
+    BatchConverter batch_converter;
+    OIIO::ArgParse arg_parser;
+    batch_converter.init_parser( arg_parser );
+    arg_parser.parse_args( argc, argv );
+
+    bool        result;
+    std::string output = capture_stderr(
+        [&]() { result = batch_converter.parse_parameters( arg_parser ); } );
+    OIIO_CHECK_ASSERT( !result );
+    OIIO_CHECK_ASSERT(
+        output.find( "Invalid number of jobs" ) != std::string::npos );
+}
+
+/// Verifies that the processing stops at the first failed file.
+void test_process_files_stops_on_failure()
+{
+    std::cout << std::endl
+              << "test_process_files_stops_on_failure()" << std::endl;
+
+    TestDirectory test_dir;
+    std::string   missing_file1 = test_dir.path() + "/missing1.dng";
+    std::string   missing_file2 = test_dir.path() + "/missing2.dng";
+
+    ImageConverter converter;
+    BatchConverter batch_converter;
+
+    bool        result;
+    std::string output = capture_stderr( [&]() {
+        result = batch_converter.process_files(
+            converter, { missing_file1, missing_file2 } );
+    } );
+
+    OIIO_CHECK_ASSERT( !result );
+    OIIO_CHECK_ASSERT(
+        output.find( "Failed on file [1/2]: " + missing_file1 ) !=
+        std::string::npos );
+    OIIO_CHECK_ASSERT(
+        output.find( "Failed on file [2/2]" ) == std::string::npos );
+}
+
+/// Verifies that the pipelined mode stops at the first failed file.
+void test_process_files_pipelined_stops_on_failure()
+{
+    std::cout << std::endl
+              << "test_process_files_pipelined_stops_on_failure()"
+              << std::endl;
+
+    TestDirectory test_dir;
+    std::string   missing_file1 = test_dir.path() + "/missing1.dng";
+    std::string   missing_file2 = test_dir.path() + "/missing2.dng";
+
+    ImageConverter converter;
+    BatchConverter batch_converter;
+    batch_converter.settings.pipeline = true;
+
+    bool        result;
+    std::string output = capture_stderr( [&]() {
+        result = batch_converter.process_files(
+            converter, { missing_file1, missing_file2 } );
+    } );
+
+    OIIO_CHECK_ASSERT( !result );
+    OIIO_CHECK_ASSERT(
+        output.find( "Failed on file [1/2]: " + missing_file1 ) !=
+        std::string::npos );
+    OIIO_CHECK_ASSERT(
+        output.find( "Failed on file [2/2]" ) == std::string::npos );
+}
+
+/// Verifies that the keep-going mode processes every file after a failure,
+/// recording the failed stage and the reason of each failure.
+void test_process_files_keep_going( bool pipeline )
+{
+    std::cout << std::endl
+              << "test_process_files_keep_going( " << pipeline << " )"
+              << std::endl;
+
+    TestDirectory test_dir;
+    std::string   missing_file = test_dir.path() + "/missing.dng";
+
+    // An input file which already has its output next to it fails when
+    // making the output path, before the file gets read.
+    std::string existing_file = test_dir.path() + "/existing.dng";
+    std::ofstream( existing_file ).close();
+    std::ofstream( test_dir.path() + "/existing_aces.exr" ).close();
+
+    ImageConverter converter;
+    BatchConverter batch_converter;
+    batch_converter.settings.pipeline   = pipeline;
+    batch_converter.settings.keep_going = true;
+
+    bool        result;
+    std::string output = capture_stderr( [&]() {
+        result = batch_converter.process_files(
+            converter, { missing_file, existing_file } );
+    } );
+
+    OIIO_CHECK_ASSERT( !result );
+    OIIO_CHECK_ASSERT(
+        output.find( "Failed on file [1/2]: " + missing_file ) !=
+        std::string::npos );
+    OIIO_CHECK_ASSERT(
+        output.find( "Failed on file [2/2]: " + existing_file ) !=
+        std::string::npos );
+    OIIO_CHECK_ASSERT(
+        output.find( "Conversion summary: 0 of 2 files converted, 2 failed." ) !=
+        std::string::npos );
+
+    auto &failures = batch_converter.get_failures();
+    OIIO_CHECK_EQUAL( failures.size(), 2 );
+    if ( failures.size() == 2 )
+    {
+        OIIO_CHECK_EQUAL( failures[0].index, 0 );
+        OIIO_CHECK_EQUAL( failures[0].file, missing_file );
+        OIIO_CHECK_EQUAL( failures[0].stage, "decode" );
+        OIIO_CHECK_ASSERT( !failures[0].reason.empty() );
+        OIIO_CHECK_ASSERT( failures[0].elapsed >= 0.0 );
+
+        OIIO_CHECK_EQUAL( failures[1].index, 1 );
+        OIIO_CHECK_EQUAL( failures[1].file, existing_file );
+        OIIO_CHECK_EQUAL( failures[1].stage, "prepare" );
+        OIIO_CHECK_ASSERT(
+            failures[1].reason.find( "already exists" ) != std::string::npos );
+    }
+}
+
+/// Verifies that process_paths converts the raw files found in the
+/// subdirectories, numbering them as they get found.
+void test_process_paths_recursive()
+{
+    std::cout << std::endl << "test_process_paths_recursive()" << std::endl;
+
+    TestDirectory test_dir;
+    std::filesystem::create_directories( test_dir.path() + "/subdir" );
+
+    // Every input file already has its output next to it, so each one fails
+    // when making the output path, before the file gets read.
+    std::string top_file = test_dir.path() + "/top.dng";
+    std::string sub_file = test_dir.path() + "/subdir/sub.dng";
+    std::ofstream( top_file ).close();
+    std::ofstream( test_dir.path() + "/top_aces.exr" ).close();
+    std::ofstream( sub_file ).close();
+    std::ofstream( test_dir.path() + "/subdir/sub_aces.exr" ).close();
+    std::ofstream( test_dir.path() + "/notes.txt" ).close();
+
+    ImageConverter converter;
+    BatchConverter batch_converter;
+    batch_converter.settings.recursive  = true;
+    batch_converter.settings.keep_going = true;
+
+    bool        result;
+    std::string output = capture_stderr( [&]() {
+        result =
+            batch_converter.process_paths( converter, { test_dir.path() } );
+    } );
+
+    OIIO_CHECK_ASSERT( !result );
+    OIIO_CHECK_EQUAL( batch_converter.get_total_files(), 2 );
+    OIIO_CHECK_ASSERT(
+        output.find( "Failed on file [1]: " ) != std::string::npos );
+    OIIO_CHECK_ASSERT(
+        output.find( "Failed on file [2]: " ) != std::string::npos );
+    OIIO_CHECK_ASSERT( output.find( top_file ) != std::string::npos );
+    OIIO_CHECK_ASSERT( output.find( sub_file ) != std::string::npos );
+    OIIO_CHECK_ASSERT( output.find( "notes.txt" ) == std::string::npos );
+
+    auto &failures = batch_converter.get_failures();
+    OIIO_CHECK_EQUAL( failures.size(), 2 );
+    for ( const auto &failure: failures )
+        OIIO_CHECK_EQUAL( failure.stage, "prepare" );
+}
+
+/// Verifies that the directory watcher reports the files written into the
+/// watched directory and its subdirectories, including the new ones.
+void test_directory_watcher()
+{
+    std::cout << std::endl << "test_directory_watcher()" << std::endl;
+    if ( !DirectoryWatcher::is_supported() )
+        return;
+
+    TestDirectory    test_dir;
+    DirectoryWatcher watcher( true );
+    OIIO_CHECK_ASSERT( watcher.add_directory( test_dir.path() ) );
+
+    std::vector<std::string> files;
+    OIIO_CHECK_ASSERT( watcher.wait( 0, files ) );
+    OIIO_CHECK_ASSERT( files.empty() );
+
+    std::string file = test_dir.path() + "/file.dng";
+    std::ofstream( file ).close();
+    std::filesystem::create_directories( test_dir.path() + "/subdir" );
+
+    OIIO_CHECK_ASSERT( watcher.wait( 1000, files ) );
+    OIIO_CHECK_EQUAL( files.size(), 1 );
+    OIIO_CHECK_ASSERT( files.size() == 1 && files[0] == file );
+
+    // The new subdirectory is being watched too.
+    std::string subdir_file = test_dir.path() + "/subdir/file.dng";
+    std::ofstream( subdir_file ).close();
+
+    files.clear();
+    OIIO_CHECK_ASSERT( watcher.wait( 1000, files ) );
+    OIIO_CHECK_ASSERT( files.size() == 1 && files[0] == subdir_file );
+}
+
+/// Verifies that watch_directory converts the files arriving into the
+/// directory until stopped, and doesn't stop on failures.
+void test_watch_directory()
+{
+    std::cout << std::endl << "test_watch_directory()" << std::endl;
+    if ( !DirectoryWatcher::is_supported() )
+        return;
+
+    TestDirectory test_dir;
+
+    // Both input files already have their outputs next to them, so each one
+    // fails when making the output path, before the file gets read.
+    std::string file1 = test_dir.path() + "/file1.dng";
+    std::string file2 = test_dir.path() + "/file2.dng";
+
+    ImageConverter converter;
+    BatchConverter batch_converter;
+
+    std::thread feeder( [&]() {
+        std::this_thread::sleep_for( std::chrono::milliseconds( 500 ) );
+        std::ofstream( test_dir.path() + "/file1_aces.exr" ).close();
+        std::ofstream( file1 ).close();
+        std::ofstream( test_dir.path() + "/file2_aces.exr" ).close();
+        std::ofstream( file2 ).close();
+        std::ofstream( test_dir.path() + "/notes.txt" ).close();
+
+        std::this_thread::sleep_for( std::chrono::milliseconds( 1500 ) );
+        batch_converter.stop();
+    } );
+
+    bool        result;
+    std::string output = capture_stderr( [&]() {
+        result = batch_converter.watch_directory( converter, test_dir.path() );
+    } );
+    feeder.join();
+
+    OIIO_CHECK_ASSERT( !result );
+    OIIO_CHECK_EQUAL( batch_converter.get_total_files(), 2 );
+    OIIO_CHECK_ASSERT(
+        output.find( "Failed on file [1]: " + file1 ) != std::string::npos );
+    OIIO_CHECK_ASSERT(
+        output.find( "Failed on file [2]: " + file2 ) != std::string::npos );
+    OIIO_CHECK_ASSERT( output.find( "notes.txt" ) == std::string::npos );
+}
+
+/// Verifies that watch_directory in the recursive mode converts every file of
+/// a directory tree copied into the watched directory exactly once, including
+/// the files written before the new directories got watched.
+void test_watch_directory_copied_tree()
+{
+    std::cout << std::endl
+              << "test_watch_directory_copied_tree()" << std::endl;
+    if ( !DirectoryWatcher::is_supported() )
+        return;
+
+    TestDirectory test_dir;
+    TestDirectory source_dir;
+
+    // Each input file already has its output next to it, so it fails when
+    // making the output path, before the file gets read.
+    const size_t file_count = 20;
+    for ( const std::string subdir: { "/shoot", "/shoot/day2" } )
+    {
+        std::filesystem::create_directories( source_dir.path() + subdir );
+        for ( size_t i = 0; i < file_count; i++ )
+        {
+            std::string name =
+                source_dir.path() + subdir + "/file" + std::to_string( i );
+            std::ofstream( name + "_aces.exr" ).close();
+            std::ofstream( name + ".dng" ).close();
+        }
+    }
+
+    ImageConverter converter;
+    BatchConverter batch_converter;
+    batch_converter.settings.recursive = true;
+
+    std::thread feeder( [&]() {
+        std::this_thread::sleep_for( std::chrono::milliseconds( 500 ) );
+        std::filesystem::copy(
+            source_dir.path() + "/shoot",
+            test_dir.path() + "/shoot",
+            std::filesystem::copy_options::recursive );
+
+        std::this_thread::sleep_for( std::chrono::milliseconds( 2000 ) );
+        batch_converter.stop();
+    } );
+
+    bool        result;
+    std::string output = capture_stderr( [&]() {
+        result = batch_converter.watch_directory( converter, test_dir.path() );
+    } );
+    feeder.join();
+
+    OIIO_CHECK_ASSERT( !result );
+    OIIO_CHECK_EQUAL( batch_converter.get_total_files(), 2 * file_count );
+    for ( size_t i = 0; i < file_count; i++ )
+    {
+        std::string name = "/file" + std::to_string( i ) + ".dng";
+        OIIO_CHECK_ASSERT(
+            output.find( test_dir.path() + "/shoot" + name ) !=
+            std::string::npos );
+        OIIO_CHECK_ASSERT(
+            output.find( test_dir.path() + "/shoot/day2" + name ) !=
+            std::string::npos );
+    }
+}
+
+/// Verifies that watch_directory in the incremental mode saves the manifest
+/// as the files get converted, not only once the watching stops.
+void test_watch_directory_incremental()
+{
+    std::cout << std::endl
+              << "test_watch_directory_incremental()" << std::endl;
+
+    // This test fails on CI runners having an old version of OIIO.
+    if ( !DirectoryWatcher::is_supported() ||
+         OIIO::openimageio_version() < 30000 )
+        return;
+
+    TestDirectory         test_dir;
+    std::filesystem::path manifest_path = test_dir.path();
+    manifest_path /= ConversionManifest::file_name;
+
+    ImageConverter converter;
+    converter.settings.WB_method =
+        ImageConverter::Settings::WBMethod::Metadata;
+    converter.settings.matrix_method =
+        ImageConverter::Settings::MatrixMethod::Metadata;
+
+    BatchConverter batch_converter;
+    batch_converter.settings.incremental = true;
+
+    bool        saved_while_watching = false;
+    std::thread feeder( [&]() {
+        std::this_thread::sleep_for( std::chrono::milliseconds( 500 ) );
+        test_dir.copy_test_files( { "frame1.dng" } );
+
+        for ( int i = 0; i < 200 && !saved_while_watching; i++ )
+        {
+            std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+            saved_while_watching = std::filesystem::exists( manifest_path );
+        }
+        batch_converter.stop();
+    } );
+
+    bool result;
+    capture_stdout( [&]() {
+        capture_stderr( [&]() {
+            result =
+                batch_converter.watch_directory( converter, test_dir.path() );
+        } );
+    } );
+    feeder.join();
+
+    OIIO_CHECK_ASSERT( result );
+    OIIO_CHECK_EQUAL( batch_converter.get_total_files(), 1 );
+    OIIO_CHECK_ASSERT( saved_while_watching );
+
+    ConversionManifest manifest( test_dir.path() );
+    OIIO_CHECK_ASSERT( manifest.load() );
+    OIIO_CHECK_ASSERT(
+        manifest.find( test_dir.path() + "/frame1.dng" ) != nullptr );
+}
+
+/// Verifies that the reservations made concurrently never exceed the memory
+/// budget, and a reservation larger than the budget still gets granted.
+void test_memory_budget()
+{
+    std::cout << std::endl << "test_memory_budget()" << std::endl;
+
+    const size_t limit = 100;
+    MemoryBudget budget( limit );
+
+    std::atomic<size_t> reserved( 0 );
+    std::atomic<bool>   exceeded( false );
+
+    std::vector<std::thread> threads;
+    for ( size_t i = 0; i < 8; i++ )
+    {
+        threads.emplace_back( [&, i]() {
+            // Mix the small requests with the ones above the budget.
+            size_t bytes = i % 4 == 0 ? 2 * limit : 10 + i * 5;
+            for ( size_t j = 0; j < 50; j++ )
+            {
+                MemoryReservation reservation( budget, bytes );
+
+                size_t granted = std::min( bytes, limit );
+                if ( ( reserved += granted ) > limit )
+                    exceeded = true;
+                std::this_thread::yield();
+                reserved -= granted;
+            }
+        } );
+    }
+
+    for ( auto &thread: threads )
+        thread.join();
+
+    OIIO_CHECK_ASSERT( !exceeded );
+    OIIO_CHECK_EQUAL( budget.used(), 0 );
+
+    // An unlimited budget never blocks and reserves nothing.
+    MemoryBudget      unlimited;
+    MemoryReservation reservation( unlimited, 1000 );
+    OIIO_CHECK_EQUAL( unlimited.used(), 0 );
+}
+
+/// Verifies that the shards cover every file exactly once, regardless of the
+/// order of the list, and the size-balanced shards get about the same total
+/// size.
+void test_select_shard( bool by_size )
+{
+    std::cout << std::endl
+              << "test_select_shard( " << by_size << " )" << std::endl;
+
+    TestDirectory            test_dir;
+    std::vector<std::string> files;
+    uint64_t                 largest = 0;
+    for ( size_t i = 0; i < 50; i++ )
+    {
+        std::string file =
+            test_dir.path() + "/file" + std::to_string( i ) + ".dng";
+        size_t size = ( i * 37 ) % 100 + 1;
+        std::ofstream( file ) << std::string( size, 'x' );
+        files.push_back( file );
+        largest = std::max<uint64_t>( largest, size );
+    }
+
+    std::vector<std::string> reversed( files.rbegin(), files.rend() );
+
+    const size_t          shard_count = 4;
+    std::vector<int>      seen( files.size(), 0 );
+    std::vector<uint64_t> sizes;
+    for ( size_t shard = 0; shard < shard_count; shard++ )
+    {
+        BatchConverter batch_converter;
+        batch_converter.settings.shard_index   = shard;
+        batch_converter.settings.shard_count   = shard_count;
+        batch_converter.settings.shard_by_size = by_size;
+
+        std::set<std::string> selected;
+        uint64_t              size = 0;
+        for ( size_t i: batch_converter.select_shard( files ) )
+        {
+            seen[i]++;
+            selected.insert( files[i] );
+            size += std::filesystem::file_size( files[i] );
+        }
+        sizes.push_back( size );
+
+        std::set<std::string> selected_reversed;
+        for ( size_t i: batch_converter.select_shard( reversed ) )
+            selected_reversed.insert( reversed[i] );
+        OIIO_CHECK_ASSERT( selected == selected_reversed );
+    }
+
+    for ( int count: seen )
+        OIIO_CHECK_EQUAL( count, 1 );
+
+    if ( by_size )
+    {
+        auto [min, max] = std::minmax_element( sizes.begin(), sizes.end() );
+        OIIO_CHECK_ASSERT( *max - *min <= largest );
+    }
+}
+
+/// Verifies that the failure summary lists every failed file.
+void test_print_failure_summary()
+{
+    std::cout << std::endl << "test_print_failure_summary()" << std::endl;
+
+    TestDirectory test_dir;
+    std::string   missing_file = test_dir.path() + "/missing.dng";
+
+    ImageConverter converter;
+    BatchConverter batch_converter;
+
+    capture_stderr(
+        [&]() { batch_converter.process_files( converter, { missing_file } ); } );
+
+    std::ostringstream stream;
+    batch_converter.print_failure_summary( stream );
+    std::string summary = stream.str();
+
+    OIIO_CHECK_ASSERT(
+        summary.find( "Conversion summary: 0 of 1 files converted, 1 failed." ) !=
+        std::string::npos );
+    OIIO_CHECK_ASSERT( summary.find( "Stage" ) != std::string::npos );
+    OIIO_CHECK_ASSERT( summary.find( missing_file ) != std::string::npos );
+    OIIO_CHECK_ASSERT( summary.find( "decode" ) != std::string::npos );
+}
+
+/// Verifies that a saved manifest loads back with the same entries.
+void test_manifest_save_load()
+{
+    std::cout << std::endl << "test_manifest_save_load()" << std::endl;
+
+    TestDirectory test_dir;
+
+    ConversionManifest::Entry entry;
+    entry.size          = 12345;
+    entry.mtime         = -678;
+    entry.settings_hash = "0123456789abcdef";
+    entry.output        = test_dir.path() + "/frame_aces.exr";
+
+    ConversionManifest manifest( test_dir.path() );
+    OIIO_CHECK_ASSERT( manifest.load() );
+    OIIO_CHECK_ASSERT( manifest.find( "/input/frame.dng" ) == nullptr );
+    manifest.update( "/input/frame.dng", entry );
+    OIIO_CHECK_ASSERT( manifest.save() );
+    OIIO_CHECK_ASSERT( std::filesystem::exists( manifest.path() ) );
+
+    ConversionManifest loaded( test_dir.path() );
+    OIIO_CHECK_ASSERT( loaded.load() );
+    auto *found = loaded.find( "/input/frame.dng" );
+    OIIO_CHECK_ASSERT( found != nullptr );
+    if ( found )
+    {
+        OIIO_CHECK_EQUAL( found->size, entry.size );
+        OIIO_CHECK_EQUAL( found->mtime, entry.mtime );
+        OIIO_CHECK_EQUAL( found->settings_hash, entry.settings_hash );
+        OIIO_CHECK_EQUAL( found->output, entry.output );
+    }
+}
+
+/// Verifies that a malformed manifest gets ignored with a warning.
+void test_manifest_malformed()
+{
+    std::cout << std::endl << "test_manifest_malformed()" << std::endl;
+
+    TestDirectory      test_dir;
+    ConversionManifest manifest( test_dir.path() );
+    std::ofstream( manifest.path() ) << "{ not json";
+
+    bool        result;
+    std::string output = capture_stderr( [&]() { result = manifest.load(); } );
+    OIIO_CHECK_ASSERT( !result );
+    OIIO_CHECK_ASSERT(
+        output.find( "Ignoring the malformed manifest file" ) !=
+        std::string::npos );
+}
+
+/// Verifies that only the settings affecting the pixels change the hash.
+void test_manifest_hash_settings()
+{
+    std::cout << std::endl << "test_manifest_hash_settings()" << std::endl;
+
+    ImageConverter::Settings settings;
+    std::string hash = ConversionManifest::hash_settings( settings );
+    OIIO_CHECK_EQUAL( hash.size(), 16 );
+    OIIO_CHECK_EQUAL( ConversionManifest::hash_settings( settings ), hash );
+
+    ImageConverter::Settings irrelevant = settings;
+    irrelevant.overwrite                = true;
+    irrelevant.create_dirs              = true;
+    irrelevant.output_dir               = "converted";
+    irrelevant.use_timing               = true;
+    irrelevant.verbosity                = 2;
+    OIIO_CHECK_EQUAL( ConversionManifest::hash_settings( irrelevant ), hash );
+
+    ImageConverter::Settings scaled = settings;
+    scaled.scale                    = 2.0f;
+    OIIO_CHECK_NE( ConversionManifest::hash_settings( scaled ), hash );
+
+    ImageConverter::Settings illuminant = settings;
+    illuminant.illuminant               = "D55";
+    OIIO_CHECK_NE( ConversionManifest::hash_settings( illuminant ), hash );
+}
+
+/// Verifies that the incremental mode gets enabled from the command line.
+void test_parse_parameters_incremental()
+{
+    std::cout << std::endl
+              << "test_parse_parameters_incremental()" << std::endl;
+
+    const char *argv[] = { "DUMMY PROGRAM PATH", "--incremental" };
+    const int   argc   = sizeof( argv ) / sizeof( argv[0] );
+
+    BatchConverter batch_converter;
+    OIIO_CHECK_ASSERT( !batch_converter.settings.incremental );
+
+    OIIO::ArgParse arg_parser;
+    batch_converter.init_parser( arg_parser );
+    OIIO_CHECK_EQUAL( arg_parser.parse_args( argc, argv ), 0 );
+    OIIO_CHECK_ASSERT( batch_converter.parse_parameters( arg_parser ) );
+    OIIO_CHECK_ASSERT( batch_converter.settings.incremental );
+}
+
+/// Verifies that the incremental mode skips the unchanged files, and
+/// re-converts the files whose inputs or settings have changed.
+void test_process_files_incremental()
+{
+    std::cout << std::endl << "test_process_files_incremental()" << std::endl;
+
+    // This test fails on CI runners having an old version of OIIO.
+    if ( OIIO::openimageio_version() < 30000 )
+        return;
+
+    TestDirectory test_dir;
+    auto files = test_dir.copy_test_files( { "frame1.dng", "frame2.dng" } );
+
+    ImageConverter converter;
+    converter.settings.WB_method =
+        ImageConverter::Settings::WBMethod::Metadata;
+    converter.settings.matrix_method =
+        ImageConverter::Settings::MatrixMethod::Metadata;
+
+    BatchConverter batch_converter;
+    batch_converter.settings.incremental = true;
+
+    // The first run converts everything and writes the manifest.
+    std::string output = capture_stdout( [&]() {
+        OIIO_CHECK_ASSERT( batch_converter.process_files( converter, files ) );
+    } );
+    OIIO_CHECK_ASSERT( output.find( "Skipping" ) == std::string::npos );
+    OIIO_CHECK_ASSERT( std::filesystem::exists(
+        std::filesystem::path( test_dir.path() ) /
+        ConversionManifest::file_name ) );
+
+    // Nothing has changed, so nothing gets converted.
+    output = capture_stdout( [&]() {
+        OIIO_CHECK_ASSERT( batch_converter.process_files( converter, files ) );
+    } );
+    OIIO_CHECK_ASSERT(
+        output.find( "Skipping unchanged file: " + files[0] ) !=
+        std::string::npos );
+    OIIO_CHECK_ASSERT(
+        output.find( "Skipping unchanged file: " + files[1] ) !=
+        std::string::npos );
+    OIIO_CHECK_ASSERT( output.find( "Processing file" ) == std::string::npos );
+
+    // A modified input gets re-converted, replacing its output even though
+    // overwriting is not enabled.
+    std::filesystem::last_write_time(
+        files[1],
+        std::filesystem::last_write_time( files[1] ) + std::chrono::hours( 1 ) );
+    output = capture_stdout( [&]() {
+        OIIO_CHECK_ASSERT( batch_converter.process_files( converter, files ) );
+    } );
+    OIIO_CHECK_ASSERT(
+        output.find( "Skipping unchanged file: " + files[0] ) !=
+        std::string::npos );
+    OIIO_CHECK_ASSERT(
+        output.find( "Processing file: " + files[1] ) != std::string::npos );
+
+    // Changed settings re-convert all files.
+    converter.settings.scale = 2.0f;
+    output                   = capture_stdout( [&]() {
+        OIIO_CHECK_ASSERT( batch_converter.process_files( converter, files ) );
+    } );
+    OIIO_CHECK_ASSERT( output.find( "Skipping" ) == std::string::npos );
+    OIIO_CHECK_ASSERT( output.find( "[2/2] Processing file" ) != std::string::npos );
+}
+
+/// Verifies that multiple workers convert every file of the batch.
+void test_process_files_parallel()
+{
+    std::cout << std::endl << "test_process_files_parallel()" << std::endl;
+
+    // This test fails on CI runners having an old version of OIIO.
+    if ( OIIO::openimageio_version() < 30000 )
+        return;
+
+    TestDirectory test_dir;
+    auto          files = test_dir.copy_test_files(
+        { "frame1.dng", "frame2.dng", "frame3.dng", "frame4.dng" } );
+
+    ImageConverter converter;
+    converter.settings.WB_method =
+        ImageConverter::Settings::WBMethod::Metadata;
+    converter.settings.matrix_method =
+        ImageConverter::Settings::MatrixMethod::Metadata;
+
+    BatchConverter batch_converter;
+    batch_converter.settings.jobs = 3;
+
+    OIIO_CHECK_ASSERT( batch_converter.process_files( converter, files ) );
+
+    for ( size_t i = 1; i <= files.size(); i++ )
+    {
+        auto output = std::filesystem::path( test_dir.path() ) /
+                      ( "frame" + std::to_string( i ) + "_aces.exr" );
+        OIIO_CHECK_ASSERT( std::filesystem::exists( output ) );
+    }
+}
+
+/// Verifies that the planned batch solves the transform shared by all files
+/// once, and still reports the files which can't be planned.
+void test_process_files_plan()
+{
+    std::cout << std::endl << "test_process_files_plan()" << std::endl;
+
+    // This test fails on CI runners having an old version of OIIO.
+    if ( OIIO::openimageio_version() < 30000 )
+        return;
+
+    TestDirectory test_dir;
+    auto          files =
+        test_dir.copy_test_files( { "frame1.dng", "frame2.dng", "frame3.dng" } );
+    std::string missing_file = test_dir.path() + "/missing.dng";
+    files.push_back( missing_file );
+
+    ImageConverter converter;
+    converter.settings.WB_method =
+        ImageConverter::Settings::WBMethod::Metadata;
+    converter.settings.matrix_method =
+        ImageConverter::Settings::MatrixMethod::Metadata;
+
+    BatchConverter batch_converter;
+    batch_converter.settings.jobs       = 2;
+    batch_converter.settings.plan       = true;
+    batch_converter.settings.keep_going = true;
+
+    bool        result;
+    std::string output = capture_stdout( [&]() {
+        capture_stderr( [&]() {
+            result = batch_converter.process_files( converter, files );
+        } );
+    } );
+
+    OIIO_CHECK_ASSERT( !result );
+    OIIO_CHECK_ASSERT(
+        output.find( "Planned 1 distinct colour transforms for 4 files." ) !=
+        std::string::npos );
+
+    for ( size_t i = 1; i <= 3; i++ )
+    {
+        auto output_file = std::filesystem::path( test_dir.path() ) /
+                           ( "frame" + std::to_string( i ) + "_aces.exr" );
+        OIIO_CHECK_ASSERT( std::filesystem::exists( output_file ) );
+    }
+
+    auto &failures = batch_converter.get_failures();
+    OIIO_CHECK_EQUAL( failures.size(), 1 );
+    if ( failures.size() == 1 )
+    {
+        OIIO_CHECK_EQUAL( failures[0].file, missing_file );
+        OIIO_CHECK_EQUAL( failures[0].stage, "decode" );
+    }
+}
+
+/// Verifies that the pipelined mode converts every file of the batch, with
+/// a single thread per stage.
+void test_process_files_pipelined()
+{
+    std::cout << std::endl << "test_process_files_pipelined()" << std::endl;
+
+    // This test fails on CI runners having an old version of OIIO.
+    if ( OIIO::openimageio_version() < 30000 )
+        return;
+
+    TestDirectory test_dir;
+    auto          files = test_dir.copy_test_files(
+        { "frame1.dng", "frame2.dng", "frame3.dng", "frame4.dng" } );
+
+    ImageConverter converter;
+    converter.settings.WB_method =
+        ImageConverter::Settings::WBMethod::Metadata;
+    converter.settings.matrix_method =
+        ImageConverter::Settings::MatrixMethod::Metadata;
+
+    BatchConverter batch_converter;
+    batch_converter.settings.jobs     = 1;
+    batch_converter.settings.pipeline = true;
+
+    OIIO_CHECK_ASSERT( batch_converter.process_files( converter, files ) );
+
+    for ( size_t i = 1; i <= files.size(); i++ )
+    {
+        auto output = std::filesystem::path( test_dir.path() ) /
+                      ( "frame" + std::to_string( i ) + "_aces.exr" );
+        OIIO_CHECK_ASSERT( std::filesystem::exists( output ) );
+    }
+}
+
+/// Verifies that a job line overrides only the given settings, and that the
+/// malformed lines are rejected.
+void test_parse_job()
+{
+    std::cout << std::endl << "test_parse_job()" << std::endl;
+
+    ImageConverter::Settings defaults;
+    defaults.headroom = 3.0f;
+
+    ConversionJob job;
+    std::string   error;
+    OIIO_CHECK_ASSERT( parse_job(
+        R"({"input": "a.dng", "output": "out/a.exr", "settings": {)"
+        R"("WB_method": "illuminant", "illuminant": "3200K", "scale": 2, )"
+        R"("half_size": true, "WB_box": [1, 2, 3, 4], )"
+        R"("custom_matrix": [1, 2, 3, 4, 5, 6, 7, 8, 9]}})",
+        defaults,
+        job,
+        error ) );
+    OIIO_CHECK_EQUAL( job.input, "a.dng" );
+    OIIO_CHECK_EQUAL( job.output, "out/a.exr" );
+    OIIO_CHECK_ASSERT(
+        job.settings.WB_method ==
+        ImageConverter::Settings::WBMethod::Illuminant );
+    OIIO_CHECK_EQUAL( job.settings.illuminant, "3200K" );
+    OIIO_CHECK_EQUAL( job.settings.scale, 2.0f );
+    OIIO_CHECK_EQUAL( job.settings.headroom, 3.0f );
+    OIIO_CHECK_ASSERT( job.settings.half_size );
+    OIIO_CHECK_EQUAL( job.settings.WB_box[3], 4 );
+    OIIO_CHECK_EQUAL( job.settings.custom_matrix[1][0], 4.0f );
+
+    // Only the input is required.
+    OIIO_CHECK_ASSERT(
+        parse_job( R"({"input": "b.dng"})", defaults, job, error ) );
+    OIIO_CHECK_EQUAL( job.input, "b.dng" );
+    OIIO_CHECK_ASSERT( job.output.empty() );
+    OIIO_CHECK_EQUAL( job.settings.scale, 1.0f );
+
+    const std::vector<std::pair<std::string, std::string>> malformed = {
+        { "not json", "Not a valid JSON value." },
+        { "[1, 2]", "Expected a JSON object." },
+        { R"({"output": "a.exr"})", "Missing the \"input\" file." },
+        { R"({"input": "a.dng", "extra": 1})", "Unknown key \"extra\"." },
+        { R"({"input": "a.dng", "settings": {"colour": 1}})",
+          "Unknown setting \"colour\"." },
+        { R"({"input": "a.dng", "settings": {"headroom": "4"}})",
+          "Invalid value of the setting \"headroom\": \"4\"." },
+        { R"({"input": "a.dng", "settings": {"flip": 1.5}})",
+          "Invalid value of the setting \"flip\": 1.5." },
+        { R"({"input": "a.dng", "settings": {"WB_box": [1, 2]}})",
+          "Invalid value of the setting \"WB_box\": [1,2]." },
+        { R"({"input": "a.dng", "settings": {"crop_mode": "none"}})",
+          "Invalid value of the setting \"crop_mode\": \"none\"." },
+        { R"({"input": "a.dng", "settings": {"WB_method": "illuminant"}})",
+          "The \"illuminant\" white balancing method needs the "
+          "\"illuminant\" setting." }
+    };
+
+    for ( const auto &[line, expected]: malformed )
+    {
+        error.clear();
+        OIIO_CHECK_ASSERT( !parse_job( line, defaults, job, error ) );
+        OIIO_CHECK_EQUAL( error, expected );
+    }
+}
+
+/// Verifies that all malformed lines of a job file get reported with their
+/// line numbers, and the empty lines get skipped.
+void test_read_job_file()
+{
+    std::cout << std::endl << "test_read_job_file()" << std::endl;
+
+    TestDirectory test_dir;
+    std::string   path = test_dir.path() + "/jobs.jsonl";
+    std::ofstream( path ) << R"({"input": "a.dng"})" << std::endl
+                          << std::endl
+                          << R"({"input": 1})" << std::endl
+                          << R"({"input": "b.dng"})" << std::endl
+                          << "{" << std::endl;
+
+    ImageConverter::Settings   defaults;
+    std::vector<ConversionJob> jobs;
+
+    bool        result;
+    std::string output = capture_stderr(
+        [&]() { result = read_job_file( path, defaults, jobs ); } );
+    OIIO_CHECK_ASSERT( !result );
+    OIIO_CHECK_EQUAL( jobs.size(), 2 );
+    OIIO_CHECK_ASSERT( output.find( path + ":3: " ) != std::string::npos );
+    OIIO_CHECK_ASSERT( output.find( path + ":5: " ) != std::string::npos );
+    OIIO_CHECK_ASSERT( output.find( path + ":2: " ) == std::string::npos );
+
+    std::string missing_path = test_dir.path() + "/missing.jsonl";
+    output                   = capture_stderr(
+        [&]() { result = read_job_file( missing_path, defaults, jobs ); } );
+    OIIO_CHECK_ASSERT( !result );
+    OIIO_CHECK_ASSERT(
+        output.find( "Failed to open the job file" ) != std::string::npos );
+}
+
+/// Verifies that the jobs get converted with their own settings into their
+/// own outputs, and the failures are numbered by the jobs.
+void test_process_job_file( bool pipeline )
+{
+    std::cout << std::endl
+              << "test_process_job_file( " << pipeline << " )" << std::endl;
+
+    // This test fails on CI runners having an old version of OIIO.
+    if ( OIIO::openimageio_version() < 30000 )
+        return;
+
+    TestDirectory test_dir;
+    auto files = test_dir.copy_test_files( { "frame1.dng", "frame2.dng" } );
+    std::string named_output = test_dir.path() + "/named/first.exr";
+    std::string missing_file = test_dir.path() + "/missing.dng";
+
+    std::string path = test_dir.path() + "/jobs.jsonl";
+    std::ofstream( path )
+        << nlohmann::json( { { "input", files[0] },
+                             { "output", named_output },
+                             { "settings", { { "create_dirs", true } } } } )
+               .dump()
+        << std::endl
+        << nlohmann::json( { { "input", missing_file } } ).dump() << std::endl
+        << nlohmann::json(
+               { { "input", files[1] },
+                 { "settings",
+                   { { "half_size", true }, { "output_dir", "half" } } } } )
+               .dump()
+        << std::endl;
+
+    ImageConverter converter;
+    converter.settings.WB_method =
+        ImageConverter::Settings::WBMethod::Metadata;
+    converter.settings.matrix_method =
+        ImageConverter::Settings::MatrixMethod::Metadata;
+
+    BatchConverter batch_converter;
+    batch_converter.settings.jobs       = 2;
+    batch_converter.settings.pipeline   = pipeline;
+    batch_converter.settings.keep_going = true;
+
+    bool        result;
+    std::string output = capture_stdout( [&]() {
+        capture_stderr( [&]() {
+            result = batch_converter.process_job_file( converter, path );
+        } );
+    } );
+    OIIO_CHECK_ASSERT( !result );
+    OIIO_CHECK_EQUAL( batch_converter.get_total_files(), 3 );
+
+    auto &failures = batch_converter.get_failures();
+    OIIO_CHECK_EQUAL( failures.size(), 1 );
+    if ( failures.size() == 1 )
+    {
+        OIIO_CHECK_EQUAL( failures[0].index, 1 );
+        OIIO_CHECK_EQUAL( failures[0].file, missing_file );
+    }
+
+    OIIO_CHECK_ASSERT( std::filesystem::exists( named_output ) );
+
+    auto half_output = std::filesystem::path( test_dir.path() ) / "half" /
+                       "frame2_aces.exr";
+    OIIO::ImageBuf full( named_output );
+    OIIO::ImageBuf half( half_output.string() );
+    OIIO_CHECK_EQUAL( half.spec().width * 2, full.spec().width );
+}
+
+/// Verifies that the job file can't be combined with the incremental mode.
+void test_parse_parameters_job_file()
+{
+    std::cout << std::endl << "test_parse_parameters_job_file()" << std::endl;
+
+    const char *argv[] = {
+        "DUMMY PROGRAM PATH", "--job-file", "jobs.jsonl", "--incremental"
+    };
+    const int argc = sizeof( argv ) / sizeof( argv[0] );
+
+    BatchConverter batch_converter;
+    OIIO::ArgParse arg_parser;
+    batch_converter.init_parser( arg_parser );
+    OIIO_CHECK_EQUAL( arg_parser.parse_args( argc, argv ), 0 );
+
+    bool        result;
+    std::string output = capture_stderr(
+        [&]() { result = batch_converter.parse_parameters( arg_parser ); } );
+    OIIO_CHECK_ASSERT( !result );
+    OIIO_CHECK_EQUAL( batch_converter.settings.job_file, "jobs.jsonl" );
+    OIIO_CHECK_ASSERT(
+        output.find( "can't be combined with --incremental" ) !=
+        std::string::npos );
+}
+
+/// Verifies that the lines sent over a local socket arrive intact, and that
+/// a socket with a server listening on it is not replaced.
+void test_local_socket()
+{
+    std::cout << std::endl << "test_local_socket()" << std::endl;
+
+    if ( !LocalSocket::is_supported() )
+        return;
+
+    TestDirectory test_dir;
+    std::string   path = test_dir.path() + "/test.sock";
+
+    {
+        LocalSocketListener listener;
+        OIIO_CHECK_ASSERT( listener.listen( path ) );
+
+        auto client = LocalSocket::connect( path );
+        OIIO_CHECK_ASSERT( client != nullptr );
+        if ( !client )
+            return;
+
+        std::unique_ptr<LocalSocket> server;
+        OIIO_CHECK_ASSERT( listener.accept( 1000, server ) );
+        OIIO_CHECK_ASSERT( server != nullptr );
+        if ( !server )
+            return;
+
+        OIIO_CHECK_ASSERT( client->write_line( "first" ) );
+        OIIO_CHECK_ASSERT( client->write_line( std::string( 10000, 'x' ) ) );
+
+        std::string line;
+        OIIO_CHECK_ASSERT(
+            server->read_line( line, 1000 ) == LocalSocket::ReadResult::Line );
+        OIIO_CHECK_EQUAL( line, "first" );
+        OIIO_CHECK_ASSERT(
+            server->read_line( line, 1000 ) == LocalSocket::ReadResult::Line );
+        OIIO_CHECK_EQUAL( line, std::string( 10000, 'x' ) );
+        OIIO_CHECK_ASSERT(
+            server->read_line( line, 10 ) ==
+            LocalSocket::ReadResult::Timeout );
+
+        OIIO_CHECK_ASSERT( server->write_line( "reply" ) );
+        OIIO_CHECK_ASSERT(
+            client->read_line( line, 1000 ) == LocalSocket::ReadResult::Line );
+        OIIO_CHECK_EQUAL( line, "reply" );
+
+        client.reset();
+        OIIO_CHECK_ASSERT(
+            server->read_line( line, 1000 ) ==
+            LocalSocket::ReadResult::Closed );
+
+        LocalSocketListener other;
+        bool                result;
+        std::string         output =
+            capture_stderr( [&]() { result = other.listen( path ); } );
+        OIIO_CHECK_ASSERT( !result );
+        OIIO_CHECK_ASSERT(
+            output.find( "Another server is already listening" ) !=
+            std::string::npos );
+    }
+
+    // The socket gets removed once the listener is gone.
+    OIIO_CHECK_ASSERT( !std::filesystem::exists( path ) );
+}
+
+/// Verifies that the server answers every request with its id, including
+/// the malformed requests and the failed conversions.
+void test_serve()
+{
+    std::cout << std::endl << "test_serve()" << std::endl;
+
+    if ( !LocalSocket::is_supported() )
+        return;
+
+    TestDirectory test_dir;
+    std::string   socket_path = test_dir.path() + "/server.sock";
+
+    // The output already exists, so the file fails when making the output
+    // path, before the file gets read.
+    std::string input  = test_dir.path() + "/file1.dng";
+    std::string output = test_dir.path() + "/file1.exr";
+    std::ofstream( output ).close();
+
+    ImageConverter converter;
+    BatchConverter batch_converter;
+
+    std::vector<nlohmann::json> responses;
+    std::thread                 client_thread( [&]() {
+        std::unique_ptr<LocalSocket> client;
+        for ( int i = 0; i < 100 && !client; i++ )
+        {
+            std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+            if ( std::filesystem::exists( socket_path ) )
+                client = LocalSocket::connect( socket_path );
+        }
+
+        if ( client )
+        {
+            client->write_line( "not json" );
+            client->write_line(
+                R"({"id": 7, "input": "a.dng", "settings": {"flip": "x"}})" );
+            client->write_line(
+                nlohmann::json(
+                    { { "id", "a" }, { "input", input }, { "output", output } } )
+                    .dump() );
+
+            std::string line;
+            while ( responses.size() < 3 &&
+                    client->read_line( line, 5000 ) ==
+                        LocalSocket::ReadResult::Line )
+                responses.push_back( nlohmann::json::parse( line ) );
+        }
+
+        batch_converter.stop();
+    } );
+
+    bool result;
+    capture_stdout( [&]() {
+        capture_stderr( [&]() {
+            result = batch_converter.serve( converter, socket_path );
+        } );
+    } );
+    client_thread.join();
+
+    OIIO_CHECK_ASSERT( !result );
+    OIIO_CHECK_EQUAL( batch_converter.get_total_files(), 1 );
+
+    // The failures are only reported to the clients.
+    OIIO_CHECK_ASSERT( batch_converter.get_failures().empty() );
+    OIIO_CHECK_ASSERT( !std::filesystem::exists( socket_path ) );
+
+    OIIO_CHECK_EQUAL( responses.size(), 3 );
+    if ( responses.size() != 3 )
+        return;
+
+    // The malformed requests get answered first, in the order received.
+    OIIO_CHECK_ASSERT( !responses[0].contains( "id" ) );
+    OIIO_CHECK_EQUAL( responses[0]["status"], "error" );
+    OIIO_CHECK_EQUAL( responses[0]["stage"], "request" );
+    OIIO_CHECK_EQUAL( responses[0]["reason"], "Not a valid JSON value." );
+
+    OIIO_CHECK_EQUAL( responses[1]["id"], 7 );
+    OIIO_CHECK_EQUAL( responses[1]["stage"], "request" );
+
+    OIIO_CHECK_EQUAL( responses[2]["id"], "a" );
+    OIIO_CHECK_EQUAL( responses[2]["status"], "error" );
+    OIIO_CHECK_EQUAL( responses[2]["stage"], "prepare" );
+    OIIO_CHECK_EQUAL( responses[2]["input"], input );
+    OIIO_CHECK_EQUAL( responses[2]["output"], output );
+    OIIO_CHECK_ASSERT( responses[2]["time"].is_number() );
+    OIIO_CHECK_ASSERT( responses[2]["queued"].is_number() );
+}
+
+/// Verifies that the files submitted by a client get converted by the
+/// server, and the failures get reported back to the client.
+void test_submit_files()
+{
+    std::cout << std::endl << "test_submit_files()" << std::endl;
+
+    // This test fails on CI runners having an old version of OIIO.
+    if ( !LocalSocket::is_supported() ||
+         OIIO::openimageio_version() < 30000 )
+        return;
+
+    TestDirectory test_dir;
+    auto          files = test_dir.copy_test_files( { "frame1.dng" } );
+    std::string   missing_file = test_dir.path() + "/missing.dng";
+    files.push_back( missing_file );
+    std::string socket_path = test_dir.path() + "/server.sock";
+
+    ImageConverter converter;
+    converter.settings.WB_method =
+        ImageConverter::Settings::WBMethod::Metadata;
+    converter.settings.matrix_method =
+        ImageConverter::Settings::MatrixMethod::Metadata;
+
+    BatchConverter server;
+    server.settings.jobs = 2;
+    std::thread server_thread(
+        [&]() { server.serve( converter, socket_path ); } );
+
+    for ( int i = 0; i < 100 && !std::filesystem::exists( socket_path ); i++ )
+        std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+
+    BatchConverter client;
+    bool           result;
+    std::string    output = capture_stdout( [&]() {
+        capture_stderr(
+            [&]() { result = client.submit_files( socket_path, files ); } );
+    } );
+
+    server.stop();
+    server_thread.join();
+
+    OIIO_CHECK_ASSERT( !result );
+    OIIO_CHECK_EQUAL( client.get_total_files(), 2 );
+    OIIO_CHECK_ASSERT(
+        output.find( "Converted file: " + files[0] ) != std::string::npos );
+    OIIO_CHECK_ASSERT( std::filesystem::exists(
+        std::filesystem::path( test_dir.path() ) / "frame1_aces.exr" ) );
+
+    auto &failures = client.get_failures();
+    OIIO_CHECK_EQUAL( failures.size(), 1 );
+    if ( failures.size() == 1 )
+    {
+        OIIO_CHECK_EQUAL( failures[0].index, 1 );
+        OIIO_CHECK_EQUAL( failures[0].file, missing_file );
+        OIIO_CHECK_EQUAL( failures[0].stage, "decode" );
+    }
+}
+
+int main( int, char ** )
+{
+    try
+    {
+        test_work_queue_multiple_consumers();
+        test_work_queue_bounded();
+        test_work_queue_close_releases_producer();
+        test_memory_budget();
+
+        test_parse_parameters_jobs();
+        test_parse_parameters_pipeline();
+        test_parse_parameters_keep_going();
+        test_parse_parameters_incremental();
+        test_parse_parameters_recursive();
+        test_parse_parameters_watch();
+        test_parse_parameters_max_memory();
+        test_parse_parameters_plan();
+        test_parse_parameters_shard();
+        test_parse_parameters_job_file();
+        test_parse_parameters_order();
+        test_parse_parameters_progress();
+        test_parse_parameters_negative_jobs();
+
+        test_process_files_stops_on_failure();
+        test_process_files_pipelined_stops_on_failure();
+        test_process_files_keep_going( false );
+        test_process_files_keep_going( true );
+        test_print_failure_summary();
+        test_select_shard( false );
+        test_select_shard( true );
+        test_schedule_files();
+        test_progress_reporter();
+        test_process_files_parallel();
+        test_process_files_pipelined();
+        test_process_files_plan();
+        test_process_paths_recursive();
+        test_directory_watcher();
+        test_watch_directory();
+        test_watch_directory_copied_tree();
+        test_watch_directory_incremental();
+        test_parse_job();
+        test_read_job_file();
+        test_process_job_file( false );
+        test_process_job_file( true );
+        test_local_socket();
+        test_serve();
+        test_submit_files();
+
+        test_manifest_save_load();
+        test_manifest_malformed();
+        test_manifest_hash_settings();
+        test_process_files_incremental();
+    }
+    catch ( const std::exception &e )
+    {
+        std::cerr << "Exception caught in main: " << e.what() << std::endl;
+    }
+    catch ( ... )
+    {
+        std::cerr << "Unknown exception caught in main" << std::endl;
+    }
+
+    return unit_test_failures;
+}
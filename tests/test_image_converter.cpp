@@ -13,10 +13,12 @@
 #include <rawtoaces/image_converter.h>
 
 #include <OpenImageIO/unittest.h>
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <nlohmann/json.hpp>
+#include <set>
 #include <sstream>
 #include <vector>
 #include <ctime>
@@ -516,6 +518,86 @@ void test_collect_image_files_directory_with_only_filtered_files()
     OIIO_CHECK_EQUAL( batches[1].size(), 0 );
 }
 
+/// Verifies that scan_image_files finds the files in subdirectories only in
+/// the recursive mode, and filters them out the same way as collect_image_files
+void test_scan_image_files_recursive()
+{
+    std::cout << std::endl
+              << "test_scan_image_files_recursive()" << std::endl;
+    TestDirectory test_dir;
+    test_dir.create_test_files();
+
+    ScanOptions options;
+    options.threads = 4;
+
+    std::set<std::string> found;
+    auto                  callback = [&]( const std::string &path ) {
+        OIIO_CHECK_ASSERT( found.insert( path ).second );
+        return true;
+    };
+
+    OIIO_CHECK_ASSERT(
+        scan_image_files( { test_dir.path() }, options, callback ) );
+    OIIO_CHECK_EQUAL( found.size(), 5 );
+
+    found.clear();
+    options.recursive = true;
+    OIIO_CHECK_ASSERT(
+        scan_image_files( { test_dir.path() }, options, callback ) );
+    OIIO_CHECK_EQUAL( found.size(), 6 );
+    OIIO_CHECK_EQUAL(
+        found.count( ( std::filesystem::path( test_dir.path() ) / "subdir" /
+                       "test8.raw" )
+                         .string() ),
+        1 );
+}
+
+/// Verifies that scan_image_files only picks up the raw files from the
+/// directories in the raw-only mode, while accepting the given files as is
+void test_scan_image_files_raw_only()
+{
+    std::cout << std::endl << "test_scan_image_files_raw_only()" << std::endl;
+    TestDirectory test_dir;
+    test_dir.create_valid_files( { "test1.nef", "test2.CR2", "test3.dng" } );
+    test_dir.create_valid_files( { "notes.txt", "test4.xmp" } );
+
+    std::string text_file =
+        ( std::filesystem::path( test_dir.path() ) / "notes.txt" ).string();
+
+    ScanOptions options;
+    options.raw_only = true;
+
+    std::vector<std::string> found;
+    OIIO_CHECK_ASSERT( scan_image_files(
+        { test_dir.path(), text_file }, options, [&]( const std::string &path ) {
+            found.push_back( path );
+            return true;
+        } ) );
+
+    // The raw files from the directory, and the explicitly given text file.
+    OIIO_CHECK_EQUAL( found.size(), 4 );
+    OIIO_CHECK_EQUAL(
+        std::count( found.begin(), found.end(), text_file ), 1 );
+}
+
+/// Verifies that scan_image_files stops when the callback returns false
+void test_scan_image_files_stop()
+{
+    std::cout << std::endl << "test_scan_image_files_stop()" << std::endl;
+    TestDirectory test_dir;
+    test_dir.create_test_files();
+
+    ScanOptions options;
+    options.recursive = true;
+
+    size_t count = 0;
+    OIIO_CHECK_ASSERT( !scan_image_files(
+        { test_dir.path() }, options, [&]( const std::string & ) {
+            return ++count < 2;
+        } ) );
+    OIIO_CHECK_EQUAL( count, 2 );
+}
+
 /// Tests collect_image_files with multiple input paths (files and directories)
 /// to ensure it properly creates separate batches for each input path
 void test_collect_image_files_multiple_paths()
@@ -1301,6 +1383,61 @@ void test_auto_detect_illuminant_with_wb_multipliers()
         output.find( "Found illuminant: '2000k'." ) != std::string::npos );
 }
 
+/// Tests that auto-detection of the illuminant fails without the white
+/// balance metadata, instead of solving the transform without an illuminant
+void test_auto_detect_illuminant_without_wb_metadata()
+{
+    std::cout << std::endl
+              << "test_auto_detect_illuminant_without_wb_metadata()"
+              << std::endl;
+
+    // Create test directory with database
+    TestDirectory test_dir;
+
+    test_dir.create_test_data_file(
+        "camera",
+        { { "manufacturer", "Blackmagic" }, { "model", "Cinema Camera" } } );
+    test_dir.create_test_data_file( "training" );
+    test_dir.create_test_data_file( "cmf" );
+
+    // No "raw:pre_mul" metadata, and zero multipliers, which both end up as
+    // all-zero multipliers
+    OIIO::ImageSpec image_spec;
+    image_spec.width          = 100;
+    image_spec.height         = 100;
+    image_spec.nchannels      = 3;
+    image_spec.format         = OIIO::TypeDesc::UINT8;
+    image_spec["cameraMake"]  = "Blackmagic";
+    image_spec["cameraModel"] = "Cinema Camera";
+
+    ImageConverter::Settings settings;
+    settings.database_directories = { test_dir.get_database_path() };
+    settings.illuminant           = "";
+
+    for ( const std::vector<double> &multipliers:
+          { std::vector<double>(), std::vector<double>( 4, 0.0 ) } )
+    {
+        std::vector<double>              WB_multipliers = multipliers;
+        std::vector<std::vector<double>> IDT_matrix;
+        std::vector<std::vector<double>> CAT_matrix;
+
+        bool        success;
+        std::string output = capture_stderr( [&]() {
+            success = prepare_transform_spectral(
+                image_spec, settings, WB_multipliers, IDT_matrix, CAT_matrix );
+        } );
+
+        OIIO_CHECK_ASSERT( !success );
+        OIIO_CHECK_ASSERT(
+            output.find(
+                "ERROR: Failed to find the illuminant from the white balance multipliers 0, 0, 0." ) !=
+            std::string::npos );
+        OIIO_CHECK_ASSERT(
+            output.find( "illuminant needs to be initialised" ) ==
+            std::string::npos );
+    }
+}
+
 /// Tests that auto-detection extracts white balance from RAW metadata when WB_multipliers is not provided
 void test_auto_detect_illuminant_from_raw_metadata()
 {
@@ -1795,6 +1932,56 @@ void test_illuminant_ignored_with_metadata_wb()
     assert_success_conversion( output );
 }
 
+/// Tests that the auto matrix method falls back to the metadata matrix when
+/// the camera is in the database, but its spectral data fails to load.
+void test_auto_matrix_method_camera_data_fails_to_load()
+{
+    std::cout << std::endl
+              << "test_auto_matrix_method_camera_data_fails_to_load()"
+              << std::endl;
+
+    // Create test directory with database
+    TestDirectory test_dir;
+
+    // Create camera data with a valid header, so the camera gets indexed,
+    // but with a gap in the wavelengths, so loading the data fails
+    std::string camera_path = test_dir.create_test_data_file(
+        "camera",
+        { { "manufacturer", "Blackmagic" }, { "model", "Cinema Camera" } } );
+
+    nlohmann::json camera_data;
+    {
+        std::ifstream file( camera_path );
+        file >> camera_data;
+    }
+    camera_data["spectral_data"]["data"]["main"].erase( "385" );
+    {
+        std::ofstream file( camera_path );
+        file << camera_data.dump( 4 );
+    }
+
+    test_dir.create_test_data_file( "training" );
+    test_dir.create_test_data_file( "cmf", { { "type", "observer" } } );
+
+    std::vector<std::string> args = { "--wb-method",  "metadata",
+                                      "--mat-method", "auto",
+                                      "--verbose",    "--overwrite",
+                                      dng_test_file };
+
+    // This should succeed with the metadata matrix
+    std::string output = run_rawtoaces_with_data_dir(
+        args, test_dir.get_database_path(), false, false );
+
+    OIIO_CHECK_ASSERT(
+        output.find( "Inconsistent wavelength step" ) != std::string::npos );
+    OIIO_CHECK_ASSERT(
+        output.find(
+            "Warning: Falling back to metadata matrix method because the spectral data for camera" ) !=
+        std::string::npos );
+    OIIO_CHECK_ASSERT( output.find( "ERROR" ) == std::string::npos );
+    OIIO_CHECK_ASSERT( output.find( "Processing file" ) != std::string::npos );
+}
+
 /// Tests prepare_transform_spectral when white balance calculation fails due to invalid illuminant data
 void test_prepare_transform_spectral_wb_calculation_fail_due_to_invalid_illuminant_data()
 {
@@ -1897,6 +2084,231 @@ void test_prepare_transform_spectral_wb_calculation_fail_due_to_invalid_camera_d
         std::string::npos );
 }
 
+/// Verifies the memory estimate of a file depends on the settings which
+/// change the size of the buffers, and fails for a missing file.
+void test_estimate_memory_usage()
+{
+    std::cout << std::endl << "test_estimate_memory_usage()" << std::endl;
+
+    ImageConverter converter;
+    size_t         hard_crop;
+    OIIO_CHECK_ASSERT(
+        converter.estimate_memory_usage( dng_test_file, hard_crop ) );
+
+    // At least the floating point image itself.
+    OIIO::ImageSpec image_spec;
+    auto            image_input = OIIO::ImageInput::open( dng_test_file );
+    OIIO_CHECK_ASSERT( image_input );
+    if ( image_input )
+        image_spec = image_input->spec();
+    OIIO_CHECK_ASSERT(
+        hard_crop >= static_cast<size_t>( image_spec.width ) *
+                         image_spec.height * image_spec.nchannels *
+                         sizeof( float ) );
+
+    converter.settings.crop_mode = ImageConverter::Settings::CropMode::Off;
+    size_t no_crop;
+    OIIO_CHECK_ASSERT(
+        converter.estimate_memory_usage( dng_test_file, no_crop ) );
+    OIIO_CHECK_ASSERT( no_crop <= hard_crop );
+
+    converter.settings.half_size = true;
+    size_t half_size;
+    OIIO_CHECK_ASSERT(
+        converter.estimate_memory_usage( dng_test_file, half_size ) );
+    OIIO_CHECK_ASSERT( half_size < no_crop );
+
+    size_t missing;
+    OIIO_CHECK_ASSERT(
+        !converter.estimate_memory_usage( "missing_file.dng", missing ) );
+}
+
+/// Verifies that the transform key only depends on the metadata the
+/// transform is solved from, and the transform solved from the metadata
+/// matches the one `configure` solves for the file.
+void test_transform_key_and_solve()
+{
+    std::cout << std::endl << "test_transform_key_and_solve()" << std::endl;
+
+    ImageConverter converter;
+    converter.settings.WB_method =
+        ImageConverter::Settings::WBMethod::Metadata;
+    converter.settings.matrix_method =
+        ImageConverter::Settings::MatrixMethod::Metadata;
+
+    OIIO::ImageSpec spec1, spec2;
+    OIIO_CHECK_ASSERT( converter.read_metadata( dng_test_file, spec1 ) );
+    OIIO_CHECK_ASSERT( converter.read_metadata( dng_test_file, spec2 ) );
+    OIIO_CHECK_EQUAL(
+        converter.get_transform_key( spec1 ),
+        converter.get_transform_key( spec2 ) );
+
+    // Unrelated metadata doesn't change the key.
+    spec2.attribute( "Exif:ExposureTime", 0.5f );
+    OIIO_CHECK_EQUAL(
+        converter.get_transform_key( spec1 ),
+        converter.get_transform_key( spec2 ) );
+
+    // A different white balance does.
+    const float cam_mul[4] = { 2.0f, 1.0f, 1.5f, 1.0f };
+    spec2.attribute(
+        "raw:cam_mul", OIIO::TypeDesc( OIIO::TypeDesc::FLOAT, 4 ), cam_mul );
+    OIIO_CHECK_NE(
+        converter.get_transform_key( spec1 ),
+        converter.get_transform_key( spec2 ) );
+
+    ImageConverter::Transform transform;
+    OIIO_CHECK_ASSERT( converter.solve_transform( spec1, transform ) );
+
+    ImageConverter       reference;
+    OIIO::ParamValueList hints;
+    reference.settings = converter.settings;
+    OIIO_CHECK_ASSERT( reference.configure( dng_test_file, hints ) );
+    OIIO_CHECK_ASSERT( transform.IDT_matrix == reference.get_IDT_matrix() );
+    OIIO_CHECK_ASSERT( transform.CAT_matrix == reference.get_CAT_matrix() );
+    OIIO_CHECK_ASSERT(
+        transform.WB_multipliers == reference.get_WB_multipliers() );
+
+    OIIO::ImageSpec missing_spec;
+    OIIO_CHECK_ASSERT(
+        !converter.read_metadata( "missing_file.dng", missing_spec ) );
+}
+
+/// Tests that the spectral transforms are reused from the cache
+void test_prepare_transform_spectral_cache()
+{
+    std::cout << std::endl
+              << "test_prepare_transform_spectral_cache()" << std::endl;
+
+    TestDirectory test_dir;
+    test_dir.create_test_data_file(
+        "camera",
+        { { "manufacturer", "Blackmagic" }, { "model", "Cinema Camera" } } );
+    test_dir.create_test_data_file( "training" );
+    test_dir.create_test_data_file( "cmf" );
+
+    OIIO::ImageSpec image_spec;
+    image_spec["cameraMake"]  = "Blackmagic";
+    image_spec["cameraModel"] = "Cinema Camera";
+
+    ImageConverter::Settings settings;
+    settings.database_directories = { test_dir.get_database_path() };
+
+    TransformCache cache;
+
+    std::vector<double>              WB_multipliers = { 1.5, 1.0, 1.2, 1.0 };
+    std::vector<std::vector<double>> IDT_matrix;
+    std::vector<std::vector<double>> CAT_matrix;
+    OIIO_CHECK_ASSERT( prepare_transform_spectral(
+        image_spec, settings, WB_multipliers, IDT_matrix, CAT_matrix, &cache ) );
+    OIIO_CHECK_EQUAL( cache.size(), 1 );
+
+    settings.illuminant = "D55";
+    std::vector<double> illuminant_WB_multipliers;
+    OIIO_CHECK_ASSERT( prepare_transform_spectral(
+        image_spec,
+        settings,
+        illuminant_WB_multipliers,
+        IDT_matrix,
+        CAT_matrix,
+        &cache ) );
+    OIIO_CHECK_EQUAL( cache.size(), 2 );
+
+    std::vector<std::vector<double>> cached_IDT_matrix;
+    std::vector<double>              cached_WB_multipliers;
+    OIIO_CHECK_ASSERT( prepare_transform_spectral(
+        image_spec,
+        settings,
+        cached_WB_multipliers,
+        cached_IDT_matrix,
+        CAT_matrix,
+        &cache ) );
+    OIIO_CHECK_EQUAL( cache.size(), 2 );
+    OIIO_CHECK_ASSERT( cached_IDT_matrix == IDT_matrix );
+    OIIO_CHECK_ASSERT( cached_WB_multipliers == illuminant_WB_multipliers );
+    OIIO_CHECK_ASSERT( CAT_matrix.empty() );
+
+    // The white balance differing only by the rounding errors reuses the
+    // transform, while a different one needs solving.
+    settings.illuminant = "";
+    WB_multipliers      = { 1.5 + 1e-9, 1.0, 1.2, 1.0 };
+    OIIO_CHECK_ASSERT( prepare_transform_spectral(
+        image_spec, settings, WB_multipliers, IDT_matrix, CAT_matrix, &cache ) );
+    OIIO_CHECK_EQUAL( cache.size(), 2 );
+
+    WB_multipliers = { 2.5, 1.0, 1.2, 1.0 };
+    OIIO_CHECK_ASSERT( prepare_transform_spectral(
+        image_spec, settings, WB_multipliers, IDT_matrix, CAT_matrix, &cache ) );
+    OIIO_CHECK_EQUAL( cache.size(), 3 );
+}
+
+/// Tests that the transforms saved into a cache directory are reused by
+/// another cache, unless the database has changed
+void test_transform_cache_directory()
+{
+    std::cout << std::endl << "test_transform_cache_directory()" << std::endl;
+
+    TestDirectory test_dir;
+    test_dir.create_test_data_file(
+        "camera",
+        { { "manufacturer", "Blackmagic" }, { "model", "Cinema Camera" } } );
+    test_dir.create_test_data_file( "training" );
+    test_dir.create_test_data_file( "cmf" );
+
+    const std::vector<std::string> database = { test_dir.get_database_path() };
+    const std::string cache_dir = test_dir.path() + "/transform-cache";
+
+    TransformCache::Entry solved;
+    solved.illuminant     = "d55";
+    solved.WB_multipliers = { 1.5, 1.0, 1.25 };
+    solved.IDT_matrix     = { { 1.0, 0.1, 0.2 },
+                              { 0.3, 1.0, 0.4 },
+                              { 0.5, 0.6, 1.0 } };
+
+    int  solve_count = 0;
+    auto solve       = [&]( TransformCache::Entry &entry ) {
+        solve_count++;
+        entry = solved;
+        return true;
+    };
+    auto fail = [&]( TransformCache::Entry & ) {
+        solve_count++;
+        return false;
+    };
+
+    TransformCache first;
+    std::string    database_hash = first.get_database_hash( database );
+    OIIO_CHECK_EQUAL( database_hash.size(), 16 );
+
+    std::string           key = "camera;d55;" + database_hash;
+    TransformCache::Entry entry;
+    OIIO_CHECK_ASSERT( first.get( key, cache_dir, solve, entry ) );
+    OIIO_CHECK_EQUAL( solve_count, 1 );
+    OIIO_CHECK_ASSERT( std::filesystem::is_directory( cache_dir ) );
+
+    // Another process with the same database reads the transform instead of
+    // solving it.
+    TransformCache second;
+    OIIO_CHECK_EQUAL( second.get_database_hash( database ), database_hash );
+
+    TransformCache::Entry loaded;
+    OIIO_CHECK_ASSERT( second.get( key, cache_dir, fail, loaded ) );
+    OIIO_CHECK_EQUAL( solve_count, 1 );
+    OIIO_CHECK_EQUAL( loaded.illuminant, solved.illuminant );
+    OIIO_CHECK_ASSERT( loaded.WB_multipliers == solved.WB_multipliers );
+    OIIO_CHECK_ASSERT( loaded.IDT_matrix == solved.IDT_matrix );
+
+    // Without the directory, the transform needs solving.
+    TransformCache third;
+    OIIO_CHECK_ASSERT( !third.get( key, "", fail, loaded ) );
+    OIIO_CHECK_EQUAL( solve_count, 2 );
+
+    // Any change to the camera data changes the database hash.
+    test_dir.create_test_data_file(
+        "camera", { { "manufacturer", "Other" }, { "model", "Camera" } } );
+    OIIO_CHECK_NE( third.get_database_hash( database ), database_hash );
+}
+
 int main( int, char ** )
 {
     try
@@ -1909,6 +2321,9 @@ int main( int, char ** )
         test_collect_image_files_directory_with_only_filtered_files();
         test_collect_image_files_multiple_paths();
         test_collect_image_files_mixed_valid_invalid_paths();
+        test_scan_image_files_recursive();
+        test_scan_image_files_raw_only();
+        test_scan_image_files_stop();
 
         // Tests for database_paths
         test_database_paths_default();
@@ -1943,6 +2358,7 @@ int main( int, char ** )
         test_missing_illuminant_data();
         test_illuminant_type_not_found();
         test_auto_detect_illuminant_with_wb_multipliers();
+        test_auto_detect_illuminant_without_wb_metadata();
         test_auto_detect_illuminant_from_raw_metadata();
         test_auto_detect_illuminant_with_normalization();
 
@@ -1958,6 +2374,12 @@ int main( int, char ** )
 
         test_rawtoaces_spectral_mode_complete_success_with_default_illuminant_warning();
         test_illuminant_ignored_with_metadata_wb();
+        test_auto_matrix_method_camera_data_fails_to_load();
+
+        test_estimate_memory_usage();
+        test_transform_key_and_solve();
+        test_prepare_transform_spectral_cache();
+        test_transform_cache_directory();
     }
     catch ( const std::exception &e )
     {
@@ -8,18 +8,21 @@
 #include <sstream>
 #include <streambuf>
 
-/// RAII helper class to capture stderr output for testing
-class StderrCapture
+/// RAII helper class to capture the output of a stream for testing
+class StreamCapture
 {
 public:
-    StderrCapture() : buffer(), old( std::cerr.rdbuf( buffer.rdbuf() ) ) {}
+    StreamCapture( std::ostream &stream )
+        : stream( stream ), buffer(), old( stream.rdbuf( buffer.rdbuf() ) )
+    {}
 
-    ~StderrCapture() { std::cerr.rdbuf( old ); }
+    ~StreamCapture() { stream.rdbuf( old ); }
 
     /// Get the captured output as a string
     std::string str() const { return buffer.str(); }
 
 private:
+    std::ostream     &stream;
     std::stringstream buffer;
     std::streambuf   *old;
 };
@@ -27,7 +30,15 @@ private:
 /// Wrapper function that captures stderr output from a callable action
 std::string capture_stderr( std::function<void()> action )
 {
-    StderrCapture capture;
+    StreamCapture capture( std::cerr );
+    action();
+    return capture.str();
+}
+
+/// Wrapper function that captures stdout output from a callable action
+std::string capture_stdout( std::function<void()> action )
+{
+    StreamCapture capture( std::cout );
     action();
     return capture.str();
 }
@@ -10,3 +10,8 @@
 /// @param action A callable (function, lambda, etc.) that may write to stderr
 /// @return The captured stderr output as a string
 std::string capture_stderr( std::function<void()> action );
+
+/// Wrapper function that captures stdout output from a callable action
+/// @param action A callable (function, lambda, etc.) that may write to stdout
+/// @return The captured stdout output as a string
+std::string capture_stdout( std::function<void()> action );